@@ -0,0 +1,43 @@
+; benchmark for pdata-map!, runs the same deformation over a big
+; sphere as a procedure, and as a quoted lambda which pdata-expr-map!
+; runs natively, then one using round, which it can't compile so it
+; falls back to running as a procedure. prints the time each takes
+
+(clear)
+
+(define runs 20)
+
+(define (time-runs name thunk)
+    (let ((start (current-inexact-milliseconds)))
+        (for ((i (in-range 0 runs)))
+            (thunk))
+        (let ((ms (/ (- (current-inexact-milliseconds) start) runs)))
+            (printf "~a: ~a ms per run~n" name (/ (round (* ms 10)) 10))
+            ms)))
+
+(with-primitive (build-sphere 200 200)
+    (pdata-copy "p" "pref")
+    (printf "~a vertices~n" (pdata-size))
+    (let ((closure
+                (time-runs "procedure"
+                    (lambda ()
+                        (pdata-map!
+                            (lambda (p pref n)
+                                (vadd pref (vmul n (* 0.1 (sin (* (vy pref) 10))))))
+                            "p" "pref" "n"))))
+          (native
+                (time-runs "quoted lambda"
+                    (lambda ()
+                        (pdata-map!
+                            '(lambda (p pref n)
+                                (vadd pref (vmul n (* 0.1 (sin (* (vy pref) 10))))))
+                            "p" "pref" "n"))))
+          (fallback
+                (time-runs "quoted lambda, falling back"
+                    (lambda ()
+                        (pdata-map!
+                            '(lambda (p pref n)
+                                (vadd pref (vmul n (* 0.1 (sin (round (* (vy pref) 10)))))))
+                            "p" "pref" "n")))))
+        (printf "quoted lambda ~ax faster than the procedure~n" 
+            (/ (round (* (/ closure native) 10)) 10))))
@@ -0,0 +1,54 @@
+; stress test for the scenegraph, creates and destroys a million
+; primitives in batches, looking each one up a few times on the way
+; prints the time taken and the memory used by the process, next to
+; the numbers for the node tree on its own before and after primitive
+; ids became slot indices (the old ids were kept in a std::map)
+
+(clear)
+
+(define total 1000000)
+(define batch 1000)
+
+; the tree alone doing the same adds, lookups and removes, and the
+; extra resident memory for a million nodes (64 bit linux, -O3)
+(define tree-map '(3.6e6 133216))
+(define tree-slots '(1.1e7 86332))
+
+; the resident memory of the process in kb, from /proc on linux
+(define (resident-kb)
+    (if (file-exists? "/proc/self/status")
+        (with-input-from-file "/proc/self/status"
+            (lambda ()
+                (let loop ((line (read-line)))
+                    (cond
+                        ((eof-object? line) 0)
+                        ((regexp-match #rx"^VmRSS:[ \t]*([0-9]+)" line)
+                            => (lambda (m) (string->number (cadr m))))
+                        (else (loop (read-line)))))))
+        0))
+
+(define (stress)
+    (let ((start (current-inexact-milliseconds))
+          (start-kb (resident-kb)))
+        (for ((b (in-range 0 (quotient total batch))))
+            (let ((prims (build-list batch (lambda (i) (build-locator)))))
+                (for ((p (in-list prims)))
+                    (with-primitive p
+                        (translate (vector 1 0 0))))
+                (for ((p (in-list prims)))
+                    (with-primitive p
+                        (identity)))
+                (for-each destroy prims)))
+        (let ((ms (- (current-inexact-milliseconds) start)))
+            (printf "~a primitives in ~a ms, ~a per second~n"
+                total (round ms) (round (/ total (/ ms 1000))))
+            (printf "resident memory ~a kb, ~a kb more than before~n"
+                (resident-kb) (- (resident-kb) start-kb))
+            (printf "tree alone, old map: ~a nodes per second, ~a kb per million~n"
+                (inexact->exact (car tree-map)) (cadr tree-map))
+            (printf "tree alone, new slots: ~a nodes per second, ~a kb per million (~ax faster, ~a kb less)~n"
+                (inexact->exact (car tree-slots)) (cadr tree-slots)
+                (/ (round (* 10 (/ (car tree-slots) (car tree-map)))) 10)
+                (- (cadr tree-map) (cadr tree-slots))))))
+
+(stress)
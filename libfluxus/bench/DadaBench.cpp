@@ -0,0 +1,143 @@
+// Copyright (C) 2005 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+// microbenchmark for the dada maths, compares the sse matrix code and the
+// batch functions against plain c++ versions of the same operations.
+// not part of the build, compile by hand from this directory with:
+//
+// g++ -O3 -I../src DadaBench.cpp ../src/dada.cpp ../src/Trace.cpp -o dadabench
+//
+// add -mavx to try the avx batch transform, or -DDADA_NO_SSE to check the
+// timings of the fallback code.
+
+#include <sys/time.h>
+#include <cstdio>
+#include <vector>
+#include "dada.h"
+
+using namespace Fluxus;
+
+static double Now()
+{
+	timeval tv;
+	gettimeofday(&tv,NULL);
+	return tv.tv_sec+tv.tv_usec/1000000.0;
+}
+
+static dMatrix ScalarMul(const dMatrix &a, const dMatrix &b)
+{
+	dMatrix t;
+	for (int i=0; i<4; i++)
+		for (int j=0; j<4; j++)
+			t.m[i][j]=a.m[0][j]*b.m[i][0]+a.m[1][j]*b.m[i][1]+
+			          a.m[2][j]*b.m[i][2]+a.m[3][j]*b.m[i][3];
+	return t;
+}
+
+static dVector ScalarTransform(const dMatrix &m, const dVector &p)
+{
+	dVector t;
+	t.x=p.x*m.m[0][0] + p.y*m.m[1][0] + p.z*m.m[2][0] + p.w*m.m[3][0];
+	t.y=p.x*m.m[0][1] + p.y*m.m[1][1] + p.z*m.m[2][1] + p.w*m.m[3][1];
+	t.z=p.x*m.m[0][2] + p.y*m.m[1][2] + p.z*m.m[2][2] + p.w*m.m[3][2];
+	t.w=p.x*m.m[0][3] + p.y*m.m[1][3] + p.z*m.m[2][3] + p.w*m.m[3][3];
+	return t;
+}
+
+static void __attribute__((noinline)) TransformLoop(const dMatrix &m, const dVector *src, dVector *dst, unsigned int count)
+{
+	for (unsigned int i=0; i<count; i++) dst[i]=m.transform(src[i]);
+}
+
+static dMatrix RandMatrix()
+{
+	dMatrix m;
+	m.translate(RandRange(-10,10),RandRange(-10,10),RandRange(-10,10));
+	m.rotxyz(RandRange(0,360),RandRange(0,360),RandRange(0,360));
+	m.scale(RandRange(0.5,2),RandRange(0.5,2),RandRange(0.5,2));
+	return m;
+}
+
+int main()
+{
+	const unsigned int count=4096;
+	const int runs=300;
+	// timings are the best of several repeats, to keep out
+	// other processes and frequency changes
+	const int repeats=40;
+
+	vector<dVector> src(count),dst(count),ref(count);
+	vector<dMatrix> mats(count),mdst(count),mref(count);
+	for (unsigned int i=0; i<count; i++)
+	{
+		src[i]=dVector(RandRange(-1,1),RandRange(-1,1),RandRange(-1,1));
+		mats[i]=RandMatrix();
+	}
+	dMatrix m=RandMatrix();
+
+	// the loop is what the callers did before the batch function,
+	// one dMatrix::transform per point through a reference gcc can't
+	// prove isn't aliased by the output
+	double scalar=1e9,batch=1e9,op=1e9,loop=1e9;
+	for (int rep=0; rep<repeats; rep++)
+	{
+		double t=Now();
+		for (int r=0; r<runs; r++)
+			for (unsigned int i=0; i<count; i++) ref[i]=ScalarTransform(m,src[i]);
+		scalar=min(scalar,Now()-t);
+
+		t=Now();
+		for (int r=0; r<runs; r++) TransformLoop(m,&src[0],&dst[0],count);
+		loop=min(loop,Now()-t);
+
+		t=Now();
+		for (int r=0; r<runs; r++) dTransformPoints(m,&src[0],&dst[0],count);
+		batch=min(batch,Now()-t);
+	}
+
+	float err=0;
+	for (unsigned int i=0; i<count; i++) err=max(err,(dst[i]-ref[i]).mag());
+	printf("transform points: scalar %.4fs loop %.4fs batch %.4fs (x%.2f, x%.2f on the loop) max error %g\n",
+		scalar,loop,batch,scalar/batch,loop/batch,err);
+
+	scalar=batch=1e9;
+	for (int rep=0; rep<repeats; rep++)
+	{
+		double t=Now();
+		for (int r=0; r<runs; r++)
+			for (unsigned int i=0; i<count; i++) mref[i]=ScalarMul(m,mats[i]);
+		scalar=min(scalar,Now()-t);
+
+		t=Now();
+		for (int r=0; r<runs; r++) dMultiplyMatrices(m,&mats[0],&mdst[0],count);
+		batch=min(batch,Now()-t);
+
+		t=Now();
+		for (int r=0; r<runs; r++)
+			for (unsigned int i=0; i<count; i++) mdst[i]=m*mats[i];
+		op=min(op,Now()-t);
+	}
+
+	err=0;
+	for (unsigned int i=0; i<count; i++)
+		for (int j=0; j<4; j++)
+			for (int k=0; k<4; k++)
+				err=max(err,fabsf(mdst[i].m[j][k]-mref[i].m[j][k]));
+	printf("multiply matrices: scalar %.4fs operator %.4fs (x%.2f) batch %.4fs (x%.2f) max error %g\n",
+		scalar,op,scalar/op,batch,scalar/batch,err);
+
+	return 0;
+}
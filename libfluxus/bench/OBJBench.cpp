@@ -0,0 +1,286 @@
+// Copyright (C) 2010 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+// regression test and benchmark for the obj loader, compares it against the
+// old tokenising reader (kept below as the reference) on a generated mesh or
+// the obj files given on the command line, checking the pdata and index are
+// identical, and that files with out of range indices fail to load. built 
+// and run by "scons check", or run by hand with obj files to compare
+
+#include <sys/time.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include "OBJPrimitiveIO.h"
+#include "PolyPrimitive.h"
+
+using namespace Fluxus;
+
+static double Now()
+{
+	timeval tv;
+	gettimeofday(&tv,NULL);
+	return tv.tv_sec+tv.tv_usec/1000000.0;
+}
+
+/////////////////////////////////////////////////
+// the old reader
+
+struct RefIndices
+{
+	RefIndices() : Position(0), Texture(0), Normal(0) {}
+	bool operator<(const RefIndices &o) const
+	{
+		if (Position!=o.Position) return Position<o.Position;
+		if (Texture!=o.Texture) return Texture<o.Texture;
+		return Normal<o.Normal;
+	}
+	unsigned int Position, Texture, Normal;
+};
+
+struct RefMesh
+{
+	vector<dVector> Position, Texture, Normal;
+	vector<unsigned int> Index;
+	unsigned int FirstFaceSize;
+};
+
+static unsigned int TokeniseLine(const vector<char> &data, unsigned int pos, vector<string> &output)
+{
+	char c=data[pos];
+	vector<string> temp;
+	temp.push_back("");
+	while(c!='\n' && pos<data.size()-1)
+	{
+		if (c==' ' && *temp.rbegin()!="") temp.push_back("");
+		else temp.rbegin()->push_back(c);
+		c=data[++pos];
+	}
+	output.clear();
+	for(vector<string>::iterator i=temp.begin(); i!=temp.end(); ++i)
+	{
+		if (*i!="")	output.push_back(*i);
+	}
+	return pos+1;
+}
+
+static void TokeniseIndices(const string &str, vector<string> &output)
+{
+	unsigned int pos=0;
+	output.clear();
+	output.push_back("");
+	while(pos<str.size())
+	{
+		char c=str[pos++];
+		if (c==' ' || c=='/') output.push_back("");
+		else output.rbegin()->push_back(c);
+	}
+}
+
+static bool RefRead(const string &filename, RefMesh &mesh)
+{
+	FILE *file=fopen(filename.c_str(),"rb");
+	if (file==NULL) return false;
+	fseek(file,0,SEEK_END);
+	vector<char> data(ftell(file)+1,0);
+	rewind(file);
+	if (fread(&data[0],1,data.size()-1,file)!=data.size()-1) return false;
+	fclose(file);
+
+	vector<vector<RefIndices> > faces;
+	bool unified=true;
+	unsigned int pos=0;
+	while (pos<data.size()-1)
+	{
+		vector<string> tokens;
+		pos=TokeniseLine(data,pos,tokens);
+		if (tokens.empty()) continue;
+		if (tokens[0]=="v" && tokens.size()==4)
+		{
+			mesh.Position.push_back(dVector(atof(tokens[1].c_str()),atof(tokens[2].c_str()),atof(tokens[3].c_str())));
+		}
+		else if (tokens[0]=="vt" && (tokens.size()==4 || tokens.size()==3))
+		{
+			mesh.Texture.push_back(dVector(atof(tokens[1].c_str()),atof(tokens[2].c_str()),
+				tokens.size()==4?atof(tokens[3].c_str()):0));
+		}
+		else if (tokens[0]=="vn" && tokens.size()==4)
+		{
+			mesh.Normal.push_back(dVector(atof(tokens[1].c_str()),atof(tokens[2].c_str()),atof(tokens[3].c_str())));
+		}
+		else if (tokens[0]=="f")
+		{
+			vector<RefIndices> f;
+			for(unsigned int i=1; i<tokens.size(); i++)
+			{
+				vector<string> it;
+				TokeniseIndices(tokens[i],it);
+				if (it.size()>3) continue;
+				RefIndices ind;
+				if (it.size()>0 && it[0]!="") ind.Position=(unsigned int)atof(it[0].c_str())-1;
+				if (it.size()>1 && it[1]!="") ind.Texture=(unsigned int)atof(it[1].c_str())-1;
+				if (it.size()>2 && it[2]!="") ind.Normal=(unsigned int)atof(it[2].c_str())-1;
+				if ((it.size()==3 && (ind.Position!=ind.Texture || ind.Position!=ind.Normal)) ||
+					(it.size()==2 && ind.Position!=ind.Texture)) unified=false;
+				f.push_back(ind);
+			}
+			if (f.size()>3)
+			{
+				vector<RefIndices> tri(f.begin(),f.begin()+3);
+				faces.push_back(tri);
+				for (unsigned i=3; i<f.size(); i++)
+				{
+					tri.erase(tri.begin()+1);
+					tri.push_back(f[i]);
+					faces.push_back(tri);
+				}
+			}
+			else faces.push_back(f);
+		}
+	}
+
+	if (faces.empty()) return false;
+	mesh.FirstFaceSize=faces[0].size();
+
+	if (unified)
+	{
+		for (unsigned int i=0; i<faces.size(); i++)
+			for (unsigned int j=0; j<faces[i].size(); j++)
+				mesh.Index.push_back(faces[i][j].Position);
+		return true;
+	}
+
+	// numbered in the order first seen, as the old linear search did
+	map<RefIndices,unsigned int> unique;
+	vector<dVector> p,t,n;
+	for (unsigned int i=0; i<faces.size(); i++)
+	{
+		for (unsigned int j=0; j<faces[i].size(); j++)
+		{
+			const RefIndices &ind=faces[i][j];
+			map<RefIndices,unsigned int>::iterator u=unique.find(ind);
+			if (u==unique.end())
+			{
+				u=unique.insert(make_pair(ind,(unsigned int)unique.size())).first;
+				if (!mesh.Position.empty()) p.push_back(mesh.Position[ind.Position]);
+				if (!mesh.Texture.empty()) t.push_back(mesh.Texture[ind.Texture]);
+				if (!mesh.Normal.empty()) n.push_back(mesh.Normal[ind.Normal]);
+			}
+			mesh.Index.push_back(u->second);
+		}
+	}
+	mesh.Position=p;
+	mesh.Texture=t;
+	mesh.Normal=n;
+	return true;
+}
+
+/////////////////////////////////////////////////
+
+static bool Same(const vector<dVector> &a, const Primitive *prim, const string &name)
+{
+	char type;
+	unsigned int size;
+	if (!prim->GetDataInfo(name,type,size)) return a.empty();
+	const TypedPData<dVector> *b=dynamic_cast<const TypedPData<dVector>*>(prim->GetDataRawConst(name));
+	return b!=NULL && a.size()==b->Size() && 
+		(a.empty() || !memcmp(&a[0],b->View(),a.size()*sizeof(dVector)));
+}
+
+static bool Compare(const string &filename)
+{
+	double t=Now();
+	RefMesh ref;
+	bool refok=RefRead(filename,ref);
+	double reftime=Now()-t;
+
+	t=Now();
+	OBJPrimitiveIO io;
+	PolyPrimitive *prim=dynamic_cast<PolyPrimitive*>(io.FormatRead(filename));
+	double newtime=Now()-t;
+
+	bool ok=(prim!=NULL)==refok;
+	if (ok && prim!=NULL)
+	{
+		ok=Same(ref.Position,prim,"p") && 
+		   (ref.Texture.empty() || Same(ref.Texture,prim,"t")) &&
+		   (ref.Normal.empty() || Same(ref.Normal,prim,"n")) &&
+		   ref.Index==prim->GetIndexConst() &&
+		   (ref.FirstFaceSize==3)==(prim->GetType()==PolyPrimitive::TRILIST);
+	}
+	printf("%s: %s old %.3fs new %.3fs (%.1fx)\n",filename.c_str(),ok?"same":"DIFFERENT",
+		reftime,newtime,reftime/newtime);
+	delete prim;
+	return ok;
+}
+
+// a grid of quads with positions, texture coordinates and normals
+static void MakeGrid(const string &filename, unsigned int size)
+{
+	FILE *file=fopen(filename.c_str(),"w");
+	for (unsigned int y=0; y<=size; y++)
+		for (unsigned int x=0; x<=size; x++)
+			fprintf(file,"v %f %f %g\n",x*0.1f,y*0.1f,sin(x*0.3)*cos(y*0.2));
+	for (unsigned int y=0; y<=size; y++)
+		for (unsigned int x=0; x<=size; x++)
+			fprintf(file,"vt %f %f\n",x/(float)size,y/(float)size);
+	fprintf(file,"vn 0 0 1\nvn 0 1 0\n");
+	for (unsigned int y=0; y<size; y++)
+	{
+		for (unsigned int x=0; x<size; x++)
+		{
+			unsigned int i=y*(size+1)+x+1;
+			fprintf(file,"f %d/%d/%d %d/%d/%d %d/%d/%d %d/%d/%d\n",
+				i,i,1+(x&1), i+1,i+1,1+(x&1), i+size+2,i+size+2,1+(x&1), i+size+1,i+size+1,1+(x&1));
+		}
+	}
+	fclose(file);
+}
+
+// a triangle with the given face line, which should fail to load
+static bool Rejected(const string &filename, const char *face)
+{
+	FILE *file=fopen(filename.c_str(),"w");
+	fprintf(file,"v 0 0 0\nv 1 0 0\nv 0 1 0\nvt 0 0\nvt 1 0\n%s\n",face);
+	fclose(file);
+
+	OBJPrimitiveIO io;
+	Primitive *prim=io.FormatRead(filename);
+	bool ok=prim==NULL;
+	printf("%s: %s\n",face,ok?"rejected":"LOADED");
+	delete prim;
+	return ok;
+}
+
+int main(int argc, char **argv)
+{
+	bool ok=true;
+	if (argc>1)
+	{
+		for (int i=1; i<argc; i++) ok=Compare(argv[i]) && ok;
+	}
+	else
+	{
+		MakeGrid("/tmp/objbench.obj",710);
+		ok=Compare("/tmp/objbench.obj");
+		ok=Rejected("/tmp/objbench.obj","f 1 2 4") && ok;
+		ok=Rejected("/tmp/objbench.obj","f 1/1 2/2 3/3") && ok;
+		ok=Rejected("/tmp/objbench.obj","f 1/1 2/2 3/9") && ok;
+		remove("/tmp/objbench.obj");
+	}
+	return ok?0:1;
+}
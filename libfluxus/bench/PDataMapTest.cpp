@@ -0,0 +1,108 @@
+// Copyright (C) 2010 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+// regression test for mapped pdata, checks drawing a polygon primitive
+// reads its arrays from the mapped file, and that only the arrays which
+// are written to are copied. links with gl but doesn't need a context,
+// the gl calls do nothing without one. built and run by "scons check"
+
+#include <cstdio>
+#include "PolyPrimitive.h"
+#include "MappedFile.h"
+
+using namespace Fluxus;
+
+static int Failures=0;
+
+#define CHECK(c) if (!(c)) { printf("%s:%d: failed: %s\n",__FILE__,__LINE__,#c); Failures++; }
+
+static const unsigned int NUM_VERTS=4;
+
+template<class T>
+static void MapData(PolyPrimitive &prim, const string &name, MappedFile *file, size_t offset)
+{
+	TypedPData<T> *data=new TypedPData<T>;
+	CHECK(data->Map(file,offset,NUM_VERTS));
+	prim.SetDataRaw(name,data);
+}
+
+template<class T>
+static bool IsMapped(PolyPrimitive &prim, const string &name)
+{
+	const TypedPData<T> *data=prim.GetDataView<T>(name);
+	return data!=NULL && data->IsMapped();
+}
+
+int main()
+{
+	// a quad's worth of vectors and colours
+	const char *filename="PDataMapTest.dat";
+	FILE *out=fopen(filename,"wb");
+	for (unsigned int i=0; i<NUM_VERTS; i++)
+	{
+		dVector v(i&1,i>>1,0);
+		fwrite(&v,sizeof(v),1,out);
+	}
+	for (unsigned int i=0; i<NUM_VERTS; i++)
+	{
+		dColour c(1,0,0,1);
+		fwrite(&c,sizeof(c),1,out);
+	}
+	fclose(out);
+
+	MappedFile *file=MappedFile::Open(filename);
+	CHECK(file!=NULL);
+	if (file==NULL) return 1;
+
+	PolyPrimitive prim(PolyPrimitive::QUADS);
+	prim.Resize(NUM_VERTS);
+	MapData<dVector>(prim,"p",file,0);
+	MapData<dVector>(prim,"n",file,0);
+	MapData<dVector>(prim,"t",file,0);
+	MapData<dColour>(prim,"c",file,NUM_VERTS*sizeof(dVector));
+	file->Release();
+
+	// drawing, and working out the box, read in place
+	prim.GetState()->Hints|=HINT_VERTCOLS|HINT_WIRE|HINT_NORMAL;
+	prim.Render();
+	dBoundingBox box=prim.GetBoundingBox(dMatrix());
+	CHECK(box.min.x==0 && box.max.x==1 && box.max.y==1);
+	CHECK(IsMapped<dVector>(prim,"p"));
+	CHECK(IsMapped<dVector>(prim,"n"));
+	CHECK(IsMapped<dVector>(prim,"t"));
+	CHECK(IsMapped<dColour>(prim,"c"));
+
+	// writing copies just that array
+	prim.SetData<dColour>("c",0,dColour(0,1,0,1));
+	CHECK(!IsMapped<dColour>(prim,"c"));
+	CHECK(IsMapped<dVector>(prim,"p"));
+
+	// as does a deform
+	prim.GetState()->Transform.translate(1,0,0);
+	prim.ApplyTransform();
+	CHECK(!IsMapped<dVector>(prim,"p"));
+	CHECK(IsMapped<dVector>(prim,"n"));
+	CHECK(prim.GetData<dVector>("p",3).x==2);
+
+	prim.Render();
+	CHECK(IsMapped<dVector>(prim,"n"));
+	CHECK(IsMapped<dVector>(prim,"t"));
+
+	remove(filename);
+
+	if (Failures==0) printf("mapped pdata: ok\n");
+	return Failures==0?0:1;
+}
@@ -0,0 +1,152 @@
+// Copyright (C) 2010 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+// regression test for the scenegraph culling, checks culled subtrees aren't
+// walked, and that boxes are only refitted when a transform or the pdata
+// changes. doesn't need a gl context, built and run by "scons check"
+
+#include <cstdio>
+#include "SceneGraph.h"
+
+using namespace Fluxus;
+
+static int Failures=0;
+
+#define CHECK(c) if (!(c)) { printf("%s:%d: failed: %s\n",__FILE__,__LINE__,#c); Failures++; }
+
+// a primitive whose box is made from its "p" pdata
+class BoxPrimitive : public Primitive
+{
+public:
+	BoxPrimitive()
+	{
+		AddData("p",new TypedPData<dVector>(2));
+		SetData<dVector>("p",0,dVector(-0.5,-0.5,-0.5));
+		SetData<dVector>("p",1,dVector(0.5,0.5,0.5));
+		GetState()->Hints|=HINT_FRUSTUM_CULL;
+	}
+
+	virtual BoxPrimitive *Clone() const { return new BoxPrimitive(*this); }
+	virtual void Render() {}
+	virtual void ApplyTransform(bool ScaleRotOnly=false) {}
+	virtual Evaluator *MakeEvaluator() { return NULL; }
+
+	virtual dBoundingBox GetBoundingBox(const dMatrix &space)
+	{
+		dBoundingBox box;
+		const TypedPData<dVector> *p=GetDataView<dVector>("p");
+		for (unsigned int i=0; i<p->Size(); i++)
+		{
+			box.expand(space.transform(p->View()[i]));
+		}
+		return box;
+	}
+
+protected:
+	virtual void PDataDirty() {}
+};
+
+static SceneNode *Add(SceneGraph &graph, int parent, float x, bool cull=true)
+{
+	BoxPrimitive *prim=new BoxPrimitive;
+	prim->GetState()->Transform.translate(x,0,0);
+	if (!cull) prim->GetState()->Hints&=~HINT_FRUSTUM_CULL;
+	SceneNode *node=new SceneNode(prim);
+	graph.AddNode(parent,node);
+	return node;
+}
+
+static bool Contains(const vector<const SceneNode*> &nodes, const SceneNode *node)
+{
+	for (unsigned int i=0; i<nodes.size(); i++)
+	{
+		if (nodes[i]==node) return true;
+	}
+	return false;
+}
+
+int main()
+{
+	SceneGraph graph;
+	int root=graph.Root()->ID;
+
+	// a in view, b out of view with children which are
+	// too, and c out of view but not culled
+	SceneNode *a=Add(graph,root,0);
+	SceneNode *a1=Add(graph,a->ID,0);
+	SceneNode *b=Add(graph,root,100);
+	SceneNode *b1=Add(graph,b->ID,0);
+	SceneNode *b2=Add(graph,b1->ID,0);
+	SceneNode *c=Add(graph,root,100,false);
+
+	// the identity view projection sees the -1 to 1 cube
+	dMatrix viewprojection;
+	vector<const SceneNode*> nodes;
+
+	graph.GetVisibleNodes(viewprojection,0,nodes);
+	CHECK(nodes.size()==3);
+	CHECK(Contains(nodes,a) && Contains(nodes,a1) && Contains(nodes,c));
+	// b is culled, so its children aren't looked at
+	CHECK(graph.GetNumVisited()==4);
+
+	// nothing has changed, so nothing is refitted
+	nodes.clear();
+	graph.GetVisibleNodes(viewprojection,0,nodes);
+	CHECK(graph.GetNumRefitted()==0);
+	CHECK(nodes.size()==3);
+	CHECK(graph.GetNumVisited()==4);
+
+	// moving b refits it, but its children haven't been
+	// in the hierarchy yet as they've never been walked
+	b->Prim->GetState()->Transform.init();
+	b->DirtyTransform();
+	nodes.clear();
+	graph.GetVisibleNodes(viewprojection,0,nodes);
+	CHECK(graph.GetNumRefitted()==1);
+	CHECK(nodes.size()==6);
+	CHECK(Contains(nodes,b) && Contains(nodes,b1) && Contains(nodes,b2));
+	CHECK(graph.GetNumVisited()==6);
+
+	// moving the parent refits all the children
+	b->Prim->GetState()->Transform.translate(100,0,0);
+	b->DirtyTransform();
+	nodes.clear();
+	graph.GetVisibleNodes(viewprojection,0,nodes);
+	CHECK(graph.GetNumRefitted()==3);
+	CHECK(nodes.size()==3);
+	CHECK(!Contains(nodes,b1) && !Contains(nodes,b2));
+	CHECK(graph.GetNumVisited()==4);
+
+	// writing pdata refits only that node
+	a1->Prim->SetData<dVector>("p",0,dVector(99.5,-0.5,-0.5));
+	a1->Prim->SetData<dVector>("p",1,dVector(100.5,0.5,0.5));
+	nodes.clear();
+	graph.GetVisibleNodes(viewprojection,0,nodes);
+	CHECK(graph.GetNumRefitted()==1);
+	CHECK(nodes.size()==2);
+	CHECK(!Contains(nodes,a1));
+
+	// removed nodes waiting to be refitted are skipped
+	b->DirtyTransform();
+	graph.RemoveNode(b);
+	nodes.clear();
+	graph.GetVisibleNodes(viewprojection,0,nodes);
+	CHECK(graph.GetNumRefitted()==0);
+	CHECK(graph.GetNumVisited()==3);
+
+	if (Failures==0) printf("scenegraph culling: ok\n");
+	return Failures==0?0:1;
+}
@@ -0,0 +1,337 @@
+// Copyright (C) 2010 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#include "BVH.h"
+
+using namespace Fluxus;
+
+// leaf boxes are grown by this proportion of their size, so
+// things can move a bit before the tree needs changing
+static const float MARGIN = 0.1f;
+
+static inline float SurfaceArea(const float *min, const float *max)
+{
+	float x=max[0]-min[0], y=max[1]-min[1], z=max[2]-min[2];
+	return x*y+y*z+z*x;
+}
+
+static inline void Union(const float *amin, const float *amax, 
+                         const float *bmin, const float *bmax,
+                         float *min, float *max)
+{
+	for (int i=0; i<3; i++)
+	{
+		min[i]=amin[i]<bmin[i]?amin[i]:bmin[i];
+		max[i]=amax[i]>bmax[i]?amax[i]:bmax[i];
+	}
+}
+
+BVH::BVH() :
+m_Root(-1),
+m_FreeList(-1)
+{
+}
+
+BVH::~BVH()
+{
+}
+
+void BVH::Clear()
+{
+	m_Items.clear();
+	m_Root=-1;
+	m_FreeList=-1;
+}
+
+int BVH::Allocate()
+{
+	if (m_FreeList<0)
+	{
+		m_Items.push_back(Item());
+		m_FreeList=m_Items.size()-1;
+		m_Items[m_FreeList].Parent=-1;
+	}
+
+	int index=m_FreeList;
+	Item &item=m_Items[index];
+	m_FreeList=item.Parent;
+	item.Parent=-1;
+	item.Left=-1;
+	item.Right=-1;
+	item.Height=0;
+	item.Node=NULL;
+	return index;
+}
+
+void BVH::Free(int index)
+{
+	m_Items[index].Parent=m_FreeList;
+	m_Items[index].Height=-1;
+	m_FreeList=index;
+}
+
+int BVH::Insert(const dBoundingBox &box, SceneNode *node)
+{
+	int leaf=Allocate();
+	m_Items[leaf].Node=node;
+	SetBox(leaf,box);
+	InsertLeaf(leaf);
+	return leaf;
+}
+
+void BVH::SetBox(int leaf, const dBoundingBox &box)
+{
+	Item &item=m_Items[leaf];
+	dVector margin=(box.max-box.min)*MARGIN;
+	item.Min[0]=box.min.x-margin.x;
+	item.Min[1]=box.min.y-margin.y;
+	item.Min[2]=box.min.z-margin.z;
+	item.Max[0]=box.max.x+margin.x;
+	item.Max[1]=box.max.y+margin.y;
+	item.Max[2]=box.max.z+margin.z;
+}
+
+void BVH::Remove(int leaf)
+{
+	RemoveLeaf(leaf);
+	Free(leaf);
+}
+
+bool BVH::Update(int leaf, const dBoundingBox &box)
+{
+	Item &item=m_Items[leaf];
+	if (item.Min[0]<=box.min.x && item.Min[1]<=box.min.y && item.Min[2]<=box.min.z &&
+	    item.Max[0]>=box.max.x && item.Max[1]>=box.max.y && item.Max[2]>=box.max.z)
+	{
+		return false;
+	}
+
+	RemoveLeaf(leaf);
+	SetBox(leaf,box);
+	InsertLeaf(leaf);
+	return true;
+}
+
+void BVH::InsertLeaf(int leaf)
+{
+	if (m_Root<0)
+	{
+		m_Root=leaf;
+		m_Items[leaf].Parent=-1;
+		return;
+	}
+
+	// walk down to the cheapest sibling by surface area
+	const float *lmin=m_Items[leaf].Min;
+	const float *lmax=m_Items[leaf].Max;
+	int index=m_Root;
+	while (!m_Items[index].IsLeaf())
+	{
+		const Item &item=m_Items[index];
+		float min[3],max[3];
+		float area=SurfaceArea(item.Min,item.Max);
+		Union(item.Min,item.Max,lmin,lmax,min,max);
+		float combined=SurfaceArea(min,max);
+
+		// cost of making a new parent here, and the extra cost 
+		// pushed down to the children if we carry on
+		float cost=2*combined;
+		float inherited=2*(combined-area);
+
+		float childcost[2];
+		int children[2]={item.Left,item.Right};
+		for (int c=0; c<2; c++)
+		{
+			const Item &child=m_Items[children[c]];
+			Union(child.Min,child.Max,lmin,lmax,min,max);
+			childcost[c]=SurfaceArea(min,max)+inherited;
+			if (!child.IsLeaf()) childcost[c]-=SurfaceArea(child.Min,child.Max);
+		}
+
+		if (cost<childcost[0] && cost<childcost[1]) break;
+		index=childcost[0]<childcost[1]?children[0]:children[1];
+	}
+
+	// make a new parent for the sibling and the leaf
+	int sibling=index;
+	int oldparent=m_Items[sibling].Parent;
+	int parent=Allocate();
+	Item &p=m_Items[parent];
+	p.Parent=oldparent;
+	p.Left=sibling;
+	p.Right=leaf;
+	p.Height=m_Items[sibling].Height+1;
+	Union(m_Items[sibling].Min,m_Items[sibling].Max,
+	      m_Items[leaf].Min,m_Items[leaf].Max,p.Min,p.Max);
+	m_Items[sibling].Parent=parent;
+	m_Items[leaf].Parent=parent;
+
+	if (oldparent<0)
+	{
+		m_Root=parent;
+	}
+	else
+	{
+		if (m_Items[oldparent].Left==sibling) m_Items[oldparent].Left=parent;
+		else m_Items[oldparent].Right=parent;
+	}
+
+	Refit(m_Items[leaf].Parent);
+}
+
+void BVH::RemoveLeaf(int leaf)
+{
+	if (leaf==m_Root)
+	{
+		m_Root=-1;
+		return;
+	}
+
+	int parent=m_Items[leaf].Parent;
+	int grandparent=m_Items[parent].Parent;
+	int sibling=m_Items[parent].Left==leaf?m_Items[parent].Right:m_Items[parent].Left;
+
+	// the sibling takes the place of the parent
+	if (grandparent<0)
+	{
+		m_Root=sibling;
+		m_Items[sibling].Parent=-1;
+	}
+	else
+	{
+		if (m_Items[grandparent].Left==parent) m_Items[grandparent].Left=sibling;
+		else m_Items[grandparent].Right=sibling;
+		m_Items[sibling].Parent=grandparent;
+		Refit(grandparent);
+	}
+	Free(parent);
+}
+
+void BVH::Refit(int index)
+{
+	while (index>=0)
+	{
+		index=Balance(index);
+		Item &item=m_Items[index];
+		const Item &left=m_Items[item.Left];
+		const Item &right=m_Items[item.Right];
+		item.Height=1+(left.Height>right.Height?left.Height:right.Height);
+		Union(left.Min,left.Max,right.Min,right.Max,item.Min,item.Max);
+		index=item.Parent;
+	}
+}
+
+// rotates the taller child up if the item is out of balance,
+// returns the index of the item now in its place
+int BVH::Balance(int a)
+{
+	if (m_Items[a].IsLeaf() || m_Items[a].Height<2) return a;
+
+	int b=m_Items[a].Left;
+	int c=m_Items[a].Right;
+	int balance=m_Items[c].Height-m_Items[b].Height;
+	if (balance>-2 && balance<2) return a;
+
+	// rotate the taller child, up and its taller child across
+	int up=balance>1?c:b;
+	Item &u=m_Items[up];
+	int f=u.Left;
+	int g=u.Right;
+
+	u.Left=a;
+	u.Parent=m_Items[a].Parent;
+	m_Items[a].Parent=up;
+	if (u.Parent<0) m_Root=up;
+	else if (m_Items[u.Parent].Left==a) m_Items[u.Parent].Left=up;
+	else m_Items[u.Parent].Right=up;
+
+	int keep=m_Items[f].Height>m_Items[g].Height?f:g;
+	int move=keep==f?g:f;
+	u.Right=keep;
+	if (up==c) m_Items[a].Right=move;
+	else m_Items[a].Left=move;
+	m_Items[move].Parent=a;
+
+	Item &ai=m_Items[a];
+	const Item &l=m_Items[ai.Left];
+	const Item &r=m_Items[ai.Right];
+	Union(l.Min,l.Max,r.Min,r.Max,ai.Min,ai.Max);
+	ai.Height=1+(l.Height>r.Height?l.Height:r.Height);
+
+	const Item &k=m_Items[keep];
+	Union(ai.Min,ai.Max,k.Min,k.Max,u.Min,u.Max);
+	u.Height=1+(ai.Height>k.Height?ai.Height:k.Height);
+	return up;
+}
+
+void BVH::Cull(const dPlane *planes, unsigned int count, vector<SceneNode*> &inside) const
+{
+	if (m_Root<0) return;
+	Cull(m_Root,planes,count,(1<<count)-1,inside);
+}
+
+void BVH::Cull(int index, const dPlane *planes, unsigned int count, unsigned int mask, vector<SceneNode*> &inside) const
+{
+	const Item &item=m_Items[index];
+	for (unsigned int p=0; p<count; p++)
+	{
+		if (!(mask&(1<<p))) continue;
+
+		// the corners furthest along and against the plane normal
+		const dPlane &plane=planes[p];
+		float nx=plane.a, ny=plane.b, nz=plane.c;
+		float outer=plane.d+
+			nx*(nx>=0?item.Max[0]:item.Min[0])+
+			ny*(ny>=0?item.Max[1]:item.Min[1])+
+			nz*(nz>=0?item.Max[2]:item.Min[2]);
+		if (outer<0) return;
+
+		float inner=plane.d+
+			nx*(nx>=0?item.Min[0]:item.Max[0])+
+			ny*(ny>=0?item.Min[1]:item.Max[1])+
+			nz*(nz>=0?item.Min[2]:item.Max[2]);
+		// this plane doesn't need testing below here
+		if (inner>=0) mask&=~(1<<p);
+	}
+
+	if (mask==0)
+	{
+		AddAll(index,inside);
+	}
+	else if (item.IsLeaf())
+	{
+		inside.push_back(item.Node);
+	}
+	else
+	{
+		Cull(item.Left,planes,count,mask,inside);
+		Cull(item.Right,planes,count,mask,inside);
+	}
+}
+
+void BVH::AddAll(int index, vector<SceneNode*> &inside) const
+{
+	const Item &item=m_Items[index];
+	if (item.IsLeaf())
+	{
+		inside.push_back(item.Node);
+	}
+	else
+	{
+		AddAll(item.Left,inside);
+		AddAll(item.Right,inside);
+	}
+}
@@ -0,0 +1,94 @@
+// Copyright (C) 2010 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#ifndef N_BVH
+#define N_BVH
+
+#include <vector>
+#include "dada.h"
+
+using namespace std;
+
+namespace Fluxus
+{
+
+class SceneNode;
+
+//////////////////////////////////////////////////////
+/// A bounding volume hierarchy of scene node world 
+/// bounding boxes, used for frustum culling. Leaves are
+/// stored with a margin, so small movements don't change
+/// the tree, bigger ones remove and reinsert the leaf 
+/// and refit the boxes above it. Whole branches outside
+/// the frustum are rejected with one test, and branches
+/// completely inside it are accepted without any more.
+class BVH
+{
+public:
+	BVH();
+	~BVH();
+
+	/// Adds a box, returns the leaf to update or remove it with
+	int Insert(const dBoundingBox &box, SceneNode *node);
+
+	/// Removes a leaf
+	void Remove(int leaf);
+
+	/// Updates the box of a leaf, returns true if it's moved 
+	/// outside its margin and the tree has been changed
+	bool Update(int leaf, const dBoundingBox &box);
+
+	/// Adds all the nodes which may be inside all the planes
+	void Cull(const dPlane *planes, unsigned int count, vector<SceneNode*> &inside) const;
+
+	/// Removes everything
+	void Clear();
+
+	bool Empty() const { return m_Root<0; }
+
+private:
+	class Item
+	{
+	public:
+		float Min[3];
+		float Max[3];
+		int Parent; // or the next free item
+		int Left;   // -1 for leaves
+		int Right;
+		int Height; // 0 for leaves, -1 for free items
+		SceneNode *Node;
+
+		bool IsLeaf() const { return Left<0; }
+	};
+
+	int Allocate();
+	void SetBox(int leaf, const dBoundingBox &box);
+	void Free(int index);
+	void InsertLeaf(int leaf);
+	void RemoveLeaf(int leaf);
+	void Refit(int index);
+	int Balance(int index);
+	void Cull(int index, const dPlane *planes, unsigned int count, unsigned int mask, vector<SceneNode*> &inside) const;
+	void AddAll(int index, vector<SceneNode*> &inside) const;
+
+	vector<Item> m_Items;
+	int m_Root;
+	int m_FreeList;
+};
+
+}
+
+#endif
@@ -18,11 +18,47 @@
 #include "BlobbyPrimitive.h"
 #include "State.h"
 #include "ImplicitSurface.h"
+#include "ThreadPool.h"
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
 
 using namespace Fluxus;
 
+// the field is worked out a brick of grid points at a time,
+// using only the influences that reach into the brick
+static const unsigned int BRICK_SIZE=8;
+
+// influences are ignored where they add less than this much
+// of the isolevel to the field, so the surface moves by far
+// less than a cell whatever the isolevel. isolevels nearer 0 
+// than MIN_ISOLEVEL use that, so influences still only reach 
+// a finite distance
+static const float FIELD_CUTOFF=0.001f;
+static const float MIN_ISOLEVEL=0.001f;
+
+// for bricks with no influences, so the list isn't NULL
+static const unsigned int NoInfluences[1]={0};
+
+static inline float FieldCutoff(float isolevel)
+{
+	isolevel=fabs(isolevel);
+	return (isolevel<MIN_ISOLEVEL?MIN_ISOLEVEL:isolevel)*FIELD_CUTOFF;
+}
+
+static inline float CutoffSq(float strength, float cutoff)
+{
+	return fabs(strength)/cutoff;
+}
+
 BlobbyPrimitive::BlobbyPrimitive(int dimx, int dimy, int dimz, dVector size) :
-    m_LockVoxels(false)
+m_FieldCutoff(FieldCutoff(1)),
+m_SurfaceVersion(0),
+m_SurfaceIsolevel(0),
+m_SurfaceColour(false),
+m_SurfaceDirty(true),
+m_LockVoxels(false)
 {
 	AddData("p",new TypedPData<dVector>);
 	AddData("c",new TypedPData<dColour>);
@@ -38,43 +74,29 @@ BlobbyPrimitive::BlobbyPrimitive(int dimx, int dimy, int dimz, dVector size) :
 	m_Width = dimx;
 	m_Height = dimy;
 	m_Depth = dimz;
+	m_CellSize = dVector(sx,sy,sz);
 
-	for (int x=0; x<dimx; x++)
-	{
-		for (int y=0; y<dimy; y++)
-		{
-			for (int z=0; z<dimz; z++)
-			{
-				Cell cell;
-
-				cell.p[0]=dVector(sx*x,sy*y+sy,sz*z);
-				cell.p[1]=dVector(sx*x,sy*y+sy,sz*z+sz);
-				cell.p[2]=dVector(sx*x,sy*y,sz*z+sz);
-				cell.p[3]=dVector(sx*x,sy*y,sz*z);
-
-				cell.p[4]=dVector(sx*x+sx,sy*y+sy,sz*z);
-				cell.p[5]=dVector(sx*x+sx,sy*y+sy,sz*z+sz);
-				cell.p[6]=dVector(sx*x+sx,sy*y,sz*z+sz);
-				cell.p[7]=dVector(sx*x+sx,sy*y,sz*z);
-
-				cell.val[0]=0;
-				cell.val[1]=0;
-				cell.val[2]=0;
-				cell.val[3]=0;
-				cell.val[4]=0;
-				cell.val[5]=0;
-				cell.val[6]=0;
-				cell.val[7]=0;
-
-				m_Voxels.push_back(cell);
-			}
-		}
-	}
+	m_BricksX = (dimx+BRICK_SIZE)/BRICK_SIZE;
+	m_BricksY = (dimy+BRICK_SIZE)/BRICK_SIZE;
+	m_BricksZ = (dimz+BRICK_SIZE)/BRICK_SIZE;
 }
 
 BlobbyPrimitive::BlobbyPrimitive(const BlobbyPrimitive &other) :
 Primitive(other),
-m_Voxels(other.m_Voxels)
+m_Voxels(other.m_Voxels),
+m_Width(other.m_Width),
+m_Height(other.m_Height),
+m_Depth(other.m_Depth),
+m_CellSize(other.m_CellSize),
+m_BricksX(other.m_BricksX),
+m_BricksY(other.m_BricksY),
+m_BricksZ(other.m_BricksZ),
+m_FieldCutoff(FieldCutoff(1)),
+m_SurfaceVersion(0),
+m_SurfaceIsolevel(0),
+m_SurfaceColour(false),
+m_SurfaceDirty(true),
+m_LockVoxels(other.m_LockVoxels)
 {
 	PDataDirty();
 }
@@ -101,67 +123,614 @@ void BlobbyPrimitive::AddInfluence(const dVector &Vert, float Strength)
 	m_PosData->push_back(Vert); 
 	m_StrengthData->push_back(Strength); 
 	m_ColData->push_back(dColour(1,1,1)); 
+	m_SurfaceDirty=true;
+	DirtyBounds();
 }	
 
-float BlobbyPrimitive::Sample(const dVector &pos)
+vector<BlobbyPrimitive::Cell> &BlobbyPrimitive::GetVoxels()
 {
-	float val=0;
-	for (unsigned int n=0; n<m_PosData->size(); n++)
+	// the cells are only needed for setting the field directly, 
+	// so they are made the first time they are asked for
+	if (m_Voxels.empty())
 	{
-		float distance=fabs((*m_PosData)[n].distsq(pos));
-		if (distance>0)
+		float sx=m_CellSize.x;
+		float sy=m_CellSize.y;
+		float sz=m_CellSize.z;
+		m_Voxels.reserve(m_Width*m_Height*m_Depth);
+
+		for (unsigned int x=0; x<m_Width; x++)
 		{
-			val+=(*m_StrengthData)[n]*(1/distance);
+			for (unsigned int y=0; y<m_Height; y++)
+			{
+				for (unsigned int z=0; z<m_Depth; z++)
+				{
+					Cell cell;
+
+					cell.p[0]=dVector(sx*x,sy*y+sy,sz*z);
+					cell.p[1]=dVector(sx*x,sy*y+sy,sz*z+sz);
+					cell.p[2]=dVector(sx*x,sy*y,sz*z+sz);
+					cell.p[3]=dVector(sx*x,sy*y,sz*z);
+
+					cell.p[4]=dVector(sx*x+sx,sy*y+sy,sz*z);
+					cell.p[5]=dVector(sx*x+sx,sy*y+sy,sz*z+sz);
+					cell.p[6]=dVector(sx*x+sx,sy*y,sz*z+sz);
+					cell.p[7]=dVector(sx*x+sx,sy*y,sz*z);
+
+					for (int c=0; c<8; c++)
+					{
+						cell.val[c]=0;
+					}
+
+					m_Voxels.push_back(cell);
+				}
+			}
 		}
 	}
-	return val;
+
+	// assume they are about to be written
+	m_SurfaceDirty=true;
+	return m_Voxels;
 }
 
-float BlobbyPrimitive::SampleCol(const dVector &pos, dColour &col)
+void BlobbyPrimitive::LockVoxels() 
+{ 
+	m_LockVoxels=true; 
+	m_SurfaceDirty=true;
+}
+
+const unsigned int *BlobbyPrimitive::Influences(const dVector &pos, unsigned int &count)
 {
-	float val=0;
-	col=dColour(0,0,0);
-	
-	for (unsigned int n=0; n<m_PosData->size(); n++)
+	if (!m_LockVoxels && !m_BrickStart.empty())
 	{
-		float distance=fabs((*m_PosData)[n].distsq(pos));
-		if (distance>0)
+		float bx=floorf(pos.x/(m_CellSize.x*BRICK_SIZE));
+		float by=floorf(pos.y/(m_CellSize.y*BRICK_SIZE));
+		float bz=floorf(pos.z/(m_CellSize.z*BRICK_SIZE));
+		if (bx>=0 && bx<m_BricksX && by>=0 && by<m_BricksY && bz>=0 && bz<m_BricksZ)
+		{
+			unsigned int brick=((unsigned int)bx*m_BricksY+(unsigned int)by)*m_BricksZ+(unsigned int)bz;
+			count=m_BrickStart[brick+1]-m_BrickStart[brick];
+			if (count==0) return NoInfluences;
+			return &m_BrickInfluences[m_BrickStart[brick]];
+		}
+	}
+	// outside the grid, try them all
+	count=m_PosData->size();
+	return NULL;
+}
+
+dVector BlobbyPrimitive::Normal(const dVector &pos)
+{
+	// minus the gradient of the sum of strength/distance^2
+	unsigned int count;
+	const unsigned int *influences=Influences(pos,count);
+	dVector normal(0,0,0);
+	for (unsigned int i=0; i<count; i++)
+	{
+		unsigned int n=influences?influences[i]:i;
+		dVector dir=pos-(*m_PosData)[n];
+		float distance=dir.dot(dir);
+		if (distance>0 && distance<CutoffSq((*m_StrengthData)[n],m_FieldCutoff))
 		{
 			float mul=1/distance;
-			val+=(*m_StrengthData)[n]*mul;
-			
-			//col+=(*m_ColData)[n]*mul;
+			normal+=dir*((*m_StrengthData)[n]*mul*mul);
+		}
+	}
+	float mag=normal.mag();
+	if (mag>0) normal/=mag;
+	return normal;
+}
+
+// the range of bricks of this size a span from p-r to p+r 
+// touches, false if it misses them all
+static bool BrickRange(float p, float r, float size, unsigned int count, unsigned int &lo, unsigned int &hi)
+{
+	float first=floorf((p-r)/size);
+	float last=floorf((p+r)/size);
+	if (!(last>=0 && first<count)) return false;
+	lo=first<0?0:(unsigned int)first;
+	hi=last>=count?count-1:(unsigned int)last;
+	return true;
+}
+
+void BlobbyPrimitive::BucketInfluences()
+{
+	unsigned int numbricks=m_BricksX*m_BricksY*m_BricksZ;
+	dVector bricksize=m_CellSize*BRICK_SIZE;
+	m_BrickStart.assign(numbricks+1,0);
+	m_BrickInfluences.clear();
+
+	// count the influences in each brick, then fill them in
+	vector<unsigned int> next;
+	for (int pass=0; pass<2; pass++)
+	{
+		for (unsigned int n=0; n<m_PosData->size(); n++)
+		{
+			const dVector &pos=(*m_PosData)[n];
+			float r=sqrtf(CutoffSq((*m_StrengthData)[n],m_FieldCutoff));
+			unsigned int x0,x1,y0,y1,z0,z1;
+			if (!BrickRange(pos.x,r,bricksize.x,m_BricksX,x0,x1) ||
+				!BrickRange(pos.y,r,bricksize.y,m_BricksY,y0,y1) ||
+				!BrickRange(pos.z,r,bricksize.z,m_BricksZ,z0,z1))
+			{
+				continue;
+			}
+
+			for (unsigned int x=x0; x<=x1; x++)
+			{
+				for (unsigned int y=y0; y<=y1; y++)
+				{
+					for (unsigned int z=z0; z<=z1; z++)
+					{
+						unsigned int brick=(x*m_BricksY+y)*m_BricksZ+z;
+						if (pass==0) m_BrickStart[brick+1]++;
+						else m_BrickInfluences[next[brick]++]=n;
+					}
+				}
+			}
+		}
+
+		if (pass==0)
+		{
+			for (unsigned int b=0; b<numbricks; b++)
+			{
+				m_BrickStart[b+1]+=m_BrickStart[b];
+			}
+			m_BrickInfluences.resize(m_BrickStart[numbricks]);
+			next.assign(m_BrickStart.begin(),m_BrickStart.end()-1);
+		}
+	}
+}
+
+// works out the field for a range of bricks
+class BlobbyPrimitive::FieldTask : public ThreadPool::Task
+{
+public:
+	FieldTask(BlobbyPrimitive &blob, bool colour) : m_Blob(blob), m_Colour(colour) {}
+
+	virtual void Run(unsigned int start, unsigned int end)
+	{
+		const BlobbyPrimitive &blob=m_Blob;
+		const bool colour=m_Colour;
+		const unsigned int stridey=blob.m_Depth+1;
+		const unsigned int stridex=(blob.m_Height+1)*stridey;
+		const float sx=blob.m_CellSize.x;
+		const float sy=blob.m_CellSize.y;
+		const float sz=blob.m_CellSize.z;
+		float *field=&m_Blob.m_Field[0];
+		dColour *fieldcol=colour?&m_Blob.m_FieldCol[0]:NULL;
+
+		// the brick's influences, copied out so they are together
+		vector<float> ix,iy,iz,is,ir,cr,cg,cb;
+
+		for (unsigned int b=start; b<end; b++)
+		{
+			unsigned int first=blob.m_BrickStart[b];
+			unsigned int count=blob.m_BrickStart[b+1]-first;
+			ix.resize(count); iy.resize(count); iz.resize(count);
+			is.resize(count); ir.resize(count);
+			if (colour)
+			{
+				cr.resize(count); cg.resize(count); cb.resize(count);
+			}
+
+			for (unsigned int i=0; i<count; i++)
+			{
+				unsigned int n=blob.m_BrickInfluences[first+i];
+				const dVector &pos=(*blob.m_PosData)[n];
+				ix[i]=pos.x; iy[i]=pos.y; iz[i]=pos.z;
+				is[i]=(*blob.m_StrengthData)[n];
+				ir[i]=CutoffSq(is[i],blob.m_FieldCutoff);
+				if (colour)
+				{
+					const dColour &c=(*blob.m_ColData)[n];
+					cr[i]=c.r; cg[i]=c.g; cb[i]=c.b;
+				}
+			}
 
-			col.r+=(*m_ColData)[n].r*mul;
-			col.g+=(*m_ColData)[n].g*mul;
-			col.b+=(*m_ColData)[n].b*mul;
+			unsigned int bz=b%blob.m_BricksZ;
+			unsigned int by=(b/blob.m_BricksZ)%blob.m_BricksY;
+			unsigned int bx=b/(blob.m_BricksZ*blob.m_BricksY);
+			unsigned int x0=bx*BRICK_SIZE, x1=min(x0+BRICK_SIZE,blob.m_Width+1);
+			unsigned int y0=by*BRICK_SIZE, y1=min(y0+BRICK_SIZE,blob.m_Height+1);
+			unsigned int z0=bz*BRICK_SIZE, z1=min(z0+BRICK_SIZE,blob.m_Depth+1);
+			unsigned int rowlen=z1-z0;
+
+			// a row along z at a time, with the influences in the 
+			// inner loop so the row stays in registers
+			float val[BRICK_SIZE], r[BRICK_SIZE], g[BRICK_SIZE], bl[BRICK_SIZE];
+			for (unsigned int x=x0; x<x1; x++)
+			{
+				float px=sx*x;
+				for (unsigned int y=y0; y<y1; y++)
+				{
+					float py=sy*y;
+#ifdef __SSE__
+					__m128 zero=_mm_setzero_ps();
+					__m128 one=_mm_set1_ps(1.0f);
+					__m128 pz0=_mm_set_ps(sz*(z0+3),sz*(z0+2),sz*(z0+1),sz*z0);
+					__m128 pz1=_mm_set_ps(sz*(z0+7),sz*(z0+6),sz*(z0+5),sz*(z0+4));
+					__m128 v0=zero, v1=zero;
+					__m128 r0=zero, r1=zero, g0=zero, g1=zero, b0=zero, b1=zero;
+					for (unsigned int i=0; i<count; i++)
+					{
+						float dx=ix[i]-px;
+						float dy=iy[i]-py;
+						__m128 dxy=_mm_set1_ps(dx*dx+dy*dy);
+						__m128 inz=_mm_set1_ps(iz[i]);
+						__m128 cutoff=_mm_set1_ps(ir[i]);
+						__m128 dz0=_mm_sub_ps(pz0,inz);
+						__m128 dz1=_mm_sub_ps(pz1,inz);
+						__m128 d0=_mm_add_ps(dxy,_mm_mul_ps(dz0,dz0));
+						__m128 d1=_mm_add_ps(dxy,_mm_mul_ps(dz1,dz1));
+						// 1/distance, or zero where it's on top of the
+						// influence or past the cutoff
+						__m128 mul0=_mm_and_ps(_mm_and_ps(_mm_cmpgt_ps(d0,zero),_mm_cmplt_ps(d0,cutoff)),
+							_mm_div_ps(one,d0));
+						__m128 mul1=_mm_and_ps(_mm_and_ps(_mm_cmpgt_ps(d1,zero),_mm_cmplt_ps(d1,cutoff)),
+							_mm_div_ps(one,d1));
+						__m128 strength=_mm_set1_ps(is[i]);
+						v0=_mm_add_ps(v0,_mm_mul_ps(strength,mul0));
+						v1=_mm_add_ps(v1,_mm_mul_ps(strength,mul1));
+						if (colour)
+						{
+							__m128 c=_mm_set1_ps(cr[i]);
+							r0=_mm_add_ps(r0,_mm_mul_ps(c,mul0));
+							r1=_mm_add_ps(r1,_mm_mul_ps(c,mul1));
+							c=_mm_set1_ps(cg[i]);
+							g0=_mm_add_ps(g0,_mm_mul_ps(c,mul0));
+							g1=_mm_add_ps(g1,_mm_mul_ps(c,mul1));
+							c=_mm_set1_ps(cb[i]);
+							b0=_mm_add_ps(b0,_mm_mul_ps(c,mul0));
+							b1=_mm_add_ps(b1,_mm_mul_ps(c,mul1));
+						}
+					}
+					_mm_storeu_ps(val,v0); _mm_storeu_ps(val+4,v1);
+					if (colour)
+					{
+						_mm_storeu_ps(r,r0); _mm_storeu_ps(r+4,r1);
+						_mm_storeu_ps(g,g0); _mm_storeu_ps(g+4,g1);
+						_mm_storeu_ps(bl,b0); _mm_storeu_ps(bl+4,b1);
+					}
+#else
+					for (unsigned int k=0; k<rowlen; k++)
+					{
+						val[k]=r[k]=g[k]=bl[k]=0;
+					}
+					for (unsigned int i=0; i<count; i++)
+					{
+						float dx=ix[i]-px;
+						float dy=iy[i]-py;
+						float dxy=dx*dx+dy*dy;
+						for (unsigned int k=0; k<rowlen; k++)
+						{
+							float dz=sz*(z0+k)-iz[i];
+							float d=dxy+dz*dz;
+							if (d>0 && d<ir[i])
+							{
+								float mul=1/d;
+								val[k]+=is[i]*mul;
+								if (colour)
+								{
+									r[k]+=cr[i]*mul;
+									g[k]+=cg[i]*mul;
+									bl[k]+=cb[i]*mul;
+								}
+							}
+						}
+					}
+#endif
+					unsigned int base=x*stridex+y*stridey+z0;
+					for (unsigned int k=0; k<rowlen; k++)
+					{
+						field[base+k]=val[k];
+					}
+					if (colour)
+					{
+						for (unsigned int k=0; k<rowlen; k++)
+						{
+							dColour &c=fieldcol[base+k];
+							c.r=r[k]; c.g=g[k]; c.b=bl[k]; c.a=1;
+						}
+					}
+				}
+			}
 		}
-	}		
-	return val;	
+	}
+
+private:
+	BlobbyPrimitive &m_Blob;
+	bool m_Colour;
+};
+
+void BlobbyPrimitive::UpdateField(bool colour)
+{
+	BucketInfluences();
+
+	unsigned int points=(m_Width+1)*(m_Height+1)*(m_Depth+1);
+	m_Field.resize(points);
+	if (colour) m_FieldCol.resize(points);
+
+	FieldTask field(*this,colour);
+	ThreadPool::Run(field,m_BricksX*m_BricksY*m_BricksZ,1);
+}
+
+void BlobbyPrimitive::GatherField(bool colour)
+{
+	unsigned int points=(m_Width+1)*(m_Height+1)*(m_Depth+1);
+	m_Field.assign(points,0);
+	if (colour) m_FieldCol.assign(points,dColour(0,0,0));
+	if (m_Voxels.empty()) return;
+
+	const unsigned int stridey=m_Depth+1;
+	const unsigned int stridex=(m_Height+1)*stridey;
+	// the grid point of each corner, from the cell's lowest one
+	const unsigned int corner[8]={stridey, stridey+1, 1, 0,
+		stridex+stridey, stridex+stridey+1, stridex+1, stridex};
+
+	unsigned int cell=0;
+	for (unsigned int x=0; x<m_Width; x++)
+	{
+		for (unsigned int y=0; y<m_Height; y++)
+		{
+			for (unsigned int z=0; z<m_Depth; z++)
+			{
+				unsigned int base=x*stridex+y*stridey+z;
+				for (int c=0; c<8; c++)
+				{
+					m_Field[base+corner[c]]=m_Voxels[cell].val[c];
+					if (colour) m_FieldCol[base+corner[c]]=m_Voxels[cell].col[c];
+				}
+				cell++;
+			}
+		}
+	}
+}
+
+// this implicit surface implementation is modified from Paul Bourke's which can be found here:
+// http://astronomy.swin.edu.au/~pbourke/modelling/polygonise/
+// 
+// each edge of the grid cut by the surface gets one vertex, shared
+// by the triangles of the cells around it. the vertices are made
+// first, a plane of grid points (constant x) at a time, then the
+// triangles of each plane of cells pick them up.
+
+// makes the vertices on the edges starting from a range of x planes 
+// of grid points, or just counts them if m_Count is set
+class BlobbyPrimitive::VertexTask : public ThreadPool::Task
+{
+public:
+	VertexTask(BlobbyPrimitive &blob, float isolevel, bool colour, bool count) : 
+		m_Blob(blob), m_Isolevel(isolevel), m_Colour(colour), m_Count(count) {}
+
+	virtual void Run(unsigned int start, unsigned int end)
+	{
+		BlobbyPrimitive &blob=m_Blob;
+		const float isolevel=m_Isolevel;
+		const unsigned int width=blob.m_Width;
+		const unsigned int height=blob.m_Height;
+		const unsigned int depth=blob.m_Depth;
+		const unsigned int stride[3]={(height+1)*(depth+1), depth+1, 1};
+		const float *field=&blob.m_Field[0];
+
+		for (unsigned int x=start; x<end; x++)
+		{
+			unsigned int next=m_Count?0:blob.m_PlaneVerts[x];
+			for (unsigned int y=0; y<=height; y++)
+			{
+				for (unsigned int z=0; z<=depth; z++)
+				{
+					unsigned int base=x*stride[0]+y*stride[1]+z;
+					float val=field[base];
+					bool inside=val<isolevel;
+					bool more[3]={x<width, y<height, z<depth};
+					for (int axis=0; axis<3; axis++)
+					{
+						if (!more[axis]) continue;
+						float other=field[base+stride[axis]];
+						if ((other<isolevel)==inside) continue;
+
+						if (!m_Count)
+						{
+							blob.m_EdgeVerts[axis][base]=next;
+							MakeVertex(next,x,y,z,axis,(isolevel-val)/(other-val));
+						}
+						next++;
+					}
+				}
+			}
+			if (m_Count) blob.m_PlaneVerts[x]=next;
+		}
+	}
+
+private:
+	void MakeVertex(unsigned int i, unsigned int x, unsigned int y, unsigned int z, int axis, float mu)
+	{
+		BlobbyPrimitive &blob=m_Blob;
+		const unsigned int stridey=blob.m_Depth+1;
+		const unsigned int stridex=(blob.m_Height+1)*stridey;
+		const unsigned int base=x*stridex+y*stridey+z;
+		const unsigned int other=base+(axis==0?stridex:axis==1?stridey:1);
+
+		dVector pos(blob.m_CellSize.x*x, blob.m_CellSize.y*y, blob.m_CellSize.z*z);
+		pos.arr()[axis]+=mu*blob.m_CellSize.arr()[axis];
+		blob.m_SurfacePoints[i]=pos;
+
+		if (blob.m_LockVoxels)
+		{
+			// from the field around the grid points
+			dVector grad=lerp(Gradient(x,y,z),
+				Gradient(x+(axis==0),y+(axis==1),z+(axis==2)),mu);
+			float mag=grad.mag();
+			if (mag>0) grad/=mag;
+			blob.m_SurfaceNormals[i]=grad;
+		}
+		else
+		{
+			blob.m_SurfaceNormals[i]=blob.Normal(pos);
+		}
+
+		if (m_Colour)
+		{
+			const dColour &a=blob.m_FieldCol[base];
+			const dColour &b=blob.m_FieldCol[other];
+			blob.m_SurfaceColours[i]=dColour(a.r+mu*(b.r-a.r), a.g+mu*(b.g-a.g), a.b+mu*(b.b-a.b));
+		}
+	}
+
+	float Value(int x, int y, int z) const
+	{
+		const BlobbyPrimitive &blob=m_Blob;
+		if (x<0 || y<0 || z<0 || x>(int)blob.m_Width || y>(int)blob.m_Height || z>(int)blob.m_Depth) return 0;
+		return blob.m_Field[(x*(blob.m_Height+1)+y)*(blob.m_Depth+1)+z];
+	}
+
+	// minus the gradient, from the neighbouring grid points
+	dVector Gradient(int x, int y, int z) const
+	{
+		return dVector(Value(x-1,y,z)-Value(x+1,y,z),
+					   Value(x,y-1,z)-Value(x,y+1,z),
+					   Value(x,y,z-1)-Value(x,y,z+1));
+	}
+
+	BlobbyPrimitive &m_Blob;
+	float m_Isolevel;
+	bool m_Colour;
+	bool m_Count;
+};
+
+// makes the triangles for a range of x planes of cells
+class BlobbyPrimitive::TriangleTask : public ThreadPool::Task
+{
+public:
+	TriangleTask(BlobbyPrimitive &blob, float isolevel) : m_Blob(blob), m_Isolevel(isolevel) {}
+
+	virtual void Run(unsigned int start, unsigned int end)
+	{
+		BlobbyPrimitive &blob=m_Blob;
+		const float isolevel=m_Isolevel;
+		const unsigned int height=blob.m_Height;
+		const unsigned int depth=blob.m_Depth;
+		const unsigned int stridey=depth+1;
+		const unsigned int stridex=(height+1)*stridey;
+		const unsigned int corner[8]={stridey, stridey+1, 1, 0,
+			stridex+stridey, stridex+stridey+1, stridex+1, stridex};
+		unsigned int edge[12];
+		for (int e=0; e<12; e++)
+		{
+			edge[e]=ImplicitSurfaceEdgeStart[e][0]*stridex+ImplicitSurfaceEdgeStart[e][1]*stridey+ImplicitSurfaceEdgeStart[e][2];
+		}
+		const float *field=&blob.m_Field[0];
+
+		for (unsigned int x=start; x<end; x++)
+		{
+			vector<unsigned int> &out=blob.m_PlaneTriangles[x];
+			out.clear();
+			for (unsigned int y=0; y<height; y++)
+			{
+				for (unsigned int z=0; z<depth; z++)
+				{
+					unsigned int base=x*stridex+y*stridey+z;
+
+					//  Determine the index into the edge table which
+					//  tells us which vertices are inside of the surface
+					int cubeindex=0;
+					for (int c=0; c<8; c++)
+					{
+						if (field[base+corner[c]]<isolevel) cubeindex|=1<<c;
+					}
+
+					// Cube is entirely in/out of the surface 
+					if (ImplicitSurfaceEdges[cubeindex]==0) continue;
+
+					for (int i=0; ImplicitSurfaceTriangles[cubeindex][i]!=-1; i++)
+					{
+						int e=ImplicitSurfaceTriangles[cubeindex][i];
+						out.push_back(blob.m_EdgeVerts[ImplicitSurfaceEdgeAxis[e]][base+edge[e]]);
+					}
+				}
+			}
+		}
+	}
+
+private:
+	BlobbyPrimitive &m_Blob;
+	float m_Isolevel;
+};
+
+void BlobbyPrimitive::Extract(float isolevel, bool colour)
+{
+	unsigned int points=m_Field.size();
+	for (int axis=0; axis<3; axis++)
+	{
+		m_EdgeVerts[axis].resize(points);
+	}
+
+	// count the vertices on each plane to find where they go
+	m_PlaneVerts.resize(m_Width+1);
+	VertexTask count(*this,isolevel,colour,true);
+	ThreadPool::Run(count,m_Width+1,1);
+
+	unsigned int total=0;
+	for (unsigned int x=0; x<=m_Width; x++)
+	{
+		unsigned int n=m_PlaneVerts[x];
+		m_PlaneVerts[x]=total;
+		total+=n;
+	}
+
+	m_SurfacePoints.resize(total);
+	m_SurfaceNormals.resize(total);
+	if (colour) m_SurfaceColours.resize(total);
+	else m_SurfaceColours.clear();
+
+	VertexTask make(*this,isolevel,colour,false);
+	ThreadPool::Run(make,m_Width+1,1);
+
+	m_PlaneTriangles.resize(m_Width);
+	TriangleTask triangles(*this,isolevel);
+	ThreadPool::Run(triangles,m_Width,1);
+
+	m_SurfaceIndices.clear();
+	for (unsigned int x=0; x<m_Width; x++)
+	{
+		m_SurfaceIndices.insert(m_SurfaceIndices.end(),m_PlaneTriangles[x].begin(),m_PlaneTriangles[x].end());
+	}
+}
+
+void BlobbyPrimitive::UpdateSurface(float isolevel, bool colour)
+{
+	unsigned int version=GetDataVersion();
+	if (!m_SurfaceDirty && version==m_SurfaceVersion && 
+		isolevel==m_SurfaceIsolevel && colour==m_SurfaceColour)
+	{
+		return;
+	}
+
+	// the influences reach further for lower isolevels
+	m_FieldCutoff=FieldCutoff(isolevel);
+	if (m_LockVoxels) GatherField(colour);
+	else UpdateField(colour);
+
+	Extract(isolevel,colour);
+
+	m_SurfaceVersion=version;
+	m_SurfaceIsolevel=isolevel;
+	m_SurfaceColour=colour;
+	m_SurfaceDirty=false;
+
+	// the box is the surface's now, rather than the influences
+	DirtyBounds();
 }
 
 void BlobbyPrimitive::Render()
 {
+	bool colour=m_State.Hints & HINT_VERTCOLS;
+	UpdateSurface(1,colour);
+	if (m_SurfaceIndices.empty()) return;
 
-    if (!m_LockVoxels)
-    {
-        for (unsigned int i=0; i<m_Voxels.size(); i++)
-        {
-            for (int c=0; c<8; c++)
-            {
-                dVector pos = m_Voxels[i].p[c];
-                
-                if (m_State.Hints & HINT_VERTCOLS)
-                {
-                    m_Voxels[i].val[c]=SampleCol(pos,m_Voxels[i].col[c]);
-                }
-                else
-                {
-                    m_Voxels[i].val[c]=Sample(pos);
-                }
-            }
-        }
-    }
+	glVertexPointer(3,GL_FLOAT,sizeof(dVector),&m_SurfacePoints[0]);
+	glNormalPointer(GL_FLOAT,sizeof(dVector),&m_SurfaceNormals[0]);
+	glDisableClientState(GL_TEXTURE_COORD_ARRAY);
 
 	if (m_State.Hints & HINT_SPHERE_MAP)
 	{
@@ -173,9 +742,13 @@ void BlobbyPrimitive::Render()
 
 	if (m_State.Hints & HINT_SOLID)
 	{
-		glBegin(GL_TRIANGLES);
-		Draw(1, true, m_State.Hints & HINT_VERTCOLS);
-		glEnd();
+		if (colour)
+		{
+			glEnableClientState(GL_COLOR_ARRAY);
+			glColorPointer(4,GL_FLOAT,sizeof(dColour),&m_SurfaceColours[0]);
+		}
+		glDrawElements(GL_TRIANGLES,m_SurfaceIndices.size(),GL_UNSIGNED_INT,&m_SurfaceIndices[0]);
+		glDisableClientState(GL_COLOR_ARRAY);
 	}
 
 	if (m_State.Hints & HINT_WIRE)
@@ -189,9 +762,7 @@ void BlobbyPrimitive::Render()
 			glEnable(GL_LINE_STIPPLE);
 			glLineStipple(m_State.StippleFactor, m_State.StipplePattern);
 		}
-		glBegin(GL_TRIANGLES);
-		Draw(1, false, false);
-		glEnd();
+		glDrawElements(GL_TRIANGLES,m_SurfaceIndices.size(),GL_UNSIGNED_INT,&m_SurfaceIndices[0]);
 		glPolygonMode(GL_FRONT_AND_BACK,GL_FILL);
 		glEnable(GL_LIGHTING);
 		if ((m_State.Hints & HINT_WIRE_STIPPLED) > HINT_WIRE)
@@ -205,6 +776,8 @@ void BlobbyPrimitive::Render()
 		glDisable(GL_TEXTURE_GEN_S);
 		glDisable(GL_TEXTURE_GEN_T);
 	}
+
+	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
 }
 
 void BlobbyPrimitive::RecalculateNormals(bool smooth)
@@ -215,6 +788,17 @@ void BlobbyPrimitive::RecalculateNormals(bool smooth)
 dBoundingBox BlobbyPrimitive::GetBoundingBox(const dMatrix &space)
 {	
 	dBoundingBox box;
+
+	// the surface reaches past the influences, so use it if it's up to date
+	if (!m_SurfaceDirty && m_SurfaceVersion==GetDataVersion() && !m_SurfacePoints.empty())
+	{
+		for (vector<dVector>::iterator i=m_SurfacePoints.begin(); i!=m_SurfacePoints.end(); ++i)
+		{
+			box.expand(space.transform(*i));
+		}
+		return box;
+	}
+
 	for (vector<dVector,FLX_ALLOC(dVector) >::iterator i=m_PosData->begin(); i!=m_PosData->end(); ++i)
 	{
 		box.expand(space.transform(*i));
@@ -241,288 +825,36 @@ void BlobbyPrimitive::ApplyTransform(bool ScaleRotOnly)
 	}
 	
 	GetState()->Transform.init();
-}
-
-// this implicit surface implementation is modified from Paul Bourke's which can be found here:
-// http://astronomy.swin.edu.au/~pbourke/modelling/polygonise/
-
-void BlobbyPrimitive::Draw(float isolevel, bool calcnormals, bool colour)
-{
-   int i;
-   int cubeindex;
-   dVertex vertlist[12];
-
-	for (unsigned int cell=0; cell<m_Voxels.size(); cell++)
-	{ 
-		//  Determine the index into the edge table which
-		//  tells us which vertices are inside of the surface
-		cubeindex = 0;
-		if (m_Voxels[cell].val[0] < isolevel) cubeindex |= 1;
-		if (m_Voxels[cell].val[1] < isolevel) cubeindex |= 2;
-		if (m_Voxels[cell].val[2] < isolevel) cubeindex |= 4;
-		if (m_Voxels[cell].val[3] < isolevel) cubeindex |= 8;
-		if (m_Voxels[cell].val[4] < isolevel) cubeindex |= 16;
-		if (m_Voxels[cell].val[5] < isolevel) cubeindex |= 32;
-		if (m_Voxels[cell].val[6] < isolevel) cubeindex |= 64;
-		if (m_Voxels[cell].val[7] < isolevel) cubeindex |= 128;
-
-		// Cube is entirely in/out of the surface 
-		if (ImplicitSurfaceEdges[cubeindex] != 0)
-		{
-
-			// Find the vertices where the surface intersects the cube
-			if (ImplicitSurfaceEdges[cubeindex] & 1) Interpolate(vertlist[0],isolevel,cell,0,1);
-			if (ImplicitSurfaceEdges[cubeindex] & 2) Interpolate(vertlist[1],isolevel,cell,1,2);
-			if (ImplicitSurfaceEdges[cubeindex] & 4) Interpolate(vertlist[2],isolevel,cell,2,3);
-			if (ImplicitSurfaceEdges[cubeindex] & 8) Interpolate(vertlist[3],isolevel,cell,3,0);
-			if (ImplicitSurfaceEdges[cubeindex] & 16) Interpolate(vertlist[4],isolevel,cell,4,5);
-			if (ImplicitSurfaceEdges[cubeindex] & 32) Interpolate(vertlist[5],isolevel,cell,5,6);
-			if (ImplicitSurfaceEdges[cubeindex] & 64) Interpolate(vertlist[6],isolevel,cell,6,7);
-			if (ImplicitSurfaceEdges[cubeindex] & 128) Interpolate(vertlist[7],isolevel,cell,7,4);
-			if (ImplicitSurfaceEdges[cubeindex] & 256) Interpolate(vertlist[8],isolevel,cell,0,4);
-			if (ImplicitSurfaceEdges[cubeindex] & 512) Interpolate(vertlist[9],isolevel,cell,1,5);
-			if (ImplicitSurfaceEdges[cubeindex] & 1024) Interpolate(vertlist[10],isolevel,cell,2,6);
-			if (ImplicitSurfaceEdges[cubeindex] & 2048) Interpolate(vertlist[11],isolevel,cell,3,7);
-
-			// Create the triangle 
-			for (i=0; ImplicitSurfaceTriangles[cubeindex][i]!=-1; i+=3) 
-			{
-				dVertex a=vertlist[ImplicitSurfaceTriangles[cubeindex][i]];
-				dVertex b=vertlist[ImplicitSurfaceTriangles[cubeindex][i+1]];
-				dVertex c=vertlist[ImplicitSurfaceTriangles[cubeindex][i+2]];
-			
-				dVector normal;
-				float val=0;
-				
-				if (calcnormals)
-   				{
-					val=Sample(a.point);
-					normal.x=val-Sample(a.point+dVector(0.001,0,0));
-					normal.y=val-Sample(a.point+dVector(0,0.001,0));
-					normal.z=val-Sample(a.point+dVector(0,0,0.001));
-					normal.normalise();
-					glNormal3fv(normal.arr());
-				}
-				
-				if (colour) glColor3fv(a.col.arr());
-   				glVertex3fv(a.point.arr());
-				
-				if (calcnormals)
-   				{
-					val=Sample(b.point);
-					normal.x=val-Sample(b.point+dVector(0.001,0,0));
-					normal.y=val-Sample(b.point+dVector(0,0.001,0));
-					normal.z=val-Sample(b.point+dVector(0,0,0.001));
-					normal.normalise();
-					glNormal3fv(normal.arr());
-				}
-				
- 				if (colour) glColor3fv(b.col.arr());
-				glVertex3fv(b.point.arr());
-				
-				if (calcnormals)
-   				{
-					val=Sample(c.point);
-					normal.x=val-Sample(c.point+dVector(0.001,0,0));
-					normal.y=val-Sample(c.point+dVector(0,0.001,0));
-					normal.z=val-Sample(c.point+dVector(0,0,0.001));
-					normal.normalise();
-					glNormal3fv(normal.arr());
-				}
-				
-				if (colour) glColor3fv(c.col.arr());
-				glVertex3fv(c.point.arr());
-			}
-		}
-	}
+	m_SurfaceDirty=true;
+	DirtyBounds();
 }
 
 // generate a poly mesh
 void BlobbyPrimitive::ConvertToPoly(PolyPrimitive &poly, float isolevel)
 {
-	if (!m_LockVoxels)
+	bool colour=m_State.Hints & HINT_VERTCOLS;
+	UpdateSurface(isolevel,colour);
+
+	unsigned int count=m_SurfacePoints.size();
+	poly.Resize(count);
+	vector<dVector,FLX_ALLOC(dVector) > *points=poly.GetDataVec<dVector>("p");
+	vector<dVector,FLX_ALLOC(dVector) > *normals=poly.GetDataVec<dVector>("n");
+	for (unsigned int i=0; i<count; i++)
 	{
-		// evaluate the field
-		for (unsigned int i=0; i<m_Voxels.size(); i++)
-		{
-			for (int c=0; c<8; c++)
-			{
-				dVector pos = m_Voxels[i].p[c];
-
-				if (m_State.Hints & HINT_VERTCOLS)
-				{
-					m_Voxels[i].val[c]=SampleCol(pos,m_Voxels[i].col[c]);
-				}
-				else
-				{
-					m_Voxels[i].val[c]=Sample(pos);
-				}
-			}
-		}
+		(*points)[i]=m_SurfacePoints[i];
+		(*normals)[i]=m_SurfaceNormals[i];
 	}
 
-	int i;
-	int cubeindex;
-	dVertex vertlist[12];
-	dVector grads[12]; // gradient calculated from field values
-
-	for (unsigned int cell=0; cell<m_Voxels.size(); cell++)
+	if (colour)
 	{
-		//  Determine the index into the edge table which
-		//  tells us which vertices are inside of the surface
-		cubeindex = 0;
-		if (m_Voxels[cell].val[0] < isolevel) cubeindex |= 1;
-		if (m_Voxels[cell].val[1] < isolevel) cubeindex |= 2;
-		if (m_Voxels[cell].val[2] < isolevel) cubeindex |= 4;
-		if (m_Voxels[cell].val[3] < isolevel) cubeindex |= 8;
-		if (m_Voxels[cell].val[4] < isolevel) cubeindex |= 16;
-		if (m_Voxels[cell].val[5] < isolevel) cubeindex |= 32;
-		if (m_Voxels[cell].val[6] < isolevel) cubeindex |= 64;
-		if (m_Voxels[cell].val[7] < isolevel) cubeindex |= 128;
-
-		// Cube is entirely in/out of the surface
-		if (ImplicitSurfaceEdges[cubeindex] != 0)
+		vector<dColour,FLX_ALLOC(dColour) > *colours=poly.GetDataVec<dColour>("c");
+		for (unsigned int i=0; i<count; i++)
 		{
-			// Find the vertices where the surface intersects the cube
-			if (ImplicitSurfaceEdges[cubeindex] & 1) Interpolate(vertlist[0], grads[0], isolevel, cell, 0, 1);
-			if (ImplicitSurfaceEdges[cubeindex] & 2) Interpolate(vertlist[1], grads[1], isolevel, cell, 1, 2);
-			if (ImplicitSurfaceEdges[cubeindex] & 4) Interpolate(vertlist[2], grads[2], isolevel, cell, 2, 3);
-			if (ImplicitSurfaceEdges[cubeindex] & 8) Interpolate(vertlist[3], grads[3], isolevel, cell, 3, 0);
-			if (ImplicitSurfaceEdges[cubeindex] & 16) Interpolate(vertlist[4], grads[4], isolevel, cell, 4, 5);
-			if (ImplicitSurfaceEdges[cubeindex] & 32) Interpolate(vertlist[5], grads[5], isolevel, cell, 5, 6);
-			if (ImplicitSurfaceEdges[cubeindex] & 64) Interpolate(vertlist[6], grads[6], isolevel, cell, 6, 7);
-			if (ImplicitSurfaceEdges[cubeindex] & 128) Interpolate(vertlist[7], grads[7], isolevel, cell, 7, 4);
-			if (ImplicitSurfaceEdges[cubeindex] & 256) Interpolate(vertlist[8], grads[8], isolevel, cell, 0, 4);
-			if (ImplicitSurfaceEdges[cubeindex] & 512) Interpolate(vertlist[9], grads[9], isolevel, cell, 1, 5);
-			if (ImplicitSurfaceEdges[cubeindex] & 1024) Interpolate(vertlist[10], grads[10], isolevel, cell, 2, 6);
-			if (ImplicitSurfaceEdges[cubeindex] & 2048) Interpolate(vertlist[11], grads[11], isolevel, cell, 3, 7);
-
-			// Create the triangle
-			for (i=0; ImplicitSurfaceTriangles[cubeindex][i]!=-1; i+=3)
-			{
-				int idxa = ImplicitSurfaceTriangles[cubeindex][i];
-				int idxb = ImplicitSurfaceTriangles[cubeindex][i + 1];
-				int idxc = ImplicitSurfaceTriangles[cubeindex][i + 2];
-				dVertex a=vertlist[idxa];
-				dVertex b=vertlist[idxb];
-				dVertex c=vertlist[idxc];
-
-				dVector normal;
-				float val=0;
-
-				if (m_LockVoxels) // when converted from voxels use the cell gradient
-				{
-					normal = grads[idxa];
-				}
-				else
-				{
-					val=Sample(a.point);
-					normal.x=val-Sample(a.point+dVector(0.001,0,0));
-					normal.y=val-Sample(a.point+dVector(0,0.001,0));
-					normal.z=val-Sample(a.point+dVector(0,0,0.001));
-					normal.normalise();
-				}
-
-				poly.AddVertex(dVertex(a.point,normal,a.col));
-
-				if (m_LockVoxels)
-				{
-					normal = grads[idxb];
-				}
-				else
-				{
-					val=Sample(b.point);
-					normal.x=val-Sample(b.point+dVector(0.001,0,0));
-					normal.y=val-Sample(b.point+dVector(0,0.001,0));
-					normal.z=val-Sample(b.point+dVector(0,0,0.001));
-					normal.normalise();
-				}
-
-				poly.AddVertex(dVertex(b.point,normal,b.col));
-
-				if (m_LockVoxels)
-				{
-					normal = grads[idxc];
-				}
-				else
-				{
-					val=Sample(c.point);
-					normal.x=val-Sample(c.point+dVector(0.001,0,0));
-					normal.y=val-Sample(c.point+dVector(0,0.001,0));
-					normal.z=val-Sample(c.point+dVector(0,0,0.001));
-					normal.normalise();
-				}
-
-				poly.AddVertex(dVertex(c.point,normal,c.col));
-			}
+			(*colours)[i]=m_SurfaceColours[i];
 		}
 	}
-}
-
-//   Linearly interpolate the position where an isosurface cuts
-//   an edge between two vertices, each with their own scalar value
-void BlobbyPrimitive::Interpolate(dVertex &vert, float isolevel, int cell, int a, int b)
-{
-	float mu;
-
-	dVector posa = m_Voxels[cell].p[a];
-	dVector posb = m_Voxels[cell].p[b];
-	dColour cola = m_Voxels[cell].col[a];
-	dColour colb = m_Voxels[cell].col[b];
-	float vala = m_Voxels[cell].val[a];
-	float valb = m_Voxels[cell].val[b];
-
-	mu = (isolevel - vala) / (valb - vala);
-	vert.point.x = posa.x + mu * (posb.x - posa.x);
-	vert.point.y = posa.y + mu * (posb.y - posa.y);
-	vert.point.z = posa.z + mu * (posb.z - posa.z);
-
-	vert.col.r = cola.r + mu * (colb.r - cola.r);
-	vert.col.g = cola.g + mu * (colb.g - cola.g);
-	vert.col.b = cola.b + mu * (colb.b - cola.b);
-}
-
-inline float BlobbyPrimitive::SafeVal(int cell, int a)
-{
-	if ((cell >= 0) && ((unsigned)cell < m_Voxels.size()))
-	{
-		return m_Voxels[cell].val[a];
-	}
-	else
-	{
-		return 0;
-	}
-}
 
-// Same as above, but also calculate the gradient
-void BlobbyPrimitive::Interpolate(dVertex &vert, dVector &grad, float isolevel, int cell, int a, int b)
-{
-	float mu;
-
-	dVector posa = m_Voxels[cell].p[a];
-	dVector posb = m_Voxels[cell].p[b];
-	dColour cola = m_Voxels[cell].col[a];
-	dColour colb = m_Voxels[cell].col[b];
-	float vala = m_Voxels[cell].val[a];
-	float valb = m_Voxels[cell].val[b];
-
-	dVector grada(SafeVal(cell - m_Depth * m_Height, a) - SafeVal(cell + m_Depth * m_Height, a),
-				  SafeVal(cell - m_Depth, a) - SafeVal(cell + m_Depth, a),
-				  SafeVal(cell - 1, a) - SafeVal(cell + 1, a));
-	dVector gradb(SafeVal(cell - m_Depth * m_Height, b) - SafeVal(cell + m_Depth * m_Height, b),
-				  SafeVal(cell - m_Depth, b) - SafeVal(cell + m_Depth, b),
-				  SafeVal(cell - 1, b) - SafeVal(cell + 1, b));
-
-	mu = (isolevel - vala) / (valb - vala);
-	vert.point.x = posa.x + mu * (posb.x - posa.x);
-	vert.point.y = posa.y + mu * (posb.y - posa.y);
-	vert.point.z = posa.z + mu * (posb.z - posa.z);
-
-	vert.col.r = cola.r + mu * (colb.r - cola.r);
-	vert.col.g = cola.g + mu * (colb.g - cola.g);
-	vert.col.b = cola.b + mu * (colb.b - cola.b);
-
-	grad = lerp(grada, gradb, mu);
-	grad.normalise();
+	poly.SetIndexMode(true);
+	poly.GetIndex()=m_SurfaceIndices;
+	poly.InvalidateTopology();
 }
-
@@ -55,8 +55,12 @@ public:
 	/// The strength corresponds to the size of the 'blob'.
 	virtual void AddInfluence(const dVector &Vert, float Strength);
 
-	/// Fills supplied polygon primitive with the mesh
-	/// (needs to be an empty triangle list)
+	/// Fills supplied polygon primitive with the mesh, as an
+	/// indexed triangle list with the vertices shared between
+	/// neighbouring triangles (needs to be an empty triangle list).
+	/// Influences are left out where they add less than a thousandth
+	/// of the isolevel, isolevels nearer 0 than 0.001 are treated as
+	/// 0.001 for this, which only matters if the strengths are tiny
 	void ConvertToPoly(PolyPrimitive &poly, float isolevel=1.0f);
 
 	class Cell
@@ -67,18 +71,34 @@ public:
 		dColour col[8];
 	};
 
-	vector<Cell> &GetVoxels() { return m_Voxels; }
+	/// The cells, for setting the field directly
+	vector<Cell> &GetVoxels();
 
-    void LockVoxels() { m_LockVoxels=true; }
+	/// Stops the influences overwriting the field set in the cells
+	void LockVoxels();
 
 protected:
 
-	void Draw(float isolevel, bool calcnormals, bool colour);
-	void Interpolate(dVertex &vert, float isolevel, int cell, int a, int b);
-	void Interpolate(dVertex &vert, dVector &grad, float isolevel, int cell, int a, int b);
-	float Sample(const dVector &pos);
-	float SampleCol(const dVector &pos, dColour &col);
-	inline float SafeVal(int cell, int a);
+	class FieldTask;
+	class VertexTask;
+	class TriangleTask;
+
+	/// Works out the field (and colour) once at each grid point
+	void UpdateField(bool colour);
+	/// Copies the field from the cell corners to the grid points
+	void GatherField(bool colour);
+	/// Lists the influences that reach into each brick of the grid
+	void BucketInfluences();
+	/// Makes the surface from the field at the grid points
+	void Extract(float isolevel, bool colour);
+	/// Extracts the surface again if the field has changed since
+	void UpdateSurface(float isolevel, bool colour);
+
+	/// The influences that could reach this position, NULL
+	/// and the number of them all if it could be any of them
+	const unsigned int *Influences(const dVector &pos, unsigned int &count);
+	/// The surface normal from the influences
+	dVector Normal(const dVector &pos);
 
 	virtual void PDataDirty();
 
@@ -90,6 +110,39 @@ protected:
 	unsigned m_Width;
 	unsigned m_Height;
 	unsigned m_Depth;
+	dVector m_CellSize;
+
+	// the field at the grid points, z fastest, then y, then x
+	vector<float> m_Field;
+	vector<dColour> m_FieldCol;
+
+	// the influences reaching into each brick, in order, brick
+	// n's are from m_BrickStart[n] up to m_BrickStart[n+1]
+	unsigned m_BricksX;
+	unsigned m_BricksY;
+	unsigned m_BricksZ;
+	vector<unsigned int> m_BrickStart;
+	vector<unsigned int> m_BrickInfluences;
+	// influences are left out where they add less than this
+	// to the field, set from the isolevel it's made for
+	float m_FieldCutoff;
+
+	// the surface, drawn with the vertex arrays
+	vector<dVector> m_SurfacePoints;
+	vector<dVector> m_SurfaceNormals;
+	vector<dColour> m_SurfaceColours;
+	vector<unsigned int> m_SurfaceIndices;
+	// the vertex on each edge of the grid cut by the surface, for
+	// the edges along x, y and z from each grid point
+	vector<unsigned int> m_EdgeVerts[3];
+	// the first vertex on each x plane of grid points
+	vector<unsigned int> m_PlaneVerts;
+	vector<vector<unsigned int> > m_PlaneTriangles;
+	// what the surface was made from
+	unsigned int m_SurfaceVersion;
+	float m_SurfaceIsolevel;
+	bool m_SurfaceColour;
+	bool m_SurfaceDirty;
 
     bool m_LockVoxels;
 };
@@ -0,0 +1,99 @@
+// Copyright (C) 2010 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#include <algorithm>
+#include "Connectivity.h"
+
+using namespace Fluxus;
+
+void Connectivity::AddRow(const int *items, unsigned int count)
+{
+	if (m_Offsets.empty()) m_Offsets.push_back(0);
+	m_Items.insert(m_Items.end(),items,items+count);
+	m_Offsets.push_back(m_Items.size());
+}
+
+/////////////////////////////////////////////////////////////
+
+static inline unsigned int CellHash(long long x, long long y, long long z)
+{
+	unsigned long long h=(unsigned long long)x*73856093ULL ^
+	                     (unsigned long long)y*19349663ULL ^
+	                     (unsigned long long)z*83492791ULL;
+	return (unsigned int)(h^(h>>32));
+}
+
+void Fluxus::FindCoincidentPoints(const dVector *points, unsigned int count, Connectivity &out, float epsilon)
+{
+	out.Clear();
+	if (count==0) return;
+
+	// points within epsilon of each other are at most one cell apart
+	double inv=1/(double)epsilon;
+	vector<long long> cells(count*3);
+	for (unsigned int i=0; i<count; i++)
+	{
+		cells[i*3]=(long long)floor(points[i].x*inv);
+		cells[i*3+1]=(long long)floor(points[i].y*inv);
+		cells[i*3+2]=(long long)floor(points[i].z*inv);
+	}
+
+	unsigned int size=1;
+	while (size<count*2) size<<=1;
+	unsigned int mask=size-1;
+
+	// counting sort the points into hash buckets
+	vector<unsigned int> start(size+1,0);
+	vector<unsigned int> bucket(count);
+	for (unsigned int i=0; i<count; i++)
+	{
+		bucket[i]=CellHash(cells[i*3],cells[i*3+1],cells[i*3+2])&mask;
+		start[bucket[i]+1]++;
+	}
+	for (unsigned int b=0; b<size; b++) start[b+1]+=start[b];
+	vector<unsigned int> order(count);
+	vector<unsigned int> fill(start.begin(),start.end()-1);
+	for (unsigned int i=0; i<count; i++) order[fill[bucket[i]]++]=i;
+
+	vector<int> row;
+	for (unsigned int i=0; i<count; i++)
+	{
+		row.clear();
+		const long long *c=&cells[i*3];
+		for (int dx=-1; dx<=1; dx++)
+		for (int dy=-1; dy<=1; dy++)
+		for (int dz=-1; dz<=1; dz++)
+		{
+			long long x=c[0]+dx, y=c[1]+dy, z=c[2]+dz;
+			unsigned int b=CellHash(x,y,z)&mask;
+			for (unsigned int k=start[b]; k<start[b+1]; k++)
+			{
+				unsigned int j=order[k];
+				// check the cell too, so a bucket shared by 
+				// several neighbour cells is only counted once
+				if (j!=i && cells[j*3]==x && cells[j*3+1]==y && cells[j*3+2]==z &&
+					fabs(points[i].x-points[j].x)<epsilon &&
+					fabs(points[i].y-points[j].y)<epsilon &&
+					fabs(points[i].z-points[j].z)<epsilon)
+				{
+					row.push_back(j);
+				}
+			}
+		}
+		sort(row.begin(),row.end());
+		out.AddRow(row.empty()?NULL:&row[0],row.size());
+	}
+}
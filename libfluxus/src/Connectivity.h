@@ -0,0 +1,61 @@
+// Copyright (C) 2010 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#ifndef N_CONNECTIVITY
+#define N_CONNECTIVITY
+
+#include <vector>
+#include "dada.h"
+
+using namespace std;
+
+namespace Fluxus
+{
+
+//////////////////////////////////////////////////////
+/// A list of lists of ints stored as two flat arrays 
+/// (compressed sparse rows) rather than a vector per 
+/// row, row i is the range Begin(i) to End(i).
+class Connectivity
+{
+public:
+	Connectivity() {}
+
+	void Clear() { m_Offsets.clear(); m_Items.clear(); }
+	bool Empty() const { return Size()==0; }
+	unsigned int Size() const { return m_Offsets.empty()?0:m_Offsets.size()-1; }
+
+	unsigned int Count(unsigned int row) const { return m_Offsets[row+1]-m_Offsets[row]; }
+	const int *Begin(unsigned int row) const { return m_Items.empty()?NULL:&m_Items[0]+m_Offsets[row]; }
+	const int *End(unsigned int row) const { return m_Items.empty()?NULL:&m_Items[0]+m_Offsets[row+1]; }
+
+	/// Rows are added in order
+	void AddRow(const int *items, unsigned int count);
+
+private:
+	vector<unsigned int> m_Offsets;
+	vector<int> m_Items;
+};
+
+/// Fills out with a row per point listing all the other points 
+/// within epsilon of it on each axis (the dVector::feq test), 
+/// sorted. Uses a hashed grid of epsilon sized cells so it's 
+/// linear in the number of points, rather than comparing them all.
+void FindCoincidentPoints(const dVector *points, unsigned int count, Connectivity &out, float epsilon=0.001);
+
+}
+
+#endif
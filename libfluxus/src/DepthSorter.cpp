@@ -29,37 +29,39 @@ DepthSorter::~DepthSorter()
 void DepthSorter::Clear()
 {
 	m_RenderList.clear();
+	m_Sorter.Clear();
 }
 
 void DepthSorter::Add(const dMatrix &globaltransform, Primitive *prim, int id)
 {
-	Item item;
+	m_RenderList.push_back(Item());
+	Item &item=m_RenderList.back();
 	item.Prim=prim;
 	item.GlobalTransform=globaltransform;
 	item.ID=id;
 
-	dMatrix all=globaltransform*prim->GetState()->Transform;
-	dVector pos=all.transform(dVector(0,0,0));
-	item.Depth=pos.z;
-	m_RenderList.push_back(item);
+	// only need the origin, so transform that rather 
+	// than concatenating the matrices
+	dVector pos=globaltransform.transform(prim->GetState()->Transform.transform(dVector(0,0,0)));
+	m_Sorter.Add(pos.z,m_RenderList.size()-1);
 }
 
 void DepthSorter::Render()
 {
-	m_RenderList.sort();
+	const vector<unsigned int> &order=m_Sorter.Sort();
 
-	for(list<Item>::iterator i=m_RenderList.begin(); i!=m_RenderList.end(); i++)
+	for(vector<unsigned int>::const_iterator i=order.begin(); i!=order.end(); ++i)
 	{
+		Item &item=m_RenderList[*i];
 		glPushMatrix();
-		glPushName(i->ID);
+		glPushName(item.ID);
 		glLoadIdentity();
-		glMultMatrixf(i->GlobalTransform.arr());
-		i->Prim->ApplyState();
-		i->Prim->Prerender();
-		i->Prim->Render();
-		i->Prim->UnapplyState();
+		glMultMatrixf(item.GlobalTransform.arr());
+		item.Prim->ApplyState();
+		item.Prim->Prerender();
+		item.Prim->Render();
+		item.Prim->UnapplyState();
 		glPopName();
 		glPopMatrix();
 	}
 }
-
@@ -25,7 +25,7 @@
 #define N_DEPTHSORTER
 
 #include "Primitive.h"
-#include <list>
+#include "RadixSort.h"
 
 namespace Fluxus
 {
@@ -56,16 +56,13 @@ private:
 	public:
 		Primitive *Prim;
 		dMatrix GlobalTransform;
-		float Depth;
 		int ID;
-		
-		bool operator<(const Item &other) const
-		{
-			return Depth<other.Depth;
-		}
 	};
 
-	list<Item> m_RenderList;
+	// kept between frames, so we don't allocate
+	// once they've grown big enough
+	vector<Item> m_RenderList;
+	RadixSort m_Sorter;
 };
 
 };
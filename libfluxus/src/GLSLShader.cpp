@@ -395,4 +395,14 @@ void GLSLShader::SetColourAttrib(const string &name, const vector<dColour,FLX_AL
 	#endif
 }
 
+int GLSLShader::GetAttribLocation(const string &name)
+{
+	#ifdef GLSL
+	if (!m_Enabled) return -1;
+	return glGetAttribLocation(m_Program, name.c_str());
+	#else
+	return -1;
+	#endif
+}
+
 
@@ -0,0 +1,110 @@
+// Copyright (C) 2010 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#include <algorithm>
+#include "HalfEdge.h"
+
+using namespace Fluxus;
+
+// an edge keyed by its welded end points, lowest first, 
+// so both halves sort next to each other
+struct EdgeKey
+{
+	int Lo,Hi,Edge;
+	bool Forward;
+	bool operator<(const EdgeKey &other) const
+	{
+		if (Lo!=other.Lo) return Lo<other.Lo;
+		if (Hi!=other.Hi) return Hi<other.Hi;
+		return Edge<other.Edge;
+	}
+};
+
+void HalfEdgeMesh::Clear()
+{
+	m_Edges.clear();
+	m_FaceStart.clear();
+	m_CornerEdge.clear();
+}
+
+void HalfEdgeMesh::Build(const Connectivity &faces, const vector<int> &weld)
+{
+	Clear();
+	
+	m_FaceStart.push_back(0);
+	for (unsigned int f=0; f<faces.Size(); f++)
+	{
+		for (const int *c=faces.Begin(f); c!=faces.End(f); c++)
+		{
+			HalfEdge e;
+			e.Vert=*c;
+			e.Opposite=-1;
+			e.Face=f;
+			if (*c>=(int)m_CornerEdge.size()) m_CornerEdge.resize(*c+1,-1);
+			m_CornerEdge[*c]=m_Edges.size();
+			m_Edges.push_back(e);
+		}
+		m_FaceStart.push_back(m_Edges.size());
+	}
+
+	vector<EdgeKey> keys;
+	keys.reserve(m_Edges.size());
+	for (unsigned int e=0; e<m_Edges.size(); e++)
+	{
+		int a=weld[Vert(e)];
+		int b=weld[EndVert(e)];
+		// skip degenerate edges
+		if (a==b) continue;
+		EdgeKey key;
+		key.Lo=min(a,b);
+		key.Hi=max(a,b);
+		key.Edge=e;
+		key.Forward=a<b;
+		keys.push_back(key);
+	}
+	sort(keys.begin(),keys.end());
+	
+	// pair up the edges going in opposite directions, 
+	// any left over are non manifold and stay unpaired
+	unsigned int start=0;
+	while (start<keys.size())
+	{
+		unsigned int end=start+1;
+		while (end<keys.size() && keys[end].Lo==keys[start].Lo && keys[end].Hi==keys[start].Hi) end++;
+		
+		for (unsigned int i=start; i<end; i++)
+		{
+			if (m_Edges[keys[i].Edge].Opposite!=-1) continue;
+			for (unsigned int j=i+1; j<end; j++)
+			{
+				if (keys[j].Forward!=keys[i].Forward && m_Edges[keys[j].Edge].Opposite==-1)
+				{
+					m_Edges[keys[i].Edge].Opposite=keys[j].Edge;
+					m_Edges[keys[j].Edge].Opposite=keys[i].Edge;
+					break;
+				}
+			}
+		}
+
+		// faces with inconsistent winding still share the edge
+		if (end-start==2 && m_Edges[keys[start].Edge].Opposite==-1)
+		{
+			m_Edges[keys[start].Edge].Opposite=keys[start+1].Edge;
+			m_Edges[keys[start+1].Edge].Opposite=keys[start].Edge;
+		}
+		start=end;
+	}
+}
@@ -0,0 +1,89 @@
+// Copyright (C) 2010 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#ifndef N_HALFEDGE
+#define N_HALFEDGE
+
+#include <vector>
+#include "Connectivity.h"
+
+using namespace std;
+
+namespace Fluxus
+{
+
+//////////////////////////////////////////////////////
+/// A half edge structure over the faces of a polygon 
+/// primitive, giving constant time access to the next 
+/// and previous edges around a face, the opposite edge 
+/// and the faces either side of it. Edges refer to face 
+/// corners - vertices, or index positions if the 
+/// primitive is indexed.
+class HalfEdgeMesh
+{
+public:
+	HalfEdgeMesh() {}
+
+	/// Builds from a row of corners per face, in winding 
+	/// order. Corners with the same weld id are treated as 
+	/// the same point when matching up opposite edges.
+	void Build(const Connectivity &faces, const vector<int> &weld);
+	void Clear();
+	bool Empty() const { return m_Edges.empty(); }
+
+	unsigned int NumEdges() const { return m_Edges.size(); }
+	unsigned int NumFaces() const { return m_FaceStart.empty()?0:m_FaceStart.size()-1; }
+
+	/// The corner the edge starts from
+	int Vert(int e) const { return m_Edges[e].Vert; }
+	/// The corner the edge ends at
+	int EndVert(int e) const { return m_Edges[Next(e)].Vert; }
+	int Next(int e) const { return e+1==(int)m_FaceStart[Face(e)+1]?m_FaceStart[Face(e)]:e+1; }
+	int Prev(int e) const { return e==(int)m_FaceStart[Face(e)]?m_FaceStart[Face(e)+1]-1:e-1; }
+	/// The same edge in the neighbouring face, normally going
+	/// the other way, -1 for edges on a border (or a non 
+	/// manifold edge)
+	int Opposite(int e) const { return m_Edges[e].Opposite; }
+	bool IsBorder(int e) const { return m_Edges[e].Opposite==-1; }
+	int Face(int e) const { return m_Edges[e].Face; }
+
+	/// The first edge around a face
+	int FaceEdge(int f) const { return m_FaceStart[f]; }
+	unsigned int FaceSize(int f) const { return m_FaceStart[f+1]-m_FaceStart[f]; }
+	/// The face across an edge, or -1
+	int AdjacentFace(int e) const { return IsBorder(e)?-1:Face(Opposite(e)); }
+
+	/// An edge starting at a corner (the last one built, for 
+	/// corners shared by faces in strips and fans), or -1 if 
+	/// the corner isn't part of a face
+	int CornerEdge(int c) const { return c<(int)m_CornerEdge.size()?m_CornerEdge[c]:-1; }
+
+private:
+	struct HalfEdge
+	{
+		int Vert;
+		int Opposite;
+		int Face;
+	};
+
+	vector<HalfEdge> m_Edges;
+	vector<unsigned int> m_FaceStart;
+	vector<int> m_CornerEdge;
+};
+
+}
+
+#endif
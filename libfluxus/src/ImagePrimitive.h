@@ -38,6 +38,7 @@ public:
 	virtual void ApplyTransform(bool ScaleRotOnly=false);
 	virtual string GetTypeName() { return "ImagePrimitive"; }
 	virtual Evaluator *MakeEvaluator() { return NULL; }
+	virtual bool RestoresGLState() { return false; }
 
 protected:
 
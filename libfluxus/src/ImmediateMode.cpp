@@ -41,24 +41,75 @@ void ImmediateMode::Add(Primitive *p, State *s, bool del /* = false */)
 void ImmediateMode::Render(unsigned int CamIndex, ShadowVolumeGen *shadowgen)
 {
 	///\todo: not using camera visibility in immediate mode...
-	for(vector<IMItem*>::iterator i=m_IMRecord.begin(); i!=m_IMRecord.end(); ++i)
+	vector<IMItem*>::iterator i=m_IMRecord.begin();
+	while (i!=m_IMRecord.end())
 	{
+		assert((*i)->m_Primitive!=NULL);
+
+		// find the run of calls drawing the same primitive with the
+		// same state bar transform and colour, these get batched up
+		// (shadow casters need generating one at a time)
+		vector<IMItem*>::iterator end=i+1;
+		if (!shadowgen || !((*i)->m_State.Hints & HINT_CAST_SHADOW))
+		{
+			while (end!=m_IMRecord.end() &&
+				   (*end)->m_Primitive==(*i)->m_Primitive &&
+				   (*end)->m_State.Instanceable((*i)->m_State))
+			{
+				++end;
+			}
+		}
+
+		if (end-i>1)
+		{
+			RenderInstances(i,end);
+			i=end;
+			continue;
+		}
+
 		glPushMatrix();
 		(*i)->m_State.Apply();
 		// need to set the state to the primitive to update the parts of the state the
 		// render call acts on. need to look at this.
-		assert((*i)->m_Primitive!=NULL);
 	    (*i)->m_Primitive->SetState(&(*i)->m_State);
 		(*i)->m_Primitive->Prerender();
 		(*i)->m_Primitive->Render();
 
 		if (shadowgen && (*i)->m_Primitive->GetState()->Hints & HINT_CAST_SHADOW)
 		{
-			shadowgen->Generate((*i)->m_Primitive);
+			shadowgen->Generate((*i)->m_Primitive,(*i)->m_State.Transform);
 		}
 		(*i)->m_State.Unapply();
 		glPopMatrix();
+		++i;
+	}
+}
+
+void ImmediateMode::RenderInstances(vector<IMItem*>::iterator begin, vector<IMItem*>::iterator end)
+{
+	m_Transforms.clear();
+	m_Colours.clear();
+	for (vector<IMItem*>::iterator i=begin; i!=end; ++i)
+	{
+		m_Transforms.push_back((*i)->m_State.Transform);
+		dColour colour=(*i)->m_State.Colour;
+		if ((*i)->m_State.Opacity != 1.0f) colour.a=(*i)->m_State.Opacity;
+		m_Colours.push_back(colour);
 	}
+
+	// apply the shared state without the transform, 
+	// the instances carry that
+	State &state=(*begin)->m_State;
+	state.Transform.init();
+
+	glPushMatrix();
+	state.Apply();
+	Primitive *prim=(*begin)->m_Primitive;
+	prim->SetState(&state);
+	prim->Prerender();
+	prim->RenderInstances(m_Transforms,m_Colours);
+	state.Unapply();
+	glPopMatrix();
 }
 
 void ImmediateMode::Clear()
@@ -47,7 +47,12 @@ private:
 		Primitive *m_Primitive;
 		bool m_DelPrim; // delete primitive on clear
 	};
+	void RenderInstances(vector<IMItem*>::iterator begin, vector<IMItem*>::iterator end);
+
 	vector<IMItem*> m_IMRecord;
+	// kept to save reallocating every frame
+	vector<dMatrix> m_Transforms;
+	vector<dColour> m_Colours;
 };
 
 }
@@ -46,6 +46,7 @@ public:
 	void SetBoundingBoxRadius(float s)
 	{
 		m_BoundingBoxRadius=s;
+		DirtyBounds();
 	}
 	
 protected:
@@ -0,0 +1,75 @@
+// Copyright (C) 2005 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifndef WIN32
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include "MappedFile.h"
+#include "Trace.h"
+
+using namespace Fluxus;
+using namespace std;
+
+#ifndef WIN32
+
+MappedFile *MappedFile::Open(const string &filename)
+{
+	int fd=open(filename.c_str(),O_RDONLY);
+	if (fd<0) return NULL;
+	
+	struct stat st;
+	if (fstat(fd,&st)!=0 || st.st_size==0)
+	{
+		close(fd);
+		return NULL;
+	}
+	
+	void *data=mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+	close(fd);
+	if (data==MAP_FAILED) 
+	{
+		Trace::Stream<<"MappedFile::Open: couldn't map "<<filename<<endl;
+		return NULL;
+	}
+	return new MappedFile((char*)data,st.st_size);
+}
+
+MappedFile::~MappedFile()
+{
+	munmap(m_Data,m_Size);
+}
+
+#else
+
+MappedFile *MappedFile::Open(const string &filename)
+{
+	return NULL;
+}
+
+MappedFile::~MappedFile()
+{
+}
+
+#endif
+
+void MappedFile::Release()
+{
+	if (--m_RefCount==0) delete this;
+}
@@ -0,0 +1,55 @@
+// Copyright (C) 2005 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#ifndef N_MAPPEDFILE
+#define N_MAPPEDFILE
+
+#include <string>
+
+namespace Fluxus
+{
+
+///////////////////////////////////////////////////
+/// A read only file mapped into memory, so big arrays 
+/// are paged in by the os rather than read and copied.
+/// It's reference counted by the pdata arrays using it
+/// (see TypedPData::Map), and unmapped when the last of 
+/// them lets go.
+class MappedFile
+{
+public:
+	/// Maps the whole file, or returns NULL. The file 
+	/// must not be truncated while mapped.
+	static MappedFile *Open(const std::string &filename);
+
+	void AddRef() { m_RefCount++; }
+	void Release();
+
+	const char *GetData() const { return m_Data; }
+	size_t GetSize() const { return m_Size; }
+
+private:
+	MappedFile(char *data, size_t size) : m_Data(data), m_Size(size), m_RefCount(1) {}
+	~MappedFile();
+
+	char *m_Data;
+	size_t m_Size;
+	int m_RefCount;
+};
+
+}
+
+#endif
@@ -0,0 +1,359 @@
+// Copyright (C) 2010 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifndef WIN32
+#include <unistd.h>
+#endif
+#include "MeshCache.h"
+#include "PolyPrimitive.h"
+#include "Trace.h"
+
+using namespace Fluxus;
+
+static const unsigned int CACHE_VERSION = 1;
+static const unsigned int CACHE_ENDIAN = 0x01020304;
+static const unsigned int MAX_NAME = 64;
+
+// the file starts with this, followed by the source path,
+// then each pdata array and the index, all padded to 16 bytes
+struct CacheHeader
+{
+	char Magic[4];
+	unsigned int Version;
+	unsigned int Endian;
+	unsigned int PolyType;
+	unsigned long long SourceSize;
+	long long SourceTime;
+	unsigned int PathLength;
+	unsigned int Indexed;
+	unsigned int VertCount;
+	unsigned int IndexCount;
+	unsigned int NumChannels;
+	unsigned int Pad[3];
+};
+
+struct CacheChannel
+{
+	char Name[MAX_NAME];
+	char Type;
+	char Pad[3];
+	unsigned int Size;
+	unsigned int ElementSize;
+	unsigned int Pad2;
+};
+
+static unsigned int Padded(unsigned int bytes)
+{
+	return (bytes+15)&~15;
+}
+
+static bool WritePadded(FILE *file, const void *data, unsigned int bytes)
+{
+	static const char zeros[16]={0};
+	if (bytes>0 && fwrite(data,bytes,1,file)!=1) return false;
+	unsigned int pad=Padded(bytes)-bytes;
+	return pad==0 || fwrite(zeros,pad,1,file)==1;
+}
+
+template<class T>
+static bool WriteChannel(FILE *file, const string &name, const PData *pd)
+{
+	const TypedPData<T> *data=dynamic_cast<const TypedPData<T>*>(pd);
+	if (data==NULL) return false;
+	
+	CacheChannel channel;
+	memset(&channel,0,sizeof(channel));
+	strncpy(channel.Name,name.c_str(),MAX_NAME-1);
+	channel.Type=PDataType<T>();
+	channel.Size=data->Size();
+	channel.ElementSize=sizeof(T);
+	return WritePadded(file,&channel,sizeof(channel)) &&
+	       WritePadded(file,data->View(),channel.Size*sizeof(T));
+}
+
+template<class T>
+static PData *ReadChannel(MappedFile *file, const char *src, unsigned int size)
+{
+	TypedPData<T> *data=new TypedPData<T>;
+	if (!data->Map(file,src-file->GetData(),size))
+	{
+		delete data;
+		return NULL;
+	}
+	return data;
+}
+
+static unsigned int ElementSize(char type)
+{
+	switch (type)
+	{
+		case 'v': return sizeof(dVector);
+		case 'c': return sizeof(dColour);
+		case 'f': return sizeof(float);
+		case 'm': return sizeof(dMatrix);
+		default: return 0;
+	}
+}
+
+// walks through the mapped file, checking we don't run off the end
+class CacheReader
+{
+public:
+	CacheReader(const char *data, unsigned long long size) : m_Data(data), m_Size(size), m_Pos(0) {}
+	
+	const char *Take(unsigned long long bytes)
+	{
+		unsigned long long padded=(bytes+15)&~15ULL;
+		if (m_Pos+padded>m_Size) return NULL;
+		const char *ret=m_Data+m_Pos;
+		m_Pos+=padded;
+		return ret;
+	}
+	
+private:
+	const char *m_Data;
+	unsigned long long m_Size;
+	unsigned long long m_Pos;
+};
+
+/////////////////////////////////////////////////////////////
+
+string MeshCache::m_Path = MeshCache::DefaultPath();
+
+string MeshCache::DefaultPath()
+{
+	const char *cache=getenv("XDG_CACHE_HOME");
+	if (cache!=NULL && cache[0]!=0) return string(cache)+"/fluxus/meshes";
+	const char *home=getenv("HOME");
+	if (home!=NULL && home[0]!=0) return string(home)+"/.cache/fluxus/meshes";
+	return "";
+}
+
+string MeshCache::CacheFile(const string &filename)
+{
+	// fnv-1a hash of the path, which is checked on reading
+	unsigned long long hash=14695981039346656037ULL;
+	for (unsigned int i=0; i<filename.size(); i++)
+	{
+		hash^=(unsigned char)filename[i];
+		hash*=1099511628211ULL;
+	}
+	char name[32];
+	snprintf(name,32,"%016llx.fxm",hash);
+	return m_Path+"/"+name;
+}
+
+#ifndef WIN32
+
+Primitive *MeshCache::Read(const string &filename)
+{
+	if (m_Path=="") return NULL;
+	
+	struct stat source;
+	if (stat(filename.c_str(),&source)!=0) return NULL;
+	
+	MappedFile *file=MappedFile::Open(CacheFile(filename));
+	if (file==NULL) return NULL;
+	
+	CacheReader reader(file->GetData(),file->GetSize());
+	const CacheHeader *header=(const CacheHeader*)reader.Take(sizeof(CacheHeader));
+	const char *path=header?reader.Take(header->PathLength):NULL;
+	
+	// is it the right file, and up to date?
+	if (header==NULL || memcmp(header->Magic,"FXMC",4)!=0 || 
+		header->Version!=CACHE_VERSION ||
+		header->Endian!=CACHE_ENDIAN ||
+		header->SourceSize!=(unsigned long long)source.st_size ||
+		header->SourceTime!=(long long)source.st_mtime ||
+		path==NULL || 
+		string(path,header->PathLength)!=filename)
+	{
+		file->Release();
+		return NULL;
+	}
+	
+	if (header->PolyType>PolyPrimitive::POLYGON)
+	{
+		Trace::Stream<<"MeshCache::Read: "<<CacheFile(filename)<<" is corrupt, ignoring it"<<endl;
+		file->Release();
+		return NULL;
+	}
+	
+	PolyPrimitive *prim=new PolyPrimitive((PolyPrimitive::Type)header->PolyType);
+	prim->Resize(header->VertCount);
+	
+	bool ok=true;
+	for (unsigned int c=0; c<header->NumChannels && ok; c++)
+	{
+		const CacheChannel *channel=(const CacheChannel*)reader.Take(sizeof(CacheChannel));
+		// every array must be the same length, or drawing reads past the end
+		if (channel==NULL || channel->Name[MAX_NAME-1]!=0 ||
+			channel->ElementSize!=ElementSize(channel->Type) ||
+			channel->Size!=header->VertCount)
+		{
+			ok=false;
+			break;
+		}
+		
+		const char *src=reader.Take((unsigned long long)channel->Size*channel->ElementSize);
+		if (src==NULL)
+		{
+			ok=false;
+			break;
+		}
+		
+		PData *pd=NULL;
+		switch (channel->Type)
+		{
+			case 'v': pd=ReadChannel<dVector>(file,src,channel->Size); break;
+			case 'c': pd=ReadChannel<dColour>(file,src,channel->Size); break;
+			case 'f': pd=ReadChannel<float>(file,src,channel->Size); break;
+			case 'm': pd=ReadChannel<dMatrix>(file,src,channel->Size); break;
+		}
+		if (pd==NULL)
+		{
+			ok=false;
+			break;
+		}
+		
+		char type;
+		unsigned int size;
+		if (prim->GetDataInfo(channel->Name,type,size)) prim->SetDataRaw(channel->Name,pd);
+		else prim->AddData(channel->Name,pd);
+	}
+	
+	if (ok && header->Indexed)
+	{
+		const char *src=reader.Take((unsigned long long)header->IndexCount*sizeof(unsigned int));
+		if (src!=NULL)
+		{
+			vector<unsigned int> &index=prim->GetIndex();
+			index.resize(header->IndexCount);
+			if (header->IndexCount>0) memcpy(&index[0],src,header->IndexCount*sizeof(unsigned int));
+			for (unsigned int i=0; i<header->IndexCount && ok; i++)
+			{
+				if (index[i]>=header->VertCount) ok=false;
+			}
+			prim->SetIndexMode(true);
+		}
+		else ok=false;
+	}
+	
+	// the arrays keep the file mapped while they need it
+	file->Release();
+	
+	if (!ok)
+	{
+		Trace::Stream<<"MeshCache::Read: "<<CacheFile(filename)<<" is corrupt, ignoring it"<<endl;
+		delete prim;
+		return NULL;
+	}
+	return prim;
+}
+
+bool MeshCache::Write(const string &filename, const Primitive *prim)
+{
+	const PolyPrimitive *poly=dynamic_cast<const PolyPrimitive*>(prim);
+	if (m_Path=="" || poly==NULL) return false;
+
+	struct stat source;
+	if (stat(filename.c_str(),&source)!=0) return false;
+	
+	// make the directories
+	for (unsigned int i=1; i<=m_Path.size(); i++)
+	{
+		if (i==m_Path.size() || m_Path[i]=='/')
+		{
+			mkdir(m_Path.substr(0,i).c_str(),0755);
+		}
+	}
+	
+	vector<string> names;
+	poly->GetDataNames(names);
+	
+	CacheHeader header;
+	memset(&header,0,sizeof(header));
+	memcpy(header.Magic,"FXMC",4);
+	header.Version=CACHE_VERSION;
+	header.Endian=CACHE_ENDIAN;
+	header.PolyType=poly->GetType();
+	header.SourceSize=source.st_size;
+	header.SourceTime=source.st_mtime;
+	header.PathLength=filename.size();
+	header.Indexed=poly->IsIndexed();
+	header.VertCount=poly->Size();
+	header.IndexCount=poly->GetIndexConst().size();
+	header.NumChannels=names.size();
+	
+	// write to a temporary file and move it into place, so a 
+	// half written cache file is never read
+	string cachefile=CacheFile(filename);
+	char tmp[32];
+	snprintf(tmp,32,".%d",getpid());
+	string tmpfile=cachefile+tmp;
+	FILE *file=fopen(tmpfile.c_str(),"wb");
+	if (file==NULL) return false;
+	
+	bool ok=WritePadded(file,&header,sizeof(header)) && 
+	        WritePadded(file,filename.c_str(),filename.size());
+	for (vector<string>::iterator i=names.begin(); i!=names.end() && ok; ++i)
+	{
+		const PData *pd=poly->GetDataRawConst(*i);
+		ok=i->size()<MAX_NAME && pd!=NULL;
+		if (!ok) break;
+		switch (pd->GetType())
+		{
+			case 'v': ok=WriteChannel<dVector>(file,*i,pd); break;
+			case 'c': ok=WriteChannel<dColour>(file,*i,pd); break;
+			case 'f': ok=WriteChannel<float>(file,*i,pd); break;
+			case 'm': ok=WriteChannel<dMatrix>(file,*i,pd); break;
+			default: ok=false;
+		}
+	}
+	if (ok && header.Indexed)
+	{
+		const vector<unsigned int> &index=poly->GetIndexConst();
+		ok=WritePadded(file,index.empty()?NULL:&index[0],index.size()*sizeof(unsigned int));
+	}
+	
+	if (fclose(file)!=0) ok=false;
+	if (!ok || rename(tmpfile.c_str(),cachefile.c_str())!=0)
+	{
+		Trace::Stream<<"MeshCache::Write: couldn't write "<<cachefile<<endl;
+		remove(tmpfile.c_str());
+		return false;
+	}
+	return true;
+}
+
+#else
+
+Primitive *MeshCache::Read(const string &filename)
+{
+	return NULL;
+}
+
+bool MeshCache::Write(const string &filename, const Primitive *prim)
+{
+	return false;
+}
+
+#endif
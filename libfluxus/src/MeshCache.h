@@ -0,0 +1,61 @@
+// Copyright (C) 2010 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#ifndef N_MESHCACHE
+#define N_MESHCACHE
+
+#include <string>
+#include "Primitive.h"
+
+namespace Fluxus
+{
+
+//////////////////////////////////////////////////////
+/// An on disk cache of loaded meshes, so big model 
+/// files only need parsing once. Entries are keyed by 
+/// the source path, and checked against its size and 
+/// modification time. They hold the final pdata arrays 
+/// and index in a versioned binary layout, which is 
+/// mapped into memory and used by the pdata arrays 
+/// until they're written to (the ones the primitive 
+/// renders from are copied when it takes them up, see
+/// TypedPData::Map). Only poly primitives are cached.
+class MeshCache
+{
+public:
+	/// Returns the primitive cached for this file, or 
+	/// NULL if there is none or it's out of date
+	static Primitive *Read(const std::string &filename);
+	
+	/// Stores the primitive loaded from this file
+	static bool Write(const std::string &filename, const Primitive *prim);
+	
+	/// Sets the directory to keep the cache in, created if 
+	/// needed. An empty path turns the cache off. Defaults to 
+	/// $XDG_CACHE_HOME/fluxus/meshes or ~/.cache/fluxus/meshes
+	static void SetPath(const std::string &path) { m_Path=path; }
+	static const std::string &GetPath() { return m_Path; }
+
+private:
+	static std::string DefaultPath();
+	static std::string CacheFile(const std::string &filename);
+
+	static std::string m_Path;
+};
+
+}
+
+#endif
@@ -16,6 +16,7 @@
 
 #include <cstdlib>
 #include <cstdio>
+#include <cstring>
 #include <algorithm>
 
 #include "assert.h"
@@ -24,74 +25,85 @@
 #include "OBJPrimitiveIO.h"
 #include "SceneGraph.h"
 #include "Trace.h"
+#include "ThreadPool.h"
 
 using namespace Fluxus;
 
-OBJPrimitiveIO::OBJPrimitiveIO()
+OBJPrimitiveIO::OBJPrimitiveIO() :
+m_NumFaces(0),
+m_FirstFaceSize(0),
+m_UnifiedIndices(true)
 {
 }
 
 OBJPrimitiveIO::~OBJPrimitiveIO()
 {
-	// clear some mem
-	m_Position.clear();
-	m_Texture.clear();
-	m_Normal.clear();
-	m_Faces.clear();
 }
 
 Primitive *OBJPrimitiveIO::FormatRead(const string &filename)
 {
-	FILE *file = fopen(filename.c_str(),"r");
-	if (file==NULL)
+	MappedFile *mapped = MappedFile::Open(filename);
+	if (mapped!=NULL)
 	{
-		Trace::Stream<<"Cannot open .obj file: "<<filename<<endl;
-		return NULL;
+		ReadOBJ(mapped->GetData(), mapped->GetSize());
+		mapped->Release();
 	}
+	else
+	{
+		// not mappable (or empty), so read it in
+		FILE *file = fopen(filename.c_str(),"rb");
+		if (file==NULL)
+		{
+			Trace::Stream<<"Cannot open .obj file: "<<filename<<endl;
+			return NULL;
+		}
 
-	fseek(file,0,SEEK_END);
-	m_DataSize = ftell(file);
-	rewind(file);
+		fseek(file,0,SEEK_END);
+		size_t size = ftell(file);
+		rewind(file);
 
-	m_Data = new char[m_DataSize+1];
-	if (m_DataSize!=fread(m_Data,1,m_DataSize,file))
-	{
-		Trace::Stream<<"Error reading .obj file: "<<filename<<endl;
+		vector<char> data(size+1);
+		if (size!=fread(&data[0],1,size,file))
+		{
+			Trace::Stream<<"Error reading .obj file: "<<filename<<endl;
+			fclose(file);
+			return NULL;
+		}
 		fclose(file);
-		return NULL;
+		ReadOBJ(&data[0], size);
 	}
-	fclose(file);
-	m_Data[m_DataSize]='\0';
-
-	m_UnifiedIndices = true;
-	ReadOBJ(m_Position, m_Texture, m_Normal, m_Faces);
 
-	// now get rid of the text
-	delete[] m_Data;
+	// indices which are the same per vertex can only be used 
+	// directly if there are as many of each type of data
+	if ((!m_Texture.empty() && m_Texture.size()!=m_Position.size()) ||
+		(!m_Normal.empty() && m_Normal.size()!=m_Position.size()))
+	{
+		m_UnifiedIndices=false;
+	}
 
 	// skip processing if all the indices are the same per vertex
 	if (m_UnifiedIndices)
 	{
-		m_Indices.clear();
-		for (vector<Face>::const_iterator fi=m_Faces.begin();
-				fi!=m_Faces.end(); ++fi)
+		m_Indices.resize(m_Corners.size());
+		for (unsigned int i=0; i<m_Corners.size(); i++)
 		{
-			for (vector<Indices>::const_iterator ii=fi->Index.begin();
-					ii!=fi->Index.end(); ++ii)
+			if (m_Corners[i].Position>=m_Position.size())
 			{
-				m_Indices.push_back(ii->Position);
+				Trace::Stream<<"Index out of range in .obj file"<<endl;
+				return NULL;
 			}
+			m_Indices[i]=m_Corners[i].Position;
 		}
 	}
 	else
 	{
 		// shuffle stuff around so we only have one set of indices
 		vector<Indices> unique=RemoveDuplicateIndices();
-		ReorderData(unique);
+		if (!ReorderData(unique)) return NULL;
 		UnifyIndices(unique);
 	}
 
-	if (m_Faces.empty()) return NULL;
+	if (m_NumFaces==0) return NULL;
 
 	return MakePrimitive();
 }
@@ -102,7 +114,7 @@ Primitive *OBJPrimitiveIO::MakePrimitive()
 
 	// what type?
 	PolyPrimitive::Type type;
-	switch (m_Faces[0].Index.size())
+	switch (m_FirstFaceSize)
 	{
 		case 3: type=PolyPrimitive::TRILIST; break;
 		case 4: type=PolyPrimitive::QUADS; break;
@@ -116,204 +128,383 @@ Primitive *OBJPrimitiveIO::MakePrimitive()
 	PolyPrimitive *prim = new PolyPrimitive(type);
 	prim->Resize(m_Position.size());
 
-	TypedPData<dVector> *pos = new TypedPData<dVector>(m_Position);
+	TypedPData<dVector> *pos = new TypedPData<dVector>;
+	pos->m_Data.swap(m_Position);
 	prim->SetDataRaw("p", pos);
 
 	if (!m_Texture.empty())
 	{
-		assert(m_Texture.size()==m_Position.size());
-		TypedPData<dVector> *tex = new TypedPData<dVector>(m_Texture);
+		assert(m_Texture.size()==pos->m_Data.size());
+		TypedPData<dVector> *tex = new TypedPData<dVector>;
+		tex->m_Data.swap(m_Texture);
 		prim->SetDataRaw("t", tex);
 	}
 
 	if (!m_Normal.empty())
 	{
-		assert(m_Normal.size()==m_Position.size());
-		TypedPData<dVector> *nrm = new TypedPData<dVector>(m_Normal);
+		assert(m_Normal.size()==pos->m_Data.size());
+		TypedPData<dVector> *nrm = new TypedPData<dVector>;
+		nrm->m_Data.swap(m_Normal);
 		prim->SetDataRaw("n", nrm);
 	}
 
-	prim->GetIndex()=m_Indices;
+	prim->GetIndex().swap(m_Indices);
 	prim->SetIndexMode(true);
 	return prim;
 }
 
-unsigned int OBJPrimitiveIO::TokeniseLine(unsigned int pos, vector<string> &output)
+//////////////////////////////////
+// parsing
+
+static inline bool IsSpace(char c)
+{
+	return c==' ' || c=='\t' || c=='\r';
+}
+
+// returns the next whitespace separated token on the line
+static inline bool NextToken(const char *&pos, const char *end, const char *&start)
 {
-	char c=m_Data[pos];
-	vector<string> temp;
-	temp.push_back("");
-	while(c!='\n' && pos<m_DataSize)
+	while (pos<end && IsSpace(*pos)) pos++;
+	start=pos;
+	while (pos<end && !IsSpace(*pos)) pos++;
+	return pos>start;
+}
+
+static const double Pow10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 
+	1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+// converts the text to a float the same as atof does (via a double), 
+// without needing it to be null terminated. plain decimals are done 
+// directly, as with up to 15 digits and small exponents the double 
+// is exact to start with, anything else goes to strtod
+static float ParseFloat(const char *start, const char *end)
+{
+	const char *pos=start;
+	bool negative=false;
+	if (pos<end && (*pos=='-' || *pos=='+')) negative=*pos++=='-';
+
+	unsigned long long mantissa=0;
+	int digits=0;
+	int exponent=0;
+	bool any=false;
+	while (pos<end && *pos>='0' && *pos<='9')
+	{
+		if (mantissa!=0 || *pos!='0') digits++;
+		mantissa=mantissa*10+(*pos++-'0');
+		any=true;
+	}
+	if (pos<end && *pos=='.')
+	{
+		pos++;
+		while (pos<end && *pos>='0' && *pos<='9')
+		{
+			if (mantissa!=0 || *pos!='0') digits++;
+			mantissa=mantissa*10+(*pos++-'0');
+			exponent--;
+			any=true;
+		}
+	}
+	if (any && pos<end && (*pos=='e' || *pos=='E'))
 	{
-		if (c==' ' && *temp.rbegin()!="") temp.push_back("");
-		else temp.rbegin()->push_back(c);
-		c=m_Data[++pos];
+		pos++;
+		bool negexp=false;
+		if (pos<end && (*pos=='-' || *pos=='+')) negexp=*pos++=='-';
+		int e=0;
+		bool expdigits=false;
+		while (pos<end && *pos>='0' && *pos<='9' && e<10000) 
+		{
+			e=e*10+(*pos++-'0');
+			expdigits=true;
+		}
+		if (!expdigits) any=false;
+		exponent+=negexp?-e:e;
 	}
 
-	// get rid of whitespace
-	output.clear();
-	for(vector<string>::iterator i=temp.begin(); i!=temp.end(); ++i)
+	if (any && pos==end && digits<=15 && exponent>=-22 && exponent<=22)
 	{
-		if (*i!="")	output.push_back(*i);
+		double value=exponent<0?mantissa/Pow10[-exponent]:mantissa*Pow10[exponent];
+		return negative?-value:value;
 	}
 
-	return pos+1;
+	char buf[64];
+	size_t len=end-start<63?end-start:63;
+	memcpy(buf,start,len);
+	buf[len]=0;
+	return strtod(buf,NULL);
 }
 
-void OBJPrimitiveIO::TokeniseIndices(const string &str, vector<string> &output)
+// converts an obj index to zero based, the same as (unsigned int)atof(str)-1
+static unsigned int ParseIndex(const char *start, const char *end)
 {
-	unsigned int pos=0;
-	output.clear();
-	output.push_back("");
-	while(pos<str.size())
+	if (end-start<10)
 	{
-		char c=str[pos++];
-		if (c==' ' || c=='/') output.push_back("");
-		else output.rbegin()->push_back(c);
+		unsigned int value=0;
+		const char *pos=start;
+		while (pos<end && *pos>='0' && *pos<='9') value=value*10+(*pos++-'0');
+		if (pos==end) return value-1;
 	}
+	char buf[64];
+	size_t len=end-start<63?end-start:63;
+	memcpy(buf,start,len);
+	buf[len]=0;
+	return (unsigned int)atof(buf)-1;
 }
 
-void OBJPrimitiveIO::ReadOBJ(std::vector<dVector, FLX_ALLOC(dVector) > &positions,
-		std::vector<dVector, FLX_ALLOC(dVector) > &textures,
-		std::vector<dVector, FLX_ALLOC(dVector) > &normals,
-		std::vector<Face> &faces)
+// the results from parsing part of the file
+class OBJPrimitiveIO::Chunk
 {
-	unsigned int pos=0;
-	positions.clear();
-	textures.clear();
-	normals.clear();
-	faces.clear();
-
-	while (pos<m_DataSize)
+public:
+	Chunk() : Start(NULL), End(NULL), NumFaces(0), FirstFaceSize(0),
+		Unified(true), BadIndices(0) {}
+
+	void Parse();
+	void ParseFace(const char *pos, const char *end);
+
+	const char *Start;
+	const char *End;
+	vector<dVector, FLX_ALLOC(dVector) > Position;
+	vector<dVector, FLX_ALLOC(dVector) > Texture;
+	vector<dVector, FLX_ALLOC(dVector) > Normal;
+	vector<Indices> Corners;
+	vector<Indices> Face;
+	unsigned int NumFaces;
+	unsigned int FirstFaceSize;
+	bool Unified;
+	unsigned int BadIndices;
+};
+
+void OBJPrimitiveIO::Chunk::Parse()
+{
+	const char *line=Start;
+	while (line<End)
 	{
-		vector<string> tokens;
-		pos = TokeniseLine(pos, tokens);
-		if (tokens.empty())
-			continue;
+		const char *eol=(const char*)memchr(line,'\n',End-line);
+		if (eol==NULL) eol=End;
 
-		if ((tokens[0] == "v") && (tokens.size() == 4))
-		{
-			positions.push_back(dVector(atof(tokens[1].c_str()),
-									 atof(tokens[2].c_str()),
-									 atof(tokens[3].c_str())));
-		}
-		else if (tokens[0] == "vt")
-		{
-			if (tokens.size() == 4)
-			{
-				textures.push_back(dVector(atof(tokens[1].c_str()),
-										 atof(tokens[2].c_str()),
-										 atof(tokens[3].c_str())));
-			}
-			else if (tokens.size() == 3)
-			{
-				textures.push_back(dVector(atof(tokens[1].c_str()),
-										 atof(tokens[2].c_str()),
-										 0));
-			}
-		}
-		else if ((tokens[0] == "vn") && (tokens.size() == 4))
-		{
-			normals.push_back(dVector(atof(tokens[1].c_str()),
-									 atof(tokens[2].c_str()),
-									 atof(tokens[3].c_str())));
-		}
-		else if (tokens[0] == "f")
+		const char *pos=line;
+		const char *token;
+		if (NextToken(pos,eol,token))
 		{
-			Face f;
-			for(unsigned int i=1; i<tokens.size(); i++)
+			unsigned int len=pos-token;
+			if (token[0]=='v' && (len==1 || (len==2 && (token[1]=='t' || token[1]=='n'))))
 			{
-				vector<string> itokens;
-				TokeniseIndices(tokens[i],itokens);
-				if (itokens.size()==3)
-				{
-					Indices ind;
-					if (itokens[0]!="") ind.Position=(unsigned int)atof(itokens[0].c_str())-1;
-					if (itokens[1]!="") ind.Texture=(unsigned int)atof(itokens[1].c_str())-1;
-					if (itokens[2]!="") ind.Normal=(unsigned int)atof(itokens[2].c_str())-1;
-					f.Index.push_back(ind);
-
-					if ((ind.Position != ind.Texture) ||
-						(ind.Position != ind.Normal) ||
-						(ind.Texture != ind.Normal))
-					{
-						m_UnifiedIndices = false;
-					}
-				}
-				else if (itokens.size()==2)
-				{
-					Indices ind;
-					if (itokens[0]!="") ind.Position=(unsigned int)atof(itokens[0].c_str())-1;
-					if (itokens[1]!="") ind.Texture=(unsigned int)atof(itokens[1].c_str())-1;
-					f.Index.push_back(ind);
-
-					if (ind.Position != ind.Texture)
-					{
-						m_UnifiedIndices = false;
-					}
-				}
-				else if (itokens.size()==1)
-				{
-					Indices ind;
-					if (itokens[0]!="") ind.Position=(unsigned int)atof(itokens[0].c_str())-1;
-					f.Index.push_back(ind);
-				}
-				else
+				float v[3]={0,0,0};
+				unsigned int count=0;
+				const char *num;
+				while (count<3 && NextToken(pos,eol,num))
 				{
-					Trace::Stream<<"Wrong number of indices in .obj file ("<<itokens.size()<<")"<<endl;
+					v[count++]=ParseFloat(num,pos);
 				}
-			}
 
-			// subdivide polygons to triangles
-			if (f.Index.size() > 3)
-			{
-				Face tri;
-				for (unsigned i = 0; i < 3; i++)
+				if (len==1)
 				{
-					tri.Index.push_back(f.Index[i]);
+					if (count==3) Position.push_back(dVector(v[0],v[1],v[2]));
 				}
-				faces.push_back(tri);
-
-				for (unsigned i = 3; i < f.Index.size(); i++)
+				else if (token[1]=='t')
 				{
-					tri.Index.erase(tri.Index.begin() + 1);
-					tri.Index.push_back(f.Index[i]);
-					faces.push_back(tri);
+					if (count>=2) Texture.push_back(dVector(v[0],v[1],v[2]));
 				}
+				else if (count==3) Normal.push_back(dVector(v[0],v[1],v[2]));
 			}
-			else
+			else if (len==1 && token[0]=='f')
 			{
-				faces.push_back(f);
+				ParseFace(pos,eol);
 			}
 		}
+		line=eol+1;
 	}
 }
 
-vector<OBJPrimitiveIO::Indices> OBJPrimitiveIO::RemoveDuplicateIndices()
+void OBJPrimitiveIO::Chunk::ParseFace(const char *pos, const char *end)
 {
-	vector<Indices> ret;
-	for (vector<Face>::iterator fi=m_Faces.begin();
-		fi!=m_Faces.end(); ++fi)
+	Face.clear();
+	while (true)
 	{
-		for (vector<Indices>::iterator ii=fi->Index.begin();
-			ii!=fi->Index.end(); ++ii)
+		while (pos<end && IsSpace(*pos)) pos++;
+		if (pos==end) break;
+
+		// split into position/texture/normal, reading plain 
+		// indices as we go and anything else with ParseIndex
+		Indices ind;
+		unsigned int *dst[3]={&ind.Position,&ind.Texture,&ind.Normal};
+		unsigned int count=0;
+		const char *part=pos;
+		unsigned int value=0;
+		bool plain=true;
+		while (true)
 		{
-			vector<Indices>::iterator result = find(ret.begin(), ret.end(), *ii);
-			if (result == ret.end())
+			char c=pos<end?*pos:' ';
+			if (c>='0' && c<='9')
 			{
-				ii->UnifiedIndex = ret.size();
-				ret.push_back(*ii);
+				value=value*10+(c-'0');
 			}
-			else
+			else if (c=='/' || IsSpace(c))
 			{
-				ii->UnifiedIndex = result - ret.begin();
+				if (count<3 && pos>part)
+				{
+					*dst[count]=plain && pos-part<10?value-1:ParseIndex(part,pos);
+				}
+				count++;
+				part=pos+1;
+				value=0;
+				plain=true;
+				if (c!='/') break;
 			}
+			else plain=false;
+			pos++;
 		}
+
+		if (count>3)
+		{
+			BadIndices++;
+			continue;
+		}
+
+		if ((count==3 && (ind.Position!=ind.Texture || ind.Position!=ind.Normal)) ||
+			(count==2 && ind.Position!=ind.Texture))
+		{
+			Unified=false;
+		}
+		Face.push_back(ind);
+	}
+
+	if (NumFaces==0) FirstFaceSize=Face.size()>3?3:Face.size();
+
+	// subdivide polygons to triangles
+	if (Face.size()>3)
+	{
+		for (unsigned int i=2; i<Face.size(); i++)
+		{
+			Corners.push_back(Face[0]);
+			Corners.push_back(Face[i-1]);
+			Corners.push_back(Face[i]);
+			NumFaces++;
+		}
+	}
+	else
+	{
+		Corners.insert(Corners.end(),Face.begin(),Face.end());
+		NumFaces++;
+	}
+}
+
+class OBJPrimitiveIO::ParseTask : public ThreadPool::Task
+{
+public:
+	ParseTask(vector<Chunk> &chunks) : m_Chunks(chunks) {}
+
+	virtual void Run(unsigned int start, unsigned int end)
+	{
+		for (unsigned int i=start; i<end; i++) m_Chunks[i].Parse();
+	}
+
+private:
+	vector<Chunk> &m_Chunks;
+};
+
+template<class T>
+static void Append(vector<T, FLX_ALLOC(T) > &dst, const vector<T, FLX_ALLOC(T) > &src)
+{
+	dst.insert(dst.end(),src.begin(),src.end());
+}
+
+void OBJPrimitiveIO::ReadOBJ(const char *data, size_t size)
+{
+	m_Position.clear();
+	m_Texture.clear();
+	m_Normal.clear();
+	m_Corners.clear();
+	m_NumFaces=0;
+	m_FirstFaceSize=0;
+	m_UnifiedIndices=true;
+
+	// split the file into chunks at line ends, a few per 
+	// thread so they balance out, then parse them all at once
+	unsigned int numchunks=ThreadPool::GetNumThreads()*4;
+	if (numchunks>size/(256*1024)) numchunks=size/(256*1024);
+	if (numchunks<1) numchunks=1;
+
+	vector<Chunk> chunks(numchunks);
+	const char *end=data+size;
+	const char *start=data;
+	for (unsigned int i=0; i<numchunks; i++)
+	{
+		const char *split=i==numchunks-1?end:data+size/numchunks*(i+1);
+		if (split<start) split=start;
+		const char *eol=(const char*)memchr(split,'\n',end-split);
+		split=eol==NULL?end:eol+1;
+		chunks[i].Start=start;
+		chunks[i].End=split;
+		start=split;
+	}
+
+	ParseTask task(chunks);
+	ThreadPool::Run(task,numchunks,1);
+
+	// join them back up in order, indices in the file are 
+	// global so nothing needs renumbering
+	unsigned int numpositions=0, numtextures=0, numnormals=0, numcorners=0, badindices=0;
+	for (vector<Chunk>::iterator i=chunks.begin(); i!=chunks.end(); ++i)
+	{
+		numpositions+=i->Position.size();
+		numtextures+=i->Texture.size();
+		numnormals+=i->Normal.size();
+		numcorners+=i->Corners.size();
+	}
+	m_Position.reserve(numpositions);
+	m_Texture.reserve(numtextures);
+	m_Normal.reserve(numnormals);
+	m_Corners.reserve(numcorners);
+
+	for (vector<Chunk>::iterator i=chunks.begin(); i!=chunks.end(); ++i)
+	{
+		Append(m_Position,i->Position);
+		Append(m_Texture,i->Texture);
+		Append(m_Normal,i->Normal);
+		m_Corners.insert(m_Corners.end(),i->Corners.begin(),i->Corners.end());
+		if (m_NumFaces==0) m_FirstFaceSize=i->FirstFaceSize;
+		m_NumFaces+=i->NumFaces;
+		m_UnifiedIndices=m_UnifiedIndices && i->Unified;
+		badindices+=i->BadIndices;
+	}
+
+	if (badindices>0)
+	{
+		Trace::Stream<<"Wrong number of indices in .obj file ("<<badindices<<" corners skipped)"<<endl;
+	}
+}
+
+vector<OBJPrimitiveIO::Indices> OBJPrimitiveIO::RemoveDuplicateIndices()
+{
+	// chain the index triples by position, numbering each in the 
+	// order they are first seen. corners which share a position are 
+	// usually near each other in the file, so this stays in cache. 
+	// out of range positions share the first chain, ReorderData 
+	// reports them afterwards
+	const unsigned int none=0xffffffff;
+	vector<unsigned int> first(m_Position.empty()?1:m_Position.size(),none);
+	vector<unsigned int> next;
+
+	vector<Indices> ret;
+	for (vector<Indices>::iterator ii=m_Corners.begin(); ii!=m_Corners.end(); ++ii)
+	{
+		unsigned int chain=ii->Position<first.size()?ii->Position:0;
+		unsigned int u=first[chain];
+		while (u!=none && !(ret[u]==*ii)) u=next[u];
+
+		if (u==none)
+		{
+			u=ret.size();
+			ret.push_back(*ii);
+			next.push_back(first[chain]);
+			first[chain]=u;
+		}
+		ii->UnifiedIndex=u;
 	}
 	return ret;
 }
 
-void OBJPrimitiveIO::ReorderData(const vector<OBJPrimitiveIO::Indices> &unique)
+bool OBJPrimitiveIO::ReorderData(const vector<OBJPrimitiveIO::Indices> &unique)
 {
 	vector<dVector, FLX_ALLOC(dVector) > NewPosition;
 	vector<dVector, FLX_ALLOC(dVector) > NewTexture;
@@ -322,27 +513,31 @@ void OBJPrimitiveIO::ReorderData(const vector<OBJPrimitiveIO::Indices> &unique)
 	for (vector<Indices>::const_iterator i=unique.begin();
 		i!=unique.end(); ++i)
 	{
+		if ((!m_Position.empty() && i->Position>=m_Position.size()) ||
+			(!m_Texture.empty() && i->Texture>=m_Texture.size()) ||
+			(!m_Normal.empty() && i->Normal>=m_Normal.size()))
+		{
+			Trace::Stream<<"Index out of range in .obj file"<<endl;
+			return false;
+		}
+
 		if (!m_Position.empty()) NewPosition.push_back(m_Position[i->Position]);
 		if (!m_Texture.empty()) NewTexture.push_back(m_Texture[i->Texture]);
 		if (!m_Normal.empty()) NewNormal.push_back(m_Normal[i->Normal]);
 	}
 
-	m_Position=NewPosition;
-	m_Texture=NewTexture;
-	m_Normal=NewNormal;
+	m_Position.swap(NewPosition);
+	m_Texture.swap(NewTexture);
+	m_Normal.swap(NewNormal);
+	return true;
 }
 
 void OBJPrimitiveIO::UnifyIndices(const vector<Indices> &unique)
 {
-	m_Indices.clear();
-	for (vector<Face>::const_iterator fi=m_Faces.begin();
-		fi!=m_Faces.end(); ++fi)
+	m_Indices.resize(m_Corners.size());
+	for (unsigned int i=0; i<m_Corners.size(); i++)
 	{
-		for (vector<Indices>::const_iterator ii=fi->Index.begin();
-			ii!=fi->Index.end(); ++ii)
-		{
-			m_Indices.push_back(ii->UnifiedIndex);
-		}
+		m_Indices[i]=m_Corners[i].UnifiedIndex;
 	}
 }
 
@@ -355,7 +550,7 @@ void OBJPrimitiveIO::WriteVertices(const string &pdataname, const string &objnam
 	const TypedPData<dVector> *pdata = dynamic_cast<const TypedPData<dVector> *>(ob->GetDataRawConst(pdataname));
 	for (unsigned int i=0; i<ob->Size(); i++)
 	{
-		dVector p = pdata->m_Data[i];
+		dVector p = pdata->View()[i];
 		dVector o = t.transform(p);
 		snprintf(line,2048,"%s %f %f %f\n",objname.c_str(),o.x,o.y,o.z);
 		fwrite(line,1,strlen(line),file);
@@ -21,6 +21,7 @@
 #include "SceneGraph.h"
 #include "dada.h"
 #include <vector>
+#include <string>
 
 namespace Fluxus
 {
@@ -54,19 +55,12 @@ private:
 		unsigned int UnifiedIndex;
 	};
 
-	struct Face
-	{
-		vector<Indices> Index;
-	};
+	class Chunk;
+	class ParseTask;
 
-	unsigned int TokeniseLine(unsigned int pos, vector<string> &output);
-	void TokeniseIndices(const string &str, vector<string> &output);
-	void ReadOBJ(std::vector<dVector, FLX_ALLOC(dVector) > &positions,
-				std::vector<dVector, FLX_ALLOC(dVector) > &textures,
-				std::vector<dVector, FLX_ALLOC(dVector) > &normals,
-				std::vector<Face> &faces);
+	void ReadOBJ(const char *data, size_t size);
 	vector<Indices> RemoveDuplicateIndices();
-	void ReorderData(const vector<Indices> &unique);
+	bool ReorderData(const vector<Indices> &unique);
 	void UnifyIndices(const vector<Indices> &unique);
 	Primitive *MakePrimitive();
 
@@ -78,10 +72,10 @@ private:
 
 	void FormatWriteMTL(const Primitive *ob, unsigned id, FILE *file);
 
-	unsigned int m_DataSize;
-	char *m_Data;
-
-	vector<Face> m_Faces;
+	// the corners of all the faces, with polygons split into triangles
+	vector<Indices> m_Corners;
+	unsigned int m_NumFaces;
+	unsigned int m_FirstFaceSize;
 	vector<dVector, FLX_ALLOC(dVector) > m_Position;
 	vector<dVector, FLX_ALLOC(dVector) > m_Texture;
 	vector<dVector, FLX_ALLOC(dVector) > m_Normal;
@@ -18,3 +18,9 @@
 
 using namespace Fluxus;
 
+unsigned int PData::NewVersion()
+{
+	// 0 is kept free to mean 'no version'
+	static unsigned int Version=0;
+	return ++Version;
+}
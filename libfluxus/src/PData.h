@@ -21,6 +21,7 @@
 #include <string>
 #include "dada.h"
 #include "Allocator.h"
+#include "MappedFile.h"
 
 using namespace std;
 
@@ -32,52 +33,136 @@ namespace Fluxus
 class PData
 {
 public:
-	PData() {}
+	PData() : m_Type('?'), m_Version(NewVersion()) {}
 	virtual ~PData() {}
 	virtual PData *Copy() const=0;
 	virtual unsigned int Size() const=0;
 	virtual void Resize(unsigned int size)=0;
+
+	/// If the array is using a mapped file (see TypedPData::Map), 
+	/// copies it into memory so it can be written to
+	virtual void Unmap()=0;
 	
 	char GetType() const { return m_Type; }
+
+	/// Called when the contents have been written to, gives
+	/// the array a new version. Versions are unique across all
+	/// arrays, so things which keep copies of the data (such as
+	/// buffer objects) only need to store the version to know 
+	/// when they are out of date.
+	void Dirty() { m_Version=NewVersion(); }
+	unsigned int GetVersion() const { return m_Version; }
+
+	/// Returns a version number not used by anything before
+	static unsigned int NewVersion();
 	
 protected:
 	void SetType(const char s) { m_Type=s; }
 	
 private:
 	char m_Type;
+	unsigned int m_Version;
 };
 
+/////////////////////////////////////////////////
+/// The type character of pdata arrays of each type, as 
+/// returned by PData::GetType()
+template<class T> inline char PDataType() { return '?'; }
+template<> inline char PDataType<dVector>() { return 'v'; }
+template<> inline char PDataType<dColour>() { return 'c'; }
+template<> inline char PDataType<float>() { return 'f'; }
+template<> inline char PDataType<dMatrix>() { return 'm'; }
+
 /////////////////////////////////////////////////
 /// The templated pdata array class
 template<class T>
 class TypedPData : public PData
 {
 public:
-	TypedPData() {}	
-	TypedPData(T first) { m_Data.push_back(first); }	
-	TypedPData(unsigned int size) { Resize(size); }	
-	TypedPData(vector<T, FLX_ALLOC(T) > s) : m_Data(s) {}
-	virtual ~TypedPData() {}
+	TypedPData() : m_Map(NULL), m_MapData(NULL), m_MapSize(0) { SetType(PDataType<T>()); }	
+	TypedPData(T first) : m_Map(NULL), m_MapData(NULL), m_MapSize(0) { SetType(PDataType<T>()); m_Data.push_back(first); }	
+	TypedPData(unsigned int size) : m_Map(NULL), m_MapData(NULL), m_MapSize(0) { SetType(PDataType<T>()); Resize(size); }	
+	TypedPData(vector<T, FLX_ALLOC(T) > s) : m_Data(s), m_Map(NULL), m_MapData(NULL), m_MapSize(0) { SetType(PDataType<T>()); }
+	virtual ~TypedPData() { if (m_Map) m_Map->Release(); }
 	
 	virtual PData *Copy() const
 	{
 		TypedPData<T> *newdata = new TypedPData<T>;
 		newdata->m_Data=m_Data;
+		if (m_Map)
+		{
+			// copies share the mapping until one of them is written to
+			m_Map->AddRef();
+			newdata->m_Map=m_Map;
+			newdata->m_MapData=m_MapData;
+			newdata->m_MapSize=m_MapSize;
+		}
 		return newdata;
 	}
 	
 	virtual unsigned int Size() const
 	{
+		if (m_Map) return m_MapSize;
 		return m_Data.size();
 	}
 
 	virtual void Resize(unsigned int size)
 	{
+		Unmap();
 		m_Data.resize(size);
+		Dirty();
+	}
+	
+	/// Uses size elements of the mapped file from offset 
+	/// (a multiple of 16 bytes) as the array, without copying
+	/// them. Until Unmap() is called m_Data is empty, and the
+	/// array can only be read through View().
+	bool Map(MappedFile *file, size_t offset, unsigned int size)
+	{
+		if (offset%16!=0 || offset>file->GetSize() || 
+			size>(file->GetSize()-offset)/sizeof(T)) 
+		{
+			return false;
+		}
+		
+		file->AddRef();
+		if (m_Map) m_Map->Release();
+		m_Map=file;
+		m_MapData=reinterpret_cast<const T*>(file->GetData()+offset);
+		m_MapSize=size;
+		m_Data.clear();
+		Dirty();
+		return true;
+	}
+	
+	virtual void Unmap()
+	{
+		if (!m_Map) return;
+		m_Data.assign(m_MapData,m_MapData+m_MapSize);
+		m_Map->Release();
+		m_Map=NULL;
+		m_MapData=NULL;
+		m_MapSize=0;
+	}
+	
+	bool IsMapped() const { return m_Map!=NULL; }
+	
+	/// The elements for reading, from the mapped file or m_Data,
+	/// NULL if the array is empty
+	const T *View() const 
+	{ 
+		if (m_Map) return m_MapData;
+		if (m_Data.empty()) return NULL;
+		return &m_Data[0];
 	}
 	
 	///\todo add operator[] and make m_Data private
 	vector<T, FLX_ALLOC(T) > m_Data;
+
+private:
+	MappedFile *m_Map;
+	const T *m_MapData;
+	unsigned int m_MapSize;
 };
 
 }
@@ -18,6 +18,9 @@
 
 using namespace Fluxus;
 
+map<string,PDataAtom> PDataContainer::m_AtomMap;
+vector<string> PDataContainer::m_AtomNames;
+
 PDataContainer::PDataContainer() 
 {
 }
@@ -29,6 +32,7 @@ PDataContainer::PDataContainer(const PDataContainer &other)
 		i!=other.m_PData.end(); i++)
 	{
 		m_PData[i->first] = i->second->Copy();
+		SetAtomData(i->first,m_PData[i->first]);
 	}
 }
 
@@ -43,14 +47,45 @@ void PDataContainer::Clear()
 	{
 		delete i->second;
 	}
+	m_Atoms.clear();
 }	
 
+PDataAtom PDataContainer::GetAtom(const string &name)
+{
+	map<string,PDataAtom>::iterator i=m_AtomMap.find(name);
+	if (i!=m_AtomMap.end()) return i->second;
+
+	PDataAtom atom=m_AtomNames.size();
+	m_AtomNames.push_back(name);
+	m_AtomMap[name]=atom;
+	return atom;
+}
+
+const string &PDataContainer::GetAtomName(PDataAtom atom)
+{
+	static const string empty;
+	if (atom<m_AtomNames.size()) return m_AtomNames[atom];
+	return empty;
+}
+
+void PDataContainer::SetAtomData(const string &name, PData *pd)
+{
+	PDataAtom atom=GetAtom(name);
+	if (atom>=m_Atoms.size()) 
+	{
+		if (pd==NULL) return;
+		m_Atoms.resize(atom+1,NULL);
+	}
+	m_Atoms[atom]=pd;
+}
+
 void PDataContainer::Resize(unsigned int size)
 {
 	for (map<string,PData*>::iterator i=m_PData.begin(); i!=m_PData.end(); i++)
 	{
 		i->second->Resize(size);
 	}
+	DataChanged();
 }
 
 	
@@ -64,6 +99,18 @@ unsigned int PDataContainer::Size() const
 	return 0;
 }
 
+unsigned int PDataContainer::GetDataVersion() const
+{
+	// versions are unique and only increase, so the newest one
+	// changes when any array is written or added
+	unsigned int version=0;
+	for (map<string,PData*>::const_iterator i=m_PData.begin(); i!=m_PData.end(); ++i)
+	{
+		if (i->second->GetVersion()>version) version=i->second->GetVersion();
+	}
+	return version;
+}
+
 bool PDataContainer::GetDataInfo(const string &name, char &type, unsigned int &size) const
 {
 	map<string,PData*>::const_iterator i=m_PData.find(name);
@@ -73,26 +120,16 @@ bool PDataContainer::GetDataInfo(const string &name, char &type, unsigned int &s
 	}
 	
 	size=i->second->Size();
-	
-	//\todo: remove all this dynamic casting and store the char type inside pdata...
-	TypedPData<dVector> *data = dynamic_cast<TypedPData<dVector>*>(i->second);	
-	if (data) type='v';
-	else
-	{
-		TypedPData<dColour> *data = dynamic_cast<TypedPData<dColour>*>(i->second);
-		if (data) type='c';
-		else 
-		{
-			TypedPData<float> *data = dynamic_cast<TypedPData<float>*>(i->second);
-			if (data) type='f';
-			else 
-			{
-				TypedPData<dMatrix> *data = dynamic_cast<TypedPData<dMatrix>*>(i->second);
-				if (data) type='m';
-			}
-		}
-	}
-		
+	type=i->second->GetType();
+	return true;
+}
+
+bool PDataContainer::GetDataInfo(PDataAtom atom, char &type, unsigned int &size) const
+{
+	PData *pd=FindData(atom);
+	if (pd==NULL) return false;
+	size=pd->Size();
+	type=pd->GetType();
 	return true;
 }
 	
@@ -106,6 +143,8 @@ void PDataContainer::AddData(const string &name, PData* pd)
 	}
 	
 	m_PData[name]=pd;
+	SetAtomData(name,pd);
+	DataChanged();
 }
 
 void PDataContainer::CopyData(const string &name, string newname)
@@ -125,8 +164,10 @@ void PDataContainer::CopyData(const string &name, string newname)
 	}
 	
 	m_PData[newname]=i->second->Copy();
+	SetAtomData(newname,m_PData[newname]);
 	
 	PDataDirty();
+	DataChanged();
 }
 
 void PDataContainer::RemoveDataVec(const string &name)
@@ -140,6 +181,8 @@ void PDataContainer::RemoveDataVec(const string &name)
 	
 	delete i->second;
 	m_PData.erase(i);
+	SetAtomData(name,NULL);
+	DataChanged();
 }
 
 PData* PDataContainer::GetDataRaw(const string &name)
@@ -150,6 +193,9 @@ PData* PDataContainer::GetDataRaw(const string &name)
 		return NULL;
 	}
 	
+	i->second->Unmap();
+	i->second->Dirty();
+	DataChanged();
 	return i->second;
 }
 
@@ -174,7 +220,9 @@ void PDataContainer::SetDataRaw(const string &name, PData* pd)
 	}
 	delete i->second;
 	i->second = pd;
+	SetAtomData(name,pd);
 	PDataDirty();
+	DataChanged();
 }
 
 void PDataContainer::GetDataNames(vector<string> &names) const
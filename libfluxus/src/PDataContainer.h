@@ -27,6 +27,9 @@ using namespace std;
 namespace Fluxus
 {
 
+/// An interned pdata name, see PDataContainer::GetAtom()
+typedef unsigned int PDataAtom;
+
 ///////////////////////////////////////////////////
 /// The base pdata container class. Primitive data (pdata)
 /// means vertex data, colours, positions, etc etc which are
@@ -61,9 +64,17 @@ public:
 	
 	/// Retrieves a pointer to the internal vector by name
 	/// Returns NULL if it doesn't exist, or is not the 
-	/// type given in the template call.
+	/// type given in the template call. As the caller is 
+	/// free to write to the vector, the array is marked
+	/// as dirty, and copied into memory if it's mapped.
 	template<class T> vector<T,FLX_ALLOC(T) >* GetDataVec(const string &name);      
 	
+	/// Retrieves the array by name for reading through 
+	/// TypedPData::View(), without marking it as dirty or 
+	/// copying a mapped array. Returns NULL if it doesn't
+	/// exist, or is not the type given in the template call.
+	template<class T> const TypedPData<T>* GetDataView(const string &name) const;
+	
 	/// Destroys a pdata array
 	void RemoveDataVec(const string &name);
 	
@@ -82,10 +93,13 @@ public:
 	/// Runs a pdata operation on the given pdata array
 	template<class T> PData *DataOp(const string &op, const string &name, T operand);
 	
-	/// Gets the whole pdata array, returns NULL if it doesn't exist
+	/// Gets the whole pdata array, returns NULL if it doesn't exist.
+	/// Marks the array as dirty and copies it into memory if it's
+	/// mapped, use GetDataRawConst() for reading.
 	PData* GetDataRaw(const string &name);
 
-	/// Gets the whole const pdata array, returns NULL if it doesn't exist
+	/// Gets the whole const pdata array, returns NULL if it doesn't exist.
+	/// Mapped arrays stay mapped, so read typed arrays with View().
 	const PData* GetDataRawConst(const string &name) const;
 	
 	/// Sets the whole pdata array
@@ -101,9 +115,43 @@ public:
 	/// Returns the size of pdata for this object
 	unsigned int Size() const;
 
+	/// Returns the latest version of all the arrays, 
+	/// this changes whenever any of them are written to
+	unsigned int GetDataVersion() const;
+
 	/// Returns a vector of names of PData that this container contains
 	void GetDataNames(vector<string> &names) const;
 
+	/// Interns a pdata name, the atom returned is the same for the
+	/// name in all containers, and is valid even if no array of that
+	/// name exists yet. Looking arrays up by atom is an array index 
+	/// rather than a string search, for use in tight loops.
+	static PDataAtom GetAtom(const string &name);
+
+	/// Returns the name an atom was made from
+	static const string &GetAtomName(PDataAtom atom);
+
+	/// Atom versions of the above, these are bounds checked on the 
+	/// atom but not on the index
+	bool GetDataInfo(PDataAtom atom, char &type, unsigned int &size) const;
+	template<class T> void SetData(PDataAtom atom, unsigned int index, T s);
+	template<class T> T GetData(PDataAtom atom, unsigned int index) const;
+
+	/// Gets the array for an atom, NULL if it doesn't exist here. 
+	/// Doesn't mark the array as dirty or copy a mapped array, so 
+	/// read it with View() and call Unmap(), Dirty() and DataChanged()
+	/// when writing to it.
+	PData *FindData(PDataAtom atom) const 
+	{ 
+		if (atom<m_Atoms.size()) return m_Atoms[atom]; 
+		return NULL;
+	}
+
+	/// Called whenever an array is written to or changed through 
+	/// this interface. Code writing to an array it got from 
+	/// FindData() needs to call it itself.
+	virtual void DataChanged() {}
+
 protected:
 
 	/// Called when a named pdata mapping changes 
@@ -113,19 +161,50 @@ protected:
 	///\todo replace with a hashmap?
 	mutable map<string,PData*> m_PData;
 
+private:
+	void SetAtomData(const string &name, PData *pd);
+
+	/// The arrays indexed by atom, NULL for ones we don't have
+	vector<PData*> m_Atoms;
+	
+	static map<string,PDataAtom> m_AtomMap;
+	static vector<string> m_AtomNames;
 };
 
 template<class T> 
 void PDataContainer::SetData(const string &name, unsigned int index, T s)	
 {
-	static_cast<TypedPData<T>*>(m_PData[name])->m_Data[index]=s;
+	PData *pd=m_PData[name];
+	pd->Unmap();
+	static_cast<TypedPData<T>*>(pd)->m_Data[index]=s;
+	pd->Dirty();
+	DataChanged();
 }
 
 ///Todo: no const [] for m_PData[name] so m_PData has to be mutable???
 template<class T> 
 T PDataContainer::GetData(const string &name, unsigned int index) const
 {
-	return static_cast<TypedPData<T>*>(m_PData[name])->m_Data[index];
+	return static_cast<TypedPData<T>*>(m_PData[name])->View()[index];
+}
+
+template<class T> 
+void PDataContainer::SetData(PDataAtom atom, unsigned int index, T s)	
+{
+	PData *pd=FindData(atom);
+	if (pd==NULL) return;
+	pd->Unmap();
+	static_cast<TypedPData<T>*>(pd)->m_Data[index]=s;
+	pd->Dirty();
+	DataChanged();
+}
+
+template<class T> 
+T PDataContainer::GetData(PDataAtom atom, unsigned int index) const
+{
+	PData *pd=FindData(atom);
+	if (pd==NULL) return T();
+	return static_cast<TypedPData<T>*>(pd)->View()[index];
 }
 
 template<class T>
@@ -138,16 +217,31 @@ vector<T,FLX_ALLOC(T) >* PDataContainer::GetDataVec(const string &name)
 		return NULL;
 	}
 	
-	TypedPData<T> *ptr=dynamic_cast<TypedPData<T> *>(i->second);
-	if (!ptr) 
+	if (i->second->GetType()!=PDataType<T>()) 
 	{
-		Trace::Stream<<"Primitive::GetPDataVec: pdata: "<<name<<" is not of type: "<<typeid(TypedPData<T>).name()<<endl;
+		Trace::Stream<<"Primitive::GetPDataVec: pdata: "<<name<<" is not of type: "<<PDataType<T>()<<endl;
 		return NULL;
 	}
 	
+	TypedPData<T> *ptr=static_cast<TypedPData<T> *>(i->second);
+	ptr->Unmap();
+	ptr->Dirty();
+	DataChanged();
 	return &ptr->m_Data;
 }
 
+template<class T>
+const TypedPData<T>* PDataContainer::GetDataView(const string &name) const
+{
+	map<string,PData*>::const_iterator i=m_PData.find(name);
+	if (i==m_PData.end() || i->second->GetType()!=PDataType<T>()) 
+	{
+		return NULL;
+	}
+	
+	return static_cast<const TypedPData<T> *>(i->second);
+}
+
 template<class T>
 PData *PDataContainer::DataOp(const string &op, const string &name, T operand)
 {
@@ -158,22 +252,17 @@ PData *PDataContainer::DataOp(const string &op, const string &name, T operand)
 		return NULL;
 	}
 	
-	TypedPData<dVector> *data = dynamic_cast<TypedPData<dVector>*>(i->second);	
-	if (data) return FindOperate<dVector,T>(op, data, operand);
-	else
+	// most operators work in place
+	i->second->Unmap();
+	i->second->Dirty();
+	DataChanged();
+
+	switch (i->second->GetType())
 	{
-		TypedPData<dColour> *data = dynamic_cast<TypedPData<dColour>*>(i->second);
-		if (data) return FindOperate<dColour, T>(op, data, operand);
-		else 
-		{
-			TypedPData<float> *data = dynamic_cast<TypedPData<float>*>(i->second);
-			if (data) return FindOperate<float, T>(op, data, operand);
-			else 
-			{
-				TypedPData<dMatrix> *data = dynamic_cast<TypedPData<dMatrix>*>(i->second);
-				if (data) return FindOperate<dMatrix, T>(op, data, operand);
-			}
-		}
+		case 'v': return FindOperate<dVector,T>(op, static_cast<TypedPData<dVector>*>(i->second), operand);
+		case 'c': return FindOperate<dColour,T>(op, static_cast<TypedPData<dColour>*>(i->second), operand);
+		case 'f': return FindOperate<float,T>(op, static_cast<TypedPData<float>*>(i->second), operand);
+		case 'm': return FindOperate<dMatrix,T>(op, static_cast<TypedPData<dMatrix>*>(i->second), operand);
 	}
 	
 	return NULL;
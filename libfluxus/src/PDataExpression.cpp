@@ -0,0 +1,579 @@
+// Copyright (C) 2010 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#include <math.h>
+#include "PDataExpression.h"
+#include "ThreadPool.h"
+#include "Noise.h"
+#include "Trace.h"
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+using namespace Fluxus;
+
+// elements are processed in blocks this size, so the 
+// intermediate values for all the nodes stay in the cache
+static const unsigned int BLOCK_SIZE = 128;
+
+///////////////////////////////////////////////////////////////
+// four wide float operations, with sse if we have it
+
+#ifdef __SSE__
+
+typedef __m128 v4;
+
+static inline v4 Load(const float *p) { return _mm_loadu_ps(p); }
+static inline void Store(float *p, v4 a) { _mm_storeu_ps(p,a); }
+static inline v4 Set(float x, float y, float z, float w) { return _mm_setr_ps(x,y,z,w); }
+static inline v4 Add(v4 a, v4 b) { return _mm_add_ps(a,b); }
+static inline v4 Sub(v4 a, v4 b) { return _mm_sub_ps(a,b); }
+static inline v4 Mul(v4 a, v4 b) { return _mm_mul_ps(a,b); }
+static inline v4 Div(v4 a, v4 b) { return _mm_div_ps(a,b); }
+static inline v4 Min(v4 a, v4 b) { return _mm_min_ps(a,b); }
+static inline v4 Max(v4 a, v4 b) { return _mm_max_ps(a,b); }
+static inline v4 Sqrt(v4 a) { return _mm_sqrt_ps(a); }
+static inline v4 Abs(v4 a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f),a); }
+static inline v4 SplatX(v4 a) { return _mm_shuffle_ps(a,a,_MM_SHUFFLE(0,0,0,0)); }
+static inline v4 SplatY(v4 a) { return _mm_shuffle_ps(a,a,_MM_SHUFFLE(1,1,1,1)); }
+static inline v4 SplatZ(v4 a) { return _mm_shuffle_ps(a,a,_MM_SHUFFLE(2,2,2,2)); }
+static inline v4 SplatW(v4 a) { return _mm_shuffle_ps(a,a,_MM_SHUFFLE(3,3,3,3)); }
+
+static inline v4 Dot3(v4 a, v4 b) 
+{ 
+	v4 m=_mm_mul_ps(a,b);
+	return _mm_add_ps(_mm_add_ps(SplatX(m),SplatY(m)),SplatZ(m));
+}
+
+static inline v4 Cross(v4 a, v4 b)
+{
+	v4 a1=_mm_shuffle_ps(a,a,_MM_SHUFFLE(3,0,2,1));
+	v4 b1=_mm_shuffle_ps(b,b,_MM_SHUFFLE(3,1,0,2));
+	v4 a2=_mm_shuffle_ps(a,a,_MM_SHUFFLE(3,1,0,2));
+	v4 b2=_mm_shuffle_ps(b,b,_MM_SHUFFLE(3,0,2,1));
+	return _mm_sub_ps(_mm_mul_ps(a1,b1),_mm_mul_ps(a2,b2));
+}
+
+#else
+
+class v4
+{
+public:
+	float v[4];
+};
+
+static inline v4 Load(const float *p) { v4 r; r.v[0]=p[0]; r.v[1]=p[1]; r.v[2]=p[2]; r.v[3]=p[3]; return r; }
+static inline void Store(float *p, v4 a) { p[0]=a.v[0]; p[1]=a.v[1]; p[2]=a.v[2]; p[3]=a.v[3]; }
+static inline v4 Set(float x, float y, float z, float w) { v4 r; r.v[0]=x; r.v[1]=y; r.v[2]=z; r.v[3]=w; return r; }
+
+#define V4_OP2(name,expr) \
+static inline v4 name(v4 a, v4 b) { v4 r; for (int i=0; i<4; i++) { float x=a.v[i], y=b.v[i]; r.v[i]=(expr); } return r; }
+V4_OP2(Add,x+y)
+V4_OP2(Sub,x-y)
+V4_OP2(Mul,x*y)
+V4_OP2(Div,x/y)
+V4_OP2(Min,x<y?x:y)
+V4_OP2(Max,x>y?x:y)
+#undef V4_OP2
+
+static inline v4 Sqrt(v4 a) { return Set(sqrtf(a.v[0]),sqrtf(a.v[1]),sqrtf(a.v[2]),sqrtf(a.v[3])); }
+static inline v4 Abs(v4 a) { return Set(fabsf(a.v[0]),fabsf(a.v[1]),fabsf(a.v[2]),fabsf(a.v[3])); }
+static inline v4 SplatX(v4 a) { return Set(a.v[0],a.v[0],a.v[0],a.v[0]); }
+static inline v4 SplatY(v4 a) { return Set(a.v[1],a.v[1],a.v[1],a.v[1]); }
+static inline v4 SplatZ(v4 a) { return Set(a.v[2],a.v[2],a.v[2],a.v[2]); }
+static inline v4 SplatW(v4 a) { return Set(a.v[3],a.v[3],a.v[3],a.v[3]); }
+
+static inline v4 Dot3(v4 a, v4 b) 
+{ 
+	float d=a.v[0]*b.v[0]+a.v[1]*b.v[1]+a.v[2]*b.v[2];
+	return Set(d,d,d,d);
+}
+
+static inline v4 Cross(v4 a, v4 b)
+{
+	return Set(a.v[1]*b.v[2]-a.v[2]*b.v[1],
+	           a.v[2]*b.v[0]-a.v[0]*b.v[2],
+	           a.v[0]*b.v[1]-a.v[1]*b.v[0],0);
+}
+
+#endif
+
+///////////////////////////////////////////////////////////////
+
+// the names of the ops in scheme, with the number of arguments
+class OpInfo
+{
+public:
+	const char *m_Name;
+	const char *m_Alias;
+	PDataExpression::Op m_Op;
+	unsigned int m_Args;
+};
+
+static const OpInfo Ops[] = 
+{
+	{ "vadd", "+", PDataExpression::ADD, 2 },
+	{ "vsub", "-", PDataExpression::SUB, 2 },
+	{ "vmul", "*", PDataExpression::MUL, 2 },
+	{ "vdiv", "/", PDataExpression::DIV, 2 },
+	{ "min", "vmin", PDataExpression::MIN, 2 },
+	{ "max", "vmax", PDataExpression::MAX, 2 },
+	{ "neg", "vneg", PDataExpression::NEG, 1 },
+	{ "abs", "vabs", PDataExpression::ABS, 1 },
+	{ "sqrt", "vsqrt", PDataExpression::SQRT, 1 },
+	{ "sin", "vsin", PDataExpression::SIN, 1 },
+	{ "cos", "vcos", PDataExpression::COS, 1 },
+	{ "floor", "vfloor", PDataExpression::FLOOR, 1 },
+	{ "vdot", NULL, PDataExpression::DOT, 2 },
+	{ "vcross", NULL, PDataExpression::CROSS, 2 },
+	{ "vmag", NULL, PDataExpression::LENGTH, 1 },
+	{ "vnormalise", NULL, PDataExpression::NORMALISE, 1 },
+	{ "clamp", NULL, PDataExpression::CLAMP, 3 },
+	{ "lerp", "vlerp", PDataExpression::LERP, 3 },
+	{ "noise", NULL, PDataExpression::NOISE, 1 },
+	{ "vx", NULL, PDataExpression::X, 1 },
+	{ "vy", NULL, PDataExpression::Y, 1 },
+	{ "vz", NULL, PDataExpression::Z, 1 },
+	{ "vw", NULL, PDataExpression::W, 1 },
+	{ "vector", NULL, PDataExpression::VECTOR, 3 },
+	{ NULL, NULL, PDataExpression::NUM_OPS, 0 }
+};
+
+bool PDataExpression::LookupOp(const string &name, Op &op)
+{
+	for (const OpInfo *i=Ops; i->m_Name!=NULL; i++)
+	{
+		if (name==i->m_Name || (i->m_Alias && name==i->m_Alias))
+		{
+			op=i->m_Op;
+			return true;
+		}
+	}
+	return false;
+}
+
+unsigned int PDataExpression::GetOpArgs(Op op)
+{
+	switch (op)
+	{
+		case CONSTANT: case CHANNEL: case INDEX: return 0;
+		case TRANSFORM: case TRANSFORM_ROT: return 1;
+		default: break;
+	}
+
+	for (const OpInfo *i=Ops; i->m_Name!=NULL; i++)
+	{
+		if (i->m_Op==op) return i->m_Args;
+	}
+	return 0;
+}
+
+///////////////////////////////////////////////////////////////
+
+PDataExpression::PDataExpression()
+{
+}
+
+PDataExpression::~PDataExpression()
+{
+}
+
+void PDataExpression::Clear()
+{
+	m_Nodes.clear();
+}
+
+unsigned int PDataExpression::AddNode(const Node &node)
+{
+	m_Nodes.push_back(node);
+	return m_Nodes.size()-1;
+}
+
+unsigned int PDataExpression::Constant(float x, float y, float z, float w)
+{
+	Node node;
+	node.m_Op=CONSTANT;
+	node.m_Value[0]=x;
+	node.m_Value[1]=y;
+	node.m_Value[2]=z;
+	node.m_Value[3]=w;
+	node.m_Uniform=true;
+	return AddNode(node);
+}
+
+unsigned int PDataExpression::Channel(const string &name)
+{
+	Node node;
+	node.m_Op=CHANNEL;
+	node.m_Channel=name;
+	node.m_Uniform=false;
+	return AddNode(node);
+}
+
+unsigned int PDataExpression::Index()
+{
+	Node node;
+	node.m_Op=INDEX;
+	node.m_Uniform=false;
+	return AddNode(node);
+}
+
+unsigned int PDataExpression::Transform(const dMatrix &m, unsigned int a, bool rotate)
+{
+	Node node;
+	node.m_Op=rotate?TRANSFORM_ROT:TRANSFORM;
+	node.m_Matrix=m;
+	node.m_Args[0]=a;
+	node.m_Uniform=a<m_Nodes.size() && m_Nodes[a].m_Uniform;
+	return AddNode(node);
+}
+
+unsigned int PDataExpression::Apply(Op op, unsigned int a, unsigned int b, unsigned int c)
+{
+	Node node;
+	node.m_Op=op;
+	node.m_Args[0]=a;
+	node.m_Args[1]=b;
+	node.m_Args[2]=c;
+	node.m_Uniform=true;
+	for (unsigned int i=0; i<GetOpArgs(op); i++)
+	{
+		if (node.m_Args[i]>=m_Nodes.size() || !m_Nodes[node.m_Args[i]].m_Uniform)
+		{
+			node.m_Uniform=false;
+		}
+	}
+	return AddNode(node);
+}
+
+///////////////////////////////////////////////////////////////
+// runs the nodes over a range of elements, for the thread pool
+
+class PDataExpression::Task : public ThreadPool::Task
+{
+public:
+	Task(const vector<Node> &nodes, unsigned int result) : 
+		m_Nodes(nodes), m_Result(result), m_Dst(NULL), m_DstType(0) 
+	{
+		m_Sources.resize(nodes.size(),NULL);
+		m_SourceTypes.resize(nodes.size(),0);
+		m_Uniforms.resize(nodes.size()*4,0);
+	}
+
+	virtual void Run(unsigned int start, unsigned int end);
+
+	/// Works out a node, for n elements from base
+	void Evaluate(unsigned int i, unsigned int base, unsigned int n, 
+		float *out, const float **args, const unsigned int *strides);
+
+	const vector<Node> &m_Nodes;
+	unsigned int m_Result;
+	/// The pdata for channel nodes
+	vector<const float *> m_Sources;
+	vector<char> m_SourceTypes;
+	/// The values of the uniform nodes
+	vector<float> m_Uniforms;
+	float *m_Dst;
+	char m_DstType;
+};
+
+void PDataExpression::Task::Evaluate(unsigned int i, unsigned int base, unsigned int n, 
+	float *out, const float **args, const unsigned int *strides)
+{
+	const Node &node=m_Nodes[i];
+	const float *a=args[node.m_Args[0]];
+	const float *b=args[node.m_Args[1]];
+	const float *c=args[node.m_Args[2]];
+	unsigned int sa=strides[node.m_Args[0]];
+	unsigned int sb=strides[node.m_Args[1]];
+	unsigned int sc=strides[node.m_Args[2]];
+
+	switch (node.m_Op)
+	{
+		case CONSTANT: 
+			for (unsigned int k=0; k<n; k++) Store(out+k*4,Load(node.m_Value));
+		break;
+		case INDEX:
+			for (unsigned int k=0; k<n; k++) 
+			{
+				float f=base+k;
+				Store(out+k*4,Set(f,f,f,f));
+			}
+		break;
+		case CHANNEL:
+		{
+			// only float arrays get here, vectors and colours are read in place
+			const float *src=m_Sources[i]+base;
+			for (unsigned int k=0; k<n; k++) Store(out+k*4,Set(src[k],src[k],src[k],src[k]));
+		}
+		break;
+		case TRANSFORM:
+		case TRANSFORM_ROT:
+		{
+			const float *m=node.m_Matrix.arr();
+			v4 c0=Load(m), c1=Load(m+4), c2=Load(m+8), c3=Load(m+12);
+			for (unsigned int k=0; k<n; k++) 
+			{
+				v4 p=Load(a+k*sa);
+				v4 r=Add(Add(Mul(c0,SplatX(p)),Mul(c1,SplatY(p))),Mul(c2,SplatZ(p)));
+				if (node.m_Op==TRANSFORM) r=Add(r,c3);
+				Store(out+k*4,r);
+			}
+		}
+		break;
+		case ADD: for (unsigned int k=0; k<n; k++) Store(out+k*4,Add(Load(a+k*sa),Load(b+k*sb))); break;
+		case SUB: for (unsigned int k=0; k<n; k++) Store(out+k*4,Sub(Load(a+k*sa),Load(b+k*sb))); break;
+		case MUL: for (unsigned int k=0; k<n; k++) Store(out+k*4,Mul(Load(a+k*sa),Load(b+k*sb))); break;
+		case DIV: for (unsigned int k=0; k<n; k++) Store(out+k*4,Div(Load(a+k*sa),Load(b+k*sb))); break;
+		case MIN: for (unsigned int k=0; k<n; k++) Store(out+k*4,Min(Load(a+k*sa),Load(b+k*sb))); break;
+		case MAX: for (unsigned int k=0; k<n; k++) Store(out+k*4,Max(Load(a+k*sa),Load(b+k*sb))); break;
+		case NEG: for (unsigned int k=0; k<n; k++) Store(out+k*4,Sub(Set(0,0,0,0),Load(a+k*sa))); break;
+		case ABS: for (unsigned int k=0; k<n; k++) Store(out+k*4,Abs(Load(a+k*sa))); break;
+		case SQRT: for (unsigned int k=0; k<n; k++) Store(out+k*4,Sqrt(Load(a+k*sa))); break;
+		case SIN: 
+			for (unsigned int k=0; k<n; k++) 
+			{
+				const float *p=a+k*sa;
+				Store(out+k*4,Set(sinf(p[0]),sinf(p[1]),sinf(p[2]),sinf(p[3])));
+			}
+		break;
+		case COS: 
+			for (unsigned int k=0; k<n; k++) 
+			{
+				const float *p=a+k*sa;
+				Store(out+k*4,Set(cosf(p[0]),cosf(p[1]),cosf(p[2]),cosf(p[3])));
+			}
+		break;
+		case FLOOR: 
+			for (unsigned int k=0; k<n; k++) 
+			{
+				const float *p=a+k*sa;
+				Store(out+k*4,Set(floorf(p[0]),floorf(p[1]),floorf(p[2]),floorf(p[3])));
+			}
+		break;
+		case DOT: for (unsigned int k=0; k<n; k++) Store(out+k*4,Dot3(Load(a+k*sa),Load(b+k*sb))); break;
+		case CROSS: for (unsigned int k=0; k<n; k++) Store(out+k*4,Cross(Load(a+k*sa),Load(b+k*sb))); break;
+		case LENGTH: 
+			for (unsigned int k=0; k<n; k++) 
+			{
+				v4 p=Load(a+k*sa);
+				Store(out+k*4,Sqrt(Dot3(p,p)));
+			}
+		break;
+		case NORMALISE: 
+		{
+			v4 tiny=Set(1e-20f,1e-20f,1e-20f,1e-20f);
+			for (unsigned int k=0; k<n; k++) 
+			{
+				v4 p=Load(a+k*sa);
+				Store(out+k*4,Div(p,Max(Sqrt(Dot3(p,p)),tiny)));
+			}
+		}
+		break;
+		case CLAMP: 
+			for (unsigned int k=0; k<n; k++) 
+			{
+				Store(out+k*4,Min(Max(Load(a+k*sa),Load(b+k*sb)),Load(c+k*sc)));
+			}
+		break;
+		case LERP: 
+			for (unsigned int k=0; k<n; k++) 
+			{
+				v4 p=Load(a+k*sa);
+				Store(out+k*4,Add(p,Mul(Sub(Load(b+k*sb),p),Load(c+k*sc))));
+			}
+		break;
+		case NOISE: 
+			for (unsigned int k=0; k<n; k++) 
+			{
+				const float *p=a+k*sa;
+				float f=Noise::noise(p[0],p[1],p[2]);
+				Store(out+k*4,Set(f,f,f,f));
+			}
+		break;
+		case X: for (unsigned int k=0; k<n; k++) Store(out+k*4,SplatX(Load(a+k*sa))); break;
+		case Y: for (unsigned int k=0; k<n; k++) Store(out+k*4,SplatY(Load(a+k*sa))); break;
+		case Z: for (unsigned int k=0; k<n; k++) Store(out+k*4,SplatZ(Load(a+k*sa))); break;
+		case W: for (unsigned int k=0; k<n; k++) Store(out+k*4,SplatW(Load(a+k*sa))); break;
+		case VECTOR: 
+			for (unsigned int k=0; k<n; k++) 
+			{
+				Store(out+k*4,Set(a[k*sa],b[k*sb],c[k*sc],1));
+			}
+		break;
+		default: break;
+	}
+}
+
+void PDataExpression::Task::Run(unsigned int start, unsigned int end)
+{
+	unsigned int count=m_Nodes.size();
+	vector<float> registers(count*BLOCK_SIZE*4);
+	vector<const float *> args(count);
+	vector<unsigned int> strides(count);
+
+	for (unsigned int base=start; base<end; base+=BLOCK_SIZE)
+	{
+		unsigned int n=end-base;
+		if (n>BLOCK_SIZE) n=BLOCK_SIZE;
+
+		for (unsigned int i=0; i<=m_Result; i++)
+		{
+			const Node &node=m_Nodes[i];
+			if (node.m_Uniform)
+			{
+				args[i]=&m_Uniforms[i*4];
+				strides[i]=0;
+			}
+			else if (node.m_Op==CHANNEL && m_SourceTypes[i]!='f')
+			{
+				// vectors and colours are four floats already
+				args[i]=m_Sources[i]+base*4;
+				strides[i]=4;
+			}
+			else
+			{
+				float *out=&registers[i*BLOCK_SIZE*4];
+				Evaluate(i,base,n,out,&args[0],&strides[0]);
+				args[i]=out;
+				strides[i]=4;
+			}
+		}
+
+		const float *result=args[m_Result];
+		unsigned int stride=strides[m_Result];
+		switch (m_DstType)
+		{
+			case 'v':
+			{
+				float *dst=m_Dst+base*4;
+				for (unsigned int k=0; k<n; k++)
+				{
+					dst[k*4]=result[k*stride];
+					dst[k*4+1]=result[k*stride+1];
+					dst[k*4+2]=result[k*stride+2];
+				}
+			}
+			break;
+			case 'c':
+			{
+				float *dst=m_Dst+base*4;
+				for (unsigned int k=0; k<n; k++) Store(dst+k*4,Load(result+k*stride));
+			}
+			break;
+			case 'f':
+			{
+				float *dst=m_Dst+base;
+				for (unsigned int k=0; k<n; k++) dst[k]=result[k*stride];
+			}
+			break;
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////
+
+bool PDataExpression::Run(PDataContainer &pdata, unsigned int result, const string &dst)
+{
+	if (result>=m_Nodes.size()) return false;
+	if (pdata.Size()==0) return true;
+
+	Task task(m_Nodes,result);
+	bool noise=false;
+
+	PData *out=pdata.FindData(PDataContainer::GetAtom(dst));
+	if (out==NULL)
+	{
+		Trace::Stream<<"PDataExpression::Run: pdata "<<dst<<" doesn't exist"<<endl;
+		return false;
+	}
+	
+	// written to, so a mapped array is copied before the
+	// sources are found in case it's one of them
+	out->Unmap();
+	unsigned int size=out->Size();
+
+	task.m_DstType=out->GetType();
+	switch (task.m_DstType)
+	{
+		case 'v': task.m_Dst=static_cast<TypedPData<dVector>*>(out)->m_Data[0].arr(); break;
+		case 'c': task.m_Dst=static_cast<TypedPData<dColour>*>(out)->m_Data[0].arr(); break;
+		case 'f': task.m_Dst=&static_cast<TypedPData<float>*>(out)->m_Data[0]; break;
+		default:
+			Trace::Stream<<"PDataExpression::Run: pdata "<<dst<<" is not a vector, colour or float array"<<endl;
+			return false;
+	}
+
+	// find the arrays
+	for (unsigned int i=0; i<=result; i++)
+	{
+		const Node &node=m_Nodes[i];
+		for (unsigned int a=0; a<GetOpArgs(node.m_Op); a++)
+		{
+			if (node.m_Args[a]>=i)
+			{
+				Trace::Stream<<"PDataExpression::Run: node "<<i<<" uses a later node"<<endl;
+				return false;
+			}
+		}
+
+		if (node.m_Op==CHANNEL)
+		{
+			const PData *pd=pdata.FindData(PDataContainer::GetAtom(node.m_Channel));
+			if (pd==NULL)
+			{
+				Trace::Stream<<"PDataExpression::Run: pdata "<<node.m_Channel<<" doesn't exist"<<endl;
+				return false;
+			}
+			char type=pd->GetType();
+			switch (type)
+			{
+				case 'v': task.m_Sources[i]=&static_cast<const TypedPData<dVector>*>(pd)->View()->x; break;
+				case 'c': task.m_Sources[i]=&static_cast<const TypedPData<dColour>*>(pd)->View()->r; break;
+				case 'f': task.m_Sources[i]=static_cast<const TypedPData<float>*>(pd)->View(); break;
+				default:
+					Trace::Stream<<"PDataExpression::Run: pdata "<<node.m_Channel<<" is not a vector, colour or float array"<<endl;
+					return false;
+			}
+			task.m_SourceTypes[i]=type;
+		}
+		else if (node.m_Op==NOISE)
+		{
+			noise=true;
+		}
+	}
+
+	// the noise tables are made on first use, which isn't thread safe
+	if (noise) Noise::noise(0);
+
+	// work out the uniform values once
+	vector<const float *> args(m_Nodes.size());
+	vector<unsigned int> strides(m_Nodes.size(),0);
+	for (unsigned int i=0; i<=result; i++)
+	{
+		args[i]=&task.m_Uniforms[i*4];
+		if (m_Nodes[i].m_Uniform) 
+		{
+			task.Evaluate(i,0,1,&task.m_Uniforms[i*4],&args[0],&strides[0]);
+		}
+	}
+
+	ThreadPool::Run(task,size,4096);
+	out->Dirty();
+	pdata.DataChanged();
+	return true;
+}
@@ -0,0 +1,111 @@
+// Copyright (C) 2010 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#ifndef N_PDATA_EXPRESSION
+#define N_PDATA_EXPRESSION
+
+#include <string>
+#include <vector>
+#include "PDataContainer.h"
+
+using namespace std;
+
+namespace Fluxus
+{
+
+///////////////////////////////////////////////////////////////
+/// A small compiled expression language for whole pdata arrays,
+/// so per element deformers don't need to call back into scheme.
+/// Expressions are built bottom up, each call returning a node 
+/// for use as an argument to later ones. All values are four 
+/// floats wide, vectors and colours use all of them, numbers are
+/// copied into every component. Nodes which don't depend on the
+/// pdata are worked out once, the rest are run in blocks of 
+/// elements with SSE, split between the ThreadPool's threads.
+class PDataExpression
+{
+public:
+	PDataExpression();
+	~PDataExpression();
+
+	enum Op 
+	{
+		CONSTANT, CHANNEL, INDEX, TRANSFORM, TRANSFORM_ROT,
+		ADD, SUB, MUL, DIV, MIN, MAX,
+		NEG, ABS, SQRT, SIN, COS, FLOOR,
+		DOT, CROSS, LENGTH, NORMALISE, 
+		CLAMP, LERP, NOISE, X, Y, Z, W, VECTOR, 
+		NUM_OPS
+	};
+
+	/// A constant value
+	unsigned int Constant(float x, float y, float z, float w);
+	/// Reads from a pdata array of the primitive, which must be
+	/// a vector, colour or float array
+	unsigned int Channel(const string &name);
+	/// The index of the element
+	unsigned int Index();
+	/// Transforms a vector by a matrix, if rotate is true the 
+	/// translation is ignored (as for normals)
+	unsigned int Transform(const dMatrix &m, unsigned int a, bool rotate);
+	/// An operation on previous nodes, see GetOpArgs() for how 
+	/// many arguments each op needs
+	unsigned int Apply(Op op, unsigned int a, unsigned int b=0, unsigned int c=0);
+
+	/// Finds an op from its name in scheme (eg "vadd" or "+"), 
+	/// returns false if there isn't one
+	static bool LookupOp(const string &name, Op &op);
+	/// The number of arguments an op takes
+	static unsigned int GetOpArgs(Op op);
+
+	/// Removes all the nodes
+	void Clear();
+
+	/// Runs the expression with the given node as the result, 
+	/// writing it to the dst array of the container. Returns
+	/// false and leaves the container alone if the arrays don't
+	/// exist or are the wrong type.
+	bool Run(PDataContainer &pdata, unsigned int result, const string &dst);
+
+private:
+	class Node
+	{
+	public:
+		Node() : m_Op(CONSTANT), m_Uniform(true)
+		{
+			m_Args[0]=m_Args[1]=m_Args[2]=0;
+			m_Value[0]=m_Value[1]=m_Value[2]=m_Value[3]=0;
+		}
+
+		Op m_Op;
+		unsigned int m_Args[3];
+		float m_Value[4];
+		dMatrix m_Matrix;
+		string m_Channel;
+		/// Doesn't depend on the element, so only runs once
+		bool m_Uniform;
+	};
+
+	class Task;
+
+	unsigned int AddNode(const Node &node);
+
+	vector<Node> m_Nodes;
+};
+
+}
+
+#endif
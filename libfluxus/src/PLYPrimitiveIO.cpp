@@ -0,0 +1,459 @@
+// Copyright (C) 2010 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+#include "ParticlePrimitive.h"
+#include "PLYPrimitiveIO.h"
+#include "SceneGraph.h"
+#include "Trace.h"
+
+using namespace Fluxus;
+
+static const unsigned int BUFFER_SIZE = 1024*1024;
+
+unsigned int PLYPrimitiveIO::m_Decimation = 1;
+
+PLYPrimitiveIO::Stream::Stream(FILE *file) :
+m_File(file),
+m_Buffer(BUFFER_SIZE),
+m_Pos(0),
+m_Size(0)
+{
+}
+
+PLYPrimitiveIO::Stream::~Stream()
+{
+}
+
+bool PLYPrimitiveIO::Stream::Fill(unsigned int n)
+{
+	if (m_Size-m_Pos>=n) return true;
+
+	// move what's left to the front, and read more after it
+	memmove(&m_Buffer[0],&m_Buffer[m_Pos],m_Size-m_Pos);
+	m_Size-=m_Pos;
+	m_Pos=0;
+	if (n>m_Buffer.size()) m_Buffer.resize(n*2);
+	m_Size+=fread(&m_Buffer[m_Size],1,m_Buffer.size()-m_Size,m_File);
+	return m_Size>=n;
+}
+
+const char *PLYPrimitiveIO::Stream::Take(unsigned int n)
+{
+	if (!Fill(n)) return NULL;
+	const char *ret=&m_Buffer[m_Pos];
+	m_Pos+=n;
+	return ret;
+}
+
+bool PLYPrimitiveIO::Stream::Line(const char *&start, const char *&end)
+{
+	unsigned int searched=0;
+	for (;;)
+	{
+		const char *buf=&m_Buffer[0];
+		const char *eol=(const char*)memchr(buf+m_Pos+searched,'\n',m_Size-m_Pos-searched);
+		if (eol!=NULL)
+		{
+			start=buf+m_Pos;
+			end=eol;
+			m_Pos=eol+1-buf;
+			break;
+		}
+
+		searched=m_Size-m_Pos;
+		if (!Fill(searched+1))
+		{
+			// the last line may not have a line end
+			if (m_Size==m_Pos) return false;
+			start=&m_Buffer[m_Pos];
+			end=&m_Buffer[0]+m_Size;
+			m_Pos=m_Size;
+			break;
+		}
+	}
+	if (end>start && end[-1]=='\r') end--;
+	return true;
+}
+
+/////////////////////////////////////////////
+
+unsigned int PLYPrimitiveIO::TypeSize(ValueType type)
+{
+	static const unsigned int sizes[] = { 0, 1, 1, 2, 2, 4, 4, 4, 8 };
+	return sizes[type];
+}
+
+double PLYPrimitiveIO::Decode(const char *src, ValueType type, bool swap)
+{
+	char tmp[8];
+	unsigned int size=TypeSize(type);
+	if (swap) for (unsigned int i=0; i<size; i++) tmp[i]=src[size-1-i];
+	else memcpy(tmp,src,size);
+
+	switch (type)
+	{
+		case INT8: { signed char v; memcpy(&v,tmp,1); return v; }
+		case UINT8: { unsigned char v; memcpy(&v,tmp,1); return v; }
+		case INT16: { short v; memcpy(&v,tmp,2); return v; }
+		case UINT16: { unsigned short v; memcpy(&v,tmp,2); return v; }
+		case INT32: { int v; memcpy(&v,tmp,4); return v; }
+		case UINT32: { unsigned int v; memcpy(&v,tmp,4); return v; }
+		case FLOAT32: { float v; memcpy(&v,tmp,4); return v; }
+		case FLOAT64: { double v; memcpy(&v,tmp,8); return v; }
+		default: return 0;
+	}
+}
+
+static bool LittleEndian()
+{
+	unsigned int i=1;
+	return *(char*)&i==1;
+}
+
+PLYPrimitiveIO::ValueType PLYPrimitiveIO::ParseType(const string &name)
+{
+	if (name=="char" || name=="int8") return INT8;
+	if (name=="uchar" || name=="uint8") return UINT8;
+	if (name=="short" || name=="int16") return INT16;
+	if (name=="ushort" || name=="uint16") return UINT16;
+	if (name=="int" || name=="int32") return INT32;
+	if (name=="uint" || name=="uint32") return UINT32;
+	if (name=="float" || name=="float32") return FLOAT32;
+	if (name=="double" || name=="float64") return FLOAT64;
+	return NONE;
+}
+
+/////////////////////////////////////////////
+
+PLYPrimitiveIO::PLYPrimitiveIO() :
+m_Format(ASCII)
+{
+}
+
+PLYPrimitiveIO::~PLYPrimitiveIO()
+{
+}
+
+Primitive *PLYPrimitiveIO::FormatRead(const string &filename)
+{
+	FILE *file=fopen(filename.c_str(),"rb");
+	if (file==NULL)
+	{
+		Trace::Stream<<"Cannot open .ply file: "<<filename<<endl;
+		return NULL;
+	}
+
+	Primitive *prim=NULL;
+	Stream stream(file);
+	if (ReadHeader(stream))
+	{
+		for (vector<Element>::iterator i=m_Elements.begin(); i!=m_Elements.end(); ++i)
+		{
+			if (i->Name=="vertex")
+			{
+				prim=ReadVertices(stream,*i,filename);
+				break;
+			}
+			else if (!SkipElement(stream,*i))
+			{
+				Trace::Stream<<"Error reading .ply file: "<<filename<<endl;
+				break;
+			}
+		}
+	}
+	else
+	{
+		Trace::Stream<<"Not a ply file I can read: "<<filename<<endl;
+	}
+
+	fclose(file);
+	return prim;
+}
+
+bool PLYPrimitiveIO::FormatWrite(const std::string &filename, const Primitive *ob, unsigned id,
+		const SceneGraph &world)
+{
+	Trace::Stream<<"Saving ply files is not supported"<<endl;
+	return false;
+}
+
+bool PLYPrimitiveIO::ReadHeader(Stream &stream)
+{
+	const char *start, *end;
+	if (!stream.Line(start,end) || string(start,end)!="ply") return false;
+
+	bool haveformat=false;
+	while (stream.Line(start,end))
+	{
+		istringstream line(string(start,end));
+		string keyword;
+		line>>keyword;
+
+		if (keyword=="format")
+		{
+			string format;
+			line>>format;
+			if (format=="ascii") m_Format=ASCII;
+			else if (format=="binary_little_endian") m_Format=BINARY_LE;
+			else if (format=="binary_big_endian") m_Format=BINARY_BE;
+			else return false;
+			haveformat=true;
+		}
+		else if (keyword=="element")
+		{
+			Element element;
+			line>>element.Name>>element.Count;
+			if (line.fail()) return false;
+			m_Elements.push_back(element);
+		}
+		else if (keyword=="property")
+		{
+			if (m_Elements.empty()) return false;
+
+			Property property;
+			property.CountType=NONE;
+			property.Slot=SKIP;
+			property.Scale=1;
+
+			string type,name;
+			line>>type;
+			if (type=="list")
+			{
+				string counttype;
+				line>>counttype>>type;
+				property.CountType=ParseType(counttype);
+				if (property.CountType==NONE) return false;
+			}
+			property.Type=ParseType(type);
+			line>>name;
+			if (property.Type==NONE || line.fail()) return false;
+
+			// the vertex properties we know about
+			if (property.CountType==NONE)
+			{
+				static const char *names[NUM_SLOTS][2] = { 
+					{"x",""}, {"y",""}, {"z",""}, 
+					{"red","diffuse_red"}, {"green","diffuse_green"}, {"blue","diffuse_blue"}, {"alpha",""},
+					{"nx",""}, {"ny",""}, {"nz",""} };
+				for (int s=0; s<NUM_SLOTS; s++)
+				{
+					if (name==names[s][0] || name==names[s][1]) property.Slot=s;
+				}
+				// colours stored as integers go from 0 to the type's maximum
+				if (property.Slot>=R && property.Slot<=A)
+				{
+					if (property.Type==UINT8) property.Scale=1/255.0f;
+					else if (property.Type==UINT16) property.Scale=1/65535.0f;
+				}
+			}
+			m_Elements.rbegin()->Properties.push_back(property);
+		}
+		else if (keyword=="end_header")
+		{
+			return haveformat;
+		}
+	}
+	return false;
+}
+
+bool PLYPrimitiveIO::ReadBinaryValue(Stream &stream, ValueType type, double &value)
+{
+	const char *src=stream.Take(TypeSize(type));
+	if (src==NULL) return false;
+	value=Decode(src,type,(m_Format==BINARY_LE)!=LittleEndian());
+	return true;
+}
+
+bool PLYPrimitiveIO::SkipElement(Stream &stream, const Element &element)
+{
+	const char *start, *end;
+	for (unsigned int n=0; n<element.Count; n++)
+	{
+		if (m_Format==ASCII) 
+		{
+			if (!stream.Line(start,end)) return false;
+			continue;
+		}
+
+		for (vector<Property>::const_iterator p=element.Properties.begin(); 
+			p!=element.Properties.end(); ++p)
+		{
+			unsigned int count=1;
+			if (p->CountType!=NONE)
+			{
+				double c;
+				if (!ReadBinaryValue(stream,p->CountType,c)) return false;
+				count=(unsigned int)c;
+			}
+			if (count>0 && stream.Take(count*TypeSize(p->Type))==NULL) return false;
+		}
+	}
+	return true;
+}
+
+Primitive *PLYPrimitiveIO::ReadVertices(Stream &stream, const Element &element, const string &filename)
+{
+	bool slots[NUM_SLOTS];
+	for (int s=0; s<NUM_SLOTS; s++) slots[s]=false;
+
+	// records without lists are a fixed size, and can be read in one go
+	bool fixed=true;
+	unsigned int recordsize=0;
+	vector<unsigned int> offsets;
+	for (vector<Property>::const_iterator p=element.Properties.begin(); 
+		p!=element.Properties.end(); ++p)
+	{
+		if (p->Slot!=SKIP) slots[p->Slot]=true;
+		if (p->CountType!=NONE) fixed=false;
+		offsets.push_back(recordsize);
+		recordsize+=TypeSize(p->Type);
+	}
+
+	if (!slots[X] || !slots[Y] || !slots[Z])
+	{
+		Trace::Stream<<filename<<" has no vertex positions"<<endl;
+		return NULL;
+	}
+
+	unsigned int decimation=m_Decimation;
+	unsigned int size=(element.Count+decimation-1)/decimation;
+	if (size==0) return NULL;
+
+	ParticlePrimitive *prim=new ParticlePrimitive;
+	prim->Resize(size);
+	dVector *pos=&(*prim->GetDataVec<dVector>("p"))[0];
+	dColour *col=&(*prim->GetDataVec<dColour>("c"))[0];
+	dVector *sizes=&(*prim->GetDataVec<dVector>("s"))[0];
+	dVector *nrm=NULL;
+	if (slots[NX] || slots[NY] || slots[NZ])
+	{
+		prim->AddData("n",new TypedPData<dVector>(size));
+		nrm=&(*prim->GetDataVec<dVector>("n"))[0];
+	}
+
+	bool colour=slots[R] || slots[G] || slots[B];
+	bool swap=m_Format!=ASCII && (m_Format==BINARY_LE)!=LittleEndian();
+	float values[NUM_SLOTS];
+	unsigned int progress=element.Count/10;
+	unsigned int kept=0;
+	bool ok=true;
+
+	for (unsigned int n=0; n<element.Count && ok; n++)
+	{
+		bool keep=n%decimation==0;
+
+		if (element.Count>=1000000 && n%progress==0 && n>0)
+		{
+			Trace::Stream<<"Loading "<<filename<<" "<<n/progress*10<<"%"<<endl;
+		}
+
+		values[R]=values[G]=values[B]=values[A]=1;
+		values[NX]=values[NY]=values[NZ]=0;
+
+		if (m_Format==ASCII)
+		{
+			const char *start, *end;
+			if (!stream.Line(start,end)) 
+			{
+				ok=false;
+				break;
+			}
+			if (!keep) continue;
+
+			// strtod needs it null terminated
+			string line(start,end);
+			const char *str=line.c_str();
+			for (vector<Property>::const_iterator p=element.Properties.begin(); 
+				p!=element.Properties.end(); ++p)
+			{
+				char *next;
+				unsigned int count=1;
+				if (p->CountType!=NONE) 
+				{
+					count=(unsigned int)strtod(str,&next);
+					str=next;
+				}
+				for (unsigned int c=0; c<count; c++)
+				{
+					double v=strtod(str,&next);
+					if (next==str) ok=false;
+					str=next;
+					if (p->Slot!=SKIP) values[p->Slot]=v*p->Scale;
+				}
+			}
+			if (!ok) break;
+		}
+		else if (fixed)
+		{
+			const char *record=stream.Take(recordsize);
+			if (record==NULL)
+			{
+				ok=false;
+				break;
+			}
+			if (!keep) continue;
+
+			for (unsigned int i=0; i<element.Properties.size(); i++)
+			{
+				const Property &p=element.Properties[i];
+				if (p.Slot!=SKIP) values[p.Slot]=Decode(record+offsets[i],p.Type,swap)*p.Scale;
+			}
+		}
+		else
+		{
+			for (vector<Property>::const_iterator p=element.Properties.begin(); 
+				p!=element.Properties.end() && ok; ++p)
+			{
+				double v;
+				unsigned int count=1;
+				if (p->CountType!=NONE) 
+				{
+					ok=ReadBinaryValue(stream,p->CountType,v);
+					count=(unsigned int)v;
+				}
+				for (unsigned int c=0; c<count && ok; c++)
+				{
+					ok=ReadBinaryValue(stream,p->Type,v);
+					if (p->Slot!=SKIP) values[p->Slot]=v*p->Scale;
+				}
+			}
+			if (!ok || !keep) continue;
+		}
+
+		pos[kept]=dVector(values[X],values[Y],values[Z]);
+		if (colour) col[kept]=dColour(values[R],values[G],values[B],values[A]);
+		else col[kept]=dColour(1,1,1);
+		sizes[kept]=dVector(0.1,0.1,0.1);
+		if (nrm) nrm[kept]=dVector(values[NX],values[NY],values[NZ],0);
+		kept++;
+	}
+
+	if (!ok)
+	{
+		Trace::Stream<<filename<<" is truncated or corrupt, loaded "<<kept<<" of "<<size<<" points"<<endl;
+		if (kept==0)
+		{
+			delete prim;
+			return NULL;
+		}
+		prim->Resize(kept);
+	}
+	return prim;
+}
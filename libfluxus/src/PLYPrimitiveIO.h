@@ -0,0 +1,109 @@
+// Copyright (C) 2010 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#ifndef FLUX_PLY_PRIMITIVE_IO
+#define FLUX_PLY_PRIMITIVE_IO
+
+#include "PrimitiveIO.h"
+#include "SceneGraph.h"
+#include <vector>
+#include <string>
+#include <cstdio>
+
+namespace Fluxus
+{
+
+//////////////////////////////////////////////////////
+/// Loads the vertices of ply files (ascii or binary of
+/// either endianness) into a particle primitive, for
+/// viewing scanned point clouds. Positions, colours and
+/// normals are read straight into the pdata as the file
+/// is streamed through a small buffer, so the only 
+/// memory used is the primitive itself. Faces are ignored.
+class PLYPrimitiveIO : public PrimitiveIO
+{
+public:
+	PLYPrimitiveIO();
+	virtual ~PLYPrimitiveIO();
+	virtual Primitive *FormatRead(const std::string &filename);
+	virtual bool FormatWrite(const std::string &filename, const Primitive *ob, unsigned id,
+			const SceneGraph &world);
+	/// Point clouds are too big to keep a spare copy of
+	virtual bool CacheInMemory() const { return false; }
+
+	/// Only keep every nth vertex when loading, 1 keeps them all
+	static void SetDecimation(unsigned int s) { m_Decimation=s<1?1:s; }
+	static unsigned int GetDecimation() { return m_Decimation; }
+
+private:
+	enum Format { ASCII, BINARY_LE, BINARY_BE };
+	enum ValueType { NONE, INT8, UINT8, INT16, UINT16, INT32, UINT32, FLOAT32, FLOAT64 };
+
+	/// Where a vertex property goes
+	enum Slot { SKIP=-1, X, Y, Z, R, G, B, A, NX, NY, NZ, NUM_SLOTS };
+
+	struct Property
+	{
+		ValueType Type;
+		ValueType CountType; // NONE unless it's a list
+		int Slot;
+		float Scale; // for normalising integer colours
+	};
+
+	struct Element
+	{
+		std::string Name;
+		unsigned int Count;
+		std::vector<Property> Properties;
+	};
+
+	/// Buffers the file so records can be read in place
+	class Stream
+	{
+	public:
+		Stream(FILE *file);
+		~Stream();
+		/// Returns a pointer to the next n bytes, or NULL at 
+		/// the end of the file, valid until the next call
+		const char *Take(unsigned int n);
+		/// Returns the next line without the line end, or false
+		bool Line(const char *&start, const char *&end);
+	private:
+		bool Fill(unsigned int n);
+		FILE *m_File;
+		std::vector<char> m_Buffer;
+		unsigned int m_Pos;
+		unsigned int m_Size;
+	};
+
+	bool ReadHeader(Stream &stream);
+	bool SkipElement(Stream &stream, const Element &element);
+	Primitive *ReadVertices(Stream &stream, const Element &element, const std::string &filename);
+	bool ReadBinaryValue(Stream &stream, ValueType type, double &value);
+
+	static unsigned int TypeSize(ValueType type);
+	static double Decode(const char *src, ValueType type, bool swap);
+	static ValueType ParseType(const std::string &name);
+
+	Format m_Format;
+	std::vector<Element> m_Elements;
+
+	static unsigned int m_Decimation;
+};
+
+}
+
+#endif
@@ -18,8 +18,15 @@
 #include "ParticlePrimitive.h"
 #include "State.h"
 
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
 using namespace Fluxus;
 
+vector<ParticlePrimitive::BillboardVertex> ParticlePrimitive::m_Billboards;
+RadixSort ParticlePrimitive::m_Sorter;
+
 ParticlePrimitive::ParticlePrimitive()
 {
 	AddData("p",new TypedPData<dVector>);
@@ -48,10 +55,17 @@ ParticlePrimitive* ParticlePrimitive::Clone() const
 
 void ParticlePrimitive::PDataDirty()
 {
-	m_VertData=GetDataVec<dVector>("p");
-	m_ColData=GetDataVec<dColour>("c");
-	m_SizeData=GetDataVec<dVector>("s");
-	m_RotateData=GetDataVec<float>("r");
+	m_VertData=GetDataView<dVector>("p");
+	m_ColData=GetDataView<dColour>("c");
+	m_SizeData=GetDataView<dVector>("s");
+}
+
+void ParticlePrimitive::AddParticle(const dVector &v, const dColour &c, const dVector &s) 
+{ 
+	GetDataVec<dVector>("p")->push_back(v); 
+	GetDataVec<dColour>("c")->push_back(c); 
+	GetDataVec<dVector>("s")->push_back(s); 
+	GetDataVec<float>("r")->push_back(0); 
 }
 	
 void ParticlePrimitive::Render()
@@ -64,8 +78,8 @@ void ParticlePrimitive::Render()
 		glDisableClientState(GL_TEXTURE_COORD_ARRAY);
 		glEnableClientState(GL_COLOR_ARRAY);
 
-		glVertexPointer(3,GL_FLOAT,sizeof(dVector),(void*)m_VertData->begin()->arr());
-		glColorPointer(4,GL_FLOAT,sizeof(dColour),(void*)m_ColData->begin()->arr());
+		glVertexPointer(3,GL_FLOAT,sizeof(dVector),m_VertData->View());
+		glColorPointer(4,GL_FLOAT,sizeof(dColour),m_ColData->View());
 
 		//glEnable(GL_BLEND);
 	    //glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
@@ -74,7 +88,7 @@ void ParticlePrimitive::Render()
 		if (m_State.Hints & HINT_AALIAS) glEnable(GL_POINT_SMOOTH);
 		else glDisable(GL_POINT_SMOOTH);
 
-		glDrawArrays(GL_POINTS,0,m_VertData->size());
+		glDrawArrays(GL_POINTS,0,m_VertData->Size());
 
 		glDisableClientState(GL_COLOR_ARRAY);
 		glEnableClientState(GL_NORMAL_ARRAY);
@@ -83,87 +97,199 @@ void ParticlePrimitive::Render()
 
 	if (m_State.Hints & HINT_SOLID)
 	{
-		dVector cameradir=GetLocalCameraDir();
-		dVector across=GetLocalCameraUp().cross(cameradir);
-		across.normalise();
-		dVector down=across.cross(cameradir);
-		down.normalise();
-		
+		const unsigned int *order=NULL;
 		if (m_State.Hints & HINT_DEPTH_SORT)
 		{
 			dMatrix ModelView2;
 			glGetFloatv(GL_MODELVIEW_MATRIX,ModelView2.arr());
-			
-			list<SortItem> sorted;
-			for (unsigned int n=0; n<m_VertData->size(); n++)
-			{
-				dVector t=ModelView2.transform((*m_VertData)[n]);
-				sorted.push_back(SortItem(n, t.z));
-			}
-			sorted.sort();
-			
-			glBegin(GL_QUADS);
-			for (list<SortItem>::iterator i=sorted.begin(); i!=sorted.end(); ++i)
+
+			// only the eye space depth is needed
+			m_Sorter.Clear();
+			const dVector *verts=m_VertData->View();
+			for (unsigned int n=0; n<m_VertData->Size(); n++)
 			{
-				dVector scaledacross(across*(*m_SizeData)[i->Index].x*0.5);
-				dVector scaledown(down*(*m_SizeData)[i->Index].y*0.5);
-				glColor4fv((*m_ColData)[i->Index].arr());
-				glTexCoord2f(0,0);
-				glVertex3fv(((*m_VertData)[i->Index]-scaledacross-scaledown).arr());
-				glTexCoord2f(0,1);
-				glVertex3fv(((*m_VertData)[i->Index]-scaledacross+scaledown).arr());
-				glTexCoord2f(1,1);
-				glVertex3fv(((*m_VertData)[i->Index]+scaledacross+scaledown).arr());
-				glTexCoord2f(1,0);
-				glVertex3fv(((*m_VertData)[i->Index]+scaledacross-scaledown).arr());
+				const dVector &v=verts[n];
+				m_Sorter.Add(v.x*ModelView2.m[0][2] + v.y*ModelView2.m[1][2] + 
+							 v.z*ModelView2.m[2][2] + v.w*ModelView2.m[3][2], n);
 			}
-			glEnd();
+
+			const vector<unsigned int> &sorted=m_Sorter.Sort();
+			if (!sorted.empty()) order=&sorted[0];
+		}
+
+		if ((m_State.Hints & HINT_SPRITE) && GLEW_ARB_point_sprite && 
+			GLEW_ARB_point_parameters && UniformSize())
+		{
+			RenderSprites(order);
 		}
 		else
 		{
-			glBegin(GL_QUADS);
-			for (unsigned int n=0; n<m_VertData->size(); n++)
-			{
-				dVector scaledacross(across*(*m_SizeData)[n].x*0.5);
-				dVector scaledown(down*(*m_SizeData)[n].y*0.5);
-				glColor4fv((*m_ColData)[n].arr());
-				glTexCoord2f(0,0);
-				glVertex3fv(((*m_VertData)[n]-scaledacross-scaledown).arr());
-				glTexCoord2f(0,1);
-				glVertex3fv(((*m_VertData)[n]-scaledacross+scaledown).arr());
-				glTexCoord2f(1,1);
-				glVertex3fv(((*m_VertData)[n]+scaledacross+scaledown).arr());
-				glTexCoord2f(1,0);
-				glVertex3fv(((*m_VertData)[n]+scaledacross-scaledown).arr());
-			}
-			glEnd();
+			RenderBillboards(order);
 		}
 	}
 	glEnable(GL_LIGHTING);
 }
 
+void ParticlePrimitive::ExpandBillboards(const dVector &across, const dVector &down, const unsigned int *order)
+{
+	unsigned int count=m_VertData->Size();
+	if (m_Billboards.size()<count*4)
+	{
+		unsigned int start=m_Billboards.size();
+		m_Billboards.resize(count*4);
+		// the texture coordinates are always the same
+		for (unsigned int n=start; n<m_Billboards.size(); n+=4)
+		{
+			m_Billboards[n].Tex[0]=0; m_Billboards[n].Tex[1]=0;
+			m_Billboards[n+1].Tex[0]=0; m_Billboards[n+1].Tex[1]=1;
+			m_Billboards[n+2].Tex[0]=1; m_Billboards[n+2].Tex[1]=1;
+			m_Billboards[n+3].Tex[0]=1; m_Billboards[n+3].Tex[1]=0;
+		}
+	}
+
+	const dVector *verts=m_VertData->View();
+	const dColour *cols=m_ColData->View();
+	const dVector *sizes=m_SizeData->View();
+	BillboardVertex *out=&m_Billboards[0];
+
+#ifdef __SSE__
+	// w is zero, so the positions keep theirs
+	__m128 halfacross=_mm_set_ps(0,across.z*0.5f,across.y*0.5f,across.x*0.5f);
+	__m128 halfdown=_mm_set_ps(0,down.z*0.5f,down.y*0.5f,down.x*0.5f);
+
+	for (unsigned int n=0; n<count; n++, out+=4)
+	{
+		unsigned int i=order?order[n]:n;
+		__m128 pos=_mm_loadu_ps(&verts[i].x);
+		__m128 col=_mm_loadu_ps(&cols[i].r);
+		__m128 scaledacross=_mm_mul_ps(halfacross,_mm_set1_ps(sizes[i].x));
+		__m128 scaledown=_mm_mul_ps(halfdown,_mm_set1_ps(sizes[i].y));
+		__m128 left=_mm_sub_ps(pos,scaledacross);
+		__m128 right=_mm_add_ps(pos,scaledacross);
+		_mm_storeu_ps(&out[0].Pos.x,_mm_sub_ps(left,scaledown));
+		_mm_storeu_ps(&out[1].Pos.x,_mm_add_ps(left,scaledown));
+		_mm_storeu_ps(&out[2].Pos.x,_mm_add_ps(right,scaledown));
+		_mm_storeu_ps(&out[3].Pos.x,_mm_sub_ps(right,scaledown));
+		_mm_storeu_ps(&out[0].Col.r,col);
+		_mm_storeu_ps(&out[1].Col.r,col);
+		_mm_storeu_ps(&out[2].Col.r,col);
+		_mm_storeu_ps(&out[3].Col.r,col);
+	}
+#else
+	for (unsigned int n=0; n<count; n++, out+=4)
+	{
+		unsigned int i=order?order[n]:n;
+		dVector scaledacross(across*sizes[i].x*0.5);
+		dVector scaledown(down*sizes[i].y*0.5);
+		out[0].Pos=verts[i]-scaledacross-scaledown;
+		out[1].Pos=verts[i]-scaledacross+scaledown;
+		out[2].Pos=verts[i]+scaledacross+scaledown;
+		out[3].Pos=verts[i]+scaledacross-scaledown;
+		out[0].Col=out[1].Col=out[2].Col=out[3].Col=cols[i];
+	}
+#endif
+}
+
+void ParticlePrimitive::RenderBillboards(const unsigned int *order)
+{
+	if (m_VertData->Size()==0) return;
+
+	dVector cameradir=GetLocalCameraDir();
+	dVector across=GetLocalCameraUp().cross(cameradir);
+	across.normalise();
+	dVector down=across.cross(cameradir);
+	down.normalise();
+
+	ExpandBillboards(across,down,order);
+
+	glDisableClientState(GL_NORMAL_ARRAY);
+	glEnableClientState(GL_COLOR_ARRAY);
+
+	glVertexPointer(3,GL_FLOAT,sizeof(BillboardVertex),&m_Billboards[0].Pos.x);
+	glColorPointer(4,GL_FLOAT,sizeof(BillboardVertex),&m_Billboards[0].Col.r);
+	glTexCoordPointer(2,GL_FLOAT,sizeof(BillboardVertex),m_Billboards[0].Tex);
+	glDrawArrays(GL_QUADS,0,m_VertData->Size()*4);
+
+	glDisableClientState(GL_COLOR_ARRAY);
+	glEnableClientState(GL_NORMAL_ARRAY);
+}
+
+void ParticlePrimitive::RenderSprites(const unsigned int *order)
+{
+	if (m_VertData->Size()==0) return;
+
+	// the size in pixels of a particle one unit away from the
+	// camera, the distance attenuation divides it by the distance
+	dMatrix projection;
+	glGetFloatv(GL_PROJECTION_MATRIX,projection.arr());
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT,viewport);
+	float size=m_SizeData->View()[0].x*projection.m[1][1]*viewport[3]*0.5f;
+
+	float attenuation[3]={0,0,1};
+	glPointParameterfvARB(GL_POINT_DISTANCE_ATTENUATION_ARB,attenuation);
+	glPointSize(size);
+	glEnable(GL_POINT_SPRITE_ARB);
+	glTexEnvi(GL_POINT_SPRITE_ARB,GL_COORD_REPLACE_ARB,GL_TRUE);
+
+	glDisableClientState(GL_NORMAL_ARRAY);
+	glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+	glEnableClientState(GL_COLOR_ARRAY);
+
+	glVertexPointer(3,GL_FLOAT,sizeof(dVector),m_VertData->View());
+	glColorPointer(4,GL_FLOAT,sizeof(dColour),m_ColData->View());
+
+	if (order) glDrawElements(GL_POINTS,m_VertData->Size(),GL_UNSIGNED_INT,order);
+	else glDrawArrays(GL_POINTS,0,m_VertData->Size());
+
+	glDisableClientState(GL_COLOR_ARRAY);
+	glEnableClientState(GL_NORMAL_ARRAY);
+	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+
+	glTexEnvi(GL_POINT_SPRITE_ARB,GL_COORD_REPLACE_ARB,GL_FALSE);
+	glDisable(GL_POINT_SPRITE_ARB);
+	attenuation[0]=1;
+	attenuation[2]=0;
+	glPointParameterfvARB(GL_POINT_DISTANCE_ATTENUATION_ARB,attenuation);
+	glPointSize(m_State.PointWidth);
+}
+
+bool ParticlePrimitive::UniformSize()
+{
+	if (m_SizeData->Size()==0) return false;
+	const dVector *sizes=m_SizeData->View();
+	float size=sizes[0].x;
+	for (unsigned int n=0; n<m_SizeData->Size(); n++)
+	{
+		if (sizes[n].x!=size || sizes[n].y!=size) return false;
+	}
+	return true;
+}
+
 dBoundingBox ParticlePrimitive::GetBoundingBox(const dMatrix &space)
 {
 	dBoundingBox box;
-	for (vector<dVector,FLX_ALLOC(dVector) >::iterator i=m_VertData->begin(); i!=m_VertData->end(); ++i)
+	const dVector *verts=m_VertData->View();
+	for (unsigned int n=0; n<m_VertData->Size(); n++)
 	{
-		box.expand(space.transform(*i));
+		box.expand(space.transform(verts[n]));
 	}
 	return box;
 }
 
 void ParticlePrimitive::ApplyTransform(bool ScaleRotOnly)
 {
+	vector<dVector,FLX_ALLOC(dVector) > *verts=GetDataVec<dVector>("p");
 	if (!ScaleRotOnly)
 	{
-		for (vector<dVector,FLX_ALLOC(dVector) >::iterator i=m_VertData->begin(); i!=m_VertData->end(); ++i)
+		for (vector<dVector,FLX_ALLOC(dVector) >::iterator i=verts->begin(); i!=verts->end(); ++i)
 		{
 			*i=GetState()->Transform.transform(*i);
 		}
 	}
 	else
 	{
-		for (vector<dVector,FLX_ALLOC(dVector) >::iterator i=m_VertData->begin(); i!=m_VertData->end(); ++i)
+		for (vector<dVector,FLX_ALLOC(dVector) >::iterator i=verts->begin(); i!=verts->end(); ++i)
 		{
 			*i=GetState()->Transform.transform_no_trans(*i);
 		}
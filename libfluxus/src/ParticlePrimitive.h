@@ -18,6 +18,7 @@
 #define N_PARTICLEPRIM
 
 #include "Primitive.h"
+#include "RadixSort.h"
 
 namespace Fluxus
 {
@@ -42,13 +43,7 @@ public:
 	virtual Evaluator *MakeEvaluator() { return NULL; }
 	///@}
 	
-	void AddParticle(const dVector &v, const dColour &c, const dVector &s) 
-	{ 
-		m_VertData->push_back(v); 
-		m_ColData->push_back(c); 
-		m_SizeData->push_back(s); 
-		m_RotateData->push_back(0); 
-	}
+	void AddParticle(const dVector &v, const dColour &c, const dVector &s);
 
 protected:
 
@@ -56,24 +51,34 @@ protected:
 
 private:
 
-	vector<dVector,FLX_ALLOC(dVector) > *m_VertData;
-	vector<dColour,FLX_ALLOC(dColour) > *m_ColData;
-	vector<dVector,FLX_ALLOC(dVector) > *m_SizeData;
-	vector<float,FLX_ALLOC(float) > *m_RotateData;
+	/// Builds the camera facing quads into the billboard
+	/// buffer, in the order given or pdata order if NULL
+	void ExpandBillboards(const dVector &across, const dVector &down, const unsigned int *order);
+	void RenderBillboards(const unsigned int *order);
+	void RenderSprites(const unsigned int *order);
+	bool UniformSize();
+
+	// read only, so mapped arrays are drawn from the file,
+	// writes go through GetDataVec()
+	const TypedPData<dVector> *m_VertData;
+	const TypedPData<dColour> *m_ColData;
+	const TypedPData<dVector> *m_SizeData;
 	
-	class SortItem
+	/// One corner of a particle quad, interleaved for a single
+	/// glDrawArrays - the position and colour are four floats 
+	/// each so the expansion can work on whole sse registers
+	class BillboardVertex
 	{
 	public:
-		SortItem(int i, float d) : Index(i), Depth(d) {}
-
-		int Index;
-		float Depth;
-		
-		bool operator<(const SortItem &other) const
-		{
-			return Depth<other.Depth;
-		}
+		dVector Pos;
+		dColour Col;
+		float Tex[4];
 	};
+
+	// shared between particle primitives, they're only 
+	// needed while rendering
+	static vector<BillboardVertex> m_Billboards;
+	static RadixSort m_Sorter;
 };
 
 }
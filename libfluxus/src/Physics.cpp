@@ -211,6 +211,7 @@ void Physics::SetupTransform(Primitive *p, dMatrix &rotation, dVector &Pos)
 	// state transform for the object, and the bounding volume will be correct.
 	// can't undo this.	
 	p->ApplyTransform(false);
+	p->DirtyBounds();
 	
     // make sure object's transform is in sync with physics right away, so we can use it in scripts directly
     ObState->Transform=rotation;
@@ -238,6 +239,7 @@ void Physics::MakeActive(int ID, float Mass, BoundingType Bound)
     dMatrix rotation;
     dVector Pos;
     SetupTransform(Ob->Prim,rotation,Pos);
+    m_Renderer->DirtyTransform(ID);
     dMatrix ident;
 	  	
 	// get the bounding box from the fluxus object
@@ -379,6 +381,7 @@ void Physics::MakePassive(int ID, float Mass, BoundingType Bound)
     dMatrix rotation;
     dVector Pos;
     SetupTransform(Ob->Prim,rotation,Pos);
+    m_Renderer->DirtyTransform(ID);
     dMatrix ident;
 	
 	// this tells ode to attach joints to the static environment if they are attached
@@ -575,6 +578,7 @@ void Physics::UpdatePrimitives()
 				
 			i->second->Prim->GetState()->Transform=Rot;
 			i->second->Prim->GetState()->Transform.settranslate(PosVec);
+			m_Renderer->DirtyTransform(i->first);
 		}
 	}
 }
@@ -118,7 +118,7 @@ m_RendererActive(RendererActive)
 
 		glBindTexture(GL_TEXTURE_2D, m_Textures[0]);
 		gluBuild2DMipmaps(GL_TEXTURE_2D, 4, m_Width, m_Height,
-				GL_RGBA, GL_FLOAT, &(*m_ColourData)[0]);
+				GL_RGBA, GL_FLOAT, m_ColourPData->View());
 		glBindTexture(GL_TEXTURE_2D, 0);
 
 		cerr << "FBO is not supported" << endl;
@@ -196,8 +196,9 @@ PixelPrimitive* PixelPrimitive::Clone() const
 
 void PixelPrimitive::PDataDirty()
 {
-	// reset pointers
-	m_ColourData=GetDataVec<dColour>("c");
+	// reset pointers, without copying a mapped array
+	m_ColourPData=dynamic_cast<TypedPData<dColour>*>(FindData(GetAtom("c")));
+	m_ColourData=&m_ColourPData->m_Data;
 }
 
 void PixelPrimitive::ResizeFBO(int w, int h)
@@ -255,7 +256,7 @@ void PixelPrimitive::ResizeFBO(int w, int h)
 			CHECK_GL_ERRORS("ResizeFBO GlGenerateMipmapEXT");
 			/* upload pdata to the top left corner of m_Width x m_Height size */
 			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_Width, m_Height,
-					GL_RGBA, GL_FLOAT, &(*m_ColourData)[0]);
+					GL_RGBA, GL_FLOAT, m_ColourPData->View());
 			CHECK_GL_ERRORS("ResizeFBO glTexSubImage2D");
 
 			glBindTexture(GL_TEXTURE_2D, 0);
@@ -547,7 +548,7 @@ void PixelPrimitive::UploadPData()
 	glBindTexture(GL_TEXTURE_2D, m_RenderTexture);
 
 	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_Width, m_Height,
-			GL_RGBA, GL_FLOAT, &(*m_ColourData)[0]);
+			GL_RGBA, GL_FLOAT, m_ColourPData->View());
 	glBindTexture(GL_TEXTURE_2D, 0);
 }
 
@@ -568,7 +569,10 @@ void PixelPrimitive::DownloadPData()
 
 		glReadBuffer(GL_COLOR_ATTACHMENT0_EXT + textureIndex);
 		glPixelStorei(GL_PACK_ALIGNMENT, 1);
+		// written to, so a mapped array is copied first
+		m_ColourPData->Unmap();
 		glReadPixels(0, 0, m_Width, m_Height, GL_RGBA, GL_FLOAT, &(*m_ColourData)[0]);
+		m_ColourPData->Dirty();
 
 		Unbind();
 	}
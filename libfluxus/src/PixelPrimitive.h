@@ -49,6 +49,7 @@ public:
 	virtual void ApplyTransform(bool ScaleRotOnly=false);
 	virtual string GetTypeName() { return "PixelPrimitive"; }
 	virtual Evaluator *MakeEvaluator() { return NULL; }
+	virtual bool RestoresGLState() { return false; }
 	///@}
 
 	/// Create a new FBO and release the old one if exists
@@ -113,6 +114,9 @@ protected:
 	void UploadPData();
 
 	vector<dVector,FLX_ALLOC(dVector) > m_Points;
+	// the colours, read them through View() so a mapped array 
+	// stays mapped, m_ColourData is only valid after Unmap()
+	TypedPData<dColour> *m_ColourPData;
 	vector<dColour,FLX_ALLOC(dColour) > *m_ColourData;
 
 	unsigned m_MaxTextures;
@@ -0,0 +1,123 @@
+// Copyright (C) 2010 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#include <algorithm>
+#include "Renderer.h"
+#include "PointCloudPrimitive.h"
+#include "State.h"
+#include "Trace.h"
+
+using namespace Fluxus;
+
+PointCloudPrimitive::PointCloudPrimitive(PointOctree *octree) :
+m_Octree(octree),
+m_Budget(1000000),
+m_MaxError(1),
+m_NumDrawn(0)
+{
+	m_Octree->SetCacheSize(m_Budget*4);
+}
+
+PointCloudPrimitive::PointCloudPrimitive(const PointCloudPrimitive &other) :
+ParticlePrimitive(other),
+m_Octree(other.m_Octree),
+m_Budget(other.m_Budget),
+m_MaxError(other.m_MaxError),
+m_NumDrawn(0),
+m_Gathered(other.m_Gathered)
+{
+	m_Octree->AddRef();
+}
+
+PointCloudPrimitive::~PointCloudPrimitive()
+{
+	m_Octree->Release();
+}
+
+PointCloudPrimitive* PointCloudPrimitive::Clone() const
+{
+	return new PointCloudPrimitive(*this);
+}
+
+void PointCloudPrimitive::SetBudget(unsigned int s)
+{
+	m_Budget=s;
+	// keep some nodes around for when the camera moves back
+	m_Octree->SetCacheSize(s*4);
+}
+
+void PointCloudPrimitive::Render()
+{
+	dMatrix modelview,projection;
+	glGetFloatv(GL_MODELVIEW_MATRIX,modelview.arr());
+	glGetFloatv(GL_PROJECTION_MATRIX,projection.arr());
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT,viewport);
+	float pixelscale=projection.m[1][1]*viewport[3]*0.5f;
+
+	m_Octree->Select(modelview,projection,pixelscale,m_Budget,m_MaxError,m_Selected);
+	
+	// the same nodes are chosen while the camera is still
+	if (m_Selected!=m_Gathered) Gather();
+	m_NumDrawn=Size();
+	
+	ParticlePrimitive::Render();
+}
+
+void PointCloudPrimitive::Gather()
+{
+	unsigned int total=0;
+	for (vector<const PointOctree::Node*>::iterator i=m_Selected.begin(); i!=m_Selected.end(); ++i)
+	{
+		total+=(*i)->Count;
+	}
+
+	// resizing keeps the arrays, so the particle primitive's
+	// pointers to them are still good
+	Resize(total);
+	dVector *pos=total?&(*GetDataVec<dVector>("p"))[0]:NULL;
+	dColour *col=total?&(*GetDataVec<dColour>("c"))[0]:NULL;
+	dVector *sizes=total?&(*GetDataVec<dVector>("s"))[0]:NULL;
+	for (vector<const PointOctree::Node*>::iterator i=m_Selected.begin(); i!=m_Selected.end(); ++i)
+	{
+		unsigned int count=(*i)->Count;
+		copy((*i)->GetPositions(),(*i)->GetPositions()+count,pos);
+		copy((*i)->GetColours(),(*i)->GetColours()+count,col);
+		copy((*i)->GetSizes(),(*i)->GetSizes()+count,sizes);
+		pos+=count;
+		col+=count;
+		sizes+=count;
+	}
+	m_Gathered=m_Selected;
+}
+
+dBoundingBox PointCloudPrimitive::GetBoundingBox(const dMatrix &space)
+{
+	dVector corners[8];
+	m_Octree->GetBoundingBox().getvertices(corners);
+	dBoundingBox box;
+	for (int i=0; i<8; i++)
+	{
+		box.expand(space.transform(corners[i]));
+	}
+	return box;
+}
+
+void PointCloudPrimitive::ApplyTransform(bool ScaleRotOnly)
+{
+	// the points are on disk, so they stay where they are
+	Trace::Stream<<"apply-transform doesn't work on point clouds"<<endl;
+}
@@ -0,0 +1,79 @@
+// Copyright (C) 2010 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#ifndef N_POINTCLOUDPRIM
+#define N_POINTCLOUDPRIM
+
+#include "ParticlePrimitive.h"
+#include "PointOctree.h"
+
+namespace Fluxus
+{
+
+//////////////////////////////////////////////////////
+/// A point cloud too big to draw all at once. The 
+/// points are kept in a PointOctree, and each frame 
+/// the nodes which make the most difference on screen
+/// are drawn, up to a budget of points. The points 
+/// chosen are copied into the "p", "c" and "s" pdata 
+/// when the choice changes, and drawn from there as 
+/// particles - so writes to the pdata only last until
+/// the view changes.
+class PointCloudPrimitive : public ParticlePrimitive
+{
+public:
+	/// Takes over the reference to the octree
+	PointCloudPrimitive(PointOctree *octree);
+	PointCloudPrimitive(const PointCloudPrimitive &other);
+	virtual ~PointCloudPrimitive();
+
+	///////////////////////////////////////////////////
+	///@name Primitive Interface
+	///@{
+	virtual PointCloudPrimitive* Clone() const;
+	virtual void Render();
+	virtual dBoundingBox GetBoundingBox(const dMatrix &space);
+	virtual void ApplyTransform(bool ScaleRotOnly=false);
+	virtual string GetTypeName() { return "PointCloudPrimitive"; }
+	virtual Evaluator *MakeEvaluator() { return NULL; }
+	///@}
+
+	/// The most points to draw in a frame
+	void SetBudget(unsigned int s);
+	/// How far apart points can be on screen, in pixels, 
+	/// before more detail is loaded
+	void SetMaxError(float s) { m_MaxError=s; }
+
+	unsigned int GetNumPoints() const { return m_Octree->GetNumPoints(); }
+	/// The number drawn last frame
+	unsigned int GetNumDrawn() const { return m_NumDrawn; }
+
+private:
+	/// Copies the selected nodes into the pdata
+	void Gather();
+
+	PointOctree *m_Octree;
+	unsigned int m_Budget;
+	float m_MaxError;
+	unsigned int m_NumDrawn;
+	vector<const PointOctree::Node*> m_Selected;
+	/// The nodes in the pdata now
+	vector<const PointOctree::Node*> m_Gathered;
+};
+
+}
+
+#endif
@@ -0,0 +1,375 @@
+// Copyright (C) 2010 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <queue>
+#include <unistd.h>
+#include "PointOctree.h"
+#include "Trace.h"
+
+using namespace Fluxus;
+
+// the most points a node takes before passing them on to its children
+static const unsigned int NODE_CAPACITY = 16384;
+static const unsigned int MAX_DEPTH = 20;
+// nodes asked for each frame, in order of importance
+static const unsigned int MAX_REQUESTS = 32;
+
+PointOctree::Node::Node() :
+Size(0),
+Count(0),
+Offset(0),
+Data(NULL),
+LastUsed(0)
+{
+	for (int i=0; i<8; i++) Children[i]=-1;
+}
+
+PointOctree::PointOctree() :
+m_NumPoints(0),
+m_NumResident(0),
+m_CacheSize(4000000),
+m_Frame(0),
+m_RefCount(1),
+m_File(NULL),
+m_Quit(false),
+m_Loading(-1)
+{
+	pthread_mutex_init(&m_Mutex,NULL);
+	pthread_cond_init(&m_Cond,NULL);
+	pthread_create(&m_Thread,NULL,LoaderMain,this);
+}
+
+PointOctree::~PointOctree()
+{
+	pthread_mutex_lock(&m_Mutex);
+	m_Quit=true;
+	pthread_cond_signal(&m_Cond);
+	pthread_mutex_unlock(&m_Mutex);
+	pthread_join(m_Thread,NULL);
+
+	for (vector<Node>::iterator i=m_Nodes.begin(); i!=m_Nodes.end(); ++i)
+	{
+		delete[] i->Data;
+	}
+	for (vector<pair<unsigned int,dVector*> >::iterator i=m_Loaded.begin(); i!=m_Loaded.end(); ++i)
+	{
+		delete[] i->second;
+	}
+	if (m_File) fclose(m_File);
+	pthread_mutex_destroy(&m_Mutex);
+	pthread_cond_destroy(&m_Cond);
+}
+
+void PointOctree::AddRef()
+{
+	m_RefCount++;
+}
+
+void PointOctree::Release()
+{
+	if (--m_RefCount==0) delete this;
+}
+
+PointOctree *PointOctree::Build(const dVector *positions, const dColour *colours, 
+	const dVector *sizes, unsigned int count)
+{
+	if (count==0) return NULL;
+
+	// the file is removed straight away, and goes when it's closed
+	static unsigned int counter=0;
+	char name[64];
+	snprintf(name,64,"/points-%d-%d.fxp",(int)getpid(),counter++);
+	const char *dir=getenv("TMPDIR");
+	string filename=string(dir!=NULL && dir[0]!=0?dir:"/tmp")+name;
+	FILE *file=fopen(filename.c_str(),"w+b");
+	if (file==NULL)
+	{
+		Trace::Stream<<"PointOctree::Build: can't write "<<filename<<endl;
+		return NULL;
+	}
+	remove(filename.c_str());
+
+	PointOctree *tree=new PointOctree;
+	tree->m_File=file;
+	tree->m_NumPoints=count;
+	for (unsigned int i=0; i<count; i++) tree->m_BoundingBox.expand(positions[i]);
+
+	// the nodes are cubes
+	dVector extent=tree->m_BoundingBox.max-tree->m_BoundingBox.min;
+	float size=max(extent.x,max(extent.y,extent.z));
+	size=size*1.001f+1e-6f;
+	tree->m_Nodes.push_back(Node());
+	tree->m_Nodes[0].Min=tree->m_BoundingBox.min;
+	tree->m_Nodes[0].Size=size;
+
+	// adding the points in a random order means each node 
+	// gets an even sample of everything under it. stepping 
+	// by a big prime visits them all as long as it's not a 
+	// factor of the count
+	unsigned long long step=2654435761ULL;
+	if (count%step==0) step=2246822519ULL;
+
+	vector<vector<unsigned int> > contents(1);
+	vector<unsigned int> depth(1,0);
+	for (unsigned long long n=0; n<count; n++)
+	{
+		unsigned int i=(n*step)%count;
+		const dVector &p=positions[i];
+		unsigned int node=0;
+		while (contents[node].size()>=NODE_CAPACITY && depth[node]<MAX_DEPTH)
+		{
+			const Node &parent=tree->m_Nodes[node];
+			float half=parent.Size*0.5f;
+			int octant=(p.x>=parent.Min.x+half?1:0) |
+			           (p.y>=parent.Min.y+half?2:0) |
+			           (p.z>=parent.Min.z+half?4:0);
+			int child=parent.Children[octant];
+			if (child<0)
+			{
+				Node n;
+				n.Min=dVector(parent.Min.x+(octant&1?half:0),
+				              parent.Min.y+(octant&2?half:0),
+				              parent.Min.z+(octant&4?half:0));
+				n.Size=half;
+				child=tree->m_Nodes.size();
+				tree->m_Nodes[node].Children[octant]=child;
+				tree->m_Nodes.push_back(n);
+				contents.push_back(vector<unsigned int>());
+				depth.push_back(depth[node]+1);
+			}
+			node=child;
+		}
+		contents[node].push_back(i);
+	}
+
+	// write them out
+	vector<dVector> pos, scale;
+	vector<dColour> col;
+	unsigned long long offset=0;
+	bool ok=true;
+	for (unsigned int node=0; node<tree->m_Nodes.size() && ok; node++)
+	{
+		const vector<unsigned int> &c=contents[node];
+		unsigned int size=c.size();
+		pos.resize(size);
+		col.resize(size);
+		scale.resize(size);
+		for (unsigned int j=0; j<size; j++)
+		{
+			pos[j]=positions[c[j]];
+			col[j]=colours[c[j]];
+			scale[j]=sizes[c[j]];
+		}
+		Node &n=tree->m_Nodes[node];
+		n.Count=size;
+		n.Offset=offset;
+		ok=size==0 || (fwrite(&pos[0],sizeof(dVector)*size,1,file)==1 &&
+		               fwrite(&col[0],sizeof(dColour)*size,1,file)==1 &&
+		               fwrite(&scale[0],sizeof(dVector)*size,1,file)==1);
+		offset+=sizeof(dVector)*size*3;
+
+		// the root is always there
+		if (node==0)
+		{
+			n.Data=new dVector[size*3];
+			copy(pos.begin(),pos.end(),n.Data);
+			copy(col.begin(),col.end(),reinterpret_cast<dColour*>(n.Data+size));
+			copy(scale.begin(),scale.end(),n.Data+size*2);
+			tree->m_NumResident=size;
+		}
+		vector<unsigned int>().swap(contents[node]);
+	}
+
+	if (!ok || fflush(file)!=0)
+	{
+		Trace::Stream<<"PointOctree::Build: can't write "<<filename<<endl;
+		delete tree;
+		return NULL;
+	}
+
+	return tree;
+}
+
+void *PointOctree::LoaderMain(void *arg)
+{
+	PointOctree *tree=(PointOctree*)arg;
+	pthread_mutex_lock(&tree->m_Mutex);
+	while (!tree->m_Quit)
+	{
+		if (tree->m_Requests.empty())
+		{
+			pthread_cond_wait(&tree->m_Cond,&tree->m_Mutex);
+			continue;
+		}
+
+		unsigned int node=tree->m_Requests[0];
+		tree->m_Requests.erase(tree->m_Requests.begin());
+		tree->m_Loading=node;
+		// the node list doesn't change after building, and
+		// only this thread uses the file now
+		unsigned int count=tree->m_Nodes[node].Count;
+		unsigned long long offset=tree->m_Nodes[node].Offset;
+		pthread_mutex_unlock(&tree->m_Mutex);
+
+		dVector *data=new dVector[count*3];
+		bool ok=fseeko(tree->m_File,offset,SEEK_SET)==0 &&
+			fread(data,sizeof(dVector)*count*3,1,tree->m_File)==1;
+
+		pthread_mutex_lock(&tree->m_Mutex);
+		if (ok) tree->m_Loaded.push_back(pair<unsigned int,dVector*>(node,data));
+		else delete[] data;
+		tree->m_Loading=-1;
+	}
+	pthread_mutex_unlock(&tree->m_Mutex);
+	return NULL;
+}
+
+void PointOctree::Collect()
+{
+	pthread_mutex_lock(&m_Mutex);
+	for (vector<pair<unsigned int,dVector*> >::iterator i=m_Loaded.begin(); i!=m_Loaded.end(); ++i)
+	{
+		Node &node=m_Nodes[i->first];
+		if (node.Data==NULL)
+		{
+			node.Data=i->second;
+			node.LastUsed=m_Frame;
+			m_NumResident+=node.Count;
+		}
+		else delete[] i->second;
+	}
+	m_Loaded.clear();
+	pthread_mutex_unlock(&m_Mutex);
+}
+
+float PointOctree::Spacing(const Node &node) const
+{
+	// roughly the distance between points, for a surface
+	return node.Size/sqrtf(NODE_CAPACITY);
+}
+
+bool PointOctree::Visible(const Node &node, const dMatrix &modelview, const dMatrix &projection) const
+{
+	// outside if all the corners are beyond one of the clip planes
+	unsigned int outside[6]={0,0,0,0,0,0};
+	for (int c=0; c<8; c++)
+	{
+		dVector corner(node.Min.x+(c&1?node.Size:0),
+		               node.Min.y+(c&2?node.Size:0),
+		               node.Min.z+(c&4?node.Size:0));
+		dVector clip=projection.transform(modelview.transform(corner));
+		if (clip.x<-clip.w) outside[0]++;
+		if (clip.x>clip.w) outside[1]++;
+		if (clip.y<-clip.w) outside[2]++;
+		if (clip.y>clip.w) outside[3]++;
+		if (clip.z<-clip.w) outside[4]++;
+		if (clip.z>clip.w) outside[5]++;
+	}
+	for (int p=0; p<6; p++)
+	{
+		if (outside[p]==8) return false;
+	}
+	return true;
+}
+
+void PointOctree::Select(const dMatrix &modelview, const dMatrix &projection, float pixelscale,
+	unsigned int budget, float maxerror, vector<const Node*> &out)
+{
+	m_Frame++;
+	Collect();
+	out.clear();
+
+	dVector camera=modelview.inverse().transform(dVector(0,0,0));
+	vector<unsigned int> wanted;
+
+	// the most coarse nodes on screen come first
+	priority_queue<pair<float,unsigned int> > queue;
+	if (Visible(m_Nodes[0],modelview,projection)) queue.push(pair<float,unsigned int>(0,0));
+
+	unsigned int total=0;
+	while (!queue.empty())
+	{
+		unsigned int index=queue.top().second;
+		queue.pop();
+		Node &node=m_Nodes[index];
+
+		if (node.Data==NULL)
+		{
+			if (wanted.size()<MAX_REQUESTS) wanted.push_back(index);
+			continue;
+		}
+		if (!out.empty() && total+node.Count>budget) break;
+
+		out.push_back(&node);
+		total+=node.Count;
+		node.LastUsed=m_Frame;
+
+		for (int c=0; c<8; c++)
+		{
+			if (node.Children[c]<0) continue;
+			const Node &child=m_Nodes[node.Children[c]];
+			// the spacing of the points in the parent, at the 
+			// nearest the child gets to the camera
+			float half=child.Size*0.5f;
+			dVector centre(child.Min.x+half,child.Min.y+half,child.Min.z+half);
+			float distance=max(centre.dist(camera)-half*1.7320508f,child.Size*0.01f);
+			float error=Spacing(node)*pixelscale/distance;
+			if (error>maxerror && Visible(child,modelview,projection))
+			{
+				queue.push(pair<float,unsigned int>(error,node.Children[c]));
+			}
+		}
+	}
+
+	// replace the requests with this frame's
+	pthread_mutex_lock(&m_Mutex);
+	m_Requests.clear();
+	for (vector<unsigned int>::iterator i=wanted.begin(); i!=wanted.end(); ++i)
+	{
+		if ((int)*i!=m_Loading) m_Requests.push_back(*i);
+	}
+	if (!m_Requests.empty()) pthread_cond_signal(&m_Cond);
+	pthread_mutex_unlock(&m_Mutex);
+
+	if (m_NumResident>m_CacheSize) Evict();
+}
+
+void PointOctree::Evict()
+{
+	// drop the nodes unused for longest, but not the root 
+	// or anything drawn this frame
+	vector<pair<unsigned int,unsigned int> > resident;
+	for (unsigned int i=1; i<m_Nodes.size(); i++)
+	{
+		if (m_Nodes[i].Data!=NULL && m_Nodes[i].LastUsed!=m_Frame)
+		{
+			resident.push_back(pair<unsigned int,unsigned int>(m_Nodes[i].LastUsed,i));
+		}
+	}
+	sort(resident.begin(),resident.end());
+
+	for (vector<pair<unsigned int,unsigned int> >::iterator i=resident.begin();
+		i!=resident.end() && m_NumResident>m_CacheSize; ++i)
+	{
+		Node &node=m_Nodes[i->second];
+		delete[] node.Data;
+		node.Data=NULL;
+		m_NumResident-=node.Count;
+	}
+}
@@ -0,0 +1,124 @@
+// Copyright (C) 2010 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#ifndef N_POINTOCTREE
+#define N_POINTOCTREE
+
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <pthread.h>
+#include "dada.h"
+
+using namespace std;
+
+namespace Fluxus
+{
+
+//////////////////////////////////////////////////////
+/// Point clouds too big to draw every frame, kept in
+/// an octree where each node holds a random sample of
+/// the points in its cube that its ancestors don't have.
+/// Drawing a node and its ancestors gives an even
+/// sampling at the node's detail. The nodes live in a
+/// temporary file, and are loaded on a background thread
+/// when they are wanted - only the nodes drawn recently
+/// are kept in memory. Points keep their position, colour
+/// and size as they were given, so each one takes 48 bytes.
+/// Reference counted, so clones of the primitive using it 
+/// can share it.
+class PointOctree
+{
+public:
+	class Node
+	{
+	public:
+		Node();
+		dVector Min;
+		float Size;
+		int Children[8];
+		unsigned int Count;
+		unsigned long long Offset;
+		/// NULL if not loaded, otherwise the positions, colours
+		/// and sizes one after another, as they're stored on disk
+		dVector *Data;
+		unsigned int LastUsed;
+
+		const dVector *GetPositions() const { return Data; }
+		const dColour *GetColours() const { return reinterpret_cast<const dColour*>(Data+Count); }
+		const dVector *GetSizes() const { return Data+Count*2; }
+	};
+
+	/// Sorts the points into the octree, writing them to a
+	/// temporary file in $TMPDIR or /tmp. Returns NULL if 
+	/// there are no points or the file can't be written.
+	static PointOctree *Build(const dVector *positions, const dColour *colours, 
+		const dVector *sizes, unsigned int count);
+
+	void AddRef();
+	void Release();
+
+	/// Chooses the nodes to draw, in order of importance, until
+	/// the budget of points is used up or the nodes are detailed
+	/// enough (their point spacing is below maxerror pixels on
+	/// screen). Missing nodes are asked for, to be ready in a
+	/// later frame, and their parents are drawn in the meantime.
+	/// The matrices are from the primitive's local space, and
+	/// pixelscale turns a size over an eye distance into pixels.
+	void Select(const dMatrix &modelview, const dMatrix &projection, float pixelscale,
+		unsigned int budget, float maxerror, vector<const Node*> &out);
+
+	/// Sets the number of points to keep in memory, nodes not
+	/// drawn for the longest are dropped beyond this
+	void SetCacheSize(unsigned int s) { m_CacheSize=s; }
+
+	const dBoundingBox &GetBoundingBox() const { return m_BoundingBox; }
+	unsigned int GetNumPoints() const { return m_NumPoints; }
+	unsigned int GetNumResident() const { return m_NumResident; }
+
+private:
+	PointOctree();
+	~PointOctree();
+
+	float Spacing(const Node &node) const;
+	bool Visible(const Node &node, const dMatrix &modelview, const dMatrix &projection) const;
+	void Collect();
+	void Evict();
+
+	static void *LoaderMain(void *arg);
+
+	vector<Node> m_Nodes;
+	dBoundingBox m_BoundingBox;
+	unsigned int m_NumPoints;
+	unsigned int m_NumResident;
+	unsigned int m_CacheSize;
+	unsigned int m_Frame;
+	int m_RefCount;
+	FILE *m_File;
+
+	// shared with the loader thread
+	pthread_t m_Thread;
+	pthread_mutex_t m_Mutex;
+	pthread_cond_t m_Cond;
+	bool m_Quit;
+	vector<unsigned int> m_Requests;
+	int m_Loading;
+	vector<pair<unsigned int,dVector*> > m_Loaded;
+};
+
+}
+
+#endif
@@ -15,6 +15,7 @@
 // Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 
 #include <stdio.h>
+#include <algorithm>
 
 #include "OpenGL.h"
 
@@ -22,15 +23,242 @@
 #include "PolyPrimitive.h"
 #include "State.h"
 #include "TexturePainter.h"
+#include "ThreadPool.h"
 
 //#define RENDER_NORMALS
 //#define RENDER_BBOX
 
 using namespace Fluxus;
 
+/////////////////////////////////////////////////////////////////////
+// normal calculation, split over threads
+
+// the number of corners between faces for the topology 
+// calculations, 0 if it's not a simple stride
+static unsigned int FaceStride(PolyPrimitive::Type type)
+{
+	switch (type)
+	{
+		case PolyPrimitive::TRISTRIP: return 2;
+		case PolyPrimitive::QUADS: return 4;
+		case PolyPrimitive::TRILIST: return 3;
+		default: return 0;
+	}
+}
+
+// works out the geometric normal of each face from its first three 
+// corners, and writes it to all the face's corners
+class FaceNormalsTask : public ThreadPool::Task
+{
+public:
+	FaceNormalsTask(const dVector *points, const unsigned int *index, unsigned int stride, 
+		const char *dirty, dVector *normals) : 
+		m_Points(points), m_Index(index), m_Stride(stride), m_Dirty(dirty), m_Normals(normals) {}
+
+	virtual void Run(unsigned int start, unsigned int end)
+	{
+		// locals, as the stores could alias the members
+		const dVector *points=m_Points;
+		const unsigned int *index=m_Index;
+		const unsigned int stride=m_Stride;
+		const char *dirty=m_Dirty;
+		dVector *normals=m_Normals;
+		
+		unsigned int f=start;
+		#ifdef DADA_SSE
+		// four faces at a time, transposed so each register holds 
+		// one component from all of them
+		const __m128 zero=_mm_setzero_ps();
+		const __m128 one=_mm_set1_ps(1);
+		for (; f+4<=end; f+=4)
+		{
+			if (dirty && !(dirty[f]|dirty[f+1]|dirty[f+2]|dirty[f+3])) continue;
+			
+			__m128 x[3],y[3],z[3];
+			for (unsigned int c=0; c<3; c++)
+			{
+				unsigned int i0=f*stride+c, i1=i0+stride, i2=i1+stride, i3=i2+stride;
+				if (index)
+				{
+					i0=index[i0]; i1=index[i1]; i2=index[i2]; i3=index[i3];
+				}
+				__m128 r0=_mm_loadu_ps(&points[i0].x);
+				__m128 r1=_mm_loadu_ps(&points[i1].x);
+				__m128 r2=_mm_loadu_ps(&points[i2].x);
+				__m128 r3=_mm_loadu_ps(&points[i3].x);
+				_MM_TRANSPOSE4_PS(r0,r1,r2,r3);
+				x[c]=r0; y[c]=r1; z[c]=r2;
+			}
+			
+			// (p0-p1) x (p1-p2), as in the scalar code
+			__m128 ax=_mm_sub_ps(x[0],x[1]), ay=_mm_sub_ps(y[0],y[1]), az=_mm_sub_ps(z[0],z[1]);
+			__m128 bx=_mm_sub_ps(x[1],x[2]), by=_mm_sub_ps(y[1],y[2]), bz=_mm_sub_ps(z[1],z[2]);
+			__m128 nx=_mm_sub_ps(_mm_mul_ps(ay,bz),_mm_mul_ps(az,by));
+			__m128 ny=_mm_sub_ps(_mm_mul_ps(az,bx),_mm_mul_ps(ax,bz));
+			__m128 nz=_mm_sub_ps(_mm_mul_ps(ax,by),_mm_mul_ps(ay,bx));
+			
+			// normalise, leaving zero length normals alone like dVector does
+			__m128 mag=_mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(nx,nx),_mm_mul_ps(ny,ny)),_mm_mul_ps(nz,nz)));
+			__m128 iszero=_mm_cmpeq_ps(mag,zero);
+			mag=_mm_or_ps(_mm_andnot_ps(iszero,mag),_mm_and_ps(iszero,one));
+			nx=_mm_div_ps(nx,mag);
+			ny=_mm_div_ps(ny,mag);
+			nz=_mm_div_ps(nz,mag);
+			
+			__m128 nw=one;
+			_MM_TRANSPOSE4_PS(nx,ny,nz,nw);
+			__m128 n[4]={nx,ny,nz,nw};
+			for (unsigned int i=0; i<4; i++)
+			{
+				dVector *dst=normals+(f+i)*stride;
+				for (unsigned int c=0; c<stride; c++)
+				{
+					_mm_storeu_ps(&dst[c].x,n[i]);
+				}
+			}
+		}
+		#endif
+		for (; f<end; f++)
+		{
+			if (dirty && !dirty[f]) continue;
+			
+			unsigned int c=f*stride;
+			const dVector &p0=points[index?index[c]:c];
+			const dVector &p1=points[index?index[c+1]:c+1];
+			const dVector &p2=points[index?index[c+2]:c+2];
+			dVector a(p0-p1);
+			dVector b(p1-p2);
+			dVector normal(a.cross(b));
+			normal.normalise();
+			for (unsigned int n=0; n<stride; n++)
+			{
+				normals[c+n]=normal;
+			}
+		}
+	}
+
+private:
+	const dVector *m_Points;
+	const unsigned int *m_Index;
+	unsigned int m_Stride;
+	const char *m_Dirty;
+	dVector *m_Normals;
+};
+
+// gathers the geometric normals into the vertex normals, averaging
+// over the index positions which use each vertex when indexed, or
+// over coincident vertices when smoothing
+class VertexNormalsTask : public ThreadPool::Task
+{
+public:
+	VertexNormalsTask(const vector<dVector> &geometric, const Connectivity *sources, 
+		bool indexed, const char *dirty, dVector *normals) :
+		m_Geometric(geometric), m_Sources(sources), m_Indexed(indexed), m_Dirty(dirty), m_Normals(normals) {}
+
+	virtual void Run(unsigned int start, unsigned int end)
+	{
+		for (unsigned int v=start; v<end; v++)
+		{
+			if (m_Dirty && !Dirty(v)) continue;
+			
+			if (m_Indexed)
+			{
+				dVector n(0,0,0);
+				float count=0;
+				for (const int *c=m_Sources->Begin(v); c!=m_Sources->End(v); c++)
+				{
+					if (*c<(int)m_Geometric.size())
+					{
+						n+=m_Geometric[*c];
+						count+=1;
+					}
+				}
+				if (count>0) n/=count;
+				m_Normals[v]=n;
+			}
+			else if (v<m_Geometric.size())
+			{
+				if (m_Sources==NULL)
+				{
+					m_Normals[v]=m_Geometric[v];
+				}
+				else
+				{
+					dVector n=m_Geometric[v];
+					float count=1;
+					for (const int *b=m_Sources->Begin(v); b!=m_Sources->End(v); b++)
+					{
+						if (*b<(int)m_Geometric.size())
+						{
+							n+=m_Geometric[*b];
+							count+=1;
+						}
+					}
+					m_Normals[v]=(n/count).normalise();
+				}
+			}
+		}
+	}
+
+private:
+	bool Dirty(unsigned int v) const
+	{
+		if (!m_Indexed && m_Dirty[v]) return true;
+		if (m_Sources!=NULL)
+		{
+			for (const int *c=m_Sources->Begin(v); c!=m_Sources->End(v); c++)
+			{
+				if (m_Dirty[*c]) return true;
+			}
+		}
+		return false;
+	}
+
+	const vector<dVector> &m_Geometric;
+	const Connectivity *m_Sources;
+	bool m_Indexed;
+	const char *m_Dirty;
+	dVector *m_Normals;
+};
+
+// flags the vertices which have moved since the normals were last 
+// calculated, and brings the copy of their positions up to date
+class MovedVertsTask : public ThreadPool::Task
+{
+public:
+	MovedVertsTask(const dVector *points, dVector *last, char *moved) :
+		m_Points(points), m_Last(last), m_Moved(moved) {}
+
+	virtual void Run(unsigned int start, unsigned int end)
+	{
+		for (unsigned int v=start; v<end; v++)
+		{
+			const dVector &p=m_Points[v];
+			dVector &l=m_Last[v];
+			m_Moved[v]=p.x!=l.x || p.y!=l.y || p.z!=l.z;
+			if (m_Moved[v]) l=p;
+		}
+	}
+
+private:
+	const dVector *m_Points;
+	dVector *m_Last;
+	char *m_Moved;
+};
+
 PolyPrimitive::PolyPrimitive(Type t) :
+m_NormalsVersion(0),
+m_NormalsPointsVersion(0),
+m_NormalsSmooth(false),
+m_TopologyVerts(NULL),
+m_TopologySize(0),
+m_TopologyIndexVersion(0),
+m_TopologyIndexMode(false),
+m_TopologyVersion(0),
 m_IndexMode(false),
-m_Type(t)
+m_IndexVersion(PData::NewVersion()),
+m_Type(t),
+m_IndexBuffer(GL_ELEMENT_ARRAY_BUFFER)
 {
 	AddData("p",new TypedPData<dVector>);
 	AddData("n",new TypedPData<dVector>);
@@ -43,9 +271,19 @@ m_Type(t)
 
 PolyPrimitive::PolyPrimitive(const PolyPrimitive &other) :
 Primitive(other),
+m_NormalsVersion(0),
+m_NormalsPointsVersion(0),
+m_NormalsSmooth(false),
+m_TopologyVerts(NULL),
+m_TopologySize(0),
+m_TopologyIndexVersion(0),
+m_TopologyIndexMode(false),
+m_TopologyVersion(0),
 m_IndexMode(other.m_IndexMode),
 m_IndexData(other.m_IndexData),
-m_Type(other.m_Type)
+m_IndexVersion(PData::NewVersion()),
+m_Type(other.m_Type),
+m_IndexBuffer(other.m_IndexBuffer)
 {
 	PDataDirty();
 }
@@ -62,39 +300,53 @@ PolyPrimitive *PolyPrimitive::Clone() const
 void PolyPrimitive::Clear()
 {
 	Resize(0);
-	m_ConnectedVerts.clear();
-	m_GeometricNormals.clear();
-	m_UniqueEdges.clear();
+	InvalidateTopology();
 }
 
 void PolyPrimitive::PDataDirty()
 {
-	// reset pointers
-	m_VertData=GetDataVec<dVector>("p");
-	m_NormData=GetDataVec<dVector>("n");
-	m_ColData=GetDataVec<dColour>("c");
-	m_TexData=GetDataVec<dVector>("t");
+	// reset pointers, without copying mapped arrays
+	m_VertPData=dynamic_cast<TypedPData<dVector>*>(FindData(GetAtom("p")));
+	m_NormPData=dynamic_cast<TypedPData<dVector>*>(FindData(GetAtom("n")));
+	m_ColPData=dynamic_cast<TypedPData<dColour>*>(FindData(GetAtom("c")));
+	m_TexPData=dynamic_cast<TypedPData<dVector>*>(FindData(GetAtom("t")));
+	m_VertData=&m_VertPData->m_Data;
+	m_NormData=&m_NormPData->m_Data;
+	m_ColData=&m_ColPData->m_Data;
+	m_TexData=&m_TexPData->m_Data;
+	
+	// only a new vertex array changes the topology
+	if (m_VertPData!=m_TopologyVerts)
+	{
+		InvalidateTopology();
+	}
 }
 
 void PolyPrimitive::AddVertex(const dVertex &Vert) 
 { 
+	m_VertPData->Unmap();
+	m_NormPData->Unmap();
+	m_ColPData->Unmap();
+	m_TexPData->Unmap();
 	m_VertData->push_back(Vert.point); 
 	m_NormData->push_back(Vert.normal); 
 	m_ColData->push_back(Vert.col); 	
 	m_TexData->push_back(dVector(Vert.s, Vert.t, 0));
+	m_VertPData->Dirty();
+	m_NormPData->Dirty();
+	m_ColPData->Dirty();
+	m_TexPData->Dirty();
+	DirtyBounds();
 	
-	m_ConnectedVerts.clear();
-	m_GeometricNormals.clear();
-	m_UniqueEdges.clear();
+	InvalidateTopology();
 }
 
-void PolyPrimitive::Render()
+bool PolyPrimitive::GetGLType(int &type)
 {
 	// some drivers crash if they don't get enough data for a primitive...
-	if (m_VertData->size()<3) return;
-	if (m_IndexMode && m_IndexData.size()<3) return;
+	if (m_VertPData->Size()<3) return false;
+	if (m_IndexMode && m_IndexData.size()<3) return false;
 
-	int type=0;
 	switch (m_Type)
 	{
 		case TRISTRIP : type=GL_TRIANGLE_STRIP; break;
@@ -102,41 +354,145 @@ void PolyPrimitive::Render()
 			// some drivers crash if they don't get enough data for a primitive...
 			if (m_IndexMode)
 			{
-				if (m_IndexData.size()<4) return;
+				if (m_IndexData.size()<4) return false;
 			}
 			else
 			{
-				if (m_VertData->size()<4) return;
+				if (m_VertPData->Size()<4) return false;
 			}
 			type=GL_QUADS;
 		break;
 		case TRILIST : type=GL_TRIANGLES; break;
 		case TRIFAN : type=GL_TRIANGLE_FAN; break;
 		case POLYGON : type=GL_POLYGON; break;
+		default : return false;
 	}
+	return true;
+}
 
-	if (m_State.Hints & HINT_AALIAS) glEnable(GL_LINE_SMOOTH);
-	else glDisable(GL_LINE_SMOOTH);
+void PolyPrimitive::Render()
+{
+	int type;
+	if (!GetGLType(type)) return;
 
-	if (m_State.Hints & HINT_NORMAL)
+	const void *indexptr=NULL;
+	bool vbo=BeginArrays(indexptr);
+	DrawPasses(type,indexptr,0);
+	EndArrays(vbo);
+}
+
+void PolyPrimitive::RenderInstances(const vector<dMatrix> &transforms, const vector<dColour> &colours)
+{
+	int type;
+	if (transforms.empty() || !GetGLType(type)) return;
+
+	const void *indexptr=NULL;
+	bool vbo=BeginArrays(indexptr);
+
+	#ifdef GLSL
+	// if the shader takes the per instance transform (and colour) 
+	// attributes, all the instances are drawn with one call per pass
+	int transformattr=-1;
+	if (m_State.Shader!=NULL && VertexBuffer::InstancingSupported() && 
+		!(m_State.Hints & HINT_NORMAL))
 	{
-		glColor4fv(m_State.NormalColour.arr());
-		glDisable(GL_LIGHTING);
-		glBegin(GL_LINES);
-		for (unsigned int i=0; i<m_VertData->size(); i++)
+		transformattr=m_State.Shader->GetAttribLocation("instance_transform");
+	}
+
+	if (transformattr>=0)
+	{
+		int colourattr=m_State.Shader->GetAttribLocation("instance_colour");
+
+		// a mat4 attribute takes a location per column
+		const char *ptr=(const char*)m_InstanceBuffer.Bind(PData::NewVersion(),
+				transforms[0].arr(),transforms.size()*sizeof(dMatrix));
+		for (int c=0; c<4; c++)
 		{
-			glVertex3fv((*m_VertData)[i].arr());
-			glVertex3fv(((*m_VertData)[i]+(*m_NormData)[i]).arr());
+			glEnableVertexAttribArray(transformattr+c);
+			glVertexAttribPointer(transformattr+c,4,GL_FLOAT,false,sizeof(dMatrix),ptr+c*4*sizeof(float));
+			glVertexAttribDivisorARB(transformattr+c,1);
+		}
+
+		if (colourattr>=0)
+		{
+			ptr=(const char*)m_InstanceColourBuffer.Bind(PData::NewVersion(),
+					colours[0].arr(),colours.size()*sizeof(dColour));
+			glEnableVertexAttribArray(colourattr);
+			glVertexAttribPointer(colourattr,4,GL_FLOAT,false,sizeof(dColour),ptr);
+			glVertexAttribDivisorARB(colourattr,1);
+		}
+
+		DrawPasses(type,indexptr,transforms.size());
+
+		for (int c=0; c<4; c++)
+		{
+			glVertexAttribDivisorARB(transformattr+c,0);
+			glDisableVertexAttribArray(transformattr+c);
+		}
+
+		if (colourattr>=0)
+		{
+			glVertexAttribDivisorARB(colourattr,0);
+			glDisableVertexAttribArray(colourattr);
+		}
+
+		// the instance streams may be in buffers
+		vbo=true;
+	}
+	else
+	#endif
+	{
+		// otherwise we still only set up the arrays once
+		for (unsigned int n=0; n<transforms.size(); n++)
+		{
+			glPushMatrix();
+			glMultMatrixf(transforms[n].arr());
+			m_State.Colour=colours[n];
+			glColor4fv(m_State.Colour.arr());
+			glMaterialfv(GL_FRONT_AND_BACK,GL_DIFFUSE,m_State.Colour.arr());
+			DrawPasses(type,indexptr,0);
+			glPopMatrix();
 		}
-		glEnd();
-		glEnable(GL_LIGHTING);
-		glColor4fv(m_State.Colour.arr());
 	}
+
+	EndArrays(vbo);
+}
+
+bool PolyPrimitive::BeginArrays(const void *&indexptr)
+{
+	if (m_State.Hints & HINT_AALIAS) glEnable(GL_LINE_SMOOTH);
+	else glDisable(GL_LINE_SMOOTH);
+
 	if (m_State.Hints & HINT_UNLIT) glDisable(GL_LIGHTING);
 
-	glVertexPointer(3,GL_FLOAT,sizeof(dVector),(void*)m_VertData->begin()->arr());
-	glNormalPointer(GL_FLOAT,sizeof(dVector),(void*)m_NormData->begin()->arr());
-	glTexCoordPointer(3,GL_FLOAT,sizeof(dVector),(void*)m_TexData->begin()->arr());
+	// with HINT_VBO the arrays live in buffer objects, and are only 
+	// uploaded when the pdata has been changed, the pointers become 
+	// offsets into the buffers
+	bool vbo = (m_State.Hints & HINT_VBO) && VertexBuffer::Supported();
+	const void *vertptr=(const void*)m_VertPData->View();
+	const void *normptr=(const void*)m_NormPData->View();
+	const void *texptr=(const void*)m_TexPData->View();
+	indexptr=m_IndexMode?&(m_IndexData[0]):NULL;
+
+	if (vbo)
+	{
+		vertptr=m_VertBuffer.Bind(m_VertPData->GetVersion(),vertptr,m_VertPData->Size()*sizeof(dVector));
+		glVertexPointer(3,GL_FLOAT,sizeof(dVector),vertptr);
+		normptr=m_NormBuffer.Bind(m_NormPData->GetVersion(),normptr,m_NormPData->Size()*sizeof(dVector));
+		glNormalPointer(GL_FLOAT,sizeof(dVector),normptr);
+		texptr=m_TexBuffer.Bind(m_TexPData->GetVersion(),texptr,m_TexPData->Size()*sizeof(dVector));
+		glTexCoordPointer(3,GL_FLOAT,sizeof(dVector),texptr);
+		if (m_IndexMode)
+		{
+			indexptr=m_IndexBuffer.Bind(m_IndexVersion,indexptr,m_IndexData.size()*sizeof(unsigned int));
+		}
+	}
+	else
+	{
+		glVertexPointer(3,GL_FLOAT,sizeof(dVector),vertptr);
+		glNormalPointer(GL_FLOAT,sizeof(dVector),normptr);
+		glTexCoordPointer(3,GL_FLOAT,sizeof(dVector),texptr);
+	}
 
 	if (m_State.Hints & HINT_SPHERE_MAP)
 	{
@@ -156,17 +512,23 @@ void PolyPrimitive::Render()
 			{
 				char name[3];
 				snprintf(name,3,"t%d",n);
-				TypedPData<dVector> *tex = dynamic_cast<TypedPData<dVector>*>(GetDataRaw(name));
+				const TypedPData<dVector> *tex = dynamic_cast<const TypedPData<dVector>*>(GetDataRawConst(name));
 				glClientActiveTexture(GL_TEXTURE0+n);
 				glEnableClientState(GL_TEXTURE_COORD_ARRAY);
 
-				if (tex!=NULL)
+				if (tex!=NULL && tex->Size()>0)
 				{
-					glTexCoordPointer(3,GL_FLOAT,sizeof(dVector),(void*)tex->m_Data.begin()->arr());
+					const void *ptr=tex->View();
+					if (vbo)
+					{
+						ptr=m_MultiTexBuffer[n].Bind(tex->GetVersion(),ptr,tex->Size()*sizeof(dVector));
+					}
+					glTexCoordPointer(3,GL_FLOAT,sizeof(dVector),ptr);
 				}
 				else // default to using the normal vertex coordinates
 				{
-					glTexCoordPointer(3,GL_FLOAT,sizeof(dVector),(void*)m_TexData->begin()->arr());
+					if (vbo) m_TexBuffer.Bind(m_TexPData->GetVersion(),(const void*)m_TexPData->View(),m_TexPData->Size()*sizeof(dVector));
+					glTexCoordPointer(3,GL_FLOAT,sizeof(dVector),texptr);
 				}
 			}
 		}
@@ -176,18 +538,39 @@ void PolyPrimitive::Render()
 
 	if (m_State.Hints & HINT_VERTCOLS)
 	{
+		const void *colptr=(const void*)m_ColPData->View();
+		if (vbo) colptr=m_ColBuffer.Bind(m_ColPData->GetVersion(),colptr,m_ColPData->Size()*sizeof(dColour));
 		glEnableClientState(GL_COLOR_ARRAY);
-		glColorPointer(4,GL_FLOAT,sizeof(dVector),(void*)m_ColData->begin()->arr());
+		glColorPointer(4,GL_FLOAT,sizeof(dColour),colptr);
 	}
 	else
 	{
 		glDisableClientState(GL_COLOR_ARRAY);
 	}
 
+	return vbo;
+}
+
+void PolyPrimitive::DrawPasses(int type, const void *indexptr, unsigned int instances)
+{
+	if (m_State.Hints & HINT_NORMAL)
+	{
+		glColor4fv(m_State.NormalColour.arr());
+		glDisable(GL_LIGHTING);
+		glBegin(GL_LINES);
+		for (unsigned int i=0; i<m_VertPData->Size(); i++)
+		{
+			glVertex3fv(&m_VertPData->View()[i].x);
+			glVertex3fv((m_VertPData->View()[i]+m_NormPData->View()[i]).arr());
+		}
+		glEnd();
+		if (!(m_State.Hints & HINT_UNLIT)) glEnable(GL_LIGHTING);
+		glColor4fv(m_State.Colour.arr());
+	}
+
 	if (m_State.Hints & HINT_SOLID)
 	{
-		if (m_IndexMode) glDrawElements(type,m_IndexData.size(),GL_UNSIGNED_INT,&(m_IndexData[0]));
-		else glDrawArrays(type,0,m_VertData->size());
+		Draw(type,indexptr,instances);
 	}
 
 	if (m_State.Hints & HINT_WIRE)
@@ -203,10 +586,9 @@ void PolyPrimitive::Render()
 		}
 
 		glDisable(GL_LIGHTING);
-		if (m_IndexMode) glDrawElements(type,m_IndexData.size(),GL_UNSIGNED_INT,&(m_IndexData[0]));
-		else glDrawArrays(type,0,m_VertData->size());
+		Draw(type,indexptr,instances);
 		glPolygonMode(GL_FRONT_AND_BACK,GL_FILL);
-		glEnable(GL_LIGHTING);
+		if (!(m_State.Hints & HINT_UNLIT)) glEnable(GL_LIGHTING);
 		glEnable(GL_TEXTURE_2D);
 		if ((m_State.Hints & HINT_WIRE_STIPPLED) > HINT_WIRE)
 		{
@@ -221,15 +603,33 @@ void PolyPrimitive::Render()
 		glPolygonMode(GL_FRONT_AND_BACK,GL_POINT);
 		glColor4fv(m_State.WireColour.arr());
 		glDisable(GL_LIGHTING);
-		if (m_IndexMode) glDrawElements(type,m_IndexData.size(),GL_UNSIGNED_INT,&(m_IndexData[0]));
-		else glDrawArrays(type,0,m_VertData->size());
+		Draw(type,indexptr,instances);
 		glPolygonMode(GL_FRONT_AND_BACK,GL_FILL);
-		glEnable(GL_LIGHTING);
+		if (!(m_State.Hints & HINT_UNLIT)) glEnable(GL_LIGHTING);
 		glEnable(GL_TEXTURE_2D);
 		glColor4fv(m_State.Colour.arr());
 	}
+}
 
+void PolyPrimitive::Draw(int type, const void *indexptr, unsigned int instances)
+{
+	if (instances==0)
+	{
+		if (m_IndexMode) glDrawElements(type,m_IndexData.size(),GL_UNSIGNED_INT,indexptr);
+		else glDrawArrays(type,0,m_VertPData->Size());
+	}
+	#ifdef GLSL
+	else
+	{
+		if (m_IndexMode) glDrawElementsInstancedARB(type,m_IndexData.size(),GL_UNSIGNED_INT,indexptr,instances);
+		else glDrawArraysInstancedARB(type,0,m_VertPData->Size(),instances);
+	}
+	#endif
+}
 
+void PolyPrimitive::EndArrays(bool vbo)
+{
+	if (vbo) VertexBuffer::Unbind();
 	if (m_State.Hints & HINT_UNLIT) glEnable(GL_LIGHTING);
 	if (m_State.Hints & HINT_AALIAS) glDisable(GL_LINE_SMOOTH);
 	if (m_State.Hints & HINT_SPHERE_MAP)
@@ -241,61 +641,82 @@ void PolyPrimitive::Render()
 
 void PolyPrimitive::RecalculateNormals(bool smooth)
 {
-	GenerateTopology();
-	CalculateGeometricNormals();
-
-	if (!m_GeometricNormals.empty()) 
+	CheckTopology();
+	if (m_ConnectedVerts.Empty())
 	{
-		if (m_IndexMode) // accumulate
-		{
-			vector<int> count(m_VertData->size());
-						
-			// clear the normals
-			for (unsigned int i=0; i<m_NormData->size(); i++)
-			{
-				(*m_NormData)[i]=dVector(0,0,0);
-				count[i]=0;
-			}
-			
-			// add all the contributing normals
-			for (unsigned int i=0; i<m_IndexData.size(); i++)
-			{
-				(*m_NormData)[m_IndexData[i]]+=m_GeometricNormals[i];
-				count[m_IndexData[i]]++;
-			}
+		CalculateConnected();
+	}
+	
+	if (m_VertPData->Size()==0 || m_NormPData->Size()!=m_VertPData->Size()) return;
+	
+	// if we've done this before, only the faces around 
+	// vertices which have moved need redoing
+	bool partial = FaceStride(m_Type)>0 && 
+		!m_GeometricNormals.empty() &&
+		m_NormalsFrom.size()==m_VertPData->Size() &&
+		m_NormalsSmooth==smooth &&
+		m_NormalsVersion==m_NormPData->GetVersion();
 
-			// scale back
-			for (unsigned int i=0; i<m_NormData->size(); i++)
-			{
-				(*m_NormData)[i]/=(float)count[i];
-			}
-		}
-		else
+	if (partial && m_NormalsPointsVersion==m_VertPData->GetVersion()) return;
+	
+	vector<char> dirtycorners;
+	if (partial)
+	{
+		vector<char> moved(m_VertPData->Size());
+		MovedVertsTask movedtask(m_VertPData->View(),&m_NormalsFrom[0],&moved[0]);
+		ThreadPool::Run(movedtask,m_VertPData->Size());
+		if (find(moved.begin(),moved.end(),1)==moved.end())
 		{
-			for (unsigned int i=0; i<m_VertData->size(); i++)
-			{
-				(*m_NormData)[i]=m_GeometricNormals[i];
-			}
+			m_NormalsPointsVersion=m_VertPData->GetVersion();
+			return;
 		}
 		
-		if (smooth && !m_IndexMode)
+		// a face normal depends on its first three corners, and 
+		// is written to all of them
+		unsigned int stride=FaceStride(m_Type);
+		unsigned int corners=m_IndexMode?m_IndexData.size():m_VertPData->Size();
+		unsigned int faces=m_GeometricNormals.size()/stride;
+		vector<char> dirtyfaces(faces,0);
+		dirtycorners.resize(max(corners,faces*stride),0);
+		for (unsigned int f=0; f<faces; f++)
 		{
-			// smooth the normals
-			TypedPData<dVector> *newnorms = new TypedPData<dVector>;
-			for (unsigned int i=0; i<m_VertData->size(); i++)
+			unsigned int c=f*stride;
+			for (unsigned int n=0; n<3; n++)
 			{
-				float count=1;
-				dVector n = (*m_NormData)[i];
-				for (vector<int>::iterator b=m_ConnectedVerts[i].begin(); 
-						b!=m_ConnectedVerts[i].end(); b++)
+				unsigned int v=m_IndexMode?m_IndexData[c+n]:c+n;
+				if (v<moved.size() && moved[v])
 				{
-					n+=(*m_NormData)[*b];
-					count+=1;
+					dirtyfaces[f]=1;
+					memset(&dirtycorners[c],1,stride);
+					break;
 				}
-				newnorms->m_Data.push_back((n/count).normalise());
 			}
-			SetDataRaw("n", newnorms);
 		}
+		CalculateGeometricNormals(&dirtyfaces[0]);
+	}
+	else
+	{
+		m_NormalsFrom.assign(m_VertPData->View(),m_VertPData->View()+m_VertPData->Size());
+		CalculateGeometricNormals();
+	}
+
+	if (!m_GeometricNormals.empty()) 
+	{
+		// indexed primitives average over the faces using each vertex, 
+		// otherwise smoothing averages over the coincident vertices
+		const Connectivity *sources=NULL;
+		if (m_IndexMode) sources=&m_IndexUsers;
+		else if (smooth) sources=&m_ConnectedVerts;
+		
+		m_NormPData->Unmap();
+		VertexNormalsTask task(m_GeometricNormals,sources,m_IndexMode,
+			dirtycorners.empty()?NULL:&dirtycorners[0],&(*m_NormData)[0]);
+		ThreadPool::Run(task,m_VertPData->Size());
+		
+		m_NormPData->Dirty();
+		m_NormalsVersion=m_NormPData->GetVersion();
+		m_NormalsPointsVersion=m_VertPData->GetVersion();
+		m_NormalsSmooth=smooth;
 	}
 }
 
@@ -303,7 +724,8 @@ void PolyPrimitive::ConvertToIndexed()
 {
 	if (m_IndexMode) return;
 
-	if (m_ConnectedVerts.empty())
+	CheckTopology();
+	if (m_ConnectedVerts.Empty())
 	{
 		CalculateConnected();
 	}
@@ -314,36 +736,31 @@ void PolyPrimitive::ConvertToIndexed()
 	TypedPData<dVector> *NewTex = new TypedPData<dVector>;
 
 	m_IndexData.clear();
-	int vert=0;
+	m_IndexVersion=PData::NewVersion();
 	int index=0;
-	map<int,int> verttoindex;
-	for (vector<vector<int> >::iterator i=m_ConnectedVerts.begin();
-		 i!=m_ConnectedVerts.end(); i++)
+	vector<int> verttoindex(m_ConnectedVerts.Size(),-1);
+	for (unsigned int vert=0; vert<m_ConnectedVerts.Size(); vert++)
 	{
-		if (!i->empty() && verttoindex.find(vert)==verttoindex.end())
+		if (verttoindex[vert]==-1)
 		{
-			// take the first connected as our new point - will trash non-shared
+			// take this vert as our new point - will trash non-shared
 			// normals, texture coords and colours
-			NewVerts->m_Data.push_back((*m_VertData)[(*i)[0]]);
-			NewNorms->m_Data.push_back((*m_NormData)[(*i)[0]]);
-			NewCols->m_Data.push_back((*m_ColData)[(*i)[0]]);
-			NewTex->m_Data.push_back((*m_TexData)[(*i)[0]]);
-			m_IndexData.push_back(index);
+			NewVerts->m_Data.push_back(m_VertPData->View()[vert]);
+			NewNorms->m_Data.push_back(m_NormPData->View()[vert]);
+			NewCols->m_Data.push_back(m_ColPData->View()[vert]);
+			NewTex->m_Data.push_back(m_TexPData->View()[vert]);
 			
 			// record all the verts that can point to this index
-			for (vector<int>::iterator v=i->begin(); v!=i->end(); v++)
+			verttoindex[vert]=index;
+			for (const int *v=m_ConnectedVerts.Begin(vert); v!=m_ConnectedVerts.End(vert); v++)
 			{
 				verttoindex[*v]=index;
 			}
 			
 			index++;
 		}
-		else
-		{
-			m_IndexData.push_back(verttoindex[vert]);
-		}
-		
-		vert++;
+
+		m_IndexData.push_back(verttoindex[vert]);
 	}
 	
 	SetDataRaw("p", NewVerts);
@@ -352,11 +769,43 @@ void PolyPrimitive::ConvertToIndexed()
 	SetDataRaw("t", NewTex);
 		
 	m_IndexMode=true;
+	
+	// the topology is now in terms of index positions
+	InvalidateTopology();
+}
+
+void PolyPrimitive::InvalidateTopology()
+{
+	m_ConnectedVerts.Clear();
+	m_GeometricNormals.clear();
+	m_UniqueEdges.clear();
+	m_HalfEdges.Clear();
+	m_IndexUsers.Clear();
+	m_NormalsFrom.clear();
+	
+	m_TopologyVerts=m_VertPData;
+	m_TopologySize=m_VertPData->Size();
+	m_TopologyIndexVersion=m_IndexVersion;
+	m_TopologyIndexMode=m_IndexMode;
+	m_TopologyVersion=PData::NewVersion();
+}
+
+void PolyPrimitive::CheckTopology()
+{
+	// catch resizes and index changes, which don't go through PDataDirty
+	if (m_TopologySize!=m_VertPData->Size() || 
+	    m_TopologyIndexVersion!=m_IndexVersion ||
+	    m_TopologyIndexMode!=m_IndexMode)
+	{
+		InvalidateTopology();
+	}
 }
 
 void PolyPrimitive::GenerateTopology()
 {
-	if (m_ConnectedVerts.empty())
+	CheckTopology();
+	
+	if (m_ConnectedVerts.Empty())
 	{
 		CalculateConnected();
 	}
@@ -369,60 +818,78 @@ void PolyPrimitive::GenerateTopology()
 
 void PolyPrimitive::CalculateConnected()
 { 
-	
+	m_ConnectedVerts.Clear();
+	m_IndexUsers.Clear();
+	if (m_VertPData->Size()==0) return;
+
 	if (m_IndexMode)
-	{		
+	{
+		// weld the vertices themselves
+		Connectivity coincident;
+		FindCoincidentPoints(m_VertPData->View(),m_VertPData->Size(),coincident);
+		
+		// and find the index positions which use each vertex
+		vector<unsigned int> start(m_VertPData->Size()+1,0);
+		for (unsigned int i=0; i<m_IndexData.size(); i++)
+		{
+			if (m_IndexData[i]<m_VertPData->Size()) start[m_IndexData[i]+1]++;
+		}
+		for (unsigned int v=0; v<m_VertPData->Size(); v++) start[v+1]+=start[v];
+		vector<int> users(m_IndexData.size());
+		vector<unsigned int> fill(start.begin(),start.end()-1);
+		for (unsigned int i=0; i<m_IndexData.size(); i++)
+		{
+			if (m_IndexData[i]<m_VertPData->Size()) users[fill[m_IndexData[i]]++]=i;
+		}
+		m_IndexUsers.Clear();
+		for (unsigned int v=0; v<m_VertPData->Size(); v++)
+		{
+			m_IndexUsers.AddRow(users.empty()?NULL:&users[0]+start[v],start[v+1]-start[v]);
+		}
+
+		// index positions are connected if they share the
+		// index value, or the vertices they point to are coincident
+		vector<int> connected;
 		for (unsigned int i=0; i<m_IndexData.size(); i++)
 		{
-			vector<int> connected;
-			for (unsigned int b=0; b<m_IndexData.size(); b++)
+			connected.clear();
+			unsigned int v=m_IndexData[i];
+			if (v<m_VertPData->Size())
 			{
-				// compare index value
-				if (i!=b && (m_IndexData[i]==m_IndexData[b] || 
-				   // compare positions
-				   ((*m_VertData)[m_IndexData[i]].feq((*m_VertData)[m_IndexData[b]]))))
+				for (const int *u=m_IndexUsers.Begin(v); u!=m_IndexUsers.End(v); u++)
+				{
+					if (*u!=(int)i) connected.push_back(*u);
+				}
+				for (const int *c=coincident.Begin(v); c!=coincident.End(v); c++)
 				{
-					connected.push_back(b);
+					connected.insert(connected.end(),m_IndexUsers.Begin(*c),m_IndexUsers.End(*c));
 				}
+				sort(connected.begin(),connected.end());
 			}
-			
-			m_ConnectedVerts.push_back(connected);
+			m_ConnectedVerts.AddRow(connected.empty()?NULL:&connected[0],connected.size());
 		}
 	}
 	else
 	{
 		// cache the connected verts 
-		for (unsigned int i=0; i<m_VertData->size(); i++)
-		{
-			vector<int> connected;
-			for (unsigned int b=0; b<m_VertData->size(); b++)
-			{
-				// find all close verts
-				if (i!=b && (*m_VertData)[i].feq((*m_VertData)[b]))
-				{
-					connected.push_back(b);
-				}
-			}	
-
-			m_ConnectedVerts.push_back(connected);
-		}
+		FindCoincidentPoints(m_VertPData->View(),m_VertPData->Size(),m_ConnectedVerts);
 	}
 }
 
 
-void PolyPrimitive::CalculateGeometricNormals()
+void PolyPrimitive::CalculateGeometricNormals(const char *dirtyfaces)
 {
 	///\todo - need different approach for TRIFAN
 	// one face 
-	if (m_Type==POLYGON && m_VertData->size()>2) 
+	if (m_Type==POLYGON && m_VertPData->Size()>2) 
 	{
 		m_GeometricNormals.clear();
-		dVector a((*m_VertData)[0]-(*m_VertData)[1]);
-		dVector b((*m_VertData)[1]-(*m_VertData)[2]);
+		dVector a(m_VertPData->View()[0]-m_VertPData->View()[1]);
+		dVector b(m_VertPData->View()[1]-m_VertPData->View()[2]);
 		dVector normal(a.cross(b));
 		normal.normalise();
 		
-		for (unsigned int i=0; i<m_VertData->size(); i++)
+		for (unsigned int i=0; i<m_VertPData->Size(); i++)
 		{
 			m_GeometricNormals.push_back(normal);
 		}
@@ -430,170 +897,151 @@ void PolyPrimitive::CalculateGeometricNormals()
 		return;
 	}
 	
-	int stride=0;
-	if (m_Type==TRISTRIP) stride=2;
-	if (m_Type==QUADS) stride=4;
-	if (m_Type==TRILIST) stride=3;
+	unsigned int stride=FaceStride(m_Type);
 	if (stride>0)
 	{
-		m_GeometricNormals.clear();
+		// a face for every stride with three corners to make a normal from
+		unsigned int corners=m_IndexMode?m_IndexData.size():m_VertPData->Size();
+		unsigned int faces=corners>2?(corners-3)/stride+1:0;
 		
-		if (m_IndexMode)
-		{
-			for (unsigned int i=0; i<m_IndexData.size(); i+=stride)
-			{
-				if (i+2<m_IndexData.size())
-				{
-					dVector a((*m_VertData)[m_IndexData[i]]-(*m_VertData)[m_IndexData[i+1]]);
-					dVector b((*m_VertData)[m_IndexData[i+1]]-(*m_VertData)[m_IndexData[i+2]]);
-					dVector normal(a.cross(b));
-					normal.normalise();
-					for (int n=0; n<stride; n++)
-					{
-						m_GeometricNormals.push_back(normal);
-					}
-				}
-			}
-		}
-		else
-		{
-			for (unsigned int i=0; i<m_VertData->size(); i+=stride)
-			{
-				if (i+2<m_VertData->size())
-				{
-					dVector a((*m_VertData)[i]-(*m_VertData)[i+1]);
-					dVector b((*m_VertData)[i+1]-(*m_VertData)[i+2]);
-					dVector normal(a.cross(b));
-					normal.normalise();
-					for (int n=0; n<stride; n++)
-					{
-						m_GeometricNormals.push_back(normal);
-					}
-				}
-			}
-		}
+		if (dirtyfaces==NULL) m_GeometricNormals.resize(faces*stride);
+		if (faces==0) return;
+		
+		FaceNormalsTask task(m_VertPData->View(),m_IndexMode?&m_IndexData[0]:NULL,
+			stride,dirtyfaces,&m_GeometricNormals[0]);
+		ThreadPool::Run(task,faces);
 	}
 }
 
 void PolyPrimitive::CalculateUniqueEdges()
 {
+	CalculateHalfEdges();
+	
 	if (m_UniqueEdges.empty())
 	{
-		// todo - need different approach for TRIFAN
-		int stride=0;
-		if (m_Type==TRISTRIP) stride=2;
-		if (m_Type==QUADS) stride=4;
-		if (m_Type==TRILIST) stride=3;
-		if (stride>0)
-		{		
-			set<pair<int,int> > firstpass;
-			
-			unsigned int vertcount=m_VertData->size();
-			if (m_IndexMode) vertcount=m_IndexData.size();
-			
-			// first, record all valid edges from the topology type
-			for (unsigned int i=0; i<vertcount; i+=stride)
+		// each edge paired with the one it shares
+		for (unsigned int e=0; e<m_HalfEdges.NumEdges(); e++)
+		{
+			int o=m_HalfEdges.Opposite(e);
+			if (o==-1 || (int)e<o)
 			{
-				for (int n=0; n<stride-1; n++)
+				vector<pair<int,int> > edges;
+				edges.push_back(pair<int,int>(m_HalfEdges.Vert(e),m_HalfEdges.EndVert(e)));
+				if (o!=-1)
 				{
-					firstpass.insert(pair<int,int>(n+i,n+i+1));
+					edges.push_back(pair<int,int>(m_HalfEdges.Vert(o),m_HalfEdges.EndVert(o)));
 				}
-				firstpass.insert(pair<int,int>(i+stride-1,i));
-			}
-
-			set<pair<int,int> > stored;
-			pair<int,int> key;
-
-			// now find all edges which share points and group them together
-			for (unsigned int i=0; i<vertcount; i+=stride)
-			{
-				for (int n=0; n<stride-1; n++)
-				{	
-					UniqueEdgesFindShared(pair<int,int>(n+i,n+i+1), firstpass, stored);
-				}	
-				UniqueEdgesFindShared(pair<int,int>(i+stride-1,i), firstpass, stored);	
+				m_UniqueEdges.push_back(edges);
 			}
 		}
 	}
 }
 
-void PolyPrimitive::UniqueEdgesFindShared(pair<int,int> edge, set<pair<int,int> > firstpass, set<pair<int,int> > &stored)
+void PolyPrimitive::CalculateHalfEdges()
 {
-	vector<pair<int,int> > edges;
+	CheckTopology();
+	
+	if (!m_HalfEdges.Empty()) return;
 	
-	if (stored.find(edge)==stored.end() && stored.find(pair<int,int>(edge.second,edge.first))==stored.end())
+	if (m_ConnectedVerts.Empty())
 	{
-		// first, store the test edge
-		edges.push_back(edge);
-		stored.insert(edge);
-		
-		//Trace::Stream<<"edge:"<<edge.first<<" "<<edge.second<<endl;
-		
-		// make all combinations of verts connected to the edge verts
-		for (vector<int>::iterator a=m_ConnectedVerts[edge.first].begin();
-			a!=m_ConnectedVerts[edge.first].end(); a++)
+		CalculateConnected();
+	}
+	
+	unsigned int corners=m_VertPData->Size();
+	if (m_IndexMode) corners=m_IndexData.size();
+	
+	// weld each corner to the lowest one it's connected to
+	vector<int> weld(corners);
+	for (unsigned int c=0; c<corners; c++)
+	{
+		weld[c]=c;
+		if (c<m_ConnectedVerts.Size() && m_ConnectedVerts.Count(c)>0)
 		{
-			for (vector<int>::iterator b=m_ConnectedVerts[edge.second].begin();
-					b!=m_ConnectedVerts[edge.second].end(); b++)
+			weld[c]=min((int)c,*m_ConnectedVerts.Begin(c));
+		}
+	}
+	
+	// split the corners into faces
+	Connectivity faces;
+	int face[4];
+	switch (m_Type)
+	{
+		case TRISTRIP:
+			for (unsigned int c=0; c+2<corners; c++)
 			{
-				//Trace::Stream<<*a<<" "<<*b<<endl;
-				pair<int, int> candidate(*a,*b);
-				if (firstpass.find(candidate)!=firstpass.end() && // if this is a real edge
-					stored.find(candidate)==stored.end() )        // and we've not stored it already
-				{
-					edges.push_back(candidate);
-					stored.insert(candidate);
-					//Trace::Stream<<"^ "<<candidate.first<<" "<<candidate.second<<endl;
-				}						
-
-				pair<int, int> rcandidate(*b,*a);
-				if (firstpass.find(rcandidate)!=firstpass.end() && // if this is a real edge
-					stored.find(rcandidate)==stored.end() )        // and we've not stored it already
-				{
-					edges.push_back(rcandidate);
-					stored.insert(rcandidate);
-					//Trace::Stream<<"^ "<<rcandidate.first<<" "<<rcandidate.second<<endl;
-				}						
+				// every other triangle is wound the other way
+				face[0]=c+(c&1); face[1]=c+1-(c&1); face[2]=c+2;
+				faces.AddRow(face,3);
 			}
-		}
-
-		if (!edges.empty())
-		{
-			m_UniqueEdges.push_back(edges);
-		}
+		break;
+		case QUADS:
+			for (unsigned int c=0; c+3<corners; c+=4)
+			{
+				face[0]=c; face[1]=c+1; face[2]=c+2; face[3]=c+3;
+				faces.AddRow(face,4);
+			}
+		break;
+		case TRILIST:
+			for (unsigned int c=0; c+2<corners; c+=3)
+			{
+				face[0]=c; face[1]=c+1; face[2]=c+2;
+				faces.AddRow(face,3);
+			}
+		break;
+		case TRIFAN:
+			for (unsigned int c=1; c+1<corners; c++)
+			{
+				face[0]=0; face[1]=c; face[2]=c+1;
+				faces.AddRow(face,3);
+			}
+		break;
+		case POLYGON:
+			if (corners>2)
+			{
+				vector<int> poly(corners);
+				for (unsigned int c=0; c<corners; c++) poly[c]=c;
+				faces.AddRow(&poly[0],corners);
+			}
+		break;
 	}
+	
+	m_HalfEdges.Build(faces,weld);
 }
 
 dBoundingBox PolyPrimitive::GetBoundingBox(const dMatrix &space)
 {	
 	dBoundingBox box;
-	for (vector<dVector,FLX_ALLOC(dVector) >::iterator i=m_VertData->begin(); i!=m_VertData->end(); ++i)
+	const dVector *verts=m_VertPData->View();
+	for (unsigned int i=0; i<m_VertPData->Size(); i++)
 	{
-		box.expand(space.transform(*i));
+		box.expand(space.transform(verts[i]));
 	}
 	return box;
 }
 
 void PolyPrimitive::ApplyTransform(bool ScaleRotOnly)
 {
+	if (m_VertPData->Size()==0)
+	{
+		GetState()->Transform.init();
+		return;
+	}
+
+	m_VertPData->Unmap();
 	if (!ScaleRotOnly)
 	{
-		for (vector<dVector,FLX_ALLOC(dVector) >::iterator i=m_VertData->begin(); i!=m_VertData->end(); ++i)
-		{
- 			*i=GetState()->Transform.transform(*i);
-			// why not normals?
-		}
+		// why not normals?
+		dTransformPoints(GetState()->Transform,&(*m_VertData)[0],&(*m_VertData)[0],m_VertData->size());
 	}
 	else
 	{
-		for (unsigned int i=0; i<m_VertData->size(); i++)
-		{
-			(*m_VertData)[i]=GetState()->Transform.transform_no_trans((*m_VertData)[i]);
-			(*m_NormData)[i]=GetState()->Transform.transform_no_trans((*m_NormData)[i]).normalise();
-		}
+		m_NormPData->Unmap();
+		dTransformNormals(GetState()->Transform,&(*m_VertData)[0],&(*m_VertData)[0],m_VertData->size());
+		dTransformNormals(GetState()->Transform,&(*m_NormData)[0],&(*m_NormData)[0],m_NormData->size(),true);
+		m_NormPData->Dirty();
 	}
+	m_VertPData->Dirty();
 	
 	GetState()->Transform.init();
 }
-
-
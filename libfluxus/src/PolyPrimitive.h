@@ -21,6 +21,8 @@
 
 #include "Primitive.h"
 #include "PolyEvaluator.h"
+#include "VertexBuffer.h"
+#include "HalfEdge.h"
 
 namespace Fluxus
 {
@@ -42,6 +44,7 @@ public:
 	///@{
 	virtual PolyPrimitive *Clone() const;
 	virtual void Render();
+	virtual void RenderInstances(const vector<dMatrix> &transforms, const vector<dColour> &colours);
 	virtual dBoundingBox GetBoundingBox(const dMatrix &space);
 	virtual void RecalculateNormals(bool smooth);
 	virtual void ApplyTransform(bool ScaleRotOnly=false);
@@ -71,7 +74,7 @@ public:
 	/// of the index is stored, otherwise it's done by 	
 	/// looking at the actual vertex positions, with a 
 	/// small allowed error, and the index is stored.
-	const vector<vector<int> > &GetConnectedVerts() { GenerateTopology(); return m_ConnectedVerts; }
+	const Connectivity &GetConnectedVerts() { GenerateTopology(); return m_ConnectedVerts; }
 	
 	/// Unique edges is a list of coincident edges in 
 	/// the topology, formed by pairs of vert indexes, 
@@ -81,6 +84,25 @@ public:
 	/// In indexed mode there is a geometric normal 
 	/// for every index
 	const vector<dVector> &GetGeometricNormals() { GenerateTopology(); return m_GeometricNormals; }
+	
+	/// The faces as a half edge structure, for constant 
+	/// time neighbour, opposite edge and face adjacency 
+	/// queries. Corners are vert indexes, or index 
+	/// positions if the poly is indexed, welded as for 
+	/// the connected verts.
+	const HalfEdgeMesh &GetHalfEdges() { CalculateHalfEdges(); return m_HalfEdges; }
+	
+	/// The topology depends on the number of verts and 
+	/// the index, but not the vertex positions - so 
+	/// deforming a primitive keeps it. Call this if the 
+	/// change should weld or split vertices.
+	void InvalidateTopology();
+	
+	/// A unique version given to the topology each time it's 
+	/// invalidated, to tell when things built from the half 
+	/// edges need redoing. Only up to date after one of the 
+	/// topology functions above has been called.
+	unsigned int GetTopologyVersion() const { return m_TopologyVersion; }
 	///@}
 
 	//////////////////////////////////////////////////
@@ -88,7 +110,8 @@ public:
 	///@{
 	void SetIndexMode(bool s) { m_IndexMode=s; }
 	bool IsIndexed() const { return m_IndexMode; }
-	vector<unsigned int> &GetIndex() { return m_IndexData; }
+	/// The index is assumed to be written to
+	vector<unsigned int> &GetIndex() { m_IndexVersion=PData::NewVersion(); return m_IndexData; }
 	const vector<unsigned int> &GetIndexConst() const { return m_IndexData; }
 	/// Look at coincident verts and compress the poly
 	/// primitive into an indexed form
@@ -99,27 +122,73 @@ public:
 protected:
 
 	virtual void PDataDirty();
+
+	// Rendering, split up so instances can share the array setup
+	bool GetGLType(int &type);
+	bool BeginArrays(const void *&indexptr);
+	void DrawPasses(int type, const void *indexptr, unsigned int instances);
+	void Draw(int type, const void *indexptr, unsigned int instances);
+	void EndArrays(bool vbo);
 	
 	// Topology generation commands
 	void GenerateTopology();
 	void CalculateConnected();
-	void CalculateGeometricNormals();
+	void CalculateGeometricNormals(const char *dirtyfaces=NULL);
 	void CalculateUniqueEdges();
-	void UniqueEdgesFindShared(pair<int,int> edge, set<pair<int,int> > firstpass, set<pair<int,int> > &stored);
+	void CalculateHalfEdges();
+	void CheckTopology();
 	void RecalculateNormalsIndexed();
 	
-	vector<vector<int> > m_ConnectedVerts;
+	Connectivity m_ConnectedVerts;
 	vector<dVector> m_GeometricNormals;
 	vector<vector<pair<int,int> > > m_UniqueEdges;
+	HalfEdgeMesh m_HalfEdges;
+	/// The index positions using each vertex, in indexed mode
+	Connectivity m_IndexUsers;
+	
+	// the positions and versions the normals were last 
+	// calculated from, to only update the parts that move
+	vector<dVector> m_NormalsFrom;
+	unsigned int m_NormalsVersion;
+	unsigned int m_NormalsPointsVersion;
+	bool m_NormalsSmooth;
+	
+	// what the topology was built from
+	PData *m_TopologyVerts;
+	unsigned int m_TopologySize;
+	unsigned int m_TopologyIndexVersion;
+	bool m_TopologyIndexMode;
+	unsigned int m_TopologyVersion;
 	
 	bool m_IndexMode;
 	vector<unsigned int> m_IndexData;
+	unsigned int m_IndexVersion;
 	
 	Type m_Type;
+	// the arrays, read them through View() so mapped 
+	// arrays stay mapped
+	TypedPData<dVector> *m_VertPData;
+	TypedPData<dVector> *m_NormPData;
+	TypedPData<dColour> *m_ColPData;
+	TypedPData<dVector> *m_TexPData;
+
+	// direct access for writing, only valid after 
+	// calling Unmap() on the array
 	vector<dVector,FLX_ALLOC(dVector) > *m_VertData;
 	vector<dVector,FLX_ALLOC(dVector) > *m_NormData;
 	vector<dColour,FLX_ALLOC(dColour) > *m_ColData;
 	vector<dVector,FLX_ALLOC(dVector) > *m_TexData;
+
+	// video memory copies for HINT_VBO
+	VertexBuffer m_VertBuffer;
+	VertexBuffer m_NormBuffer;
+	VertexBuffer m_ColBuffer;
+	VertexBuffer m_TexBuffer;
+	VertexBuffer m_MultiTexBuffer[MAX_TEXTURES];
+	VertexBuffer m_IndexBuffer;
+	// per instance attribute streams
+	VertexBuffer m_InstanceBuffer;
+	VertexBuffer m_InstanceColourBuffer;
 };
 
 };
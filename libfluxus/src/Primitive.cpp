@@ -22,7 +22,9 @@ Primitive::SceneInfo Primitive::m_SceneInfo;
 
 Primitive::Primitive() :
 m_Visibility(0xffffffff),
-m_Selectable(true)
+m_Selectable(true),
+m_BoundsVersion(PData::NewVersion()),
+m_BoundsListener(NULL)
 {
 }
 
@@ -30,7 +32,9 @@ Primitive::Primitive(const Primitive &other) :
 PDataContainer(other),
 m_State(other.m_State),
 m_Visibility(other.m_Visibility),
-m_Selectable(other.m_Selectable)
+m_Selectable(other.m_Selectable),
+m_BoundsVersion(PData::NewVersion()),
+m_BoundsListener(NULL)
 {
 }
 
@@ -53,6 +57,8 @@ void Primitive::Prerender()
 	{
 		for (map<string,PData*>::iterator i=m_PData.begin(); i!=m_PData.end(); i++)
 		{
+			// the shader takes the vectors, so mapped arrays need copying
+			i->second->Unmap();
 			TypedPData<dVector> *data = dynamic_cast<TypedPData<dVector>*>(i->second);
 			if (data) m_State.Shader->SetVectorAttrib(i->first,data->m_Data);
 			else
@@ -70,6 +76,20 @@ void Primitive::Prerender()
 
 }
 
+void Primitive::RenderInstances(const vector<dMatrix> &transforms, const vector<dColour> &colours)
+{
+	for (unsigned int n=0; n<transforms.size(); n++)
+	{
+		glPushMatrix();
+		glMultMatrixf(transforms[n].arr());
+		m_State.Colour=colours[n];
+		glColor4fv(m_State.Colour.arr());
+		glMaterialfv(GL_FRONT_AND_BACK,GL_DIFFUSE,m_State.Colour.arr());
+		Render();
+		glPopMatrix();
+	}
+}
+
 void Primitive::RenderAxes()
 {
 	glDisable(GL_LIGHTING);
@@ -27,6 +27,16 @@
 namespace Fluxus
 {
 
+//////////////////////////////////////////////////
+/// Something which needs to know when a 
+/// primitive's bounding box may have changed
+class BoundsListener
+{
+public:
+	virtual ~BoundsListener() {}
+	virtual void BoundsChanged()=0;
+};
+
 //////////////////////////////////////////////////
 /// The base primitive class.
 class Primitive : public PDataContainer
@@ -52,6 +62,15 @@ public:
 	/// Only makes sense for certain primitive types
 	virtual void RecalculateNormals(bool smooth) {}
 
+	/// Renders the primitive once for each transform, in
+	/// the matching colour, with the state already applied.
+	/// Used by immediate mode to batch up draw-instance calls.
+	virtual void RenderInstances(const vector<dMatrix> &transforms, const vector<dColour> &colours);
+
+	/// False if Render() leaves gl state behind it, so
+	/// the render queue needs to apply the next state in full
+	virtual bool RestoresGLState()  { return true; }
+
 	///////////////////////////////////////////////////
 	///@name Primitive Interface
 	///@{
@@ -74,8 +93,27 @@ public:
 	/// Whether we should be included in the selection pass
 	bool IsSelectable()				{ return m_Selectable; }
 	void Selectable(bool s)			{ m_Selectable=s; }
+
+	/// Changes whenever anything the bounding box is made from 
+	/// changes, versions are unique like the pdata ones
+	unsigned int GetBoundsVersion() const { return m_BoundsVersion; }
+
+	/// Primitives which change their shape without going 
+	/// through the pdata interface need to call this
+	void DirtyBounds()              
+	{ 
+		m_BoundsVersion=PData::NewVersion(); 
+		if (m_BoundsListener) m_BoundsListener->BoundsChanged();
+	}
+
+	/// Tells the listener about DirtyBounds() calls, NULL for none.
+	/// Not copied with the primitive
+	void SetBoundsListener(BoundsListener *l) { m_BoundsListener=l; }
 	///@}
 
+	/// Any pdata write may move the bounding box
+	virtual void DataChanged()      { DirtyBounds(); }
+
 	static void SetSceneInfo(const dVector &dir, const dVector &up);
 									
 	// Information which the renderer can pass to primitives,
@@ -102,6 +140,8 @@ private:
 	///\todo: make these into an enum/bitfield?
 	unsigned int m_Visibility;
 	bool  m_Selectable;
+	unsigned int m_BoundsVersion;
+	BoundsListener *m_BoundsListener;
 };
 
 };
@@ -17,6 +17,8 @@
 #include "PrimitiveIO.h"
 #include "OBJPrimitiveIO.h"
 #include "PixelPrimitiveIO.h"
+#include "PLYPrimitiveIO.h"
+#include "MeshCache.h"
 #include "SceneGraph.h"
 
 using namespace Fluxus;
@@ -38,17 +40,24 @@ Primitive *PrimitiveIO::Read(const string &filename, bool cache)
 	map<string, Primitive*>::iterator i = m_GeometryCache.find(filename);
 	if (i!=m_GeometryCache.end()) return i->second->Clone();
 	
-	// otherwise, we need to load it...
-	string extension = filename.substr(filename.find_last_of('.')+1,filename.size());
-	PrimitiveIO *pio = GetFromExtension(extension);
-	Primitive *prim = NULL;
-	if (pio!=NULL)
+	// then on disk, which saves parsing the file again
+	Primitive *prim = MeshCache::Read(filename);
+	if (prim==NULL)
 	{
-		prim = pio->FormatRead(filename);
+		// otherwise, we need to load it...
+		string extension = filename.substr(filename.find_last_of('.')+1,filename.size());
+		PrimitiveIO *pio = GetFromExtension(extension);
+		if (pio!=NULL)
+		{
+			prim = pio->FormatRead(filename);
+			if (!pio->CacheInMemory()) cache = false;
+		}
+		delete pio;
+		
+		if (prim==NULL) return NULL;
+		MeshCache::Write(filename,prim);
 	}
-	delete pio;
 	
-	if (prim==NULL) return NULL;
 	if (!cache) return prim;
 	m_GeometryCache[filename]=prim;
 	return prim->Clone();
@@ -73,6 +82,7 @@ PrimitiveIO *PrimitiveIO::GetFromExtension(const string &extension)
 {
 	if (extension=="obj") return new OBJPrimitiveIO;
 	else if (extension=="png") return new PixelPrimitiveIO;
+	else if (extension=="ply") return new PLYPrimitiveIO;
 	return NULL;
 }
 
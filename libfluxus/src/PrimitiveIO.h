@@ -33,6 +33,8 @@ public:
 	virtual Primitive *FormatRead(const std::string &filename)=0;
 	virtual bool FormatWrite(const std::string &filename, const Primitive *ob, unsigned id,
 			const SceneGraph &world)=0;
+	/// Whether Read should keep a copy of primitives loaded in this format
+	virtual bool CacheInMemory() const { return true; }
 
 	static Primitive *Read(const std::string &filename, bool cache=true);
 	static bool Write(const std::string &filename, const Primitive *ob, unsigned id,
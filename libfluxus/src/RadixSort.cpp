@@ -0,0 +1,95 @@
+// Copyright (C) 2010 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#include <cstring>
+#include "RadixSort.h"
+
+using namespace Fluxus;
+
+// flips the float bits so they sort correctly as unsigned 
+// ints - negative numbers have all their bits flipped, 
+// positive ones just the sign bit
+static inline unsigned int FloatKey(float f)
+{
+	unsigned int u;
+	memcpy(&u,&f,sizeof(u));
+	// -0 and 0 are equal, and need to stay in order
+	if (u==0x80000000) u=0;
+	unsigned int mask=-int(u>>31)|0x80000000;
+	return u^mask;
+}
+
+void RadixSort::Add(float key, unsigned int index)
+{
+	Item item;
+	item.Key=FloatKey(key);
+	item.Index=index;
+	m_Items.push_back(item);
+}
+
+const vector<unsigned int> &RadixSort::Sort()
+{
+	unsigned int count=m_Items.size();
+	m_Temp.resize(count);
+	m_Order.resize(count);
+	if (count==0) return m_Order;
+
+	// histograms for all four bytes in one go
+	unsigned int histogram[4][256];
+	memset(histogram,0,sizeof(histogram));
+	for (vector<Item>::iterator i=m_Items.begin(); i!=m_Items.end(); ++i)
+	{
+		histogram[0][i->Key&0xff]++;
+		histogram[1][(i->Key>>8)&0xff]++;
+		histogram[2][(i->Key>>16)&0xff]++;
+		histogram[3][i->Key>>24]++;
+	}
+
+	// least significant byte first, each pass is stable
+	Item *src=&m_Items[0];
+	Item *dst=&m_Temp[0];
+	for (unsigned int pass=0; pass<4; pass++)
+	{
+		unsigned int shift=pass*8;
+
+		// skip the pass if all the keys have the same byte
+		if (histogram[pass][(src[0].Key>>shift)&0xff]==count) continue;
+
+		unsigned int offset[256];
+		unsigned int total=0;
+		for (unsigned int n=0; n<256; n++)
+		{
+			offset[n]=total;
+			total+=histogram[pass][n];
+		}
+
+		for (unsigned int n=0; n<count; n++)
+		{
+			dst[offset[(src[n].Key>>shift)&0xff]++]=src[n];
+		}
+
+		Item *t=src;
+		src=dst;
+		dst=t;
+	}
+
+	for (unsigned int n=0; n<count; n++)
+	{
+		m_Order[n]=src[n].Index;
+	}
+
+	return m_Order;
+}
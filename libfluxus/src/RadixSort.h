@@ -0,0 +1,70 @@
+// Copyright (C) 2010 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#ifndef N_RADIXSORT
+#define N_RADIXSORT
+
+#include <vector>
+
+using namespace std;
+
+namespace Fluxus
+{
+
+//////////////////////////////////////////////////////
+/// Sorts indices by float keys with a radix sort, 
+/// used for depth sorting. The storage is kept between
+/// sorts, so once it's grown to size there is no
+/// allocation per frame. Equal keys keep the order
+/// they were added in.
+class RadixSort
+{
+public:
+	RadixSort() {}
+	~RadixSort() {}
+
+	/// Clear the keys, but keep the memory
+	void Clear() { m_Items.clear(); }
+
+	/// Make space for this many keys
+	void Reserve(unsigned int size) { m_Items.reserve(size); }
+
+	/// Add a key for the given index
+	void Add(float key, unsigned int index);
+
+	/// Sort by key, smallest first, and return the
+	/// indices in sorted order
+	const vector<unsigned int> &Sort();
+
+	/// The indices from the last Sort()
+	const vector<unsigned int> &GetOrder() const { return m_Order; }
+
+private:
+	class Item
+	{
+	public:
+		unsigned int Key;
+		unsigned int Index;
+	};
+
+	vector<Item> m_Items;
+	vector<Item> m_Temp;
+	vector<unsigned int> m_Order;
+};
+
+}
+
+#endif
@@ -0,0 +1,165 @@
+// Copyright (C) 2010 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#include <algorithm>
+#include "RenderQueue.h"
+
+using namespace Fluxus;
+
+#define INHERITED_HINTS (HINT_NORMALISE|HINT_NOZWRITE)
+
+static int CompareColour(const dColour &a, const dColour &b)
+{
+	if (a.r!=b.r) return a.r<b.r?-1:1;
+	if (a.g!=b.g) return a.g<b.g?-1:1;
+	if (a.b!=b.b) return a.b<b.b?-1:1;
+	if (a.a!=b.a) return a.a<b.a?-1:1;
+	return 0;
+}
+
+bool RenderQueue::StateOrder::operator()(unsigned int a, unsigned int b) const
+{
+	const Item &ia=m_Items[a];
+	const Item &ib=m_Items[b];
+	const State *sa=ia.Prim->GetState();
+	const State *sb=ib.Prim->GetState();
+
+	// most expensive changes first
+	if (sa->Shader!=sb->Shader) return sa->Shader<sb->Shader;
+	for (int n=0; n<MAX_TEXTURES; n++)
+	{
+		if (sa->Textures[n]!=sb->Textures[n]) return sa->Textures[n]<sb->Textures[n];
+	}
+	if (ia.Hints!=ib.Hints) return ia.Hints<ib.Hints;
+	if (sa->Opacity!=sb->Opacity) return sa->Opacity<sb->Opacity;
+
+	int c=CompareColour(sa->Colour,sb->Colour);
+	if (c==0) c=CompareColour(sa->Ambient,sb->Ambient);
+	if (c==0) c=CompareColour(sa->Emissive,sb->Emissive);
+	if (c==0) c=CompareColour(sa->Specular,sb->Specular);
+	if (c!=0) return c<0;
+	return sa->Shinyness<sb->Shinyness;
+}
+
+bool RenderQueue::Opaque::operator()(unsigned int n) const
+{
+	const Item &item=m_Items[n];
+	const State *state=item.Prim->GetState();
+	if (item.Hints&HINT_NOBLEND) return true;
+	return state->Opacity>=1 && state->Colour.a>=1 &&
+		!(item.Hints&HINT_NOZWRITE) &&
+		state->SourceBlend==GL_SRC_ALPHA &&
+		state->DestinationBlend==GL_ONE_MINUS_SRC_ALPHA;
+}
+
+RenderQueue::RenderQueue()
+{
+}
+
+RenderQueue::~RenderQueue()
+{
+}
+
+void RenderQueue::Clear()
+{
+	// keeps the memory for the next frame
+	m_Items.clear();
+}
+
+void RenderQueue::Add(const dMatrix &parenttransform, Primitive *prim, int id, int inherited)
+{
+	Item item;
+	item.Prim=prim;
+	item.ParentTransform=parenttransform;
+	item.ID=id;
+	item.Hints=prim->GetState()->Hints|(inherited&INHERITED_HINTS);
+	m_Items.push_back(item);
+}
+
+void RenderQueue::Render()
+{
+	if (m_Items.empty()) return;
+
+	m_Order.clear();
+	for (unsigned int n=0; n<m_Items.size(); n++)
+	{
+		m_Order.push_back(n);
+	}
+
+	// opaque primitives first, sorted by state. the blended ones
+	// are drawn after them in scenegraph order, as drawing them
+	// in a different order changes the picture
+	vector<unsigned int>::iterator blended=
+		stable_partition(m_Order.begin(),m_Order.end(),Opaque(m_Items));
+	stable_sort(m_Order.begin(),blended,StateOrder(m_Items));
+
+	glPushMatrix();
+
+	State *last=NULL;
+	bool clean=false;
+	int hints=0;
+
+	for (vector<unsigned int>::iterator i=m_Order.begin(); i!=m_Order.end(); ++i)
+	{
+		Item &item=m_Items[*i];
+		State *state=item.Prim->GetState();
+
+		glLoadMatrixf(item.ParentTransform.arr());
+
+		if (clean)
+		{
+			state->ApplyChanges(*last);
+		}
+		else
+		{
+			// we don't know what the gl state is, so set the
+			// toggles apply only switches on as well
+			state->Apply();
+			if (state->Shader==NULL || !(state->Hints&HINT_POINTS))
+			{
+				glDisable(GL_VERTEX_PROGRAM_POINT_SIZE);
+			}
+			hints=~item.Hints;
+		}
+
+		if ((item.Hints^hints)&HINT_NORMALISE)
+		{
+			if (item.Hints&HINT_NORMALISE) glEnable(GL_NORMALIZE);
+			else glDisable(GL_NORMALIZE);
+		}
+
+		if ((item.Hints^hints)&HINT_NOZWRITE)
+		{
+			glDepthMask(!(item.Hints&HINT_NOZWRITE));
+		}
+
+		hints=item.Hints;
+
+		glPushName(item.ID);
+		item.Prim->Prerender();
+		item.Prim->Render();
+		glPopName();
+
+		last=state;
+		clean=item.Prim->RestoresGLState();
+	}
+
+	last->Unapply();
+	if (hints&HINT_NORMALISE) glDisable(GL_NORMALIZE);
+	if (hints&HINT_NOZWRITE) glDepthMask(true);
+
+	glPopMatrix();
+}
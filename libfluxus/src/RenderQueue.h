@@ -0,0 +1,90 @@
+// Copyright (C) 2010 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#ifndef N_RENDERQUEUE
+#define N_RENDERQUEUE
+
+#include "Primitive.h"
+#include <vector>
+
+namespace Fluxus
+{
+
+//////////////////////////////////////////////////////
+/// Collects primitives during the scenegraph walk and
+/// renders them sorted by state, so only the gl state
+/// which changes between primitives is applied. Used
+/// for lots of primitives which share materials,
+/// textures and shaders. Only opaque primitives are
+/// sorted, blended ones are rendered after them in
+/// scenegraph order.
+class RenderQueue
+{
+public:
+	RenderQueue();
+	~RenderQueue();
+
+	/// Clear all stored primitives
+	void Clear();
+
+	/// Add a primitive to the queue, the transform is the
+	/// world space transform of its parent, inherited holds
+	/// the normalise/nozwrite hints set by its parents
+	void Add(const dMatrix &parenttransform, Primitive *prim, int id, int inherited);
+
+	/// Sort the stored primitives by state and render them
+	void Render();
+
+private:
+
+	class Item
+	{
+	public:
+		Primitive *Prim;
+		dMatrix ParentTransform;
+		int ID;
+		int Hints;
+	};
+
+	/// Picks out items which don't blend with what's
+	/// behind them
+	class Opaque
+	{
+	public:
+		Opaque(const vector<Item> &items) : m_Items(items) {}
+		bool operator()(unsigned int n) const;
+	private:
+		const vector<Item> &m_Items;
+	};
+
+	/// Orders item indices by shader, textures, hints,
+	/// opacity then material
+	class StateOrder
+	{
+	public:
+		StateOrder(const vector<Item> &items) : m_Items(items) {}
+		bool operator()(unsigned int a, unsigned int b) const;
+	private:
+		const vector<Item> &m_Items;
+	};
+
+	vector<Item> m_Items;
+	vector<unsigned int> m_Order;
+};
+
+};
+
+#endif
@@ -23,6 +23,7 @@
 #include "PrimitiveIO.h"
 #include "ShaderCache.h"
 #include "GLSLShader.h"
+#include "VertexBuffer.h"
 #include "Trace.h"
 #include "FFGLManager.h"
 #include <sys/time.h>
@@ -54,6 +55,7 @@ m_MotionBlur(false),
 m_Fade(0.02f),
 m_ShowAxis(false),
 m_Grabbed(NULL),
+m_GrabbedNode(NULL),
 m_ClearFrame(true),
 m_ClearZBuffer(true),
 m_ClearAccum(false),
@@ -151,7 +153,7 @@ void Renderer::Render()
 		else
 		{
 			PreRender(cam);
-			m_World.Render(&m_ShadowVolumeGen,cam);
+			m_World.Render(NULL,cam);
 			m_ImmediateMode.Render(cam);
 			PostRender();
 		}
@@ -227,7 +229,8 @@ void Renderer::RenderStencilShadows(unsigned int CamIndex)
 
 	glEnable(GL_LIGHT0+m_ShadowLight);
 
-	m_World.Render(&m_ShadowVolumeGen,CamIndex);
+	// the casters were all added in the first pass
+	m_World.Render(NULL,CamIndex);
 	m_ImmediateMode.Render(CamIndex);
 	m_ImmediateMode.Clear();
 
@@ -252,6 +255,7 @@ void Renderer::PreRender(unsigned int CamIndex, bool PickMode)
     if (!m_Initialised || PickMode || Cam.NeedsInit())
     {
 		GLSLShader::Init();
+		VertexBuffer::Init();
 
 		glViewport((int)(Cam.GetViewportX()*(float)m_Width),(int)(Cam.GetViewportY()*(float)m_Height),
 			(int)(Cam.GetViewportWidth()*(float)m_Width),(int)(Cam.GetViewportHeight()*(float)m_Height));
@@ -467,7 +471,7 @@ int Renderer::Select(unsigned int CamIndex, int x, int y, int size)
 	PreRender(CamIndex,true);
 	
 	// render the scene for picking
-	m_World.Render(&m_ShadowVolumeGen,SceneGraph::SELECT);
+	m_World.Render(NULL,SceneGraph::SELECT);
 	
 	int hits=glRenderMode(GL_RENDER);
 	unsigned int *ptr=IDs, numnames;
@@ -519,7 +523,7 @@ int Renderer::SelectAll(unsigned int CamIndex, int x, int y, int size, unsigned
 	PreRender(CamIndex,true);
 
 	// render the scene for picking
-	m_World.Render(&m_ShadowVolumeGen,SceneGraph::SELECT);
+	m_World.Render(NULL,SceneGraph::SELECT);
 
 	int hits=glRenderMode(GL_RENDER);
 	unsigned int *ptr=IDs, numnames;
@@ -548,6 +552,12 @@ int Renderer::AddPrimitive(Primitive *Prim)
 	Prim->SetState(GetState());
 	SceneNode *node = new SceneNode(Prim);
 	int ret=m_World.AddNode(GetState()->Parent,node);
+	if (ret==0)
+	{
+		// no parent, or the scenegraph is full (already reported)
+		delete node;
+		return 0;
+	}
 	m_World.RecalcAABB(node);
 	return ret;
 }
@@ -564,7 +574,8 @@ void Renderer::RemovePrimitive(int ID)
 	SceneNode *node = (SceneNode*)m_World.FindNode(ID);
 	if (node!=NULL)
 	{
-		if (node->Prim==m_Grabbed) UnGrab();
+		// removing the node removes all its children too
+		if (m_GrabbedNode && m_World.IsDecendedFrom(node,m_GrabbedNode)) UnGrab();
 		m_World.RemoveNode(node);
 	}
 }
@@ -589,6 +600,12 @@ dMatrix Renderer::GetGlobalTransform(int ID)
 	return mat;
 }
 
+void Renderer::DirtyTransform(int ID)
+{
+	SceneNode *node=(SceneNode*)m_World.FindNode(ID);
+	if (node) node->DirtyTransform();
+}
+
 dBoundingBox Renderer::GetBoundingBox(int ID)
 {
 	dBoundingBox bbox;
@@ -649,6 +666,7 @@ void Renderer::Grab(int ID)
 		if (p)
 		{
 			m_Grabbed=p;
+			m_GrabbedNode=n;
 		}
 	}
 }
@@ -656,6 +674,7 @@ void Renderer::Grab(int ID)
 void Renderer::UnGrab()
 {
 	m_Grabbed=NULL;
+	m_GrabbedNode=NULL;
 }
 
 //void Renderer::Apply(int id)
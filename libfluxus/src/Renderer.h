@@ -78,6 +78,9 @@ public:
 	void Grab(int ID);
 	void UnGrab();
 	Primitive *Grabbed() { return m_Grabbed; }
+	/// The grabbed primitive's state may have been written 
+	/// to, so the world transforms below it are out of date
+	void DirtyGrabbed() { if (m_GrabbedNode) m_GrabbedNode->DirtyTransform(); }
 	///@}
 	
 	//////////////////////////////////////////////////////////////////////
@@ -91,6 +94,9 @@ public:
 	/// graph and adds it to the root.
 	void         DetachPrimitive(int ID);
 	dMatrix      GetGlobalTransform(int ID);
+	/// Call when the transform or hints of a primitive are changed
+	/// directly, so the cached world transforms get updated
+	void         DirtyTransform(int ID);
 	dBoundingBox GetBoundingBox(int ID);
 	/// Immediate mode (don't delete prim till after Render() - when it
 	/// will actually be rendered
@@ -138,6 +144,7 @@ public:
 	void SetClearFrame(bool s)               { m_ClearFrame=s; }
 	void SetClearZBuffer(bool s)             { m_ClearZBuffer=s; }
 	void SetClearAccum(bool s)               { m_ClearAccum=s; }
+	void SetRenderQueue(bool s)              { m_World.SetRenderQueue(s); }
 	void SetDesiredFPS(float s)              { m_Deadline=1/s; }
 	void SetFPSDisplay(bool s)               { m_FPSDisplay=s; }
 	void SetFog(const dColour &c, float d, float s, float e)
@@ -176,6 +183,7 @@ private:
 	float m_Fade;
 	bool  m_ShowAxis;
 	Primitive *m_Grabbed;
+	SceneNode *m_GrabbedNode;
 	dColour m_BGColour;
 	bool m_ClearFrame;
 	bool m_ClearZBuffer;
@@ -20,9 +20,36 @@
 
 using namespace Fluxus;
 
+void SceneNode::DirtyTransform()
+{
+	// if we are dirty already, all our children will be too
+	if (m_WorldDirty) return;
+
+	m_WorldDirty=true;
+	m_AABBVersion=0;
+	BoundsChanged();
+	for (vector<Node*>::iterator i=Children.begin(); i!=Children.end(); ++i)
+	{
+		static_cast<SceneNode*>(*i)->DirtyTransform();
+	}
+}
+
+void SceneNode::BoundsChanged()
+{
+	if (m_RefitQueued || m_Graph==NULL) return;
+	m_RefitQueued=true;
+	m_Graph->m_Refits.push_back(ID);
+}
+
+////////////////////////////////////////////////////////////
+
 SceneGraph::SceneGraph() :
+m_UseRenderQueue(false),
+m_Frame(0),
 m_NumRendered(0),
-m_HighWater(0)
+m_HighWater(0),
+m_NumVisited(0),
+m_NumRefitted(0)
 {
 	// need to reset to having a root node present
 	Clear();
@@ -41,15 +68,31 @@ void SceneGraph::Render(ShadowVolumeGen *shadowgen, unsigned int camera, Mode re
 	glGetFloatv(GL_PROJECTION_MATRIX,total.arr());
 	total=total*m_TopTransform;
 	GetFrustumPlanes(m_FrustumPlanes, total, false);
+	Cull();
 	
 	unsigned int cameracode = 1<<camera;
 
 	m_NumRendered=0;
+	m_NumVisited=0;
 
-	// render all the children of the root
-	for (vector<Node*>::iterator i=m_Root->Children.begin(); i!=m_Root->Children.end(); ++i)
+	if (m_UseRenderQueue && rendermode==RENDER)
+	{
+		// collect all the children of the root, and render them sorted by state
+		for (vector<Node*>::iterator i=m_Root->Children.begin(); i!=m_Root->Children.end(); ++i)
+		{
+			QueueWalk((SceneNode*)*i,m_TopTransform,HINT_NONE,cameracode,shadowgen);
+		}
+
+		m_RenderQueue.Render();
+		m_RenderQueue.Clear();
+	}
+	else
 	{
-		RenderWalk((SceneNode*)*i,0,cameracode,shadowgen,rendermode);
+		// render all the children of the root
+		for (vector<Node*>::iterator i=m_Root->Children.begin(); i!=m_Root->Children.end(); ++i)
+		{
+			RenderWalk((SceneNode*)*i,0,cameracode,shadowgen,rendermode);
+		}
 	}
 
 	// now render the depth sorted primitives:
@@ -59,6 +102,63 @@ void SceneGraph::Render(ShadowVolumeGen *shadowgen, unsigned int camera, Mode re
 	if (m_NumRendered>m_HighWater) m_HighWater=m_NumRendered;
 }
 
+void SceneGraph::GetVisibleNodes(const dMatrix &viewprojection, unsigned int camera, vector<const SceneNode*> &nodes)
+{
+	GetFrustumPlanes(m_FrustumPlanes, viewprojection, false);
+	Cull();
+
+	m_NumVisited=0;
+	for (vector<Node*>::iterator i=m_Root->Children.begin(); i!=m_Root->Children.end(); ++i)
+	{
+		VisibleWalk((SceneNode*)*i,1<<camera,nodes);
+	}
+}
+
+void SceneGraph::Cull()
+{
+	// refit the boxes which have changed since the last frame, 
+	// nodes which are never culled don't need them working out
+	m_NumRefitted=0;
+	for (vector<int>::iterator i=m_Refits.begin(); i!=m_Refits.end(); ++i)
+	{
+		SceneNode *node=static_cast<SceneNode*>(FindNode(*i));
+		// removed since it was queued
+		if (node==NULL) continue;
+		node->m_RefitQueued=false;
+		if (node->m_BVHLeaf>=0)
+		{
+			m_BVH.Update(node->m_BVHLeaf,GetGlobalAABB(node));
+			m_NumRefitted++;
+		}
+	}
+	m_Refits.clear();
+
+	// mark everything the bounding volume hierarchy finds in the
+	// frustum, so the walk doesn't need to test them one by one
+	m_Frame++;
+	m_Visible.clear();
+	m_BVH.Cull(m_FrustumPlanes,6,m_Visible);
+	for (vector<SceneNode*>::iterator i=m_Visible.begin(); i!=m_Visible.end(); ++i)
+	{
+		(*i)->m_VisibleFrame=m_Frame;
+	}
+}
+
+void SceneGraph::VisibleWalk(SceneNode *node, unsigned int cameracode, vector<const SceneNode*> &nodes)
+{
+	// the same tests as RenderWalk
+	m_NumVisited++;
+	if ((node->Prim->GetVisibility()&cameracode)==0) return;
+	if ((node->Prim->GetState()->Hints & HINT_FRUSTUM_CULL) && !InFrustum(node)) return;
+
+	nodes.push_back(node);
+
+	for (vector<Node*>::iterator i=node->Children.begin(); i!=node->Children.end(); ++i)
+	{
+		VisibleWalk((SceneNode*)*i,cameracode,nodes);
+	}
+}
+
 void SceneGraph::RenderWalk(SceneNode *node,  int depth, unsigned int cameracode, ShadowVolumeGen *shadowgen, Mode rendermode)
 {
 	// max gl matrix stack is 32
@@ -68,9 +168,22 @@ void SceneGraph::RenderWalk(SceneNode *node,  int depth, unsigned int cameracode
 		return;
 	}*/
 
+	m_NumVisited++;
 	if ((node->Prim->GetVisibility()&cameracode)==0) return;
 	if (rendermode==SELECT && !node->Prim->IsSelectable()) return;
 
+	// cull before touching any gl state, the children are culled 
+	// along with us, we still need to cast shadows from things 
+	// outside the frustum though
+	if ((node->Prim->GetState()->Hints & HINT_FRUSTUM_CULL) && !InFrustum(node))
+	{
+		if (shadowgen && (node->Prim->GetState()->Hints & HINT_CAST_SHADOW))
+		{
+			shadowgen->Generate(node->Prim,GetWorldTransform(node));
+		}
+		return;
+	}
+
 	dMatrix parent;
 	// see if we need the parent (result of all the parents) transform
 	if (node->Prim->GetState()->Hints & HINT_DEPTH_SORT)
@@ -88,39 +201,84 @@ void SceneGraph::RenderWalk(SceneNode *node,  int depth, unsigned int cameracode
 		glLoadMatrixf(m_TopTransform.arr());
 	}
 
-
 	node->Prim->ApplyState();
 
-	if (!(node->Prim->GetState()->Hints & HINT_FRUSTUM_CULL) || FrustumClip(node))
+	if (node->Prim->GetState()->Hints & HINT_DEPTH_SORT)
+	{
+		// render it later, and after depth sorting
+		m_DepthSorter.Add(parent,node->Prim,node->ID);
+	}
+	else
+	{
+		glPushName(node->ID);
+		node->Prim->Prerender();
+		node->Prim->Render();
+		glPopName();
+	}
+
+	m_NumRendered++;
+	depth++;
+
+	for (vector<Node*>::iterator i=node->Children.begin(); i!=node->Children.end(); ++i)
 	{
-		if (node->Prim->GetState()->Hints & HINT_DEPTH_SORT)
+		RenderWalk((SceneNode*)*i,depth,cameracode,shadowgen,rendermode);
+	}
+
+	node->Prim->UnapplyState();
+	glPopMatrix();
+
+	if (shadowgen && (node->Prim->GetState()->Hints & HINT_CAST_SHADOW))
+	{
+		shadowgen->Generate(node->Prim,GetWorldTransform(node));
+	}
+}
+
+void SceneGraph::QueueWalk(SceneNode *node, const dMatrix &parent, int inherited, unsigned int cameracode, ShadowVolumeGen *shadowgen)
+{
+	m_NumVisited++;
+	if ((node->Prim->GetVisibility()&cameracode)==0) return;
+
+	State *state=node->Prim->GetState();
+
+	// lazy parents ignore the heirachical transform, so
+	// render them and their children the old way - the
+	// modelview is still the top transform here
+	if (state->Hints & HINT_LAZY_PARENT)
+	{
+		if (inherited & HINT_NORMALISE) glEnable(GL_NORMALIZE);
+		if (inherited & HINT_NOZWRITE) glDepthMask(false);
+		RenderWalk(node,0,cameracode,shadowgen,RENDER);
+		if (inherited & HINT_NORMALISE) glDisable(GL_NORMALIZE);
+		if (inherited & HINT_NOZWRITE) glDepthMask(true);
+		return;
+	}
+
+	if (!(state->Hints & HINT_FRUSTUM_CULL) || InFrustum(node))
+	{
+		if (state->Hints & HINT_DEPTH_SORT)
 		{
-			// render it later, and after depth sorting
 			m_DepthSorter.Add(parent,node->Prim,node->ID);
 		}
 		else
 		{
-			glPushName(node->ID);
-			node->Prim->Prerender();
-			node->Prim->Render();
-			glPopName();
+			m_RenderQueue.Add(parent,node->Prim,node->ID,inherited);
 		}
 
 		m_NumRendered++;
-		depth++;
+
+		// these stay on for the children in the immediate walk
+		inherited|=state->Hints&(HINT_NORMALISE|HINT_NOZWRITE);
+		dMatrix world=parent*state->Transform;
 
 		for (vector<Node*>::iterator i=node->Children.begin(); i!=node->Children.end(); ++i)
 		{
-			RenderWalk((SceneNode*)*i,depth,cameracode,shadowgen,rendermode);
+			QueueWalk((SceneNode*)*i,world,inherited,cameracode,shadowgen);
 		}
 	}
 
-	node->Prim->UnapplyState();
-	glPopMatrix();
-
-	if (node->Prim->GetState()->Hints & HINT_CAST_SHADOW)
+	if (shadowgen && (state->Hints & HINT_CAST_SHADOW))
 	{
-		shadowgen->Generate(node->Prim);
+		shadowgen->Generate(node->Prim,GetWorldTransform(node));
 	}
 }
 
@@ -185,6 +343,34 @@ bool SceneGraph::FrustumClip(SceneNode *node)
 	return true;
 }
 
+bool SceneGraph::InFrustum(SceneNode *node)
+{
+	// first time we've been culled, start tracking the node - the 
+	// cull at the start of the frame didn't know about it, from now 
+	// on it's refitted whenever its transform or bounds change
+	if (node->m_BVHLeaf<0)
+	{
+		node->m_BVHLeaf=m_BVH.Insert(GetGlobalAABB(node),node);
+		return FrustumClip(node);
+	}
+
+	return node->m_VisibleFrame==m_Frame;
+}
+
+void SceneGraph::RemoveFromBVH(SceneNode *node)
+{
+	if (node->m_BVHLeaf>=0)
+	{
+		m_BVH.Remove(node->m_BVHLeaf);
+		node->m_BVHLeaf=-1;
+	}
+
+	for (vector<Node*>::iterator i=node->Children.begin(); i!=node->Children.end(); ++i)
+	{
+		RemoveFromBVH(static_cast<SceneNode*>(*i));
+	}
+}
+
 void SceneGraph::CohenSutherland(const dVector &p, char &cs)
 {
 	char t=0;
@@ -216,39 +402,63 @@ void SceneGraph::Detach(SceneNode *node)
 		node->Parent->RemoveChild(node->ID);
 		m_Root->Children.push_back(node);
 		node->Parent=m_Root;
+		node->DirtyTransform();
 	}
 }
 
-dMatrix SceneGraph::GetGlobalTransform(const SceneNode *node) const
+void SceneGraph::RemoveNode(Node *node)
 {
-	dMatrix Mat,Ret;
+	if (node==NULL) return;
+	RemoveFromBVH(static_cast<SceneNode*>(node));
+	Tree::RemoveNode(node);
+}
 
-	list<const SceneNode*> Path;
+void SceneGraph::ReparentNode(int NodeID, int NewParentID)
+{
+	Tree::ReparentNode(NodeID,NewParentID);
+	SceneNode *node=static_cast<SceneNode*>(FindNode(NodeID));
+	if (node) node->DirtyTransform();
+}
 
-	const SceneNode* current=node;
+dMatrix SceneGraph::GetGlobalTransform(const SceneNode *node) const
+{
+	if (node->Prim==NULL) return dMatrix();
+	return GetWorldTransform(node);
+}
 
-	// iterate back up the tree storing parents...
-	// lazy parent objects are treated as non-heirachical,
-	// so we can stop if we find one of them - and
-	// use it's transform as world space
-	bool foundlazy=false;
-	while(current!=NULL && !foundlazy)
+const dMatrix &SceneGraph::GetWorldTransform(const SceneNode *node) const
+{
+	if (node->m_WorldDirty)
 	{
-		if (current && current->Prim)
+		const SceneNode *parent=static_cast<const SceneNode*>(node->Parent);
+		const State *state=node->Prim->GetState();
+
+		// lazy parent objects are treated as non-heirachical,
+		// so we use their transform as world space
+		if (parent==NULL || parent->Prim==NULL || (state->Hints & HINT_LAZY_PARENT))
+		{
+			node->m_WorldTransform=state->Transform;
+		}
+		else
 		{
-			Path.push_front(current);
-			foundlazy = current->Prim->GetState()->Hints & HINT_LAZY_PARENT;
+			node->m_WorldTransform=GetWorldTransform(parent)*state->Transform;
 		}
-		current=(const SceneNode*)current->Parent;
+
+		node->m_WorldDirty=false;
 	}
 
-	// concatenate the matrices together to get the global
-	for (list<const SceneNode*>::iterator i=Path.begin(); i!=Path.end(); ++i)
+	return node->m_WorldTransform;
+}
+
+const dBoundingBox &SceneGraph::GetGlobalAABB(const SceneNode *node) const
+{
+	unsigned int version=node->Prim->GetBoundsVersion();
+	if (node->m_AABBVersion==0 || node->m_AABBVersion!=version)
 	{
-		Mat*=(*i)->Prim->GetState()->Transform;
+		node->m_GlobalAABB=node->Prim->GetBoundingBox(GetGlobalTransform(node));
+		node->m_AABBVersion=version;
 	}
-
-	return Mat;
+	return node->m_GlobalAABB;
 }
 
 void SceneGraph::GetBoundingBox(SceneNode *node, dBoundingBox &result)
@@ -298,31 +508,46 @@ void SceneGraph::GetConnections(const Node *node, vector<pair<const SceneNode*,c
 	}
 }
 
+int SceneGraph::AddNode(int ParentID, Node *node)
+{
+	int ID=Tree::AddNode(ParentID,node);
+	SceneNode *scenenode=static_cast<SceneNode*>(node);
+	if (ID!=0 && scenenode->Prim!=NULL)
+	{
+		scenenode->m_Graph=this;
+		scenenode->Prim->SetBoundsListener(scenenode);
+	}
+	return ID;
+}
+
 void SceneGraph::Clear()
 {
 	Tree::Clear();
+	m_BVH.Clear();
+	m_Refits.clear();
 	SceneNode *root = new SceneNode(NULL);
 	AddNode(0,root);
 }
 	
 void SceneGraph::RecalcAABB(SceneNode *node)
 {
-	node->m_GlobalAABB=node->Prim->GetBoundingBox(GetGlobalTransform(node));
+	node->m_AABBVersion=0;
+	GetGlobalAABB(node);
 }
 
 bool SceneGraph::Intersect(const SceneNode *a, const SceneNode *b, float threshold)
 {
-	return b->m_GlobalAABB.inside(a->m_GlobalAABB, threshold);
+	return GetGlobalAABB(b).inside(GetGlobalAABB(a), threshold);
 }
 
 bool SceneGraph::Intersect(const dVector &point, const SceneNode *node, float threshold)
 {
-	return node->m_GlobalAABB.inside(point,threshold);
+	return GetGlobalAABB(node).inside(point,threshold);
 }
 
 bool SceneGraph::Intersect(const dPlane &plane, const SceneNode *node, float threshold)
 {
-	return node->m_GlobalAABB.inside(plane,threshold);
+	return GetGlobalAABB(node).inside(plane,threshold);
 }
 
 void SceneGraph::RenderAxes()
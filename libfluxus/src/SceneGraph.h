@@ -18,28 +18,58 @@
 #define N_SCENEGRAPH
 
 #include <iostream>
+#include <list>
 #include "Tree.h"
 #include "Primitive.h"
 #include "State.h"
 #include "ShadowVolumeGen.h"
 #include "DepthSorter.h"
+#include "RenderQueue.h"
+#include "BVH.h"
 
 using namespace std;
 
 namespace Fluxus
 {
 
+class SceneGraph;
+
 /////////////////////////////////////
 /// A scene graph node
 /// The state is contained within the
 /// primitive itself.
-class SceneNode : public Node
+class SceneNode : public Node, public BoundsListener
 {
 public:
-	SceneNode(Primitive *p) : Prim(p) {}
+	SceneNode(Primitive *p) : Prim(p), m_WorldDirty(true), m_AABBVersion(0), m_Graph(NULL),
+		m_RefitQueued(false), m_BVHLeaf(-1), m_VisibleFrame(0) {}
 	virtual ~SceneNode() { if (Prim) delete Prim; }
+
+	/// Marks the cached world transform of this node, 
+	/// and all of its children as needing recalculating
+	void DirtyTransform();
+
+	/// Queues the node to have its box refitted in the 
+	/// culling hierarchy before the next frame
+	virtual void BoundsChanged();
+
 	Primitive *Prim;
-	dBoundingBox m_GlobalAABB;
+	mutable dBoundingBox m_GlobalAABB;
+
+	// caches for the scenegraph, use SceneGraph::GetGlobalTransform
+	// and SceneGraph::GetGlobalAABB rather than these directly
+	mutable dMatrix m_WorldTransform;
+	mutable bool m_WorldDirty;
+	/// The bounds version m_GlobalAABB was made with, 0 if dirty
+	mutable unsigned int m_AABBVersion;
+	/// The graph we've been added to, NULL if none
+	SceneGraph *m_Graph;
+	/// Whether we're waiting in the graph's refit list
+	bool m_RefitQueued;
+	/// Our leaf in the culling hierarchy, -1 if we're not in it
+	int m_BVHLeaf;
+	/// The last frame the culling hierarchy found us inside the frustum
+	unsigned int m_VisibleFrame;
 };
 
 istream &operator>>(istream &s, SceneNode &o);
@@ -56,21 +86,45 @@ public:
 	enum Mode{RENDER,SELECT};
 
 	/// Traverses the graph depth first, rendering
-	/// all nodes
+	/// all nodes, and adding the shadow casters to
+	/// shadowgen if it's not NULL
 	void Render(ShadowVolumeGen *shadowgen, unsigned int camera, Mode rendermode=RENDER);
 
+	/// Collect the primitives and render them sorted by
+	/// state, rather than applying each state in turn
+	void SetRenderQueue(bool s) { m_UseRenderQueue=s; }
+
+	/// Culls the graph against the view projection matrix and walks 
+	/// it the same way Render() does without touching gl, collecting 
+	/// the nodes which would be drawn
+	void GetVisibleNodes(const dMatrix &viewprojection, unsigned int camera, vector<const SceneNode*> &nodes);
+
+	/// Adds the node, it needs to be a SceneNode
+	virtual int AddNode(int ParentID, Node *node);
+
 	/// Clears the graph of all primitives
 	virtual void Clear();
 
+	/// Removes the node and its children, and their bounding volumes
+	virtual void RemoveNode(Node *node);
+
 	/// Parents the node to the root, and sets its
 	/// transform to keep it physically in the same
 	/// place in the world.
 	///\todo make the maintain transform optional
 	void Detach(SceneNode *node);
 
-	/// Gets the world space transfrom of the node
+	/// Gets the world space transfrom of the node, these are 
+	/// cached and only recalculated after DirtyTransform()
 	dMatrix GetGlobalTransform(const SceneNode *node) const;
 
+	/// Gets the world space bounding box of the node, cached
+	/// until the transform or Primitive::GetBoundsVersion() changes
+	const dBoundingBox &GetGlobalAABB(const SceneNode *node) const;
+
+	/// Moves a node, the world transforms below it change
+	virtual void ReparentNode(int NodeID, int NewParentID);
+
 	/// Gets the bounding box of the node, and all
 	/// its children too
 	void GetBoundingBox(SceneNode *node, dBoundingBox &result);
@@ -82,6 +136,7 @@ public:
 	void GetConnections(const Node *node,
 		vector<pair<const SceneNode*,const SceneNode*> > &connections) const;
 
+	/// Forces the bounding box to be recalculated
 	void RecalcAABB(SceneNode *node);
 
 	///Bounding box intersections, for higher accuracy, see the evaluators
@@ -93,23 +148,44 @@ public:
 	/// Some statistics
 	unsigned int GetNumRendered() { return m_NumRendered; }
 	unsigned int GetHighWater() { return m_HighWater; }
+	/// Nodes the last walk looked at, culled subtrees aren't walked
+	unsigned int GetNumVisited() { return m_NumVisited; }
+	/// Boxes refitted in the culling hierarchy for the last frame
+	unsigned int GetNumRefitted() { return m_NumRefitted; }
 
 	/// Render origin
 	static void RenderAxes();
 
 private:
+	friend class SceneNode;
+
+	void Cull();
+	void VisibleWalk(SceneNode *node, unsigned int cameracode, vector<const SceneNode*> &nodes);
 	void RenderWalk(SceneNode *node, int depth, unsigned int cameracode, ShadowVolumeGen *shadowgen, Mode rendermode);
+	void QueueWalk(SceneNode *node, const dMatrix &parent, int inherited, unsigned int cameracode, ShadowVolumeGen *shadowgen);
 	void GetBoundingBox(SceneNode *node, dMatrix mat, dBoundingBox &result);
+	const dMatrix &GetWorldTransform(const SceneNode *node) const;
 	bool FrustumClip(SceneNode *node);
+	bool InFrustum(SceneNode *node);
+	void RemoveFromBVH(SceneNode *node);
 	void CohenSutherland(const dVector &p, char &cs);
 	void GetFrustumPlanes(dPlane *planes, dMatrix m, bool normalise);
 
 	DepthSorter m_DepthSorter;
+	RenderQueue m_RenderQueue;
+	bool m_UseRenderQueue;
 	dMatrix m_TopTransform;
 	dPlane m_FrustumPlanes[6];
+	BVH m_BVH;
+	vector<SceneNode*> m_Visible;
+	/// IDs of the nodes whose boxes have changed since the last cull
+	vector<int> m_Refits;
+	unsigned int m_Frame;
 
 	unsigned int m_NumRendered;
 	unsigned int m_HighWater;
+	unsigned int m_NumVisited;
+	unsigned int m_NumRefitted;
 };
 
 }
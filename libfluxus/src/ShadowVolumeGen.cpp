@@ -15,11 +15,30 @@
 // Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 
 #include <algorithm>
+#include <cstring>
 #include "ShadowVolumeGen.h"
 
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
 using namespace Fluxus;
 
+// how many clears a primitive's volumes are kept for after it 
+// stops casting, enough to ride out cameras it's hidden from
+static const unsigned int CACHE_FRAMES = 8;
+
+ShadowVolumeGen::Volume::Volume() :
+TopologyVersion(0),
+PointsVersion(0),
+Length(0),
+Version(0)
+{
+}
+
 ShadowVolumeGen::ShadowVolumeGen() :
+m_Frame(1),
+m_NextVersion(0),
 m_ShadowVolume(PolyPrimitive::QUADS),
 m_LightPosition(5,5,0),
 m_Length(10),
@@ -29,179 +48,318 @@ m_Debug(false)
 
 ShadowVolumeGen::~ShadowVolumeGen()	
 {
+	for (map<const Primitive*,Caster>::iterator i=m_Casters.begin(); i!=m_Casters.end(); ++i)
+	{
+		for (vector<Volume*>::iterator v=i->second.Volumes.begin(); v!=i->second.Volumes.end(); ++v)
+		{
+			delete *v;
+		}
+	}
 }
 
-void ShadowVolumeGen::Generate(Primitive *prim)
+void ShadowVolumeGen::Generate(Primitive *prim, const dMatrix &world)
 {	
 	PolyPrimitive *poly = dynamic_cast<PolyPrimitive*>(prim);
 	if (poly)
 	{
-		PolyGen(poly);
+		Volume *volume=GetCached(prim);
+		PolyGen(poly,world,*volume);
+		m_Generated.push_back(volume);
+		if (m_Debug) DrawSilhouette(*volume);
 	}
 	else
 	{		
 		NURBSPrimitive *nurbs = dynamic_cast<NURBSPrimitive*>(prim);
 		if (nurbs)
 		{
-			NURBSGen(nurbs);
+			NURBSGen(nurbs,world);
 		}
 	}
 }
 
 void ShadowVolumeGen::Clear()
 { 
-	m_ShadowVolume.Clear();
+	m_Frame++;
+	m_Generated.clear();
 	
+	// the primitives are only used as keys, so ones which have 
+	// been destroyed are harmless until they're dropped - and a 
+	// new one at the same address has new versions
+	map<const Primitive*,Caster>::iterator i=m_Casters.begin();
+	while (i!=m_Casters.end())
+	{
+		if (m_Frame-i->second.LastUsed>CACHE_FRAMES)
+		{
+			for (vector<Volume*>::iterator v=i->second.Volumes.begin(); v!=i->second.Volumes.end(); ++v)
+			{
+				delete *v;
+			}
+			m_Casters.erase(i++);
+		}
+		else
+		{
+			++i;
+		}
+	}
 }
 
 PolyPrimitive *ShadowVolumeGen::GetVolume() 
 { 
+	// each new set of quads gets a new version, so 
+	// the same versions in order is the same volume
+	bool changed=m_Generated.size()!=m_Built.size();
+	for (unsigned int i=0; i<m_Generated.size() && !changed; i++)
+	{
+		changed=m_Generated[i]->Version!=m_Built[i];
+	}
+	
+	if (changed)
+	{
+		unsigned int size=0;
+		m_Built.resize(m_Generated.size());
+		for (unsigned int i=0; i<m_Generated.size(); i++)
+		{
+			size+=m_Generated[i]->Quads.size();
+			m_Built[i]=m_Generated[i]->Version;
+		}
+		
+		m_ShadowVolume.Resize(0);
+		m_ShadowVolume.Resize(size);
+		if (size>0)
+		{
+			dVector *dst=&(*m_ShadowVolume.GetDataVec<dVector>("p"))[0];
+			for (unsigned int i=0; i<m_Generated.size(); i++)
+			{
+				const vector<dVector> &quads=m_Generated[i]->Quads;
+				copy(quads.begin(),quads.end(),dst);
+				dst+=quads.size();
+			}
+		}
+		m_ShadowVolume.InvalidateTopology();
+	}
+	
 	return &m_ShadowVolume; 
 }
 
-void ShadowVolumeGen::PolyGen(PolyPrimitive *src)
-{	
-	TypedPData<dVector> *points = dynamic_cast<TypedPData<dVector>* >(src->GetDataRaw("p"));
-	
-	///\todo using geometric normals, as we need them to be non smoothed
-	/// to tell the difference between faces, but this doesn't update with
-	/// n (from things like skinning and user deformation). recalc-normals
-	/// is ok though as it regenerates them... not sure what the answer is.
-	const vector<dVector> &normals = src->GetGeometricNormals();
-	const vector<vector<int> > &connected=src->GetConnectedVerts();
+ShadowVolumeGen::Volume *ShadowVolumeGen::GetCached(Primitive *prim)
+{
+	// the nth generation of a primitive this frame gets its nth volume
+	Caster &caster=m_Casters[prim];
+	if (caster.LastUsed!=m_Frame)
+	{
+		caster.LastUsed=m_Frame;
+		caster.Uses=0;
+	}
 	
-	dMatrix &transform = src->GetState()->Transform;
+	if (caster.Uses==caster.Volumes.size())
+	{
+		caster.Volumes.push_back(new Volume);
+	}
+	return caster.Volumes[caster.Uses++];
+}
+
+void ShadowVolumeGen::PolyGen(PolyPrimitive *src, const dMatrix &transform, Volume &volume)
+{	
+	const TypedPData<dVector> *points = dynamic_cast<const TypedPData<dVector>* >(src->GetDataRawConst("p"));
+	const HalfEdgeMesh &mesh = src->GetHalfEdges();
+	bool silhouette=false;
 	
-	int stride=0;
-	if (src->GetType()==PolyPrimitive::TRISTRIP) stride=2;
-	if (src->GetType()==PolyPrimitive::QUADS) stride=4;
-	if (src->GetType()==PolyPrimitive::TRILIST) stride=3;
-	if (stride>0)
+	if (volume.TopologyVersion!=src->GetTopologyVersion())
 	{
-		SharedEdgeContainer edges = src->GetUniqueEdges();
-		vector<pair<dVector,dVector> > silhouette;
-			
-		if (src->IsIndexed())
+		// the first three corners of each face, and the faces 
+		// and ends of each pair of opposite edges, as points
+		const vector<unsigned int> &index = src->GetIndexConst();
+		bool indexed = src->IsIndexed();
+		
+		volume.Corners.assign(mesh.NumFaces()*3,0);
+		for (unsigned int f=0; f<mesh.NumFaces(); f++)
 		{
-			vector<unsigned int> index = src->GetIndex();
-			// loop over all the edges
-			for (SharedEdgeContainer::iterator i=edges.begin(); i!=edges.end(); ++i)
+			if (mesh.FaceSize(f)<3) continue;
+			int e=mesh.FaceEdge(f);
+			int c[3] = { mesh.Vert(e), mesh.EndVert(e), mesh.EndVert(mesh.Next(e)) };
+			for (int n=0; n<3; n++)
 			{
-				EdgeContainer sharededges = *i;
-
-				dVector lightdir = transform.transform(points->m_Data[index[sharededges.begin()->first]])-m_LightPosition;
-				lightdir.normalise();
-
-				if (sharededges.size()==2)
-				{
-					bool backface=false;
-					bool frontface=false;
-
-					EdgeContainer::iterator frontedge;
-
-					// loop over the edges shared by this one
-					for (EdgeContainer::iterator edge=sharededges.begin(); edge!=sharededges.end(); ++edge)
-					{			
-						// only check the first vert, as they should have 
-						// the same geometric normal if the poly is planar..
-						if (lightdir.dot(transform.transform_no_trans(normals[edge->first]))>0) 
-						{
-							frontedge=edge;
-							frontface=true;
-						}
-						else backface=true;
-					}
-
-					// if we contain both front and back facing normals (from the light's pov) 
-					if (backface && frontface) 
-					{			
-						silhouette.push_back(pair<dVector,dVector>(transform.transform(points->m_Data[index[frontedge->first]]),
-					                                    		   transform.transform(points->m_Data[index[frontedge->second]])));
-					}
-				}
+				volume.Corners[f*3+n]=indexed?index[c[n]]:c[n];
 			}
 		}
-		else
+		
+		volume.EdgePairs.clear();
+		for (unsigned int e=0; e<mesh.NumEdges(); e++)
 		{
-			// loop over all the edges
-			for (SharedEdgeContainer::iterator i=edges.begin(); i!=edges.end(); ++i)
+			int o=mesh.Opposite(e);
+			if (o<(int)e) continue;
+			
+			int pair[6] = { mesh.Face(e), mesh.Face(o), 
+				mesh.Vert(e), mesh.EndVert(e), mesh.Vert(o), mesh.EndVert(o) };
+			if (indexed)
 			{
-				EdgeContainer sharededges = *i;
-
-				dVector lightdir = transform.transform(points->m_Data[sharededges.begin()->first])-m_LightPosition;
-				lightdir.normalise();
-
+				for (int n=2; n<6; n++) pair[n]=index[pair[n]];
+			}
+			volume.EdgePairs.insert(volume.EdgePairs.end(),pair,pair+6);
+		}
+		
+		volume.TopologyVersion=src->GetTopologyVersion();
+		silhouette=true;
+	}
+	
+	// the silhouette only depends on where the light is relative 
+	// to the primitive, so is found in its space - inverting the 
+	// affine part with the cross products of its axes
+	dVector x(transform.m[0][0],transform.m[0][1],transform.m[0][2]);
+	dVector y(transform.m[1][0],transform.m[1][1],transform.m[1][2]);
+	dVector z(transform.m[2][0],transform.m[2][1],transform.m[2][2]);
+	dVector yz=y.cross(z);
+	float det=x.dot(yz);
+	dVector light;
+	if (det!=0)
+	{
+		dVector rel=m_LightPosition-transform.gettranslate();
+		light=dVector(rel.dot(yz),rel.dot(z.cross(x)),rel.dot(x.cross(y)))*(1/det);
+	}
+	if (silhouette || 
+		volume.PointsVersion!=points->GetVersion() ||
+		!(light==volume.LocalLight))
+	{
+		volume.PointsVersion=points->GetVersion();
+		volume.LocalLight=light;
+		volume.Silhouette.clear();
+		
+		// a squashed flat primitive has no silhouette
+		if (det!=0 && points->Size()>0)
+		{
+			vector<char> front;
+			ClassifyFaces(points->View(),volume,front);
 
-				if (sharededges.size()==2)
+			// silhouette edges are shared by a front and a back face, 
+			// and are taken from the front one to get the winding
+			for (unsigned int e=0; e<volume.EdgePairs.size(); e+=6)
+			{
+				const int *pair=&volume.EdgePairs[e];
+				if (front[pair[0]]!=front[pair[1]])
 				{
-					bool backface=false;
-					bool frontface=false;
-
-					EdgeContainer::iterator frontedge;
-
-					// loop over the edges shared by this one
-					for (EdgeContainer::iterator edge=sharededges.begin(); edge!=sharededges.end(); ++edge)
-					{			
-						// only check the first vert, as they should have 
-						// the same geometric normal if the poly is planar..
-						if (lightdir.dot(transform.transform_no_trans(normals[edge->first]))>0) 
-						{
-							frontedge=edge;
-							frontface=true;
-						}
-						else backface=true;
-					}
-
-					// if we contain both front and back facing normals (from the light's pov) 
-					if (backface && frontface) 
-					{			
-						silhouette.push_back(pair<dVector,dVector>(transform.transform(points->m_Data[frontedge->first]),
-					                                    		   transform.transform(points->m_Data[frontedge->second])));
-					}
+					const int *ends=front[pair[0]]?pair+2:pair+4;
+					volume.Silhouette.push_back(ends[0]);
+					volume.Silhouette.push_back(ends[1]);
 				}
 			}
 		}
+		silhouette=true;
+	}
+	
+	if (silhouette || 
+		memcmp(transform.arr(),volume.Transform.arr(),sizeof(float)*16)!=0 ||
+		!(m_LightPosition==volume.Light) ||
+		m_Length!=volume.Length)
+	{
+		volume.Transform=transform;
+		volume.Light=m_LightPosition;
+		volume.Length=m_Length;
 		
-		for (vector<pair<dVector,dVector> >::iterator i=silhouette.begin();
-		     i!=silhouette.end(); i++)
+		unsigned int count=volume.Silhouette.size();
+		vector<dVector> ends(count);
+		for (unsigned int i=0; i<count; i++)
 		{
-			AddEdge(i->first,i->second);
+			ends[i]=points->View()[volume.Silhouette[i]];
 		}
+		if (count>0) dTransformPoints(transform,&ends[0],&ends[0],count);
+		
+		volume.Quads.resize(count*2);
+		for (unsigned int i=0; i<count; i+=2)
+		{
+			dVector start=ends[i];
+			dVector end=ends[i+1];
+			dVector *quad=&volume.Quads[i*2];
+			quad[0]=start;
+			quad[1]=end;
+			quad[2]=end+(end-m_LightPosition)*m_Length;
+			quad[3]=start+(start-m_LightPosition)*m_Length;
+		}
+		volume.Version=++m_NextVersion;
 	}
 }
 
-void ShadowVolumeGen::AddEdge(dVector start, dVector end)
+void ShadowVolumeGen::ClassifyFaces(const dVector *points, const Volume &volume, vector<char> &front) const
 {
-	if (m_Debug)
+	// a face points away from the light if the light is behind it, 
+	// using normals from the current positions so deformations are 
+	// followed - the light is in the primitive's space
+	unsigned int faces=volume.Corners.size()/3;
+	const int *corners=faces>0?&volume.Corners[0]:NULL;
+	const dVector &light=volume.LocalLight;
+	front.resize(faces);
+	unsigned int f=0;
+	
+#ifdef __SSE__
+	// four faces at a time, with their corners transposed 
+	// into x, y and z registers
+	__m128 zero=_mm_setzero_ps();
+	__m128 lx=_mm_set1_ps(light.x);
+	__m128 ly=_mm_set1_ps(light.y);
+	__m128 lz=_mm_set1_ps(light.z);
+	for (; f+4<=faces; f+=4)
 	{
-		glDisable(GL_LIGHTING);
-		glLineWidth(3);
-		glBegin(GL_LINES);					
-			glColor3f(1,0,0);
-			glVertex3fv(start.arr());
-			glColor3f(0,0,1);
-			glVertex3fv(end.arr());
-		glEnd();
-		glEnable(GL_LIGHTING);
+		const int *c=corners+f*3;
+		__m128 v[3][3];
+		for (int n=0; n<3; n++)
+		{
+			__m128 a=_mm_loadu_ps(&points[c[n]].x);
+			__m128 b=_mm_loadu_ps(&points[c[3+n]].x);
+			__m128 d=_mm_loadu_ps(&points[c[6+n]].x);
+			__m128 w=_mm_loadu_ps(&points[c[9+n]].x);
+			_MM_TRANSPOSE4_PS(a,b,d,w);
+			v[n][0]=a; v[n][1]=b; v[n][2]=d;
+		}
+		__m128 ax=_mm_sub_ps(v[0][0],v[1][0]);
+		__m128 ay=_mm_sub_ps(v[0][1],v[1][1]);
+		__m128 az=_mm_sub_ps(v[0][2],v[1][2]);
+		__m128 bx=_mm_sub_ps(v[1][0],v[2][0]);
+		__m128 by=_mm_sub_ps(v[1][1],v[2][1]);
+		__m128 bz=_mm_sub_ps(v[1][2],v[2][2]);
+		__m128 nx=_mm_sub_ps(_mm_mul_ps(ay,bz),_mm_mul_ps(az,by));
+		__m128 ny=_mm_sub_ps(_mm_mul_ps(az,bx),_mm_mul_ps(ax,bz));
+		__m128 nz=_mm_sub_ps(_mm_mul_ps(ax,by),_mm_mul_ps(ay,bx));
+		__m128 dot=_mm_add_ps(_mm_add_ps(
+			_mm_mul_ps(_mm_sub_ps(v[0][0],lx),nx),
+			_mm_mul_ps(_mm_sub_ps(v[0][1],ly),ny)),
+			_mm_mul_ps(_mm_sub_ps(v[0][2],lz),nz));
+		int mask=_mm_movemask_ps(_mm_cmpgt_ps(dot,zero));
+		for (int n=0; n<4; n++)
+		{
+			front[f+n]=(mask>>n)&1;
+		}
 	}
+#endif
 
-	m_ShadowVolume.AddVertex(dVertex(start,dVector(0,0,0),0,0));
-	m_ShadowVolume.AddVertex(dVertex(end,dVector(0,0,0),0,0));
-
-	dVector proj = end-m_LightPosition;
-	m_ShadowVolume.AddVertex(dVertex(end+proj*m_Length,dVector(0,0,0),0,0));
+	for (; f<faces; f++)
+	{
+		const int *c=corners+f*3;
+		dVector normal=(points[c[0]]-points[c[1]]).cross(points[c[1]]-points[c[2]]);
+		float dot=(points[c[0]]-light).dot(normal);
+		front[f]=dot>0;
+	}
+}
 
-	proj = start-m_LightPosition;
-	m_ShadowVolume.AddVertex(dVertex(start+proj*m_Length,dVector(0,0,0),0,0));
+void ShadowVolumeGen::DrawSilhouette(const Volume &volume) const
+{
+	glDisable(GL_LIGHTING);
+	glLineWidth(3);
+	glBegin(GL_LINES);					
+	for (unsigned int i=0; i<volume.Quads.size(); i+=4)
+	{
+		glColor3f(1,0,0);
+		glVertex3fv(&volume.Quads[i].x);
+		glColor3f(0,0,1);
+		glVertex3fv(&volume.Quads[i+1].x);
+	}
+	glEnd();
+	glEnable(GL_LIGHTING);
 }
 
 ///\todo shadow volumes for nurbs
-void ShadowVolumeGen::NURBSGen(NURBSPrimitive *src)
+void ShadowVolumeGen::NURBSGen(NURBSPrimitive *src, const dMatrix &transform)
 {	
-	TypedPData<dVector> *points = static_cast<TypedPData<dVector>* >(src->GetDataRaw("p"));
-	TypedPData<dVector> *normals = dynamic_cast<TypedPData<dVector>* >(src->GetDataRaw("n"));
-	
-	dMatrix &transform = src->GetState()->Transform;
+	const TypedPData<dVector> *points = static_cast<const TypedPData<dVector>* >(src->GetDataRawConst("p"));
+	const TypedPData<dVector> *normals = dynamic_cast<const TypedPData<dVector>* >(src->GetDataRawConst("n"));
 	
 	int stride=4;
 	
@@ -213,7 +371,7 @@ void ShadowVolumeGen::NURBSGen(NURBSPrimitive *src)
 
 		for (int facevert=0; facevert<stride; facevert++)
 		{
-			dVector lightdir = transform.transform(points->m_Data[vert+facevert])-m_LightPosition;
+			dVector lightdir = transform.transform(points->View()[vert+facevert])-m_LightPosition;
 			lightdir.normalise();
 
 			bool backface=false;
@@ -240,8 +398,8 @@ void ShadowVolumeGen::NURBSGen(NURBSPrimitive *src)
 		{
 			for (unsigned int i=0; i<edgeverts.size()-1; i++)
 			{	
-				dVector worldpoint1 = transform.transform(points->m_Data[edgeverts[i]]);
-				dVector worldpoint2 = transform.transform(points->m_Data[edgeverts[i+1]]);
+				dVector worldpoint1 = transform.transform(points->View()[edgeverts[i]]);
+				dVector worldpoint2 = transform.transform(points->View()[edgeverts[i+1]]);
 
 				glPushMatrix();
 				glDisable(GL_LIGHTING);
@@ -18,12 +18,10 @@
 // Generates a shadow volume poly primitive for the supplied 
 // primitives and light position
 
-// Can we accelerate the process by caching as much as possible, and 
-// changing only when light positions/primitive transforms/deform?
-
 #ifndef N_SHADOWGEN
 #define N_SHADOWGEN
 
+#include <map>
 #include "Primitive.h"
 #include "PolyPrimitive.h"
 #include "NURBSPrimitive.h"
@@ -38,6 +36,13 @@ namespace Fluxus
 /// single polygon primitive for rendering 
 /// into a stencil buffer for shadow 
 /// rendering.
+///
+/// The volumes are cached per primitive, and 
+/// only regenerated when the light, the 
+/// primitive's world transform or its points change - 
+/// the concatenated volume is only rebuilt when 
+/// one of them does, so a still scene costs 
+/// nothing to cast shadows from.
 class ShadowVolumeGen
 {
 public:
@@ -46,17 +51,21 @@ public:
 
 	/// Sets the light position to generate the silhouette 
 	/// edges and shadow volume from 
-	void SetLightPosition(dVector pos) { Clear(); m_LightPosition=pos; }
+	void SetLightPosition(dVector pos) { m_LightPosition=pos; }
 	
 	/// Clears the current shadow volume - should call this at 
 	/// start of the frame, or after rendering the shadows.
+	/// Cached volumes for primitives which haven't cast a 
+	/// shadow for a while are dropped here.
 	void Clear();
 	
 	/// Adds the volumes for a primitive to the polygon 
-	/// primitive
-	void Generate(Primitive *prim);
+	/// primitive, world is its transform concatenated with 
+	/// its parents'
+	void Generate(Primitive *prim, const dMatrix &world);
 	
-	/// Gets the volume generated so far
+	/// Gets the volume generated so far, rebuilt if it's 
+	/// different to the last one
 	PolyPrimitive *GetVolume();
 	
 	/// Sets the length to extrude the volume by, in world space
@@ -76,15 +85,59 @@ public:
 	
 private:
 
-	typedef pair<int,int> EdgeType;
-	typedef vector<EdgeType> EdgeContainer;
-	typedef vector<EdgeContainer> SharedEdgeContainer;
-
-	void PolyGen(PolyPrimitive *src);
-	void NURBSGen(NURBSPrimitive *src);
+	/// The volume for one generation of a primitive, with what 
+	/// each stage was made from
+	class Volume
+	{
+	public:
+		Volume();
+		
+		/// The faces' first three corners and the edge pairs 
+		/// between faces as point indices, from the topology
+		unsigned int TopologyVersion;
+		vector<int> Corners;
+		vector<int> EdgePairs;
+		
+		/// The silhouette as pairs of point indices, from the 
+		/// points and the light in the primitive's space
+		unsigned int PointsVersion;
+		dVector LocalLight;
+		vector<int> Silhouette;
+		
+		/// The extruded quads in world space
+		dMatrix Transform;
+		dVector Light;
+		float Length;
+		vector<dVector> Quads;
+		
+		/// A unique number given to each new set of quads
+		unsigned int Version;
+	};
 	
-	void AddEdge(dVector start, dVector end);
-	int FindNextEdge(unsigned int index, vector<pair<dVector,dVector> > &silhouette, bool &flip);
+	/// The volumes for one primitive, which can be generated 
+	/// more than once a frame by immediate mode
+	class Caster
+	{
+	public:
+		Caster() : LastUsed(0), Uses(0) {}
+		unsigned int LastUsed;
+		unsigned int Uses;
+		vector<Volume*> Volumes;
+	};
+
+	Volume *GetCached(Primitive *prim);
+	void PolyGen(PolyPrimitive *src, const dMatrix &transform, Volume &volume);
+	void NURBSGen(NURBSPrimitive *src, const dMatrix &transform);
+	void ClassifyFaces(const dVector *points, const Volume &volume, vector<char> &front) const;
+	void DrawSilhouette(const Volume &volume) const;
+
+	map<const Primitive*,Caster> m_Casters;
+	/// The volumes generated since the last clear, and the 
+	/// versions of the ones the shadow volume was built from
+	vector<const Volume*> m_Generated;
+	vector<unsigned int> m_Built;
+	unsigned int m_Frame;
+	unsigned int m_NextVersion;
 
 	PolyPrimitive m_ShadowVolume;
 	dVector m_LightPosition;
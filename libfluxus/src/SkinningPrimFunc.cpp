@@ -113,7 +113,9 @@ void SkinningPrimFunc::Run(Primitive &prim, const SceneGraph &world)
 		mat.zero();
 		for	(unsigned int bone=0; bone<skeleton.size(); bone++)
 		{
-			mat+=(transforms[bone]*(*weights[bone])[i]);
+			// most vertices are only influenced by a few bones
+			float w=(*weights[bone])[i];
+			if (w!=0) mat.add_scaled(transforms[bone],w);
 		}
 
 		(*p)[i]=mat.transform((*pref)[i]);
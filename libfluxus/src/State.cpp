@@ -149,6 +149,116 @@ void State::Unapply()
 	}
 }
 
+static bool SameColour(const dColour &a, const dColour &b)
+{
+	return a.r==b.r && a.g==b.g && a.b==b.b && a.a==b.a;
+}
+
+static bool SameTextureState(const TextureState &a, const TextureState &b)
+{
+	return a.TexEnv==b.TexEnv && a.Min==b.Min && a.Mag==b.Mag &&
+		a.WrapS==b.WrapS && a.WrapT==b.WrapT && a.WrapR==b.WrapR &&
+		SameColour(a.BorderColour,b.BorderColour) && a.Priority==b.Priority &&
+		SameColour(a.EnvColour,b.EnvColour) &&
+		a.MinLOD==b.MinLOD && a.MaxLOD==b.MaxLOD;
+}
+
+void State::ApplyChanges(const State &last)
+{
+	glMultMatrixf(Transform.arr());
+	if (Opacity != 1.0f) Colour.a=Ambient.a=Emissive.a=Specular.a=Opacity;
+	if (WireOpacity != 1.0f) WireColour.a=WireOpacity;
+	// the primitives change the current colour, so always set it
+	glColor4f(Colour.r,Colour.g,Colour.b,Colour.a);
+
+	// with vertex colours the material tracks glColor, so
+	// it needs setting again even if it's the same
+	if ((last.Hints & HINT_VERTCOLS) ||
+		!SameColour(Colour,last.Colour) ||
+		!SameColour(Ambient,last.Ambient) ||
+		!SameColour(Emissive,last.Emissive) ||
+		!SameColour(Specular,last.Specular) ||
+		Shinyness!=last.Shinyness)
+	{
+		glMaterialfv(GL_FRONT_AND_BACK,GL_AMBIENT,Ambient.arr());
+		glMaterialfv(GL_FRONT_AND_BACK,GL_EMISSION,Emissive.arr());
+		glMaterialfv(GL_FRONT_AND_BACK,GL_DIFFUSE,Colour.arr());
+		glMaterialfv(GL_FRONT_AND_BACK,GL_SPECULAR,Specular.arr());
+		glMaterialfv(GL_FRONT_AND_BACK,GL_SHININESS,&Shinyness);
+	}
+
+	if (LineWidth!=last.LineWidth) glLineWidth(LineWidth);
+	if (PointWidth!=last.PointWidth) glPointSize(PointWidth);
+	if (SourceBlend!=last.SourceBlend || DestinationBlend!=last.DestinationBlend)
+	{
+		glBlendFunc(SourceBlend,DestinationBlend);
+	}
+
+	if (Cull!=last.Cull)
+	{
+		if (Cull) glEnable(GL_CULL_FACE);
+		else glDisable(GL_CULL_FACE);
+	}
+
+	if ((Hints&HINT_CULL_CCW)!=(last.Hints&HINT_CULL_CCW))
+	{
+		if (Hints&HINT_CULL_CCW) glFrontFace(GL_CW);
+		else glFrontFace(GL_CCW);
+	}
+
+	// wire and point rendering switch texturing back on
+	// behind our back, so the textures need setting again
+	bool textures=(last.Hints & (HINT_WIRE|HINT_POINTS));
+	for (int n=0; n<MAX_TEXTURES && !textures; n++)
+	{
+		textures=Textures[n]!=last.Textures[n] ||
+			(Textures[n]!=0 && !SameTextureState(TextureStates[n],last.TextureStates[n]));
+	}
+	if (textures) TexturePainter::Get()->SetCurrent(Textures,TextureStates);
+
+	bool pointsize=Shader!=NULL && (Hints & HINT_POINTS);
+	bool lastpointsize=last.Shader!=NULL && (last.Hints & HINT_POINTS);
+	if (pointsize && !lastpointsize) glEnable(GL_VERTEX_PROGRAM_POINT_SIZE);
+	else if (!pointsize && lastpointsize) glDisable(GL_VERTEX_PROGRAM_POINT_SIZE);
+
+	if (Shader!=last.Shader)
+	{
+		if (Shader != NULL) Shader->Apply();
+		else GLSLShader::Unapply();
+	}
+}
+
+bool State::Instanceable(const State &other) const
+{
+	if (Shader!=other.Shader || Hints!=other.Hints ||
+		Opacity!=other.Opacity || WireOpacity!=other.WireOpacity ||
+		!SameColour(Specular,other.Specular) ||
+		!SameColour(Emissive,other.Emissive) ||
+		!SameColour(Ambient,other.Ambient) ||
+		Shinyness!=other.Shinyness ||
+		LineWidth!=other.LineWidth || PointWidth!=other.PointWidth ||
+		StippledLines!=other.StippledLines || StippleFactor!=other.StippleFactor ||
+		StipplePattern!=other.StipplePattern ||
+		SourceBlend!=other.SourceBlend || DestinationBlend!=other.DestinationBlend ||
+		!SameColour(WireColour,other.WireColour) ||
+		!SameColour(NormalColour,other.NormalColour) ||
+		Cull!=other.Cull)
+	{
+		return false;
+	}
+
+	for (int n=0; n<MAX_TEXTURES; n++)
+	{
+		if (Textures[n]!=other.Textures[n] ||
+			(Textures[n]!=0 && !SameTextureState(TextureStates[n],other.TextureStates[n])))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
 void State::Spew()
 {
 	Trace::Stream<<"Colour: "<<Colour<<endl
@@ -49,6 +49,8 @@ namespace Fluxus
 #define HINT_NORMALISE      0x00020000
 #define HINT_NOBLEND        0x00040000
 #define HINT_NOZWRITE       0x00080000
+#define HINT_VBO            0x00100000
+#define HINT_SPRITE         0x00200000
 
 #define MAX_TEXTURES  8
 
@@ -68,6 +70,14 @@ public:
 
 	void Apply();
 	void Unapply();
+	/// Applies the state assuming last was the previous one
+	/// applied, only making the gl calls for what differs.
+	/// Leaves normalise and nozwrite to the caller.
+	void ApplyChanges(const State &last);
+	/// Whether the state only differs from other in its
+	/// transform and colour, so a primitive using both can
+	/// be drawn as instances
+	bool Instanceable(const State &other) const;
 	void Spew();
 
 	dColour Colour;
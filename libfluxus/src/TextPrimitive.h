@@ -42,6 +42,7 @@ public:
 	virtual void Render();
 	virtual string GetTypeName() { return "TextPrimitive"; }
 	virtual Evaluator *MakeEvaluator() { return NULL; }
+	virtual bool RestoresGLState() { return false; }
 	///@}
 	
 	void SetText(const string &s, float Width=10, float Height=10, float Zoom=0);
@@ -0,0 +1,147 @@
+// Copyright (C) 2010 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#include <unistd.h>
+#include "ThreadPool.h"
+#include "Trace.h"
+
+using namespace Fluxus;
+
+bool ThreadPool::m_Initialised=false;
+bool ThreadPool::m_Busy=false;
+unsigned int ThreadPool::m_NumThreads=0;
+vector<pthread_t> ThreadPool::m_Threads;
+pthread_mutex_t ThreadPool::m_Mutex=PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t ThreadPool::m_StartCond=PTHREAD_COND_INITIALIZER;
+pthread_cond_t ThreadPool::m_DoneCond=PTHREAD_COND_INITIALIZER;
+ThreadPool::Task *ThreadPool::m_Task=NULL;
+unsigned int ThreadPool::m_Count=0;
+unsigned int ThreadPool::m_Parts=0;
+unsigned int ThreadPool::m_Pending=0;
+unsigned int ThreadPool::m_Job=0;
+
+unsigned int ThreadPool::GetNumThreads()
+{
+	if (m_NumThreads==0)
+	{
+		long procs=1;
+#ifdef _SC_NPROCESSORS_ONLN
+		procs=sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+		m_NumThreads=procs>1?procs:1;
+	}
+	return m_NumThreads;
+}
+
+void ThreadPool::SetNumThreads(unsigned int s)
+{
+	if (m_Initialised)
+	{
+		Trace::Stream<<"ThreadPool::SetNumThreads: pool already started"<<endl;
+		return;
+	}
+	m_NumThreads=s;
+}
+
+void ThreadPool::Init()
+{
+	m_Initialised=true;
+
+	// the calling thread does one share of the work
+	for (unsigned int n=1; n<GetNumThreads(); n++)
+	{
+		pthread_t thread;
+		if (pthread_create(&thread,NULL,WorkerMain,(void*)(size_t)n)!=0)
+		{
+			Trace::Stream<<"ThreadPool: could not start thread "<<n<<endl;
+			break;
+		}
+		pthread_detach(thread);
+		m_Threads.push_back(thread);
+	}
+	m_NumThreads=m_Threads.size()+1;
+}
+
+void ThreadPool::GetRange(unsigned int part, unsigned int &start, unsigned int &end)
+{
+	start=(unsigned int)(((unsigned long long)m_Count*part)/m_Parts);
+	end=(unsigned int)(((unsigned long long)m_Count*(part+1))/m_Parts);
+}
+
+void *ThreadPool::WorkerMain(void *arg)
+{
+	unsigned int part=(unsigned int)(size_t)arg;
+	unsigned int lastjob=0;
+
+	pthread_mutex_lock(&m_Mutex);
+	while (true)
+	{
+		while (m_Job==lastjob) pthread_cond_wait(&m_StartCond,&m_Mutex);
+		lastjob=m_Job;
+
+		Task *task=m_Task;
+		unsigned int start=0,end=0;
+		if (part<m_Parts) GetRange(part,start,end);
+		pthread_mutex_unlock(&m_Mutex);
+
+		if (start<end) task->Run(start,end);
+
+		pthread_mutex_lock(&m_Mutex);
+		if (--m_Pending==0) pthread_cond_signal(&m_DoneCond);
+	}
+	return NULL;
+}
+
+void ThreadPool::Run(Task &task, unsigned int count, unsigned int grain)
+{
+	if (grain==0) grain=1;
+	unsigned int parts=count/grain;
+	if (parts>GetNumThreads()) parts=GetNumThreads();
+
+	pthread_mutex_lock(&m_Mutex);
+	// too small, or we're inside a job already
+	if (parts<2 || m_Busy)
+	{
+		pthread_mutex_unlock(&m_Mutex);
+		task.Run(0,count);
+		return;
+	}
+
+	if (!m_Initialised) 
+	{
+		Init();
+		if (parts>m_NumThreads) parts=m_NumThreads;
+	}
+
+	m_Busy=true;
+	m_Task=&task;
+	m_Count=count;
+	m_Parts=parts;
+	m_Pending=m_Threads.size();
+	m_Job++;
+	pthread_cond_broadcast(&m_StartCond);
+	pthread_mutex_unlock(&m_Mutex);
+
+	unsigned int start,end;
+	GetRange(0,start,end);
+	task.Run(start,end);
+
+	pthread_mutex_lock(&m_Mutex);
+	while (m_Pending>0) pthread_cond_wait(&m_DoneCond,&m_Mutex);
+	m_Busy=false;
+	m_Task=NULL;
+	pthread_mutex_unlock(&m_Mutex);
+}
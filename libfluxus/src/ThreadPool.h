@@ -0,0 +1,84 @@
+// Copyright (C) 2010 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#ifndef N_THREADPOOL
+#define N_THREADPOOL
+
+#include <vector>
+#include <pthread.h>
+
+using namespace std;
+
+namespace Fluxus
+{
+
+//////////////////////////////////////////////////////
+/// A pool of worker threads for splitting loops over
+/// big arrays, one thread per processor. The threads 
+/// are started the first time they are needed and 
+/// wait between jobs. Run() blocks until the job is
+/// finished, and runs it on the calling thread alone 
+/// if it's too small to be worth splitting, or if it's
+/// called from inside another job.
+class ThreadPool
+{
+public:
+	/// A job to run over a range of items
+	class Task
+	{
+	public:
+		virtual ~Task() {}
+		/// Process the items from start up to (not including) end, 
+		/// this is called from several threads at once
+		virtual void Run(unsigned int start, unsigned int end)=0;
+	};
+
+	/// Runs the task over count items, giving each thread 
+	/// at least grain items
+	static void Run(Task &task, unsigned int count, unsigned int grain=1024);
+
+	/// The number of threads jobs are split between, 
+	/// including the calling one
+	static unsigned int GetNumThreads();
+
+	/// Sets the number of threads to use, 0 for one per 
+	/// processor, only works before the pool has been used
+	static void SetNumThreads(unsigned int s);
+
+private:
+	static void Init();
+	static void *WorkerMain(void *arg);
+	static void GetRange(unsigned int part, unsigned int &start, unsigned int &end);
+
+	static bool m_Initialised;
+	static bool m_Busy;
+	static unsigned int m_NumThreads;
+	static vector<pthread_t> m_Threads;
+	static pthread_mutex_t m_Mutex;
+	static pthread_cond_t m_StartCond;
+	static pthread_cond_t m_DoneCond;
+
+	// the current job
+	static Task *m_Task;
+	static unsigned int m_Count;
+	static unsigned int m_Parts;
+	static unsigned int m_Pending;
+	static unsigned int m_Job;
+};
+
+}
+
+#endif
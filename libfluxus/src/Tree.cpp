@@ -37,8 +37,8 @@ void Node::RemoveChild(int ID)
 
 Tree::Tree()
 {
-	m_CurrentID=1;
 	m_Root=NULL;
+	ResetIDs();
 }
 
 Tree::~Tree()
@@ -57,44 +57,104 @@ int Tree::AddNode(int ParentID, Node *node)
 			return 0;
 		}
 		
-		node->ID=m_CurrentID++;
+		node->ID=AllocateID(node);
+		if (node->ID==0) return 0;
 		parent->Children.push_back(node);
 		node->Parent=parent;
 	}
 	else
 	{
-		node->ID=m_CurrentID++;
+		node->ID=AllocateID(node);
+		if (node->ID==0) return 0;
 	    m_Root=node;
 	}
 	
-	// store in the node map for quick searching...
-	m_NodeMap[node->ID]=node;
-	
 	return node->ID;
 }
 
 Node *Tree::FindNode(int ID) const
 {
-	map<int,Node*>::const_iterator i=m_NodeMap.find(ID);
-	if (i!=m_NodeMap.end())
+	if (ID<=0) return NULL;
+	unsigned int index=ID&INDEX_MASK;
+	if (index>=m_Slots.size()) return NULL;
+	const Slot &slot=m_Slots[index];
+	if (slot.m_Generation!=((unsigned int)ID>>INDEX_BITS)) return NULL;
+	return slot.m_Node;
+}
+
+void Tree::Clear()
+{
+	if (m_Root) RemoveNode(m_Root);
+	m_Root=NULL;
+	ResetIDs();
+}
+
+void Tree::ResetIDs()
+{
+	m_Slots.clear();
+	// slot 0 is never used, so no ID is 0 and the first (the root) is 1
+	Slot null;
+	null.m_Node=NULL;
+	null.m_Generation=0;
+	null.m_NextFree=0;
+	m_Slots.push_back(null);
+	m_FreeHead=0;
+	m_FreeTail=0;
+	m_NumFree=0;
+	m_NumNodes=0;
+}
+
+int Tree::AllocateID(Node *node)
+{
+	unsigned int index;
+	if (m_NumFree>MIN_FREE_SLOTS)
 	{
-		return i->second;
+		index=m_FreeHead;
+		m_FreeHead=m_Slots[index].m_NextFree;
+		if (m_FreeHead==0) m_FreeTail=0;
+		m_NumFree--;
 	}
-	
-	return NULL;
+	else
+	{
+		index=m_Slots.size();
+		if (index>INDEX_MASK)
+		{
+			Trace::Stream<<"Tree::AddNode : too many nodes ("<<m_NumNodes<<")"<<endl;
+			return 0;
+		}
+		Slot slot;
+		slot.m_Generation=0;
+		m_Slots.push_back(slot);
+	}
+
+	Slot &slot=m_Slots[index];
+	slot.m_Node=node;
+	slot.m_NextFree=0;
+	m_NumNodes++;
+	return (slot.m_Generation<<INDEX_BITS)|index;
+}
+
+void Tree::FreeID(int ID)
+{
+	unsigned int index=ID&INDEX_MASK;
+	if (ID<=0 || index>=m_Slots.size()) return;
+	Slot &slot=m_Slots[index];
+	if (slot.m_Node==NULL || slot.m_Generation!=((unsigned int)ID>>INDEX_BITS)) return;
+
+	slot.m_Node=NULL;
+	slot.m_Generation=(slot.m_Generation+1)&GENERATION_MASK;
+	slot.m_NextFree=0;
+	if (m_FreeTail!=0) m_Slots[m_FreeTail].m_NextFree=index;
+	else m_FreeHead=index;
+	m_FreeTail=index;
+	m_NumFree++;
+	m_NumNodes--;
 }
 
 void Tree::RemoveNode(Node *node)
 {
 	if (node==NULL) return;
 	
-	// remove from node map
-	map<int,Node*>::iterator i=m_NodeMap.find(node->ID);
-	if (i!=m_NodeMap.end())
-	{
-		m_NodeMap.erase(i);
-	}
-	
 	// if not root, remove ourself from our parent's child vector
 	if (node->Parent)
 	{
@@ -112,13 +172,7 @@ void Tree::RemoveNodeWalk(Node *node)
 		RemoveNodeWalk(*i);
 	}
 	
-	// remove from node map
-	map<int,Node*>::iterator i=m_NodeMap.find(node->ID);
-	if (i!=m_NodeMap.end())
-	{
-		m_NodeMap.erase(i);
-	}
-	
+	FreeID(node->ID);
 	delete node;
 }
 	
@@ -18,7 +18,6 @@
 #define N_TREE
 
 #include <vector>
-#include <map>
 #include <iostream>
 
 using namespace std;
@@ -44,17 +43,23 @@ public:
 ////////////////////////////////////////////////
 /// A tree of nodes.
 /// This is the base class for the scene graph,
-/// Just a basic tree structure
+/// Just a basic tree structure. Node IDs index a 
+/// table of slots directly, with a generation count 
+/// in the high bits so IDs of removed nodes are not
+/// found again when their slot is reused.
 class Tree
 {
 public:
     Tree();
     virtual ~Tree();
 
-	/// Adds a node onto a parent node (0 is the root)
+	/// Adds a node onto a parent node (0 is the root), returns
+	/// the ID or 0 if the parent isn't there or the tree is full
+	/// (it holds about 4 million nodes at once)
     virtual int AddNode(int ParentID, Node *);
 	
-	/// Finds a node in the tree from its ID
+	/// Finds a node in the tree from its ID, returns
+	/// NULL if it's not there or has been removed
     virtual Node *FindNode(int ID) const;
 	
 	/// Frees a node - and all it's children too
@@ -64,7 +69,7 @@ public:
     virtual void ReparentNode(int NodeID, int NewParentID);
 	
 	/// Clear the tree
-    virtual void Clear() { if (m_Root) RemoveNode(m_Root); m_Root=NULL; m_CurrentID=1; }
+    virtual void Clear();
 	
 	/// Print out the tree for debugging
     virtual void Dump(int Depth=0,Node *node=NULL) const;
@@ -75,12 +80,42 @@ public:
 	/// Get the root
 	Node *Root() { return m_Root; }
 
+	/// The number of nodes in the tree
+	unsigned int GetNumNodes() const { return m_NumNodes; }
+
 protected:
 	void RemoveNodeWalk(Node *node);
-	
-	map<int,Node*> m_NodeMap;
+	int AllocateID(Node *node);
+	void FreeID(int ID);
+	void ResetIDs();
+
+	// IDs are the slot index, with the generation above it,
+	// kept small enough to fit in a scheme fixnum. this caps
+	// the tree at 2^22-1 (about 4 million) nodes at once,
+	// AddNode reports it and returns 0 past that
+	static const int INDEX_BITS = 22;
+	static const unsigned int INDEX_MASK = (1<<INDEX_BITS)-1;
+	static const unsigned int GENERATION_MASK = 0xff;
+	// freed slots wait until there are this many before
+	// being reused, so the generations wrap round slowly
+	static const unsigned int MIN_FREE_SLOTS = 1024;
+
+	// 16 bytes on 64 bit, 12 on 32 bit
+	class Slot
+	{
+	public:
+		Node *m_Node; // NULL when free
+		unsigned int m_Generation;
+		unsigned int m_NextFree;
+	};
+
+	vector<Slot> m_Slots;
+	// free slots are reused oldest first, 0 for none
+	unsigned int m_FreeHead;
+	unsigned int m_FreeTail;
+	unsigned int m_NumFree;
+	unsigned int m_NumNodes;
 	Node *m_Root;
-    int m_CurrentID;
 };
 
 }
@@ -0,0 +1,102 @@
+// Copyright (C) 2010 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+
+#include "VertexBuffer.h"
+
+using namespace Fluxus;
+
+bool VertexBuffer::m_Supported=false;
+bool VertexBuffer::m_InstancingSupported=false;
+
+VertexBuffer::VertexBuffer(GLenum target) :
+m_Target(target),
+m_Buffer(0),
+m_Version(0),
+m_Size(0),
+m_Uploads(0)
+{
+}
+
+VertexBuffer::VertexBuffer(const VertexBuffer &other) :
+m_Target(other.m_Target),
+m_Buffer(0),
+m_Version(0),
+m_Size(0),
+m_Uploads(0)
+{
+}
+
+VertexBuffer::~VertexBuffer()
+{
+	Release();
+}
+
+void VertexBuffer::Init()
+{
+	m_Supported = glewIsSupported("GL_VERSION_1_5");
+	m_InstancingSupported = glewIsSupported("GL_ARB_draw_instanced GL_ARB_instanced_arrays");
+}
+
+const void *VertexBuffer::Bind(unsigned int version, const void *data, unsigned int bytes)
+{
+	if (!m_Supported) return data;
+
+	if (m_Buffer==0)
+	{
+		glGenBuffers(1,&m_Buffer);
+	}
+
+	glBindBuffer(m_Target,m_Buffer);
+
+	if (version!=m_Version || bytes!=m_Size)
+	{
+		if (bytes==m_Size)
+		{
+			glBufferSubData(m_Target,0,bytes,data);
+		}
+		else
+		{
+			// if we are being updated all the time, let 
+			// the driver know it's not static geometry
+			glBufferData(m_Target,bytes,data,m_Uploads>0?GL_DYNAMIC_DRAW:GL_STATIC_DRAW);
+		}
+		m_Version=version;
+		m_Size=bytes;
+		m_Uploads++;
+	}
+
+	// the pointers are now offsets into the buffer
+	return NULL;
+}
+
+void VertexBuffer::Unbind()
+{
+	if (!m_Supported) return;
+	glBindBuffer(GL_ARRAY_BUFFER,0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,0);
+}
+
+void VertexBuffer::Release()
+{
+	if (m_Buffer!=0)
+	{
+		glDeleteBuffers(1,&m_Buffer);
+		m_Buffer=0;
+	}
+	m_Version=0;
+	m_Size=0;
+}
@@ -0,0 +1,75 @@
+// Copyright (C) 2010 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+
+#ifndef N_VERTEX_BUFFER
+#define N_VERTEX_BUFFER
+
+#include "OpenGL.h"
+
+namespace Fluxus
+{
+
+//////////////////////////////////////////////////////
+/// A GL buffer object holding a copy of an array in
+/// video memory. The data is only uploaded again when
+/// the version passed in changes - pdata arrays get a
+/// new version whenever they are written to, so static
+/// geometry stays on the card.
+class VertexBuffer
+{
+public:
+	VertexBuffer(GLenum target=GL_ARRAY_BUFFER);
+	/// Copies don't share the gl buffer, they make their own
+	VertexBuffer(const VertexBuffer &other);
+	~VertexBuffer();
+
+	/// Checks the driver for buffer object support, 
+	/// needs to be called with a gl context
+	static void Init();
+	static bool Supported() { return m_Supported; }
+	/// Whether instanced draws with per instance
+	/// attribute streams are available
+	static bool InstancingSupported() { return m_InstancingSupported; }
+
+	/// Binds the buffer, uploading the data first if the
+	/// version has changed. Returns the pointer to use 
+	/// with the gl*Pointer/glDrawElements calls.
+	const void *Bind(unsigned int version, const void *data, unsigned int bytes);
+
+	/// Unbinds all buffers, so client side arrays can 
+	/// be used again
+	static void Unbind();
+
+	/// Frees the video memory, the next Bind() uploads again
+	void Release();
+
+private:
+	const VertexBuffer &operator=(const VertexBuffer &other);
+
+	GLenum m_Target;
+	GLuint m_Buffer;
+	unsigned int m_Version;
+	unsigned int m_Size;
+	unsigned int m_Uploads;
+
+	static bool m_Supported;
+	static bool m_InstancingSupported;
+};
+
+}
+
+#endif
@@ -18,23 +18,75 @@
 #include "VoxelPrimitive.h"
 #include "BlobbyPrimitive.h"
 #include "State.h"
+#include "ImplicitSurface.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <cassert>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
 
 using namespace Fluxus;
 
-VoxelPrimitive::VoxelPrimitive(unsigned int w, unsigned int h, unsigned int d)
+// influences are left out where they add less than this to 
+// every channel
+static const float INFLUENCE_CUTOFF=1/1024.0f;
+
+// the number of voxels below which an op isn't worth splitting 
+// over the threads
+static const unsigned int MIN_THREAD_VOXELS=32768;
+
+// sparse voxels are stored in bricks of BRICK_SIZE along each side
+static const unsigned int BRICK_BITS=3;
+static const unsigned int BRICK_SIZE=1<<BRICK_BITS;
+static const unsigned int BRICK_VOXELS=BRICK_SIZE*BRICK_SIZE*BRICK_SIZE;
+static const unsigned int EMPTY_BRICK=UINT_MAX;
+static const unsigned int NO_VOXEL=UINT_MAX;
+
+// what the voxels sparse voxels don't store read as
+static bool IsClear(const dColour &c) { return c.r==0 && c.g==0 && c.b==0 && c.a==0; }
+
+VoxelPrimitive::VoxelPrimitive(unsigned int w, unsigned int h, unsigned int d, bool sparse) :
+m_Width(w),
+m_Height(h),
+m_Depth(d),
+m_Sparse(sparse)
 {
-	AddData("c",new TypedPData<dColour>(w*h*d));
-	AddData("g",new TypedPData<dColour>(w*h*d));
-	m_Width=w;
-	m_Height=h;
-	m_Depth=d;
+	m_Bricks[0]=(w+BRICK_SIZE-1)>>BRICK_BITS;
+	m_Bricks[1]=(h+BRICK_SIZE-1)>>BRICK_BITS;
+	m_Bricks[2]=(d+BRICK_SIZE-1)>>BRICK_BITS;
+
+	if (m_Sparse)
+	{
+		m_BrickSlots.resize(m_Bricks[0]*m_Bricks[1]*m_Bricks[2],EMPTY_BRICK);
+		AddData("c",new TypedPData<dColour>);
+		AddData("g",new TypedPData<dColour>);
+	}
+	else
+	{
+		AddData("c",new TypedPData<dColour>(w*h*d));
+		AddData("g",new TypedPData<dColour>(w*h*d));
+	}
 	// direct access for speed
 	PDataDirty();
 }
 
 VoxelPrimitive::VoxelPrimitive(const VoxelPrimitive &other) :
-Primitive(other)
+Primitive(other),
+m_Width(other.m_Width),
+m_Height(other.m_Height),
+m_Depth(other.m_Depth),
+m_Sparse(other.m_Sparse),
+m_BrickSlots(other.m_BrickSlots),
+m_SlotBricks(other.m_SlotBricks)
 {
+	for (int axis=0; axis<3; axis++)
+	{
+		m_Bricks[axis]=other.m_Bricks[axis];
+	}
 	PDataDirty();
 }
 
@@ -53,94 +105,1012 @@ void VoxelPrimitive::PDataDirty()
 	m_GradData=GetDataVec<dColour>("g");
 }
 
-unsigned int VoxelPrimitive::Index(unsigned int x, unsigned int y, unsigned int z)
+unsigned int VoxelPrimitive::Find(unsigned int x, unsigned int y, unsigned int z) const
 {
-	return x + y*m_Width + z*m_Width*m_Height;
+	if (!m_Sparse) return x + y*m_Width + z*m_Width*m_Height;
+
+	unsigned int slot=m_BrickSlots[Brick(x,y,z)];
+	if (slot==EMPTY_BRICK) return NO_VOXEL;
+	const unsigned int mask=BRICK_SIZE-1;
+	return slot*BRICK_VOXELS + (x&mask) + ((y&mask)<<BRICK_BITS) + ((z&mask)<<(BRICK_BITS*2));
 }
 
-dVector VoxelPrimitive::Position(unsigned int index)
+dVector VoxelPrimitive::Position(unsigned int index) const
 {
-	return dVector(index%m_Width, 
-				   (index/m_Width)%m_Height, 
-				   index/(m_Width*m_Height))/m_Width;
+	if (!m_Sparse)
+	{
+		return dVector(index%m_Width, 
+					   (index/m_Width)%m_Height, 
+					   index/(m_Width*m_Height))/m_Width;
+	}
+
+	Region region=BrickRegion(m_SlotBricks[index/BRICK_VOXELS]);
+	unsigned int local=index%BRICK_VOXELS;
+	return dVector(region.Min[0]+local%BRICK_SIZE, 
+				   region.Min[1]+(local/BRICK_SIZE)%BRICK_SIZE,
+				   region.Min[2]+local/(BRICK_SIZE*BRICK_SIZE))/m_Width;
 }
 
-dColour VoxelPrimitive::SafeRef(unsigned int x, unsigned int y, unsigned int z)
+dColour VoxelPrimitive::SafeRef(unsigned int x, unsigned int y, unsigned int z) const
 {
 	if (x>0 && x<m_Width && y>0 && y<m_Height && z>0 && z<m_Depth)
 	{
-		return (*m_ColData)[Index(x,y,z)];
+		unsigned int index=Find(x,y,z);
+		if (index==NO_VOXEL) return dColour(0,0,0,0);
+		return (*m_ColData)[index];
 	}
 	return dColour(0,0,0);
 }
 
-void VoxelPrimitive::CalcGradient()
+VoxelPrimitive::Region VoxelPrimitive::Bounds(const dVector &min, const dVector &max) const
 {
-	for (unsigned int x=0; x<m_Width; x++)
+	// positions are the voxel's index over the width, widen 
+	// the range by one to be safe from rounding, the ops test
+	// the voxels in it exactly
+	const float lo[3]={min.x, min.y, min.z};
+	const float hi[3]={max.x, max.y, max.z};
+	const unsigned int size[3]={m_Width, m_Height, m_Depth};
+	Region region;
+	for (int axis=0; axis<3; axis++)
 	{
-		for (unsigned int y=0; y<m_Height; y++)
+		float first=floorf(lo[axis]*m_Width)-1;
+		float last=ceilf(hi[axis]*m_Width)+2;
+		region.Min[axis]=!(first>0)?0:first>=size[axis]?size[axis]:(unsigned int)first;
+		region.Max[axis]=!(last>0)?0:last>=size[axis]?size[axis]:(unsigned int)last;
+	}
+	return region;
+}
+
+VoxelPrimitive::Region VoxelPrimitive::All() const
+{
+	Region region;
+	region.Min[0]=region.Min[1]=region.Min[2]=0;
+	region.Max[0]=m_Width;
+	region.Max[1]=m_Height;
+	region.Max[2]=m_Depth;
+	return region;
+}
+
+unsigned int VoxelPrimitive::Brick(unsigned int x, unsigned int y, unsigned int z) const
+{
+	return (x>>BRICK_BITS) + ((y>>BRICK_BITS) + (z>>BRICK_BITS)*m_Bricks[1])*m_Bricks[0];
+}
+
+VoxelPrimitive::Region VoxelPrimitive::BrickRegion(unsigned int brick) const
+{
+	const unsigned int size[3]={m_Width, m_Height, m_Depth};
+	const unsigned int pos[3]={brick%m_Bricks[0], (brick/m_Bricks[0])%m_Bricks[1], brick/(m_Bricks[0]*m_Bricks[1])};
+	Region region;
+	for (int axis=0; axis<3; axis++)
+	{
+		region.Min[axis]=pos[axis]<<BRICK_BITS;
+		region.Max[axis]=min(region.Min[axis]+BRICK_SIZE,size[axis]);
+	}
+	return region;
+}
+
+void VoxelPrimitive::BricksIn(const Region &region, vector<unsigned int> &bricks) const
+{
+	bricks.clear();
+	if (region.Empty()) return;
+	unsigned int first=Brick(region.Min[0],region.Min[1],region.Min[2]);
+	unsigned int last[3];
+	for (int axis=0; axis<3; axis++)
+	{
+		last[axis]=(region.Max[axis]-1)>>BRICK_BITS;
+	}
+	unsigned int across=last[0]-(region.Min[0]>>BRICK_BITS)+1;
+	for (unsigned int z=region.Min[2]>>BRICK_BITS; z<=last[2]; z++)
+	{
+		for (unsigned int y=region.Min[1]>>BRICK_BITS; y<=last[1]; y++)
 		{
-			for (unsigned int z=0; z<m_Depth; z++)
+			unsigned int brick=first%m_Bricks[0] + (y + z*m_Bricks[1])*m_Bricks[0];
+			for (unsigned int x=0; x<across; x++) bricks.push_back(brick+x);
+		}
+	}
+}
+
+bool VoxelPrimitive::BrickNear(unsigned int brick, const dVector &pos, float distsq) const
+{
+	// the voxel positions nearest pos, with a little slack for rounding
+	Region region=BrickRegion(brick);
+	const float p[3]={pos.x, pos.y, pos.z};
+	float d=0;
+	for (int axis=0; axis<3; axis++)
+	{
+		float lo=region.Min[axis]/(float)m_Width;
+		float hi=(region.Max[axis]-1)/(float)m_Width;
+		float out=p[axis]<lo?lo-p[axis]:p[axis]>hi?p[axis]-hi:0;
+		d+=out*out;
+	}
+	return d<=distsq*1.001f+1e-6f;
+}
+
+void VoxelPrimitive::StoreBrick(unsigned int brick)
+{
+	if (m_BrickSlots[brick]!=EMPTY_BRICK) return;
+	m_BrickSlots[brick]=m_SlotBricks.size();
+	m_SlotBricks.push_back(brick);
+}
+
+void VoxelPrimitive::StoreAll()
+{
+	for (unsigned int brick=0; brick<m_BrickSlots.size(); brick++)
+	{
+		StoreBrick(brick);
+	}
+}
+
+void VoxelPrimitive::Grow()
+{
+	unsigned int old=Size();
+	unsigned int size=m_SlotBricks.size()*BRICK_VOXELS;
+	if (size==old) return;
+	Resize(size);
+	PDataDirty();
+	for (unsigned int n=old; n<size; n++)
+	{
+		(*m_ColData)[n]=dColour(0,0,0,0);
+	}
+}
+
+void VoxelPrimitive::StoreGradientBricks()
+{
+	if (!m_Sparse) return;
+
+	// the gradient along each axis is the difference of the red, green 
+	// or blue either side, so it spreads a voxel into the next brick 
+	// when there's any of that colour on the brick's side
+	const unsigned int size[3]={m_Width, m_Height, m_Depth};
+	const dColour *col=&(*m_ColData)[0];
+	unsigned int stored=m_SlotBricks.size();
+	for (unsigned int slot=0; slot<stored; slot++)
+	{
+		Region region=BrickRegion(m_SlotBricks[slot]);
+		for (int axis=0; axis<3; axis++)
+		{
+			int u=(axis+1)%3, v=(axis+2)%3;
+			for (int side=0; side<2; side++)
 			{
-				(*m_GradData)[Index(x,y,z)]=dColour(SafeRef(x-1,y,z).r-SafeRef(x+1,y,z).r,
-					SafeRef(x,y-1,z).g-SafeRef(x,y+1,z).g,
-					SafeRef(x,y,z-1).b-SafeRef(x,y,z+1).b);
-			}	
+				unsigned int next[3]={region.Min[0], region.Min[1], region.Min[2]};
+				if (side==0)
+				{
+					if (region.Min[axis]==0) continue;
+					next[axis]=region.Min[axis]-1;
+				}
+				else
+				{
+					if (region.Max[axis]>=size[axis]) continue;
+					next[axis]=region.Max[axis];
+				}
+				unsigned int brick=Brick(next[0],next[1],next[2]);
+				if (m_BrickSlots[brick]!=EMPTY_BRICK) continue;
+
+				unsigned int local[3]={0, 0, 0};
+				local[axis]=side?region.Max[axis]-1-region.Min[axis]:0;
+				bool edge=false;
+				for (local[u]=0; !edge && local[u]<region.Max[u]-region.Min[u]; local[u]++)
+				{
+					for (local[v]=0; !edge && local[v]<region.Max[v]-region.Min[v]; local[v]++)
+					{
+						unsigned int index=slot*BRICK_VOXELS+local[0]+((local[1]+(local[2]<<BRICK_BITS))<<BRICK_BITS);
+						edge=col[index].arr()[axis]!=0;
+					}
+				}
+				if (edge) StoreBrick(brick);
+			}
+		}
+	}
+	Grow();
+}
+
+// copies a brick from one slot to another, if the array is this type
+template<class T>
+static bool MoveBrick(PData *data, unsigned int from, unsigned int to)
+{
+	TypedPData<T> *typed=dynamic_cast<TypedPData<T>*>(data);
+	if (!typed) return false;
+	typed->Unmap();
+	copy(typed->m_Data.begin()+from*BRICK_VOXELS,typed->m_Data.begin()+(from+1)*BRICK_VOXELS,
+		typed->m_Data.begin()+to*BRICK_VOXELS);
+	return true;
+}
+
+// if the array is of type T, sets isdefault to whether the brick only
+// holds the value new voxels are given when the arrays grow
+template<class T>
+static bool IsDefaultBrick(const PData *data, unsigned int slot, bool &isdefault)
+{
+	const TypedPData<T> *typed=dynamic_cast<const TypedPData<T>*>(data);
+	if (!typed) return false;
+	const T def=T();
+	const T *v=typed->View()+slot*BRICK_VOXELS;
+	for (unsigned int n=0; n<BRICK_VOXELS && isdefault; n++)
+	{
+		isdefault=memcmp(&v[n],&def,sizeof(T))==0;
+	}
+	return true;
+}
+
+bool VoxelPrimitive::IsEmptyBrick(unsigned int slot) const
+{
+	const dColour *col=&(*m_ColData)[slot*BRICK_VOXELS];
+	for (unsigned int n=0; n<BRICK_VOXELS; n++)
+	{
+		if (!IsClear(col[n])) return false;
+	}
+
+	// the gradient and any user arrays need to be untouched too,
+	// otherwise freeing the brick would lose what's in them
+	for (map<string,PData*>::const_iterator d=m_PData.begin(); d!=m_PData.end(); ++d)
+	{
+		if (d->first=="c") continue;
+		bool isdefault=true;
+		if (!IsDefaultBrick<dColour>(d->second,slot,isdefault) &&
+			!IsDefaultBrick<dVector>(d->second,slot,isdefault) &&
+			!IsDefaultBrick<float>(d->second,slot,isdefault))
+		{
+			IsDefaultBrick<dMatrix>(d->second,slot,isdefault);
 		}
+		if (!isdefault) return false;
 	}
+	return true;
 }
 
+void VoxelPrimitive::FreeEmptyBricks()
+{
+	if (!m_Sparse) return;
+
+	vector<unsigned int> empty;
+	for (vector<unsigned int>::iterator i=m_Blocks.begin(); i!=m_Blocks.end(); ++i)
+	{
+		unsigned int slot=m_BrickSlots[*i];
+		if (IsEmptyBrick(slot)) empty.push_back(slot);
+	}
+	m_Blocks.clear();
+	if (empty.empty()) return;
+
+	// fill the gaps with the last bricks, from the end so the last 
+	// brick is never one that's going
+	sort(empty.begin(),empty.end());
+	for (vector<unsigned int>::reverse_iterator i=empty.rbegin(); i!=empty.rend(); ++i)
+	{
+		unsigned int slot=*i;
+		unsigned int last=m_SlotBricks.size()-1;
+		m_BrickSlots[m_SlotBricks[slot]]=EMPTY_BRICK;
+		if (slot!=last)
+		{
+			for (map<string,PData*>::iterator d=m_PData.begin(); d!=m_PData.end(); ++d)
+			{
+				if (!MoveBrick<dColour>(d->second,last,slot) &&
+					!MoveBrick<dVector>(d->second,last,slot) &&
+					!MoveBrick<float>(d->second,last,slot))
+				{
+					MoveBrick<dMatrix>(d->second,last,slot);
+				}
+			}
+			m_SlotBricks[slot]=m_SlotBricks[last];
+			m_BrickSlots[m_SlotBricks[slot]]=slot;
+		}
+		m_SlotBricks.pop_back();
+	}
+	Resize(m_SlotBricks.size()*BRICK_VOXELS);
+	PDataDirty();
+}
+
+// steps through the rows of voxels in a task's share of the blocks 
+// from RunBlocks(), a block at a time
+class VoxelPrimitive::Rows
+{
+public:
+	Rows(const VoxelPrimitive &vox, const Region &region, unsigned int start, unsigned int end) :
+		m_Vox(vox), m_Region(region), m_Next(start), m_End(end) {}
+
+	/// Moves on to the next block, false when there are none left
+	bool NextBlock()
+	{
+		while (m_Next<m_End)
+		{
+			unsigned int job=m_Next++;
+			if (m_Vox.m_Sparse)
+			{
+				unsigned int brick=m_Vox.m_Blocks[job];
+				m_Store=m_Vox.BrickRegion(brick);
+				m_Base=m_Vox.m_BrickSlots[brick]*BRICK_VOXELS;
+				m_Step[1]=BRICK_SIZE;
+				m_Step[2]=BRICK_SIZE*BRICK_SIZE;
+				for (int axis=0; axis<3; axis++)
+				{
+					m_Block.Min[axis]=max(m_Region.Min[axis],m_Store.Min[axis]);
+					m_Block.Max[axis]=min(m_Region.Max[axis],m_Store.Max[axis]);
+				}
+			}
+			else
+			{
+				m_Store=m_Vox.All();
+				m_Base=0;
+				m_Step[1]=m_Vox.m_Width;
+				m_Step[2]=m_Vox.m_Width*m_Vox.m_Height;
+				m_Block=m_Region;
+				m_Block.Min[2]=m_Region.Min[2]+job;
+				m_Block.Max[2]=m_Block.Min[2]+1;
+			}
+
+			if (!m_Block.Empty())
+			{
+				Y=m_Block.Min[1];
+				Z=m_Block.Min[2];
+				m_First=true;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	/// Moves on to the next row of the block, false at the end of it
+	bool NextRow()
+	{
+		if (m_First) m_First=false;
+		else if (++Y>=m_Block.Max[1])
+		{
+			Y=m_Block.Min[1];
+			if (++Z>=m_Block.Max[2]) return false;
+		}
+		Index=m_Base+(m_Block.Min[0]-m_Store.Min[0])+
+			(Y-m_Store.Min[1])*m_Step[1]+(Z-m_Store.Min[2])*m_Step[2];
+		return true;
+	}
+
+	/// The part of the region in this block
+	const Region &Block() const { return m_Block; }
+	/// The voxels stored together with this block (the whole grid, 
+	/// or the brick) which are Step() apart along each axis
+	const Region &Store() const { return m_Store; }
+	unsigned int Step(int axis) const { return axis?m_Step[axis]:1; }
+
+	/// The row, and the pdata index of the voxel at Block().Min[0]
+	unsigned int Y;
+	unsigned int Z;
+	unsigned int Index;
+
+private:
+	const VoxelPrimitive &m_Vox;
+	const Region &m_Region;
+	unsigned int m_Next;
+	unsigned int m_End;
+	Region m_Block;
+	Region m_Store;
+	unsigned int m_Base;
+	unsigned int m_Step[3];
+	bool m_First;
+};
+
+void VoxelPrimitive::RunBlocks(ThreadPool::Task &task, const Region &region)
+{
+	if (region.Empty()) return;
+	if (m_Sparse)
+	{
+		// only the bricks that are stored
+		BricksIn(region,m_Blocks);
+		vector<unsigned int>::iterator out=m_Blocks.begin();
+		for (vector<unsigned int>::iterator i=m_Blocks.begin(); i!=m_Blocks.end(); ++i)
+		{
+			if (m_BrickSlots[*i]!=EMPTY_BRICK) *out++=*i;
+		}
+		m_Blocks.erase(out,m_Blocks.end());
+		if (m_Blocks.empty()) return;
+		ThreadPool::Run(task,m_Blocks.size(),MIN_THREAD_VOXELS/BRICK_VOXELS+1);
+	}
+	else
+	{
+		unsigned int slice=(region.Max[0]-region.Min[0])*(region.Max[1]-region.Min[1]);
+		ThreadPool::Run(task,region.Max[2]-region.Min[2],MIN_THREAD_VOXELS/slice+1);
+	}
+}
+
+// the central difference of the red, green and blue values along 
+// x, y and z, for the blocks of the grid
+class VoxelPrimitive::GradientTask : public ThreadPool::Task
+{
+public:
+	GradientTask(VoxelPrimitive &vox, const Region &region) : m_Vox(vox), m_Region(region) {}
+
+	virtual void Run(unsigned int start, unsigned int end)
+	{
+		VoxelPrimitive &vox=m_Vox;
+		const unsigned int size[3]={vox.m_Width, vox.m_Height, vox.m_Depth};
+		const dColour *col=&(*vox.m_ColData)[0];
+		dColour *grad=&(*vox.m_GradData)[0];
+
+		Rows rows(vox,m_Region,start,end);
+		while (rows.NextBlock())
+		{
+			// the voxels with all their neighbours stored in the same block, 
+			// SafeRef() treats the first voxel on each axis as outside so 
+			// they start from 2
+			const Region &block=rows.Block();
+			const Region &store=rows.Store();
+			unsigned int lo[3], hi[3];
+			for (int axis=0; axis<3; axis++)
+			{
+				lo[axis]=max(store.Min[axis],1u)+1;
+				hi[axis]=min(store.Max[axis],size[axis])-1;
+			}
+			const unsigned int dy=rows.Step(1);
+			const unsigned int dz=rows.Step(2);
+
+			while (rows.NextRow())
+			{
+				unsigned int y=rows.Y, z=rows.Z, i=rows.Index;
+				unsigned int x=block.Min[0];
+				if (y>=lo[1] && y<hi[1] && z>=lo[2] && z<hi[2])
+				{
+					for (; x<block.Max[0] && x<lo[0]; x++, i++) Edge(x,y,z,grad[i]);
+					for (; x<block.Max[0] && x<hi[0]; x++, i++)
+					{
+						grad[i]=dColour(col[i-1].r-col[i+1].r,
+							col[i-dy].g-col[i+dy].g,
+							col[i-dz].b-col[i+dz].b);
+					}
+				}
+				for (; x<block.Max[0]; x++, i++) Edge(x,y,z,grad[i]);
+			}
+		}
+	}
+
+private:
+	void Edge(unsigned int x, unsigned int y, unsigned int z, dColour &out)
+	{
+		VoxelPrimitive &vox=m_Vox;
+		out=dColour(vox.SafeRef(x-1,y,z).r-vox.SafeRef(x+1,y,z).r,
+			vox.SafeRef(x,y-1,z).g-vox.SafeRef(x,y+1,z).g,
+			vox.SafeRef(x,y,z-1).b-vox.SafeRef(x,y,z+1).b);
+	}
+
+	VoxelPrimitive &m_Vox;
+	const Region &m_Region;
+};
+
+void VoxelPrimitive::CalcGradient()
+{
+	StoreGradientBricks();
+	Region all=All();
+	GradientTask task(*this,all);
+	RunBlocks(task,all);
+	FreeEmptyBricks();
+}
+
+// adds a batch of influences to the blocks of a region, each voxel 
+// is read and written once, with the influences added in order
+class VoxelPrimitive::InfluenceTask : public ThreadPool::Task
+{
+public:
+	InfluenceTask(VoxelPrimitive &vox, const vector<Influence> &influences, 
+		const vector<Region> &regions, const vector<float> &cutoffs, const Region &region) : 
+		m_Vox(vox), m_Influences(influences), m_Regions(regions), m_Cutoffs(cutoffs), m_Region(region) {}
+
+	virtual void Run(unsigned int start, unsigned int end)
+	{
+		VoxelPrimitive &vox=m_Vox;
+		const float width=vox.m_Width;
+		dColour *col=&(*vox.m_ColData)[0];
+		vector<unsigned int> near;
+		vector<RowInfluence> row;
+
+		Rows rows(vox,m_Region,start,end);
+		while (rows.NextBlock())
+		{
+			// the influences reaching this block
+			const Region &block=rows.Block();
+			near.clear();
+			for (unsigned int n=0; n<m_Influences.size(); n++)
+			{
+				const Region &region=m_Regions[n];
+				if (region.Min[0]<block.Max[0] && region.Max[0]>block.Min[0] &&
+					region.Min[1]<block.Max[1] && region.Max[1]>block.Min[1] &&
+					region.Min[2]<block.Max[2] && region.Max[2]>block.Min[2]) 
+				{
+					near.push_back(n);
+				}
+			}
+			if (near.empty()) continue;
+
+			while (rows.NextRow())
+			{
+				// the influences reaching this row, with what doesn't 
+				// change along it worked out up front
+				unsigned int y=rows.Y, z=rows.Z;
+				float py=y/width;
+				float pz=z/width;
+				row.clear();
+				unsigned int x0=block.Max[0], x1=block.Min[0];
+				for (unsigned int i=0; i<near.size(); i++)
+				{
+					unsigned int n=near[i];
+					const Region &region=m_Regions[n];
+					if (y<region.Min[1] || y>=region.Max[1] || z<region.Min[2] || z>=region.Max[2]) continue;
+
+					const Influence &inf=m_Influences[n];
+					RowInfluence ri;
+					float dy=inf.Pos.y-py;
+					float dz=inf.Pos.z-pz;
+					ri.X=inf.Pos.x;
+					ri.DistSqYZ=dy*dy+dz*dz;
+					ri.Cutoff=m_Cutoffs[n];
+					ri.Col=inf.Col;
+					ri.Pow=inf.Strength;
+					ri.Halves=Halves(inf.Strength);
+					ri.Min=region.Min[0];
+					ri.Max=region.Max[0];
+					row.push_back(ri);
+					x0=min(x0,region.Min[0]);
+					x1=max(x1,region.Max[0]);
+				}
+				x0=max(x0,block.Min[0]);
+				x1=min(x1,block.Max[0]);
+
+				// the index of voxel x is first+x
+				unsigned int first=rows.Index-block.Min[0];
+				unsigned int x=x0;
+#ifdef __SSE__
+				for (; x+4<=x1; x+=4)
+				{
+					// four voxels, swizzled so each channel is in a register
+					dColour *out=col+(first+x);
+					__m128 r=_mm_loadu_ps(out[0].arr());
+					__m128 g=_mm_loadu_ps(out[1].arr());
+					__m128 b=_mm_loadu_ps(out[2].arr());
+					__m128 a=_mm_loadu_ps(out[3].arr());
+					_MM_TRANSPOSE4_PS(r,g,b,a);
+					__m128 px=_mm_div_ps(_mm_set_ps(x+3,x+2,x+1,x),_mm_set1_ps(width));
+
+					for (vector<RowInfluence>::const_iterator i=row.begin(); i!=row.end(); ++i)
+					{
+						if (x+4<=i->Min || x>=i->Max) continue;
+						__m128 dx=_mm_sub_ps(_mm_set1_ps(i->X),px);
+						__m128 distsq=_mm_add_ps(_mm_mul_ps(dx,dx),_mm_set1_ps(i->DistSqYZ));
+						__m128 weight=_mm_and_ps(Weight(distsq,i->Halves,i->Pow),
+							_mm_cmplt_ps(distsq,_mm_set1_ps(i->Cutoff)));
+						r=_mm_add_ps(r,_mm_mul_ps(_mm_set1_ps(i->Col.r),weight));
+						g=_mm_add_ps(g,_mm_mul_ps(_mm_set1_ps(i->Col.g),weight));
+						b=_mm_add_ps(b,_mm_mul_ps(_mm_set1_ps(i->Col.b),weight));
+						a=_mm_add_ps(a,_mm_mul_ps(_mm_set1_ps(i->Col.a),weight));
+					}
+
+					_MM_TRANSPOSE4_PS(r,g,b,a);
+					_mm_storeu_ps(out[0].arr(),r);
+					_mm_storeu_ps(out[1].arr(),g);
+					_mm_storeu_ps(out[2].arr(),b);
+					_mm_storeu_ps(out[3].arr(),a);
+				}
+#endif
+				for (; x<x1; x++)
+				{
+					dColour &out=col[first+x];
+					float px=x/width;
+					for (vector<RowInfluence>::const_iterator i=row.begin(); i!=row.end(); ++i)
+					{
+						float dx=i->X-px;
+						float distsq=dx*dx+i->DistSqYZ;
+						if (distsq<i->Cutoff) out+=i->Col*Weight(distsq,i->Halves,i->Pow);
+					}
+				}
+			}
+		}
+	}
+
+private:
+	class RowInfluence
+	{
+	public:
+		float X;
+		float DistSqYZ;
+		float Cutoff;
+		dColour Col;
+		float Pow;
+		int Halves;
+		unsigned int Min;
+		unsigned int Max;
+	};
+
+	// the power in halves if it's a whole or half power that 
+	// can be done with multiplies and square roots, or 0
+	static int Halves(float pow)
+	{
+		int halves=(int)(pow*2);
+		if (halves!=pow*2 || halves<1 || halves>32) return 0;
+		return halves;
+	}
+
+	// (1/distance)^pow from the distance squared
+	static float Weight(float distsq, int halves, float pow)
+	{
+		if (!halves) return powf(1/sqrtf(distsq),pow);
+		float w=1;
+		if (halves&3)
+		{
+			float inv=1/sqrtf(distsq);
+			if ((halves&3)==1) w=sqrtf(inv);
+			else if ((halves&3)==2) w=inv;
+			else w=inv*sqrtf(inv);
+		}
+		float invsq=1/distsq;
+		for (int i=0; i<halves/4; i++) w*=invsq;
+		return w;
+	}
+
+#ifdef __SSE__
+	static __m128 Weight(__m128 distsq, int halves, float pow)
+	{
+		__m128 one=_mm_set1_ps(1.0f);
+		if (!halves)
+		{
+			float lanes[4];
+			_mm_storeu_ps(lanes,distsq);
+			for (int k=0; k<4; k++) lanes[k]=powf(1/sqrtf(lanes[k]),pow);
+			return _mm_loadu_ps(lanes);
+		}
+		__m128 w=one;
+		if (halves&3)
+		{
+			__m128 inv=_mm_div_ps(one,_mm_sqrt_ps(distsq));
+			if ((halves&3)==1) w=_mm_sqrt_ps(inv);
+			else if ((halves&3)==2) w=inv;
+			else w=_mm_mul_ps(inv,_mm_sqrt_ps(inv));
+		}
+		__m128 invsq=_mm_div_ps(one,distsq);
+		for (int i=0; i<halves/4; i++) w=_mm_mul_ps(w,invsq);
+		return w;
+	}
+#endif
+
+	VoxelPrimitive &m_Vox;
+	const vector<Influence> &m_Influences;
+	const vector<Region> &m_Regions;
+	// the distance squared each stops at
+	const vector<float> &m_Cutoffs;
+	const Region &m_Region;
+};
+
 void VoxelPrimitive::SphereInfluence(const dVector &pos, const dColour &col, float pow)
 {
-	for (unsigned int i=0; i<m_Width*m_Height*m_Depth; i++)
+	SphereInfluences(vector<Influence>(1,Influence(pos,col,pow)));
+}
+
+void VoxelPrimitive::SphereInfluences(const vector<Influence> &influences)
+{
+	// the falloff never reaches zero, so each influence is cut off 
+	// where it adds less than INFLUENCE_CUTOFF to every channel
+	Region none;
+	for (int axis=0; axis<3; axis++)
+	{
+		none.Min[axis]=none.Max[axis]=0;
+	}
+	vector<Region> regions(influences.size(),none);
+	vector<float> cutoffs(influences.size(),0);
+
+	// the box around all of them
+	Region all;
+	for (int axis=0; axis<3; axis++)
+	{
+		all.Min[axis]=UINT_MAX;
+		all.Max[axis]=0;
+	}
+
+	for (unsigned int n=0; n<influences.size(); n++)
+	{
+		const dColour &col=influences[n].Col;
+		float strength=influences[n].Strength;
+		float largest=max(max(fabsf(col.r),fabsf(col.g)),max(fabsf(col.b),fabsf(col.a)));
+		if (!(largest>0)) continue;
+
+		float cutoff=strength>0?powf(largest/INFLUENCE_CUTOFF,1/strength):HUGE_VALF;
+		cutoffs[n]=cutoff*cutoff;
+		const dVector &pos=influences[n].Pos;
+		dVector radius(cutoff,cutoff,cutoff);
+		regions[n]=Bounds(pos-radius,pos+radius);
+		if (regions[n].Empty()) continue;
+
+		for (int axis=0; axis<3; axis++)
+		{
+			all.Min[axis]=min(all.Min[axis],regions[n].Min[axis]);
+			all.Max[axis]=max(all.Max[axis],regions[n].Max[axis]);
+		}
+	}
+
+	if (m_Sparse)
 	{
-		(*m_ColData)[i]+=col*powf(1/Position(i).dist(pos),pow);
+		// store the bricks they reach
+		vector<unsigned int> bricks;
+		for (unsigned int n=0; n<influences.size(); n++)
+		{
+			BricksIn(regions[n],bricks);
+			for (vector<unsigned int>::iterator i=bricks.begin(); i!=bricks.end(); ++i)
+			{
+				if (BrickNear(*i,influences[n].Pos,cutoffs[n])) StoreBrick(*i);
+			}
+		}
+		Grow();
 	}
+
+	InfluenceTask task(*this,influences,regions,cutoffs,all);
+	RunBlocks(task,all);
 }
 
+class VoxelPrimitive::SphereSolidTask : public ThreadPool::Task
+{
+public:
+	SphereSolidTask(VoxelPrimitive &vox, const Region &region, const dVector &pos, const dColour &col, float radius) :
+		m_Vox(vox), m_Region(region), m_Pos(pos), m_Col(col), m_Radius(radius) {}
+
+	virtual void Run(unsigned int start, unsigned int end)
+	{
+		const float width=m_Vox.m_Width;
+		dColour *col=&(*m_Vox.m_ColData)[0];
+		Rows rows(m_Vox,m_Region,start,end);
+		while (rows.NextBlock())
+		{
+			const Region &block=rows.Block();
+			while (rows.NextRow())
+			{
+				unsigned int i=rows.Index;
+				for (unsigned int x=block.Min[0]; x<block.Max[0]; x++, i++)
+				{
+					if (dVector(x/width,rows.Y/width,rows.Z/width).dist(m_Pos)<m_Radius) 
+					{
+						col[i]=m_Col;
+					}
+				}
+			}
+		}
+	}
+
+private:
+	VoxelPrimitive &m_Vox;
+	const Region &m_Region;
+	dVector m_Pos;
+	dColour m_Col;
+	float m_Radius;
+};
+
 void VoxelPrimitive::SphereSolid(const dVector &pos, const dColour &col, float radius)
 {
-	for (unsigned int i=0; i<m_Width*m_Height*m_Depth; i++)
+	Region region=Bounds(pos-dVector(radius,radius,radius),pos+dVector(radius,radius,radius));
+	if (m_Sparse && !IsClear(col))
 	{
-		if (Position(i).dist(pos)<radius) (*m_ColData)[i]=col;
+		vector<unsigned int> bricks;
+		BricksIn(region,bricks);
+		for (vector<unsigned int>::iterator i=bricks.begin(); i!=bricks.end(); ++i)
+		{
+			if (BrickNear(*i,pos,radius*radius)) StoreBrick(*i);
+		}
+		Grow();
 	}
+	SphereSolidTask task(*this,region,pos,col,radius);
+	RunBlocks(task,region);
+	FreeEmptyBricks();
 }
 
+class VoxelPrimitive::BoxSolidTask : public ThreadPool::Task
+{
+public:
+	BoxSolidTask(VoxelPrimitive &vox, const Region &region, const dVector &topleft, const dVector &botright, const dColour &col) :
+		m_Vox(vox), m_Region(region), m_TopLeft(topleft), m_BotRight(botright), m_Col(col) {}
+
+	virtual void Run(unsigned int start, unsigned int end)
+	{
+		const float width=m_Vox.m_Width;
+		dColour *col=&(*m_Vox.m_ColData)[0];
+		Rows rows(m_Vox,m_Region,start,end);
+		while (rows.NextBlock())
+		{
+			const Region &block=rows.Block();
+			while (rows.NextRow())
+			{
+				unsigned int i=rows.Index;
+				for (unsigned int x=block.Min[0]; x<block.Max[0]; x++, i++)
+				{
+					dVector pos(x/width,rows.Y/width,rows.Z/width);
+					if (pos>m_TopLeft && pos<m_BotRight) col[i]=m_Col;
+				}
+			}
+		}
+	}
+
+private:
+	VoxelPrimitive &m_Vox;
+	const Region &m_Region;
+	dVector m_TopLeft;
+	dVector m_BotRight;
+	dColour m_Col;
+};
+
 void VoxelPrimitive::BoxSolid(const dVector &topleft, const dVector &botright, const dColour &col)
 {
-	for (unsigned int i=0; i<m_Width*m_Height*m_Depth; i++)
+	Region region=Bounds(topleft,botright);
+	if (m_Sparse && !IsClear(col))
 	{
-		dVector pos=Position(i);
-		if (pos>topleft && pos<botright) (*m_ColData)[i]=col;
+		// the bricks with voxels inside the box
+		vector<unsigned int> bricks;
+		BricksIn(region,bricks);
+		dVector centre=(topleft+botright)*0.5f;
+		dVector half=(botright-topleft)*0.5f;
+		for (vector<unsigned int>::iterator i=bricks.begin(); i!=bricks.end(); ++i)
+		{
+			Region brick=BrickRegion(*i);
+			dVector lo=dVector(brick.Min[0],brick.Min[1],brick.Min[2])/m_Width;
+			dVector hi=dVector(brick.Max[0]-1,brick.Max[1]-1,brick.Max[2]-1)/m_Width;
+			dVector d=(lo+hi)*0.5f-centre;
+			dVector reach=(hi-lo)*0.5f+half;
+			if (fabsf(d.x)<=reach.x && fabsf(d.y)<=reach.y && fabsf(d.z)<=reach.z) StoreBrick(*i);
+		}
+		Grow();
 	}
+	BoxSolidTask task(*this,region,topleft,botright,col);
+	RunBlocks(task,region);
+	FreeEmptyBricks();
 }
 
-void VoxelPrimitive::Threshold(float value)
+class VoxelPrimitive::ThresholdTask : public ThreadPool::Task
 {
-	for (unsigned int i=0; i<m_Width*m_Height*m_Depth; i++)
+public:
+	ThresholdTask(VoxelPrimitive &vox, const Region &region, float value) : 
+		m_Vox(vox), m_Region(region), m_Value(value) {}
+
+	virtual void Run(unsigned int start, unsigned int end)
 	{
-		if ((*m_ColData)[i].mag()<value)
+		dColour *col=&(*m_Vox.m_ColData)[0];
+		Rows rows(m_Vox,m_Region,start,end);
+		while (rows.NextBlock())
 		{
-			(*m_ColData)[i]=dColour(0,0,0,0);
+			const unsigned int length=rows.Block().Max[0]-rows.Block().Min[0];
+			while (rows.NextRow())
+			{
+				unsigned int i=rows.Index;
+				unsigned int last=i+length;
+#ifdef __SSE__
+				// four voxels at a time, swizzled so each channel is in a register
+				__m128 value=_mm_set1_ps(m_Value);
+				__m128 one=_mm_set1_ps(1.0f);
+				for (; i+4<=last; i+=4)
+				{
+					__m128 r=_mm_loadu_ps(col[i].arr());
+					__m128 g=_mm_loadu_ps(col[i+1].arr());
+					__m128 b=_mm_loadu_ps(col[i+2].arr());
+					__m128 a=_mm_loadu_ps(col[i+3].arr());
+					_MM_TRANSPOSE4_PS(r,g,b,a);
+					__m128 mag=_mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(r,r),_mm_mul_ps(g,g)),_mm_mul_ps(b,b)));
+					__m128 on=_mm_andnot_ps(_mm_cmplt_ps(mag,value),one);
+					_mm_storeu_ps(col[i].arr(),_mm_shuffle_ps(on,on,_MM_SHUFFLE(0,0,0,0)));
+					_mm_storeu_ps(col[i+1].arr(),_mm_shuffle_ps(on,on,_MM_SHUFFLE(1,1,1,1)));
+					_mm_storeu_ps(col[i+2].arr(),_mm_shuffle_ps(on,on,_MM_SHUFFLE(2,2,2,2)));
+					_mm_storeu_ps(col[i+3].arr(),_mm_shuffle_ps(on,on,_MM_SHUFFLE(3,3,3,3)));
+				}
+#endif
+				for (; i<last; i++)
+				{
+					if (col[i].mag()<m_Value)
+					{
+						col[i]=dColour(0,0,0,0);
+					}
+					else
+					{
+						col[i]=dColour(1,1,1,1);
+					}
+				}
+			}
 		}
-		else
+	}
+
+private:
+	VoxelPrimitive &m_Vox;
+	const Region &m_Region;
+	float m_Value;
+};
+
+void VoxelPrimitive::Threshold(float value)
+{
+	// clear voxels turn white when they're not below the value
+	if (m_Sparse && !(value>0))
+	{
+		StoreAll();
+		Grow();
+	}
+	Region all=All();
+	ThresholdTask task(*this,all,value);
+	RunBlocks(task,all);
+	FreeEmptyBricks();
+}
+
+class VoxelPrimitive::PointLightTask : public ThreadPool::Task
+{
+public:
+	PointLightTask(VoxelPrimitive &vox, const Region &region, const dVector &lightpos, const dColour &col) : 
+		m_Vox(vox), m_Region(region), m_LightPos(lightpos), m_Col(col) {}
+
+	virtual void Run(unsigned int start, unsigned int end)
+	{
+		VoxelPrimitive &vox=m_Vox;
+		const float width=vox.m_Width;
+		dColour *col=&(*vox.m_ColData)[0];
+		const dColour *grad=&(*vox.m_GradData)[0];
+
+		Rows rows(vox,m_Region,start,end);
+		while (rows.NextBlock())
 		{
-			(*m_ColData)[i]=dColour(1,1,1,1);
+			const Region &block=rows.Block();
+			while (rows.NextRow())
+			{
+				unsigned int i=rows.Index;
+				unsigned int x=block.Min[0];
+				// the light direction's y and z are the same along the row
+				float ly=m_LightPos.y-rows.Y/width;
+				float lz=m_LightPos.z-rows.Z/width;
+#ifdef __SSE__
+				__m128 light=_mm_loadu_ps(m_Col.arr());
+				__m128 ambient=_mm_set1_ps(0.1f);
+				for (; x+4<=block.Max[0]; x+=4, i+=4)
+				{
+					__m128 gx=_mm_loadu_ps(grad[i].arr());
+					__m128 gy=_mm_loadu_ps(grad[i+1].arr());
+					__m128 gz=_mm_loadu_ps(grad[i+2].arr());
+					__m128 ga=_mm_loadu_ps(grad[i+3].arr());
+					_MM_TRANSPOSE4_PS(gx,gy,gz,ga);
+					__m128 lx=_mm_sub_ps(_mm_set1_ps(m_LightPos.x),
+						_mm_div_ps(_mm_set_ps(x+3,x+2,x+1,x),_mm_set1_ps(width)));
+					__m128 lambert=_mm_add_ps(_mm_add_ps(_mm_mul_ps(gx,lx),
+						_mm_mul_ps(gy,_mm_set1_ps(ly))),_mm_mul_ps(gz,_mm_set1_ps(lz)));
+					float l[4];
+					_mm_storeu_ps(l,lambert);
+					for (int k=0; k<4; k++)
+					{
+						__m128 c=_mm_loadu_ps(col[i+k].arr());
+						if (l[k]>0) c=_mm_add_ps(c,_mm_mul_ps(light,_mm_set1_ps(l[k])));
+						else c=_mm_mul_ps(c,ambient);
+						_mm_storeu_ps(col[i+k].arr(),c);
+					}
+				}
+#endif
+				for (; x<block.Max[0]; x++, i++)
+				{
+					const dVector *n=reinterpret_cast<const dVector*>(&grad[i]);
+					float lambert = n->dot(dVector(m_LightPos.x-x/width,ly,lz));
+					if (lambert>0) col[i]+=m_Col*lambert;
+					else col[i]*=0.1; // ambient...
+				}
+			}
 		}
 	}
-}
+
+private:
+	VoxelPrimitive &m_Vox;
+	const Region &m_Region;
+	dVector m_LightPos;
+	dColour m_Col;
+};
 
 void VoxelPrimitive::PointLight(dVector lightpos, dColour col)
 {
-	for (unsigned int i=0; i<m_Width*m_Height*m_Depth; i++)
-	{
-		dVector *n=reinterpret_cast<dVector*>(&(*m_GradData)[i]);
-		float lambert = n->dot(lightpos-Position(i));
-		if (lambert>0) (*m_ColData)[i]+=col*lambert;
-		else (*m_ColData)[i]*=0.1; // ambient...
-	}	
+	// clear voxels have no gradient, so they stay clear
+	Region all=All();
+	PointLightTask task(*this,all,lightpos,col);
+	RunBlocks(task,all);
 }
 	
+// a camera facing quad for a voxel
+static inline void DrawVoxel(const dVector &p, const dColour &col, const dVector &across, const dVector &down)
+{
+	glColor4fv(col.arr());
+	glTexCoord2f(0,0);
+	glVertex3fv((p-across-down).arr());
+	glTexCoord2f(0,1);
+	glVertex3fv((p-across+down).arr());
+	glTexCoord2f(1,1);
+	glVertex3fv((p+across+down).arr());
+	glTexCoord2f(1,0);
+	glVertex3fv((p+across-down).arr());
+}
+
 void VoxelPrimitive::Render()
 {
 	glDisable(GL_LIGHTING);
@@ -156,21 +1126,38 @@ void VoxelPrimitive::Render()
 		down/=m_Width;
 		
 		glBegin(GL_QUADS);
-		for (unsigned int n=0; n<m_ColData->size(); n++)
-		{
-			if ((*m_ColData)[n].a>0.001)
-			{		
-				dVector p(n%m_Width,n/m_Width%m_Height,n/(m_Width*m_Height));
-				p/=m_Width;
-				glColor4fv((*m_ColData)[n].arr());
-				glTexCoord2f(0,0);
-				glVertex3fv((p-across-down).arr());
-				glTexCoord2f(0,1);
-				glVertex3fv((p-across+down).arr());
-				glTexCoord2f(1,1);
-				glVertex3fv((p+across+down).arr());
-				glTexCoord2f(1,0);
-				glVertex3fv((p+across-down).arr());
+		if (m_Sparse)
+		{
+			// only the stored bricks, the rest are clear
+			for (unsigned int slot=0; slot<m_SlotBricks.size(); slot++)
+			{
+				Region region=BrickRegion(m_SlotBricks[slot]);
+				for (unsigned int z=region.Min[2]; z<region.Max[2]; z++)
+				{
+					for (unsigned int y=region.Min[1]; y<region.Max[1]; y++)
+					{
+						unsigned int n=Find(region.Min[0],y,z);
+						for (unsigned int x=region.Min[0]; x<region.Max[0]; x++, n++)
+						{
+							if ((*m_ColData)[n].a>0.001)
+							{
+								DrawVoxel(dVector(x,y,z)/m_Width,(*m_ColData)[n],across,down);
+							}
+						}
+					}
+				}
+			}
+		}
+		else
+		{
+			for (unsigned int n=0; n<m_ColData->size(); n++)
+			{
+				if ((*m_ColData)[n].a>0.001)
+				{		
+					dVector p(n%m_Width,n/m_Width%m_Height,n/(m_Width*m_Height));
+					p/=m_Width;
+					DrawVoxel(p,(*m_ColData)[n],across,down);
+				}
 			}
 		}
 		glEnd();
@@ -178,6 +1165,317 @@ void VoxelPrimitive::Render()
 	glEnable(GL_LIGHTING);
 }
 
+// the surface is made by marching cubes over the grid points, a brick
+// of BRICK_SIZE points along each side at a time. the field at a point
+// is the magnitude of the voxel's colour there, as SafeRef() sees it, 
+// so there is a point past the last voxel on each axis. each edge cut 
+// by the surface gets one vertex, made by the brick with the edge's low 
+// end, and the triangles pick them up from there - so the bricks share
+// the vertices on the edges between them.
+
+static const unsigned int NO_EDGE=0xffff;
+
+// where a triangle corner's vertex is, as which of the next bricks up 
+// the edge starts in (a bit for each axis), and the edge's slot there
+static inline unsigned int EdgeRef(unsigned int next, unsigned int slot) { return (next<<11)|slot; }
+// the slot of the edge along an axis from a point in a brick
+static inline unsigned int EdgeSlot(unsigned int x, unsigned int y, unsigned int z, int axis)
+{
+	return (x+((y+(z<<BRICK_BITS))<<BRICK_BITS))*3+axis;
+}
+
+// the part of the surface made from a brick of grid points
+class VoxelPrimitive::SurfaceBrick
+{
+public:
+	SurfaceBrick() : FirstVertex(0), FirstIndex(0) {}
+	/// The vertex on each edge from the brick's points, by EdgeSlot(),
+	/// or NO_EDGE - empty if there are none
+	vector<unsigned short> Edges;
+	vector<dVector> Points;
+	vector<dVector> Normals;
+	vector<dColour> Colours;
+	/// The triangles' vertices as EdgeRef()s, then as indices
+	vector<unsigned int> Triangles;
+	unsigned int FirstVertex;
+	unsigned int FirstIndex;
+};
+
+// makes the vertices and triangles for a range of bricks, then once 
+// they are all made, copies them into the polygon primitive
+class VoxelPrimitive::SurfaceTask : public ThreadPool::Task
+{
+public:
+	SurfaceTask(const VoxelPrimitive &vox, float isolevel, const vector<unsigned int> &bricks, 
+		vector<SurfaceBrick> &surface, const vector<unsigned int> &lookup) : 
+		m_Vox(vox), m_Isolevel(isolevel), m_Bricks(bricks), m_Surface(surface), m_Lookup(lookup), 
+		m_Points(NULL), m_Normals(NULL), m_Colours(NULL), m_Indices(NULL) 
+	{
+		const unsigned int size[3]={vox.m_Width, vox.m_Height, vox.m_Depth};
+		for (int axis=0; axis<3; axis++)
+		{
+			m_Size[axis]=size[axis];
+			m_Across[axis]=(size[axis]>>BRICK_BITS)+1;
+		}
+	}
+
+	/// Copies the surface into these on the next Run()
+	void Output(dVector *points, dVector *normals, dColour *colours, unsigned int *indices)
+	{
+		m_Points=points;
+		m_Normals=normals;
+		m_Colours=colours;
+		m_Indices=indices;
+	}
+
+	virtual void Run(unsigned int start, unsigned int end)
+	{
+		for (unsigned int n=start; n<end; n++)
+		{
+			if (m_Points) Copy(n);
+			else Make(n);
+		}
+	}
+
+private:
+	// the field for the points from one before the brick to one after 
+	// the next brick's first, so there's a neighbour either side of all 
+	// the points that edges or cells of the brick touch
+	static const unsigned int SAMPLES=BRICK_SIZE+3;
+
+	void Make(unsigned int n)
+	{
+		const float isolevel=m_Isolevel;
+		SurfaceBrick &out=m_Surface[n];
+		unsigned int brick=m_Bricks[n];
+		const int origin[3]={(int)(brick%m_Across[0])<<BRICK_BITS, 
+			(int)((brick/m_Across[0])%m_Across[1])<<BRICK_BITS, 
+			(int)(brick/(m_Across[0]*m_Across[1]))<<BRICK_BITS};
+
+		// the points in the grid from the brick's first to the next one's
+		int last[3];
+		for (int axis=0; axis<3; axis++)
+		{
+			last[axis]=min(origin[axis]+(int)BRICK_SIZE,m_Size[axis]);
+		}
+
+		// the points the brick's edges and cells use first, to see if 
+		// the surface crosses them
+		float field[SAMPLES][SAMPLES][SAMPLES];
+		unsigned int inside=0, count=0;
+		for (int z=0; z<=(int)BRICK_SIZE; z++)
+		{
+			for (int y=0; y<=(int)BRICK_SIZE; y++)
+			{
+				for (int x=0; x<=(int)BRICK_SIZE; x++)
+				{
+					float value=m_Vox.SafeRef(origin[0]+x,origin[1]+y,origin[2]+z).mag();
+					field[z+1][y+1][x+1]=value;
+					if (origin[0]+x<=last[0] && origin[1]+y<=last[1] && origin[2]+z<=last[2])
+					{
+						inside+=value<isolevel;
+						count++;
+					}
+				}
+			}
+		}
+		if (inside==0 || inside==count) return;
+
+		// then the rest, for the normals
+		for (int z=-1; z<(int)SAMPLES-1; z++)
+		{
+			for (int y=-1; y<(int)SAMPLES-1; y++)
+			{
+				bool row=z<0 || y<0 || z>(int)BRICK_SIZE || y>(int)BRICK_SIZE;
+				for (int x=-1; x<(int)SAMPLES-1; x+=row || x==(int)BRICK_SIZE?1:BRICK_SIZE+1)
+				{
+					field[z+1][y+1][x+1]=m_Vox.SafeRef(origin[0]+x,origin[1]+y,origin[2]+z).mag();
+				}
+			}
+		}
+
+		// the vertices on the edges from the brick's points
+		out.Edges.assign(BRICK_VOXELS*3,NO_EDGE);
+		int p[3];
+		for (p[2]=0; p[2]<(int)BRICK_SIZE && origin[2]+p[2]<=m_Size[2]; p[2]++)
+		{
+			for (p[1]=0; p[1]<(int)BRICK_SIZE && origin[1]+p[1]<=m_Size[1]; p[1]++)
+			{
+				for (p[0]=0; p[0]<(int)BRICK_SIZE && origin[0]+p[0]<=m_Size[0]; p[0]++)
+				{
+					float value=field[p[2]+1][p[1]+1][p[0]+1];
+					for (int axis=0; axis<3; axis++)
+					{
+						if (origin[axis]+p[axis]>=m_Size[axis]) continue;
+						int q[3]={p[0], p[1], p[2]};
+						q[axis]++;
+						float other=field[q[2]+1][q[1]+1][q[0]+1];
+						if ((other<isolevel)==(value<isolevel)) continue;
+
+						out.Edges[EdgeSlot(p[0],p[1],p[2],axis)]=out.Points.size();
+						float mu=(isolevel-value)/(other-value);
+						dVector pos(origin[0]+p[0], origin[1]+p[1], origin[2]+p[2]);
+						pos.arr()[axis]+=mu;
+						out.Points.push_back(dVector(pos.x/m_Size[0],pos.y/m_Size[1],pos.z/m_Size[2]));
+
+						dVector normal=lerp(Gradient(field,p),Gradient(field,q),mu);
+						float mag=normal.mag();
+						if (mag>0) normal/=mag;
+						out.Normals.push_back(normal);
+
+						dColour a=m_Vox.SafeRef(origin[0]+p[0],origin[1]+p[1],origin[2]+p[2]);
+						dColour b=m_Vox.SafeRef(origin[0]+q[0],origin[1]+q[1],origin[2]+q[2]);
+						out.Colours.push_back(dColour(a.r+mu*(b.r-a.r), a.g+mu*(b.g-a.g), a.b+mu*(b.b-a.b)));
+					}
+				}
+			}
+		}
+
+		// the triangles of the brick's cells
+		int c[3];
+		for (c[2]=0; origin[2]+c[2]<last[2] && c[2]<(int)BRICK_SIZE; c[2]++)
+		{
+			for (c[1]=0; origin[1]+c[1]<last[1] && c[1]<(int)BRICK_SIZE; c[1]++)
+			{
+				for (c[0]=0; origin[0]+c[0]<last[0] && c[0]<(int)BRICK_SIZE; c[0]++)
+				{
+					int cubeindex=0;
+					for (int corner=0; corner<8; corner++)
+					{
+						const int *o=ImplicitSurfaceCorners[corner];
+						if (field[c[2]+o[2]+1][c[1]+o[1]+1][c[0]+o[0]+1]<isolevel) cubeindex|=1<<corner;
+					}
+					if (ImplicitSurfaceEdges[cubeindex]==0) continue;
+
+					for (int i=0; ImplicitSurfaceTriangles[cubeindex][i]!=-1; i++)
+					{
+						int e=ImplicitSurfaceTriangles[cubeindex][i];
+						const int *o=ImplicitSurfaceEdgeStart[e];
+						unsigned int q[3]={(unsigned int)(c[0]+o[0]), (unsigned int)(c[1]+o[1]), (unsigned int)(c[2]+o[2])};
+						unsigned int next=(q[0]>>BRICK_BITS)|((q[1]>>BRICK_BITS)<<1)|((q[2]>>BRICK_BITS)<<2);
+						const unsigned int mask=BRICK_SIZE-1;
+						out.Triangles.push_back(EdgeRef(next,EdgeSlot(q[0]&mask,q[1]&mask,q[2]&mask,ImplicitSurfaceEdgeAxis[e])));
+					}
+				}
+			}
+		}
+	}
+
+	// minus the gradient, from the neighbouring points
+	static dVector Gradient(const float field[SAMPLES][SAMPLES][SAMPLES], const int *p)
+	{
+		int x=p[0]+1, y=p[1]+1, z=p[2]+1;
+		return dVector(field[z][y][x-1]-field[z][y][x+1],
+					   field[z][y-1][x]-field[z][y+1][x],
+					   field[z-1][y][x]-field[z+1][y][x]);
+	}
+
+	void Copy(unsigned int n)
+	{
+		SurfaceBrick &brick=m_Surface[n];
+		for (unsigned int i=0; i<brick.Points.size(); i++)
+		{
+			m_Points[brick.FirstVertex+i]=brick.Points[i];
+			m_Normals[brick.FirstVertex+i]=brick.Normals[i];
+			m_Colours[brick.FirstVertex+i]=brick.Colours[i];
+		}
+
+		// find the vertices in this brick or the ones after it
+		unsigned int *out=m_Indices+brick.FirstIndex;
+		for (unsigned int i=0; i<brick.Triangles.size(); i++)
+		{
+			unsigned int ref=brick.Triangles[i];
+			unsigned int next=ref>>11;
+			unsigned int other=m_Bricks[n]+(next&1)+((next>>1)&1)*m_Across[0]+
+				((next>>2)&1)*m_Across[0]*m_Across[1];
+			const SurfaceBrick &from=m_Surface[m_Lookup[other]];
+			// it's always there, as the edge is cut - both bricks
+			// test it with the same field values, and the brick with
+			// the edge's low end is made whenever this one is
+			assert(!from.Edges.empty());
+			unsigned int vertex=from.Edges[ref&0x7ff];
+			assert(vertex!=NO_EDGE);
+			*out++=from.FirstVertex+vertex;
+		}
+	}
+
+	const VoxelPrimitive &m_Vox;
+	float m_Isolevel;
+	int m_Size[3];
+	unsigned int m_Across[3];
+	const vector<unsigned int> &m_Bricks;
+	vector<SurfaceBrick> &m_Surface;
+	const vector<unsigned int> &m_Lookup;
+	dVector *m_Points;
+	dVector *m_Normals;
+	dColour *m_Colours;
+	unsigned int *m_Indices;
+};
+
+void VoxelPrimitive::ConvertToPoly(PolyPrimitive &poly, float isolevel)
+{
+	const unsigned int across[3]={(m_Width>>BRICK_BITS)+1, (m_Height>>BRICK_BITS)+1, (m_Depth>>BRICK_BITS)+1};
+	unsigned int total=across[0]*across[1]*across[2];
+
+	// the bricks of points which could have surface in them, for sparse 
+	// voxels a brick of points reaches into the next brick of voxels 
+	// along each axis, so it's the ones with stored voxels or before
+	vector<unsigned int> bricks;
+	if (m_Sparse)
+	{
+		vector<bool> want(total,false);
+		for (unsigned int slot=0; slot<m_SlotBricks.size(); slot++)
+		{
+			Region region=BrickRegion(m_SlotBricks[slot]);
+			unsigned int pos[3];
+			for (int axis=0; axis<3; axis++) pos[axis]=region.Min[axis]>>BRICK_BITS;
+			for (unsigned int n=0; n<8; n++)
+			{
+				if ((n&1 && !pos[0]) || (n&2 && !pos[1]) || (n&4 && !pos[2])) continue;
+				want[(pos[0]-(n&1)) + ((pos[1]-((n>>1)&1)) + (pos[2]-((n>>2)&1))*across[1])*across[0]]=true;
+			}
+		}
+		for (unsigned int n=0; n<total; n++)
+		{
+			if (want[n]) bricks.push_back(n);
+		}
+	}
+	else
+	{
+		for (unsigned int n=0; n<total; n++) bricks.push_back(n);
+	}
+
+	// the triangles refer to the vertices of the bricks after them, 
+	// which are always made if the edges are cut
+	vector<SurfaceBrick> surface(bricks.size()+1);
+	vector<unsigned int> lookup(total,bricks.size());
+	for (unsigned int n=0; n<bricks.size(); n++) lookup[bricks[n]]=n;
+
+	SurfaceTask task(*this,isolevel,bricks,surface,lookup);
+	ThreadPool::Run(task,bricks.size(),1);
+
+	unsigned int vertices=0, indices=0;
+	for (unsigned int n=0; n<bricks.size(); n++)
+	{
+		surface[n].FirstVertex=vertices;
+		surface[n].FirstIndex=indices;
+		vertices+=surface[n].Points.size();
+		indices+=surface[n].Triangles.size();
+	}
+
+	poly.Resize(vertices);
+	poly.SetIndexMode(true);
+	vector<unsigned int> &index=poly.GetIndex();
+	index.resize(indices);
+	if (vertices)
+	{
+		task.Output(&(*poly.GetDataVec<dVector>("p"))[0],&(*poly.GetDataVec<dVector>("n"))[0],
+			&(*poly.GetDataVec<dColour>("c"))[0],&index[0]);
+		ThreadPool::Run(task,bricks.size(),1);
+	}
+	poly.InvalidateTopology();
+}
+
 BlobbyPrimitive *VoxelPrimitive::ConvertToBlobby()
 {
 	BlobbyPrimitive *blob = new BlobbyPrimitive(m_Width, m_Height, m_Depth, dVector(1,1,1));
@@ -235,11 +1533,18 @@ BlobbyPrimitive *VoxelPrimitive::ConvertToBlobby()
 
 dBoundingBox VoxelPrimitive::GetBoundingBox(const dMatrix &space)
 {
+	// the grid doesn't change size, so neither does the box - voxels 
+	// are scaled by the width like in Position(), and the sprites 
+	// reach a voxel past their centres
 	dBoundingBox box;
-	//for (vector<dVector>::iterator i=m_VertData->begin(); i!=m_VertData->end(); ++i)
-	//{
-	//	box.expand(space.transform(*i));
-	//}
+	float pad=1.0f/m_Width;
+	dVector size=dVector(m_Width,m_Height,m_Depth)/m_Width;
+	for (int corner=0; corner<8; corner++)
+	{
+		box.expand(space.transform(dVector(corner&1?size.x+pad:-pad,
+										   corner&2?size.y+pad:-pad,
+										   corner&4?size.z+pad:-pad)));
+	}
 	return box;
 }
 
@@ -18,6 +18,8 @@
 #define N_VOXELPRIM
 
 #include "Primitive.h"
+#include "PolyPrimitive.h"
+#include "ThreadPool.h"
 
 namespace Fluxus
 {
@@ -25,10 +27,17 @@ namespace Fluxus
 class BlobbyPrimitive;
 
 //////////////////////////////////////////////////////
+/// A grid of colours, with a gradient for lighting. 
+/// Sparse voxels only store the 8x8x8 bricks of voxels 
+/// that have been written to, so empty space costs 
+/// nothing - the pdata arrays hold just the stored 
+/// voxels, a brick at a time, rather than the whole grid.
+/// Sparse voxels start out clear (0,0,0,0) rather than
+/// black, which is what the voxels not stored read as.
 class VoxelPrimitive : public Primitive
 {
 public:
-	VoxelPrimitive(unsigned int w, unsigned int h, unsigned int d);
+	VoxelPrimitive(unsigned int w, unsigned int h, unsigned int d, bool sparse=false);
 	VoxelPrimitive(const VoxelPrimitive &other);
 	virtual ~VoxelPrimitive();
 	
@@ -49,21 +58,104 @@ public:
 	unsigned int GetWidth() { return m_Width; }
 	unsigned int GetHeight() { return m_Height; }
 	unsigned int GetDepth() { return m_Depth; }
+	bool IsSparse() { return m_Sparse; }
+	/// A spherical influence, adding col*(1/distance)^Strength,
+	/// left out of the voxels where that's less than 1/1024 in 
+	/// every channel (see INFLUENCE_CUTOFF)
+	class Influence
+	{
+	public:
+		Influence() : Strength(1) {}
+		Influence(const dVector &pos, const dColour &col, float strength) : 
+			Pos(pos), Col(col), Strength(strength) {}
+		dVector Pos;
+		dColour Col;
+		float Strength;
+	};
+
 	void SphereInfluence(const dVector &pos, const dColour &col, float pow);
+	/// Adds lots of influences in one pass over the voxels, 
+	/// the same as calling SphereInfluence() for each in turn
+	void SphereInfluences(const vector<Influence> &influences);
 	void SphereSolid(const dVector &pos, const dColour &col, float radius);
 	void BoxSolid(const dVector &topleft, const dVector &botright, const dColour &col);
 	void Threshold(float value);
 	void CalcGradient();
 	void PointLight(dVector lightpos, dColour col);
 	BlobbyPrimitive *ConvertToBlobby();
+	/// Fills the polygon primitive (an empty triangle list) with
+	/// the surface where the voxels' colour magnitude crosses the
+	/// isolevel, as indexed triangles sharing their vertices
+	void ConvertToPoly(PolyPrimitive &poly, float isolevel=1.0f);
 	///@}
 	
 protected:
 
 	virtual void PDataDirty();
-	unsigned int Index(unsigned int x, unsigned int y, unsigned int z);
-	dVector Position(unsigned int index);
-	dColour SafeRef(unsigned int x, unsigned int y, unsigned int z);
+	/// Where a voxel is in the pdata arrays, or NO_VOXEL if 
+	/// it's in a brick that isn't stored
+	unsigned int Find(unsigned int x, unsigned int y, unsigned int z) const;
+	dVector Position(unsigned int index) const;
+	dColour SafeRef(unsigned int x, unsigned int y, unsigned int z) const;
+
+	/// A box of voxels, from Min up to (not including) Max
+	class Region
+	{
+	public:
+		unsigned int Min[3];
+		unsigned int Max[3];
+		bool Empty() const { return Min[0]>=Max[0] || Min[1]>=Max[1] || Min[2]>=Max[2]; }
+	};
+
+	/// The voxels which could have positions from min to max
+	Region Bounds(const dVector &min, const dVector &max) const;
+	/// All the voxels
+	Region All() const;
+	/// Runs a task over the blocks of the region, on several
+	/// threads if there are enough voxels to be worth it. The 
+	/// blocks are z slices, or the stored bricks for sparse
+	/// voxels - use Rows to go through them.
+	void RunBlocks(ThreadPool::Task &task, const Region &region);
+
+	///////////////////////////////////////////////////
+	///@name Sparse storage
+	///@{
+	/// The brick a voxel is in
+	unsigned int Brick(unsigned int x, unsigned int y, unsigned int z) const;
+	/// The voxels in a brick
+	Region BrickRegion(unsigned int brick) const;
+	/// The bricks with voxels in the region
+	void BricksIn(const Region &region, vector<unsigned int> &bricks) const;
+	/// Whether any of a brick's voxel positions could be less 
+	/// than sqrt(distsq) from pos
+	bool BrickNear(unsigned int brick, const dVector &pos, float distsq) const;
+	/// Gives a brick a place in the pdata arrays, the arrays
+	/// aren't made bigger until Grow() is called
+	void StoreBrick(unsigned int brick);
+	void StoreAll();
+	/// Makes the pdata arrays big enough for the stored bricks,
+	/// filling new ones with clear voxels
+	void Grow();
+	/// Stores the bricks next to the ones with colour on their 
+	/// sides, which the gradient spreads into
+	void StoreGradientBricks();
+	/// Drops the bricks of the last RunBlocks() that have 
+	/// nothing in them 
+	void FreeEmptyBricks();
+	/// True if a stored brick has no colour, and nothing
+	/// written to its gradient or user pdata
+	bool IsEmptyBrick(unsigned int slot) const;
+	///@}
+
+	class Rows;
+	class InfluenceTask;
+	class SphereSolidTask;
+	class BoxSolidTask;
+	class ThresholdTask;
+	class GradientTask;
+	class PointLightTask;
+	class SurfaceBrick;
+	class SurfaceTask;
 
 private:
 
@@ -72,6 +164,16 @@ private:
 	unsigned int m_Width;
 	unsigned int m_Height;
 	unsigned int m_Depth;
+
+	bool m_Sparse;
+	/// The number of bricks along each axis
+	unsigned int m_Bricks[3];
+	/// The slot each brick is stored in, or EMPTY_BRICK, and 
+	/// the brick in each slot
+	vector<unsigned int> m_BrickSlots;
+	vector<unsigned int> m_SlotBricks;
+	/// The bricks RunBlocks() is running over
+	vector<unsigned int> m_Blocks;
 };
 
 }
@@ -26,6 +26,13 @@
 #include <iostream>
 #include "Trace.h"
 
+// the matrix and vector maths use sse where the compiler targets it,
+// define DADA_NO_SSE to force the plain c++ versions
+#if defined(__SSE__) && !defined(DADA_NO_SSE)
+#define DADA_SSE
+#include <xmmintrin.h>
+#endif
+
 using namespace std;
 
 namespace Fluxus
@@ -47,6 +54,14 @@ template<class T> T clamp(T x, T mi, T ma)
     return std::min( ma, std::max( mi, x));
 }
 
+#ifdef DADA_SSE
+/// v with its w replaced by the w of other
+static inline __m128 dSSESetW(__m128 v, __m128 other)
+{
+	return _mm_shuffle_ps(v,_mm_unpackhi_ps(v,other),_MM_SHUFFLE(3,0,1,0));
+}
+#endif
+
 class dVector
 {
 public:
@@ -66,75 +81,138 @@ public:
 
 		inline dVector operator+(dVector const &rhs) const
 		{
+			#ifdef DADA_SSE
+			dVector t;
+			_mm_storeu_ps(&t.x,dSSESetW(_mm_add_ps(_mm_loadu_ps(&x),_mm_loadu_ps(&rhs.x)),_mm_set1_ps(1)));
+			return t;
+			#else
     		dVector t;
     		t.x=x+rhs.x; t.y=y+rhs.y; t.z=z+rhs.z; //t.w=w+rhs.w;
     		return t;
+			#endif
 		}
 
 		inline dVector operator-(dVector const &rhs) const
 		{
+			#ifdef DADA_SSE
+			dVector t;
+			_mm_storeu_ps(&t.x,dSSESetW(_mm_sub_ps(_mm_loadu_ps(&x),_mm_loadu_ps(&rhs.x)),_mm_set1_ps(1)));
+			return t;
+			#else
     		dVector t;
     		t.x=x-rhs.x; t.y=y-rhs.y; t.z=z-rhs.z; //t.w=w-rhs.w;
     		return t;
+			#endif
 		}
 
 		inline dVector operator*(dVector const &rhs) const
 		{
+			#ifdef DADA_SSE
+			dVector t;
+			_mm_storeu_ps(&t.x,dSSESetW(_mm_mul_ps(_mm_loadu_ps(&x),_mm_loadu_ps(&rhs.x)),_mm_set1_ps(1)));
+			return t;
+			#else
     		dVector t;
     		t.x=x*rhs.x; t.y=y*rhs.y; t.z=z*rhs.z; //t.w=w+rhs.w;
     		return t;
+			#endif
 		}
 
 		inline dVector operator/(dVector const &rhs) const
 		{
+			#ifdef DADA_SSE
+			dVector t;
+			_mm_storeu_ps(&t.x,dSSESetW(_mm_div_ps(_mm_loadu_ps(&x),_mm_loadu_ps(&rhs.x)),_mm_set1_ps(1)));
+			return t;
+			#else
     		dVector t;
     		t.x=x/rhs.x; t.y=y/rhs.y; t.z=z/rhs.z; //t.w=w-rhs.w;
     		return t;
+			#endif
 		}
 
 		inline dVector operator+(float rhs) const
 		{
+			#ifdef DADA_SSE
+			dVector t;
+			_mm_storeu_ps(&t.x,dSSESetW(_mm_add_ps(_mm_loadu_ps(&x),_mm_set1_ps(rhs)),_mm_set1_ps(1)));
+			return t;
+			#else
     		dVector t;
     		t.x=x+rhs; t.y=y+rhs; t.z=z+rhs; //t.w=w*rhs;
     		return t;
+			#endif
 		}
 
 		inline dVector operator-(float rhs) const
 		{
+			#ifdef DADA_SSE
+			dVector t;
+			_mm_storeu_ps(&t.x,dSSESetW(_mm_sub_ps(_mm_loadu_ps(&x),_mm_set1_ps(rhs)),_mm_set1_ps(1)));
+			return t;
+			#else
     		dVector t;
     		t.x=x-rhs; t.y=y-rhs; t.z=z-rhs; //t.w=w/rhs;
     		return t;
+			#endif
 		}
 
 		inline dVector operator*(float rhs) const
 		{
+			#ifdef DADA_SSE
+			dVector t;
+			_mm_storeu_ps(&t.x,dSSESetW(_mm_mul_ps(_mm_loadu_ps(&x),_mm_set1_ps(rhs)),_mm_set1_ps(1)));
+			return t;
+			#else
     		dVector t;
     		t.x=x*rhs; t.y=y*rhs; t.z=z*rhs; //t.w=w*rhs;
     		return t;
+			#endif
 		}
 
 		inline dVector operator/(float rhs) const
 		{
+			#ifdef DADA_SSE
+			dVector t;
+			_mm_storeu_ps(&t.x,dSSESetW(_mm_div_ps(_mm_loadu_ps(&x),_mm_set1_ps(rhs)),_mm_set1_ps(1)));
+			return t;
+			#else
     		dVector t;
     		t.x=x/rhs; t.y=y/rhs; t.z=z/rhs; //t.w=w/rhs;
     		return t;
+			#endif
 		}
 
 		inline dVector &operator+=(dVector const &rhs)
 		{
+			#ifdef DADA_SSE
+			__m128 v=_mm_loadu_ps(&x);
+			_mm_storeu_ps(&x,dSSESetW(_mm_add_ps(v,_mm_loadu_ps(&rhs.x)),v));
+			#else
     		x+=rhs.x; y+=rhs.y; z+=rhs.z; //w+=rhs.w;
+			#endif
     		return *this;
 		}
 
 		inline dVector &operator-=(dVector const &rhs)
 		{
+			#ifdef DADA_SSE
+			__m128 v=_mm_loadu_ps(&x);
+			_mm_storeu_ps(&x,dSSESetW(_mm_sub_ps(v,_mm_loadu_ps(&rhs.x)),v));
+			#else
     		x-=rhs.x; y-=rhs.y; z-=rhs.z; //w-=rhs.w;
+			#endif
     		return *this;
 		}
 
 		inline dVector &operator*=(float rhs)
 		{
+			#ifdef DADA_SSE
+			__m128 v=_mm_loadu_ps(&x);
+			_mm_storeu_ps(&x,dSSESetW(_mm_mul_ps(v,_mm_set1_ps(rhs)),v));
+			#else
     		x*=rhs; y*=rhs; z*=rhs; //w*=rhs;
+			#endif
     		return *this;
 		}
 
@@ -151,9 +229,21 @@ public:
 
 		inline dVector cross(dVector const &rhs) const
 		{
+			#ifdef DADA_SSE
+			// yzx*zxy-zxy*yzx, which leaves 0 in w to be set to 1
+			__m128 a=_mm_loadu_ps(&x);
+			__m128 b=_mm_loadu_ps(&rhs.x);
+			__m128 r=_mm_sub_ps(
+				_mm_mul_ps(_mm_shuffle_ps(a,a,_MM_SHUFFLE(3,0,2,1)),_mm_shuffle_ps(b,b,_MM_SHUFFLE(3,1,0,2))),
+				_mm_mul_ps(_mm_shuffle_ps(a,a,_MM_SHUFFLE(3,1,0,2)),_mm_shuffle_ps(b,b,_MM_SHUFFLE(3,0,2,1))));
+			dVector t;
+			_mm_storeu_ps(&t.x,dSSESetW(r,_mm_set1_ps(1)));
+			return t;
+			#else
     		return dVector(y*rhs.z - z*rhs.y,
                     		  z*rhs.x - x*rhs.z,
                     		  x*rhs.y - y*rhs.x);
+			#endif
 		}
 
 		inline dVector reflect(dVector const &rhs) const
@@ -249,6 +339,7 @@ public:
 		dColour(dColour const &c) {*this=c;}
 
 		float *arr() { return &r; }
+		const float *arr() const { return &r; }
 
 		inline dColour &operator=(dColour const &rhs)
 		{
@@ -258,75 +349,135 @@ public:
 
 		inline dColour operator+(dColour const &rhs) const
 		{
+			#ifdef DADA_SSE
+			dColour t;
+			_mm_storeu_ps(&t.r,_mm_add_ps(_mm_loadu_ps(&r),_mm_loadu_ps(&rhs.r)));
+			return t;
+			#else
 			dColour t;
 			t.r=r+rhs.r; t.g=g+rhs.g; t.b=b+rhs.b; t.a=a+rhs.a;
 			return t;
+			#endif
 		}
 
 		inline dColour operator-(dColour const &rhs) const
 		{
+			#ifdef DADA_SSE
+			dColour t;
+			_mm_storeu_ps(&t.r,_mm_sub_ps(_mm_loadu_ps(&r),_mm_loadu_ps(&rhs.r)));
+			return t;
+			#else
 			dColour t;
 			t.r=r-rhs.r; t.g=g-rhs.g; t.b=b-rhs.b; t.a=a-rhs.a;
 			return t;
+			#endif
 		}
 
 		inline dColour operator*(dColour const &rhs) const
 		{
+			#ifdef DADA_SSE
+			dColour t;
+			_mm_storeu_ps(&t.r,_mm_mul_ps(_mm_loadu_ps(&r),_mm_loadu_ps(&rhs.r)));
+			return t;
+			#else
 			dColour t;
 			t.r=r*rhs.r; t.g=g*rhs.g; t.b=b*rhs.b; t.a=a*rhs.a;
 			return t;
+			#endif
 		}
 
 		inline dColour operator/(dColour const &rhs) const
 		{
+			#ifdef DADA_SSE
+			dColour t;
+			_mm_storeu_ps(&t.r,_mm_div_ps(_mm_loadu_ps(&r),_mm_loadu_ps(&rhs.r)));
+			return t;
+			#else
 			dColour t;
 			t.r=r/rhs.r; t.g=g/rhs.g; t.b=b/rhs.b; t.a=a/rhs.a;
 			return t;
+			#endif
 		}
 
 		inline dColour operator+(float rhs) const
 		{
+			#ifdef DADA_SSE
+			dColour t;
+			_mm_storeu_ps(&t.r,_mm_add_ps(_mm_loadu_ps(&r),_mm_set1_ps(rhs)));
+			return t;
+			#else
 			dColour t;
 			t.r=r+rhs; t.g=g+rhs; t.b=b+rhs; t.a=a+rhs;
 			return t;
+			#endif
 		}
 
 		inline dColour operator-(float rhs) const
 		{
+			#ifdef DADA_SSE
+			dColour t;
+			_mm_storeu_ps(&t.r,_mm_sub_ps(_mm_loadu_ps(&r),_mm_set1_ps(rhs)));
+			return t;
+			#else
 			dColour t;
 			t.r=r-rhs; t.g=g-rhs; t.b=b-rhs; t.a=a-rhs;
 			return t;
+			#endif
 		}
 
 		inline dColour operator*(float rhs) const
 		{
+			#ifdef DADA_SSE
+			dColour t;
+			_mm_storeu_ps(&t.r,_mm_mul_ps(_mm_loadu_ps(&r),_mm_set1_ps(rhs)));
+			return t;
+			#else
 			dColour t;
 			t.r=r*rhs; t.g=g*rhs; t.b=b*rhs; t.a=a*rhs;
 			return t;
+			#endif
 		}
 
 		inline dColour operator/(float rhs) const
 		{
+			#ifdef DADA_SSE
+			dColour t;
+			_mm_storeu_ps(&t.r,_mm_div_ps(_mm_loadu_ps(&r),_mm_set1_ps(rhs)));
+			return t;
+			#else
 			dColour t;
 			t.r=r/rhs; t.g=g/rhs; t.b=b/rhs; t.a=a/rhs;
 			return t;
+			#endif
 		}
 
 		inline dColour &operator+=(dColour const &rhs)
 		{
+			#ifdef DADA_SSE
+			_mm_storeu_ps(&r,_mm_add_ps(_mm_loadu_ps(&r),_mm_loadu_ps(&rhs.r)));
+			#else
 			r+=rhs.r; g+=rhs.g; b+=rhs.b; a+=rhs.a;
+			#endif
 			return *this;
 		}
 
 		inline dColour &operator-=(dColour const &rhs)
 		{
+			#ifdef DADA_SSE
+			_mm_storeu_ps(&r,_mm_sub_ps(_mm_loadu_ps(&r),_mm_loadu_ps(&rhs.r)));
+			#else
 			r-=rhs.r; g-=rhs.g; b-=rhs.b; a-=rhs.a;
+			#endif
 			return *this;
 		}
 
 		inline dColour &operator*=(float rhs)
 		{
+			#ifdef DADA_SSE
+			_mm_storeu_ps(&r,_mm_mul_ps(_mm_loadu_ps(&r),_mm_set1_ps(rhs)));
+			#else
 			r*=rhs; g*=rhs; b*=rhs; a*=rhs;
+			#endif
 			return *this;
 		}
 
@@ -408,6 +559,7 @@ public:
 	}
 	
     inline float *arr() { return &m[0][0]; }
+    inline const float *arr() const { return &m[0][0]; }
 
 	inline void init()
 	{
@@ -446,6 +598,12 @@ public:
 	inline dMatrix operator+(dMatrix const &rhs) const
 	{
     	dMatrix t;
+		#ifdef DADA_SSE
+    	for (int i=0; i<4; i++)
+		{
+			_mm_storeu_ps(t.m[i],_mm_add_ps(_mm_loadu_ps(m[i]),_mm_loadu_ps(rhs.m[i])));
+		}
+		#else
     	for (int i=0; i<4; i++)
 		{
         	for (int j=0; j<4; j++)
@@ -453,12 +611,19 @@ public:
             	t.m[i][j]=m[i][j]+rhs.m[i][j];
 			}
 		}
+		#endif
     	return t;
 	}
 
 	inline dMatrix operator-(dMatrix const &rhs) const
 	{
     	dMatrix t;
+		#ifdef DADA_SSE
+    	for (int i=0; i<4; i++)
+		{
+			_mm_storeu_ps(t.m[i],_mm_sub_ps(_mm_loadu_ps(m[i]),_mm_loadu_ps(rhs.m[i])));
+		}
+		#else
     	for (int i=0; i<4; i++)
 		{
         	for (int j=0; j<4; j++)
@@ -466,6 +631,7 @@ public:
             	t.m[i][j]=m[i][j]-rhs.m[i][j];
 			}
 		}
+		#endif
     	return t;
 	}
 
@@ -485,6 +651,19 @@ public:
     	t.m[i][j]=m[0][j]*rhs.m[i][0]+m[1][j]*rhs.m[i][1]+m[2][j]*rhs.m[i][2]+m[3][j]*rhs.m[i][3];
     	*/
 
+		#ifdef DADA_SSE
+		// each column of the result is a combination of our columns,
+		// summed in the same order as the scalar code below
+		__m128 c0=_mm_loadu_ps(m[0]);
+		__m128 c1=_mm_loadu_ps(m[1]);
+		__m128 c2=_mm_loadu_ps(m[2]);
+		__m128 c3=_mm_loadu_ps(m[3]);
+    	for (int i=0; i<4; i++)
+		{
+			_mm_storeu_ps(t.m[i],combine(c0,c1,c2,c3,rhs.m[i]));
+		}
+		#else
+
     	t.m[0][0]=m[0][0]*rhs.m[0][0]+m[1][0]*rhs.m[0][1]+m[2][0]*rhs.m[0][2]+m[3][0]*rhs.m[0][3];
     	t.m[0][1]=m[0][1]*rhs.m[0][0]+m[1][1]*rhs.m[0][1]+m[2][1]*rhs.m[0][2]+m[3][1]*rhs.m[0][3];
     	t.m[0][2]=m[0][2]*rhs.m[0][0]+m[1][2]*rhs.m[0][1]+m[2][2]*rhs.m[0][2]+m[3][2]*rhs.m[0][3];
@@ -504,6 +683,7 @@ public:
     	t.m[3][1]=m[0][1]*rhs.m[3][0]+m[1][1]*rhs.m[3][1]+m[2][1]*rhs.m[3][2]+m[3][1]*rhs.m[3][3];
     	t.m[3][2]=m[0][2]*rhs.m[3][0]+m[1][2]*rhs.m[3][1]+m[2][2]*rhs.m[3][2]+m[3][2]*rhs.m[3][3];
     	t.m[3][3]=m[0][3]*rhs.m[3][0]+m[1][3]*rhs.m[3][1]+m[2][3]*rhs.m[3][2]+m[3][3]*rhs.m[3][3];
+		#endif
 
     	return t;
 	}
@@ -553,6 +733,13 @@ public:
 	inline dMatrix operator*(float rhs) const
 	{
 		dMatrix t;
+		#ifdef DADA_SSE
+		__m128 r=_mm_set1_ps(rhs);
+    	for (int i=0; i<4; i++)
+		{
+			_mm_storeu_ps(t.m[i],_mm_mul_ps(_mm_loadu_ps(m[i]),r));
+		}
+		#else
     	for (int i=0; i<4; i++)
 		{
         	for (int j=0; j<4; j++)
@@ -560,6 +747,7 @@ public:
             	t.m[i][j]=m[i][j]*rhs;
 			}
 		}
+		#endif
     	return t;
 	}
 
@@ -578,6 +766,12 @@ public:
 
 	inline dMatrix &operator+=(dMatrix const &rhs)
 	{
+		#ifdef DADA_SSE
+    	for (int i=0; i<4; i++)
+		{
+			_mm_storeu_ps(m[i],_mm_add_ps(_mm_loadu_ps(m[i]),_mm_loadu_ps(rhs.m[i])));
+		}
+		#else
     	for (int i=0; i<4; i++)
 		{
         	for (int j=0; j<4; j++)
@@ -585,6 +779,29 @@ public:
             	m[i][j]+=rhs.m[i][j];
 			}
 		}
+		#endif
+    	return *this;
+	}
+
+	/// this+=rhs*s without the temporary, for blending lots of matrices
+	inline dMatrix &add_scaled(dMatrix const &rhs, float s)
+	{
+		#ifdef DADA_SSE
+		__m128 r=_mm_set1_ps(s);
+    	for (int i=0; i<4; i++)
+		{
+			_mm_storeu_ps(m[i],_mm_add_ps(_mm_loadu_ps(m[i]),
+				_mm_mul_ps(_mm_loadu_ps(rhs.m[i]),r)));
+		}
+		#else
+    	for (int i=0; i<4; i++)
+		{
+        	for (int j=0; j<4; j++)
+			{
+            	m[i][j]+=rhs.m[i][j]*s;
+			}
+		}
+		#endif
     	return *this;
 	}
 
@@ -775,20 +992,21 @@ public:
 	inline dVector transform(dVector const &p) const
 	{
     	dVector t;
+		#ifdef DADA_SSE
+		_mm_storeu_ps(&t.x,combine(_mm_loadu_ps(m[0]),_mm_loadu_ps(m[1]),
+			_mm_loadu_ps(m[2]),_mm_loadu_ps(m[3]),&p.x));
+		#else
     	t.x=p.x*m[0][0] + p.y*m[1][0] + p.z*m[2][0] + p.w*m[3][0];
     	t.y=p.x*m[0][1] + p.y*m[1][1] + p.z*m[2][1] + p.w*m[3][1];
     	t.z=p.x*m[0][2] + p.y*m[1][2] + p.z*m[2][2] + p.w*m[3][2];
     	t.w=p.x*m[0][3] + p.y*m[1][3] + p.z*m[2][3] + p.w*m[3][3];
+		#endif
     	return t;
 	}
 
 	inline dVector transform_persp(dVector const &p) const
 	{
-    	dVector t;
-    	t.x=p.x*m[0][0] + p.y*m[1][0] + p.z*m[2][0] + p.w*m[3][0];
-    	t.y=p.x*m[0][1] + p.y*m[1][1] + p.z*m[2][1] + p.w*m[3][1];
-    	t.z=p.x*m[0][2] + p.y*m[1][2] + p.z*m[2][2] + p.w*m[3][2];
-    	t.w=p.x*m[0][3] + p.y*m[1][3] + p.z*m[2][3] + p.w*m[3][3];
+    	dVector t=transform(p);
 		t.homog();
     	return t;
 	}
@@ -804,10 +1022,19 @@ public:
 	inline dVector transform_no_trans(dVector const &p) const
 	{
     	dVector t;
+		#ifdef DADA_SSE
+		__m128 r=_mm_add_ps(_mm_add_ps(
+			_mm_mul_ps(_mm_loadu_ps(m[0]),_mm_set1_ps(p.x)),
+			_mm_mul_ps(_mm_loadu_ps(m[1]),_mm_set1_ps(p.y))),
+			_mm_mul_ps(_mm_loadu_ps(m[2]),_mm_set1_ps(p.z)));
+		_mm_storeu_ps(&t.x,r);
+		t.w=p.w;
+		#else
     	t.x=p.x*m[0][0] + p.y*m[1][0] + p.z*m[2][0];
     	t.y=p.x*m[0][1] + p.y*m[1][1] + p.z*m[2][1];
     	t.z=p.x*m[0][2] + p.y*m[1][2] + p.z*m[2][2];
     	t.w=p.w;
+		#endif
     	return t;
 	}
 
@@ -955,8 +1182,34 @@ public:
     friend ostream &operator<<(ostream &os, dMatrix const &om);
 
     float m[4][4];
+
+private:
+	#ifdef DADA_SSE
+	/// c0*v[0]+c1*v[1]+c2*v[2]+c3*v[3]
+	static inline __m128 combine(__m128 c0, __m128 c1, __m128 c2, __m128 c3, const float *v)
+	{
+		return _mm_add_ps(_mm_add_ps(_mm_add_ps(
+			_mm_mul_ps(c0,_mm_set1_ps(v[0])),
+			_mm_mul_ps(c1,_mm_set1_ps(v[1]))),
+			_mm_mul_ps(c2,_mm_set1_ps(v[2]))),
+			_mm_mul_ps(c3,_mm_set1_ps(v[3])));
+	}
+	#endif
 };
 
+// batch versions of the matrix operations, these keep the matrix in
+// registers for the whole run and are the ones to use for big arrays.
+// src and dst may be the same array.
+
+/// dst[i]=m.transform(src[i])
+void dTransformPoints(const dMatrix &m, const dVector *src, dVector *dst, unsigned int count);
+/// dst[i]=m.transform_no_trans(src[i]), optionally normalised
+void dTransformNormals(const dMatrix &m, const dVector *src, dVector *dst, unsigned int count, bool normalise=false);
+/// dst[i]=a*b[i]
+void dMultiplyMatrices(const dMatrix &a, const dMatrix *b, dMatrix *dst, unsigned int count);
+/// dst[i]=a[i]*b[i]
+void dMultiplyMatrices(const dMatrix *a, const dMatrix *b, dMatrix *dst, unsigned int count);
+
 ostream &operator<<(ostream &os, dMatrix const &om);
 
 class dPlane
@@ -196,6 +196,9 @@ Fluxus::State *Engine::State()
 {
     if (Grabbed()) 
 	{
+		// we don't know if it's going to be written to, so
+		// assume the world transforms below it need updating
+		Renderer()->DirtyGrabbed();
 		return Grabbed()->GetState();
 	}
 	return Renderer()->GetState();
@@ -1198,6 +1198,36 @@ Scheme_Object *clear_accum(int argc, Scheme_Object **argv)
     return scheme_void;
 }
 
+// StartFunctionDoc-en
+// render-queue setting-number
+// Returns: void
+// Description:
+// Sets state sorted rendering on or off. When on, the scene is collected
+// and rendered sorted by shader, texture, hints and material so only the
+// state which changes between primitives is applied. Helps with lots of
+// primitives sharing the same state. Blended primitives - with opacity or
+// colour alpha below 1, hint-nozwrite or a changed blend mode - aren't
+// sorted, they are drawn after the opaque ones in scenegraph order. Lazy
+// parent primitives and selection still render the normal way.
+// Example:
+// (render-queue 1)
+// (with-state
+//     (texture (load-texture "test.png"))
+//     (for ((i (in-range 0 1000)))
+//         (with-state
+//             (translate (vmul (crndvec) 10))
+//             (build-cube))))
+// EndFunctionDoc
+
+Scheme_Object *render_queue(int argc, Scheme_Object **argv)
+{
+  DECL_ARGV();
+  ArgCheck("render-queue", "i", argc, argv);
+  Engine::Get()->Renderer()->SetRenderQueue(IntFromScheme(argv[0]));
+  MZ_GC_UNREG();
+  return scheme_void;
+}
+
 // StartFunctionDoc-en
 // build-camera
 // Returns: cameraid-number
@@ -2717,6 +2747,7 @@ void GlobalStateFunctions::AddGlobals(Scheme_Env *env)
 	scheme_add_global("clear-frame", scheme_make_prim_w_arity(clear_frame, "clear-frame", 1, 1), env);
 	scheme_add_global("clear-zbuffer", scheme_make_prim_w_arity(clear_zbuffer, "clear-zbuffer", 1, 1), env);
 	scheme_add_global("clear-accum", scheme_make_prim_w_arity(clear_accum, "clear-accum", 1, 1), env);
+	scheme_add_global("render-queue", scheme_make_prim_w_arity(render_queue, "render-queue", 1, 1), env);
 	scheme_add_global("build-camera", scheme_make_prim_w_arity(build_camera, "build-camera", 0, 0), env);
 	scheme_add_global("current-camera", scheme_make_prim_w_arity(current_camera, "current-camera", 1, 1), env);
 	scheme_add_global("viewport", scheme_make_prim_w_arity(viewport, "viewport", 4, 4), env);
@@ -322,13 +322,18 @@ Scheme_Object *apply(int argc, Scheme_Object **argv)
 	if (argc==1)
 	{
 		ArgCheck("apply-transform", "i", argc, argv);
-		Engine::Get()->Renderer()->GetPrimitive(IntFromScheme(argv[0]))->ApplyTransform();
+		Primitive *prim=Engine::Get()->Renderer()->GetPrimitive(IntFromScheme(argv[0]));
+		prim->ApplyTransform();
+		prim->DirtyBounds();
+		Engine::Get()->Renderer()->DirtyTransform(IntFromScheme(argv[0]));
 	}
 	else
 	{
 		if (Engine::Get()->Grabbed())
 		{
 			Engine::Get()->Grabbed()->ApplyTransform();
+			Engine::Get()->Grabbed()->DirtyBounds();
+			Engine::Get()->Renderer()->DirtyGrabbed();
 		}
 	}
 	MZ_GC_UNREG();
@@ -1805,6 +1810,9 @@ Scheme_Object *blend_mode(int argc, Scheme_Object **argv)
 // 'zwrite - Enables/disables z writes. Useful to disable for sometimes hacking
 //    transparency.
 // 'lit - turn on lighting
+// 'vbo - keeps polygon primitive pdata in video memory buffers, only
+//    uploading it again when the pdata is changed. Good for large static meshes.
+// 'sprite - draws particles as point sprites when they are all the same size.
 // 'all - all of the hints above
 //
 // Example:
@@ -1967,6 +1975,14 @@ Scheme_Object *hints(int argc, Scheme_Object **argv, int on)
 		{
 			neg_flags |= HINT_CULL_CCW;
 		}
+		else if (s == "vbo")
+		{
+			flags |= HINT_VBO;
+		}
+		else if (s == "sprite")
+		{
+			flags |= HINT_SPRITE;
+		}
 		else
 		{
 			Trace::Stream << "hint symbol not recognised: " << s << endl;
@@ -2419,6 +2435,50 @@ Scheme_Object *hint_nozwrite(int argc, Scheme_Object **argv)
     return scheme_void;
 }
 
+// StartFunctionDoc-en
+// hint-vbo
+// Returns: void
+// Description:
+// Sets the render hints to keep the pdata of polygon primitives in video
+// memory (vertex buffer objects). The pdata is only uploaded again when it is
+// changed (with pdata-set!, pdata-op, recalc-normals etc), so large static
+// meshes no longer need to be sent to the graphics card every frame.
+// Example:
+// (clear)
+// (hint-vbo)
+// (build-sphere 100 100)
+// EndFunctionDoc
+
+Scheme_Object *hint_vbo(int argc, Scheme_Object **argv)
+{
+    Engine::Get()->State()->Hints|=HINT_VBO;
+    return scheme_void;
+}
+
+// StartFunctionDoc-en
+// hint-sprite
+// Returns: void
+// Description:
+// Sets the render hints to draw solid particles as hardware point sprites,
+// instead of building a camera facing quad for each one. Only used when all
+// the particles are the same (square) size, otherwise the quads are drawn
+// as normal. The sprites are scaled with distance, but can't get bigger
+// than the maximum point size of the graphics card.
+// Example:
+// (clear)
+// (hint-sprite)
+// (texture (load-texture "splat.png"))
+// (with-primitive (build-particles 10000)
+//     (pdata-map! (lambda (p) (vmul (crndvec) 10)) "p")
+//     (pdata-map! (lambda (s) (vector 0.2 0.2 0.2)) "s"))
+// EndFunctionDoc
+
+Scheme_Object *hint_sprite(int argc, Scheme_Object **argv)
+{
+    Engine::Get()->State()->Hints|=HINT_SPRITE;
+    return scheme_void;
+}
+
 // StartFunctionDoc-en
 // line-pattern factor pattern
 // Returns: void
@@ -4308,6 +4368,8 @@ void LocalStateFunctions::AddGlobals(Scheme_Env *env)
 	scheme_add_global("hint-normalise",scheme_make_prim_w_arity(hint_normalise,"hint-normalise",0,0), env);
 	scheme_add_global("hint-noblend",scheme_make_prim_w_arity(hint_noblend,"hint-noblend",0,0), env);
 	scheme_add_global("hint-nozwrite",scheme_make_prim_w_arity(hint_nozwrite,"hint-nozwrite",0,0), env);
+	scheme_add_global("hint-vbo",scheme_make_prim_w_arity(hint_vbo,"hint-vbo",0,0), env);
+	scheme_add_global("hint-sprite",scheme_make_prim_w_arity(hint_sprite,"hint-sprite",0,0), env);
 	scheme_add_global("line-width",scheme_make_prim_w_arity(line_width,"line-width",1,1), env);
 	scheme_add_global("line-pattern",scheme_make_prim_w_arity(line_pattern,"line-pattern",2,2), env);
 	scheme_add_global("point-width",scheme_make_prim_w_arity(point_width,"point-width",1,1), env);
@@ -20,6 +20,8 @@
 #include "PDataFunctions.h"
 #include "Renderer.h"
 #include "FluxusEngine.h"
+#include "PDataExpression.h"
+#include "SearchPaths.h"
 
 using namespace PDataFunctions;
 using namespace SchemeHelper;
@@ -111,10 +113,11 @@ using namespace Fluxus;
 // EndSectionDoc 
 
 // StartFunctionDoc-en
-// pdata-ref type-string index-number
+// pdata-ref type-string/handle index-number
 // Returns: value-vector/colour/matrix/number
 // Description:
-// Returns the corresponding pdata element.
+// Returns the corresponding pdata element. The pdata can be named
+// by a string, or a handle from pdata-handle.
 // Example:
 // (pdata-ref "p" 1)
 // EndFunctionDoc
@@ -137,6 +140,13 @@ using namespace Fluxus;
 // (pdata-ref "p" 1)
 // EndFunctionDoc
 
+// pdata names can be strings, or handles from pdata-handle
+static PDataAtom AtomFromScheme(Scheme_Object *o)
+{
+	if (SCHEME_INTP(o)) return SCHEME_INT_VAL(o);
+	return PDataContainer::GetAtom(StringFromScheme(o));
+}
+
 Scheme_Object *pdata_ref(int argc, Scheme_Object **argv)
 {
 	Scheme_Object *ret=NULL;
@@ -145,41 +155,47 @@ Scheme_Object *pdata_ref(int argc, Scheme_Object **argv)
 	MZ_GC_VAR_IN_REG(0, argv);
 	MZ_GC_VAR_IN_REG(1, ret);
 	MZ_GC_REG();	
-	ArgCheck("pdata-ref", "si", argc, argv);		
+	ArgCheck("pdata-ref", "hi", argc, argv);		
 	
 	Primitive *Grabbed=Engine::Get()->Renderer()->Grabbed();    
 	if (Grabbed) 
 	{
-		string name=StringFromScheme(argv[0]);
+		PDataAtom atom=AtomFromScheme(argv[0]);
 		unsigned int index=IntFromScheme(argv[1]);
-		unsigned int size=0;
-		char type;
+		PData *pd=Grabbed->FindData(atom);
 		
-		if (Grabbed->GetDataInfo(name,type,size))
+		if (pd!=NULL && pd->Size()>0)
 		{
-			if (type=='f')	
-			{
-				ret=scheme_make_double(Grabbed->GetData<float>(name,index%size)); 
-			}
-			else if (type=='v')	
-			{
-				ret=FloatsToScheme(Grabbed->GetData<dVector>(name,index%size).arr(),3); 
-			}
-			else if (type=='c')	
+			index%=pd->Size();
+			switch (pd->GetType())
 			{
-				ret=FloatsToScheme(Grabbed->GetData<dColour>(name,index%size).arr(),4); 
-			}
-			else if (type=='m')	
-			{
-				ret=FloatsToScheme(Grabbed->GetData<dMatrix>(name,index%size).arr(),16); 
-			}
-			else
-			{
-				// this output causes fluxus to lock up with primitives 
-				// with tens of thousands of pdata elements
-				//Trace::Stream<<"unknown pdata type ["<<type<<"]"<<endl;
+				case 'f':
+					ret=scheme_make_double(static_cast<TypedPData<float>*>(pd)->View()[index]); 
+				break;
+				case 'v':
+				{
+					dVector v=static_cast<TypedPData<dVector>*>(pd)->View()[index];
+					ret=FloatsToScheme(v.arr(),3); 
+				}
+				break;
+				case 'c':
+				{
+					dColour v=static_cast<TypedPData<dColour>*>(pd)->View()[index];
+					ret=FloatsToScheme(v.arr(),4); 
+				}
+				break;
+				case 'm':
+				{
+					dMatrix v=static_cast<TypedPData<dMatrix>*>(pd)->View()[index];
+					ret=FloatsToScheme(v.arr(),16); 
+				}
+				break;
+				default:
+					// this output causes fluxus to lock up with primitives 
+					// with tens of thousands of pdata elements
+					//Trace::Stream<<"unknown pdata type ["<<type<<"]"<<endl;
+				break;
 			}
-		
 		}
 		
 		if (ret==NULL)
@@ -201,10 +217,11 @@ Scheme_Object *pdata_ref(int argc, Scheme_Object **argv)
 }
 
 // StartFunctionDoc-en
-// pdata-set! type-string index-number value-vector/colour/matrix/number
+// pdata-set! type-string/handle index-number value-vector/colour/matrix/number
 // Returns: void
 // Description:
-// Writes to the corresponding pdata element.
+// Writes to the corresponding pdata element. The pdata can be named
+// by a string, or a handle from pdata-handle.
 // Example:
 // (pdata-set! "p" 1 (vector 0 100 0))
 // EndFunctionDoc
@@ -232,17 +249,17 @@ Scheme_Object *pdata_set(int argc, Scheme_Object **argv)
 	MZ_GC_DECL_REG(1);
 	MZ_GC_VAR_IN_REG(0, argv);
 	MZ_GC_REG();
-	ArgCheck("pdata-set!", "si?", argc, argv);
+	ArgCheck("pdata-set!", "hi?", argc, argv);
     Primitive *Grabbed=Engine::Get()->Renderer()->Grabbed();
 	if (Grabbed)
 	{
-		size_t ssize=0;
-		string name=StringFromScheme(argv[0]);
+		static const PDataAtom scale=PDataContainer::GetAtom("s");
+		PDataAtom name=AtomFromScheme(argv[0]);
 		unsigned int index=IntFromScheme(argv[1]);
 		unsigned int size;
 		char type;
 
-		if (Grabbed->GetDataInfo(name,type,size))
+		if (Grabbed->GetDataInfo(name,type,size) && size>0)
 		{
 			if (type=='f')
 			{
@@ -257,7 +274,7 @@ Scheme_Object *pdata_set(int argc, Scheme_Object **argv)
 					FloatsFromScheme(argv[2],v.arr(),3);
 					Grabbed->SetData<dVector>(name,index%size,v);
 				}
-				else if (name.compare("s")==0) // one value scale
+				else if (name==scale) // one value scale
 				{
 					if (SCHEME_NUMBERP(argv[2]))
 					{
@@ -371,6 +388,77 @@ Scheme_Object *pdata_add(int argc, Scheme_Object **argv)
 	return scheme_void;
 }
 
+// StartFunctionDoc-en
+// pdata-add-mapped name-string type-string filename-string [offset-number]
+// Returns: boolean
+// Description:
+// Adds a new user pdata array like pdata-add, but uses the contents of a 
+// raw binary file directly, starting at offset bytes in (which must be a 
+// multiple of 16). The file is mapped into memory rather than read, so 
+// very large arrays are paged in as they're used. The array is read from
+// the file (by pdata-ref, pdata-map! sources or particle drawing) until 
+// it's written to, when it's copied into memory - changes are never written
+// back to the file. Poly and pixel primitives copy their own arrays ("p", 
+// "n", "c", "t") straight away, as they draw from them. Vectors and colours 
+// are 4 floats each, matrices 16 floats. Returns false if the file is too 
+// small for the primitive.
+// Example:
+// (with-primitive (build-particles 1000000)
+//   (pdata-add-mapped "p" "v" "points.bin"))
+// EndFunctionDoc
+
+Scheme_Object *pdata_add_mapped(int argc, Scheme_Object **argv)
+{
+	DECL_ARGV();
+	if (argc==4) ArgCheck("pdata-add-mapped", "sssi", argc, argv);			
+	else ArgCheck("pdata-add-mapped", "sss", argc, argv);			
+	Primitive *Grabbed=Engine::Get()->Renderer()->Grabbed();    
+	bool ok=false;
+	if (Grabbed) 
+	{
+		string names=StringFromScheme(argv[0]);
+		string types=StringFromScheme(argv[1]);
+		string filename=SearchPaths::Get()->GetFullPath(StringFromScheme(argv[2]));
+		int offset=argc==4?IntFromScheme(argv[3]):0;
+		char type=0;
+		unsigned int size=0;
+		Grabbed->GetDataInfo("p", type, size);
+		
+		MappedFile *file=MappedFile::Open(filename);
+		if (file!=NULL && offset>=0)
+		{
+			PData *ptr=NULL;
+			switch (types[0])
+			{
+				case 'v': ptr = new TypedPData<dVector>; ok=((TypedPData<dVector>*)ptr)->Map(file,offset,size); break;
+				case 'c': ptr = new TypedPData<dColour>; ok=((TypedPData<dColour>*)ptr)->Map(file,offset,size); break;
+				case 'f': ptr = new TypedPData<float>; ok=((TypedPData<float>*)ptr)->Map(file,offset,size); break;
+				case 'm': ptr = new TypedPData<dMatrix>; ok=((TypedPData<dMatrix>*)ptr)->Map(file,offset,size); break;
+				default : Trace::Stream<<"pdata-add-mapped: unknown type "<<types[0]<<endl; break;
+			}
+			file->Release();
+			
+			if (ok)
+			{
+				if (Grabbed->GetDataInfo(names, type, size)) Grabbed->SetDataRaw(names,ptr);
+				else Grabbed->AddData(names,ptr);
+			}
+			else
+			{
+				if (ptr) Trace::Stream<<"pdata-add-mapped: "<<filename<<" is too small or the offset is wrong"<<endl;
+				delete ptr;
+			}
+		}
+		else 
+		{
+			Trace::Stream<<"pdata-add-mapped: couldn't map "<<filename<<endl;
+		}
+	}
+	MZ_GC_UNREG(); 
+	
+	return ok?scheme_true:scheme_false;
+}
+
 // StartFunctionDoc-en
 // pdata-exists? name-string
 // Returns: void
@@ -434,6 +522,235 @@ Scheme_Object *pdata_exists(int argc, Scheme_Object **argv)
 	return scheme_false;
 }
 
+// StartFunctionDoc-en
+// pdata-handle name-string
+// Returns: handle-number
+// Description:
+// Returns a handle for a pdata name, which can be used in place of the
+// name in pdata-ref and pdata-set! to save looking up the name for every
+// element. Handles are the same for all primitives, and stay valid even
+// if there is no pdata of that name yet.
+// Example:
+// (define p (pdata-handle "p"))
+// (with-primitive (build-sphere 20 20)
+//     (for ((i (in-range 0 (pdata-size))))
+//         (pdata-set! p i (vmul (pdata-ref p i) 1.5))))
+// EndFunctionDoc
+
+Scheme_Object *pdata_handle(int argc, Scheme_Object **argv)
+{
+	DECL_ARGV();
+	ArgCheck("pdata-handle", "s", argc, argv);
+	PDataAtom atom=PDataContainer::GetAtom(StringFromScheme(argv[0]));
+	MZ_GC_UNREG(); 
+	return scheme_make_integer(atom);
+}
+
+// StartFunctionDoc-en
+// pdata-expr-map! expression-list index-boolean read/write-pdata-name read-pdata-name ...
+// Returns: boolean
+// Description:
+// Runs a quoted lambda expression over pdata arrays natively, rather than calling 
+// a procedure for each element. This is used by pdata-map! and pdata-index-map! 
+// when they are given a quoted lambda instead of a procedure. The arguments of 
+// the lambda are bound to the pdata arrays in order, after the element index if 
+// index-boolean is true. The body can use numbers, vectors, the arguments and 
+// +, -, *, /, vadd, vsub, vmul, vdiv, min, max, abs, sqrt, sin, cos, floor, vdot, 
+// vcross, vmag, vnormalise, clamp, lerp, noise, vx, vy, vz, vw, vector, vtransform 
+// and vtransform-rot (with a constant matrix). Numbers act on all components of 
+// vectors. Use quasiquote to put the values of scheme variables into the 
+// expression. Returns false if the expression can't be run, after saying why - 
+// pdata-map! and pdata-index-map! then run the lambda as a normal procedure.
+// Example:
+// (with-primitive (build-sphere 40 40)
+//     (pdata-copy "p" "pref")
+//     (every-frame
+//         (pdata-map! 
+//             `(lambda (p pref n) 
+//                 (vadd pref (vmul n (* 0.1 (sin (+ (* (vy pref) 10) ,(time)))))))
+//             "p" "pref" "n")))
+// EndFunctionDoc
+
+static bool ParseExpression(Scheme_Object *o, PDataExpression &expr, 
+	const map<string,unsigned int> &bindings, unsigned int &node);
+
+static bool ParseArgs(Scheme_Object *o, PDataExpression &expr, 
+	const map<string,unsigned int> &bindings, vector<unsigned int> &args)
+{
+	for (; SCHEME_PAIRP(o); o=SCHEME_CDR(o))
+	{
+		unsigned int node;
+		if (!ParseExpression(SCHEME_CAR(o),expr,bindings,node)) return false;
+		args.push_back(node);
+	}
+	return true;
+}
+
+static bool ParseExpression(Scheme_Object *o, PDataExpression &expr, 
+	const map<string,unsigned int> &bindings, unsigned int &node)
+{
+	if (SCHEME_NUMBERP(o))
+	{
+		float f=FloatFromScheme(o);
+		node=expr.Constant(f,f,f,f);
+		return true;
+	}
+	
+	if (SCHEME_VECTORP(o) && (SCHEME_VEC_SIZE(o)==3 || SCHEME_VEC_SIZE(o)==4))
+	{
+		float v[4]={0,0,0,1};
+		FloatsFromScheme(o,v,SCHEME_VEC_SIZE(o));
+		node=expr.Constant(v[0],v[1],v[2],v[3]);
+		return true;
+	}
+	
+	if (SCHEME_SYMBOLP(o))
+	{
+		map<string,unsigned int>::const_iterator i=bindings.find(SCHEME_SYM_VAL(o));
+		if (i==bindings.end())
+		{
+			Trace::Stream<<"pdata-expr-map!: unknown variable "<<SCHEME_SYM_VAL(o)<<endl;
+			return false;
+		}
+		node=i->second;
+		return true;
+	}
+	
+	if (!SCHEME_PAIRP(o) || !SCHEME_SYMBOLP(SCHEME_CAR(o)))
+	{
+		Trace::Stream<<"pdata-expr-map!: can't use this in an expression"<<endl;
+		return false;
+	}
+
+	string name=SCHEME_SYM_VAL(SCHEME_CAR(o));
+	Scheme_Object *rest=SCHEME_CDR(o);
+	
+	// transforms need the matrix as a constant
+	if (name=="vtransform" || name=="vtransform-rot")
+	{
+		if (!SCHEME_PAIRP(rest) || !SCHEME_PAIRP(SCHEME_CDR(rest)) || 
+		    !SCHEME_VECTORP(SCHEME_CAR(SCHEME_CDR(rest))) || 
+			SCHEME_VEC_SIZE(SCHEME_CAR(SCHEME_CDR(rest)))!=16)
+		{
+			Trace::Stream<<"pdata-expr-map!: "<<name<<" needs a vector and a constant matrix"<<endl;
+			return false;
+		}
+		
+		unsigned int v;
+		if (!ParseExpression(SCHEME_CAR(rest),expr,bindings,v)) return false;
+		dMatrix m;
+		FloatsFromScheme(SCHEME_CAR(SCHEME_CDR(rest)),m.arr(),16);
+		node=expr.Transform(m,v,name=="vtransform-rot");
+		return true;
+	}
+
+	PDataExpression::Op op;
+	if (!PDataExpression::LookupOp(name,op))
+	{
+		Trace::Stream<<"pdata-expr-map!: unknown function "<<name<<endl;
+		return false;
+	}
+
+	vector<unsigned int> args;
+	if (!ParseArgs(rest,expr,bindings,args)) return false;
+	
+	// (- a) is negation, and some ops take any number of arguments
+	if (op==PDataExpression::SUB && args.size()==1) 
+	{
+		node=expr.Apply(PDataExpression::NEG,args[0]);
+		return true;
+	}
+	
+	if ((op==PDataExpression::ADD || op==PDataExpression::SUB || op==PDataExpression::MUL || 
+	     op==PDataExpression::DIV || op==PDataExpression::MIN || op==PDataExpression::MAX) && 
+		args.size()>2)
+	{
+		node=args[0];
+		for (unsigned int i=1; i<args.size(); i++) node=expr.Apply(op,node,args[i]);
+		return true;
+	}
+	
+	if (args.size()!=PDataExpression::GetOpArgs(op))
+	{
+		Trace::Stream<<"pdata-expr-map!: "<<name<<" takes "<<PDataExpression::GetOpArgs(op)<<" arguments"<<endl;
+		return false;
+	}
+
+	node=expr.Apply(op,
+		args.size()>0?args[0]:0,
+		args.size()>1?args[1]:0,
+		args.size()>2?args[2]:0);
+	return true;
+}
+
+Scheme_Object *pdata_expr_map(int argc, Scheme_Object **argv)
+{
+	DECL_ARGV();
+	ArgCheck("pdata-expr-map!", "lbs", argc, argv);
+	for (int n=3; n<argc; n++) ArgCheck("pdata-expr-map!", "s", 1, &argv[n]);
+	
+	Primitive *Grabbed=Engine::Get()->Renderer()->Grabbed();
+	if (!Grabbed) 
+	{
+		Trace::Stream<<"pdata-expr-map! called without an objected being grabbed"<<endl;
+		MZ_GC_UNREG(); 
+		return scheme_false;
+	}
+
+	// (lambda (args ...) body ...)
+	Scheme_Object *l=argv[0];
+	if (!SCHEME_PAIRP(l) || !SCHEME_SYMBOLP(SCHEME_CAR(l)) || 
+		string(SCHEME_SYM_VAL(SCHEME_CAR(l)))!="lambda" ||
+		!SCHEME_PAIRP(SCHEME_CDR(l)) || !SCHEME_PAIRP(SCHEME_CDR(SCHEME_CDR(l))))
+	{
+		Trace::Stream<<"pdata-expr-map!: expected a quoted lambda"<<endl;
+		MZ_GC_UNREG(); 
+		return scheme_false;
+	}
+	
+	// get the strings first, so nothing is allocated while we 
+	// are walking the expression
+	vector<string> channels;
+	for (int n=2; n<argc; n++) channels.push_back(StringFromScheme(argv[n]));
+	l=argv[0];
+
+	PDataExpression expr;
+	map<string,unsigned int> bindings;
+	bool index=SCHEME_TRUEP(argv[1]);
+	unsigned int channel=0;
+	for (Scheme_Object *a=SCHEME_CAR(SCHEME_CDR(l)); SCHEME_PAIRP(a); a=SCHEME_CDR(a))
+	{
+		if (!SCHEME_SYMBOLP(SCHEME_CAR(a)) || (!index && channel>=channels.size()))
+		{
+			Trace::Stream<<"pdata-expr-map!: the lambda arguments don't match the pdata"<<endl;
+			MZ_GC_UNREG(); 
+			return scheme_false;
+		}
+
+		string name=SCHEME_SYM_VAL(SCHEME_CAR(a));
+		if (index) 
+		{
+			bindings[name]=expr.Index();
+			index=false;
+		}
+		else
+		{
+			bindings[name]=expr.Channel(channels[channel++]);
+		}
+	}
+
+	// the last expression in the body is the result
+	Scheme_Object *body=SCHEME_CDR(SCHEME_CDR(l));
+	while (SCHEME_PAIRP(SCHEME_CDR(body))) body=SCHEME_CDR(body);
+	
+	unsigned int result;
+	bool ok=ParseExpression(SCHEME_CAR(body),expr,bindings,result) &&
+		expr.Run(*Grabbed,result,channels[0]);
+
+	MZ_GC_UNREG(); 
+	return ok?scheme_true:scheme_false;
+}
+
 // TODO: add more type descriptions down here
 // StartFunctionDoc-en
 // pdata-names 
@@ -941,8 +1258,11 @@ void PDataFunctions::AddGlobals(Scheme_Env *env)
 	scheme_add_global("pdata-ref", scheme_make_prim_w_arity(pdata_ref, "pdata-ref", 2, 2), env);
 	scheme_add_global("pdata-set!", scheme_make_prim_w_arity(pdata_set, "pdata-set!", 3, 3), env);
 	scheme_add_global("pdata-add", scheme_make_prim_w_arity(pdata_add, "pdata-add", 2, 2), env);
+	scheme_add_global("pdata-add-mapped", scheme_make_prim_w_arity(pdata_add_mapped, "pdata-add-mapped", 3, 4), env);
 	scheme_add_global("pdata-exists?", scheme_make_prim_w_arity(pdata_exists, "pdata-exists?", 1, 1), env);
 	scheme_add_global("pdata-names", scheme_make_prim_w_arity(pdata_names, "pdata-names", 0, 0), env);
+	scheme_add_global("pdata-handle", scheme_make_prim_w_arity(pdata_handle, "pdata-handle", 1, 1), env);
+	scheme_add_global("pdata-expr-map!", scheme_make_prim_w_arity(pdata_expr_map, "pdata-expr-map!", 3, -1), env);
 	scheme_add_global("pdata-op", scheme_make_prim_w_arity(pdata_op, "pdata-op", 3, 3), env);
 	scheme_add_global("pdata-copy", scheme_make_prim_w_arity(pdata_copy, "pdata-copy", 2, 2), env);
 	scheme_add_global("pdata-size", scheme_make_prim_w_arity(pdata_size, "pdata-size", 0, 0), env);
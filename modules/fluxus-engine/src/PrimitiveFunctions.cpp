@@ -23,6 +23,7 @@
 #include "RibbonPrimitive.h"
 #include "TextPrimitive.h"
 #include "ParticlePrimitive.h"
+#include "PointCloudPrimitive.h"
 #include "LocatorPrimitive.h"
 #include "PixelPrimitive.h"
 #include "BlobbyPrimitive.h"
@@ -30,6 +31,8 @@
 #include "ImagePrimitive.h"
 #include "VoxelPrimitive.h"
 #include "PrimitiveIO.h"
+#include "MeshCache.h"
+#include "PLYPrimitiveIO.h"
 #include "SearchPaths.h"
 #include "Evaluator.h"
 
@@ -1030,12 +1033,116 @@ Scheme_Object *build_particles(int argc, Scheme_Object **argv)
 		return scheme_void;
 	}
 	ParticlePrimitive *Prim = new ParticlePrimitive;
-	for (int i=0; i<size; i++)
+	Prim->Resize(size);
+	Prim->GetDataVec<dColour>("c")->assign(size,dColour(0,0,0));
+	Prim->GetDataVec<dVector>("s")->assign(size,dVector(0.1,0.1,0.1));
+	MZ_GC_UNREG();
+    return scheme_make_integer_value(Engine::Get()->Renderer()->AddPrimitive(Prim));
+}
+
+// StartFunctionDoc-en
+// build-point-cloud primitiveid-number
+// Returns: primitiveid-number
+// Description:
+// Builds a point cloud from the positions, colours and sizes of another 
+// primitive (usually particles loaded from a ply file), for drawing clouds 
+// with many millions of points. The points are sorted into an octree kept on
+// disk, and each frame only the parts which make a difference at the current
+// view are loaded and drawn, up to a budget of points (see point-cloud-budget).
+// The points being drawn are in the cloud's "p", "c" and "s" pdata, and are 
+// drawn like particles - sized quads, or points with hint-points, which are 
+// quicker for big budgets. The pdata is refilled when the view changes, so 
+// writing to it only lasts until then. Each point takes 48 bytes on disk and
+// in memory. The source primitive isn't changed, so it can be destroyed 
+// afterwards to free its memory.
+// Example:
+// (define scan (load-primitive "scan.ply"))
+// (define cloud (build-point-cloud scan))
+// (destroy scan)
+// EndFunctionDoc
+
+Scheme_Object *build_point_cloud(int argc, Scheme_Object **argv)
+{
+	DECL_ARGV();
+	ArgCheck("build-point-cloud", "i", argc, argv);
+	Primitive *Source=Engine::Get()->Renderer()->GetPrimitive(IntFromScheme(argv[0]));
+	char type=0;
+	unsigned int size=0;
+	if (Source==NULL || !Source->GetDataInfo("p",type,size) || type!='v' || size==0)
 	{
-		Prim->AddParticle(dVector(0,0,0),dColour(0,0,0),dVector(0.1,0.1,0.1));
+		Trace::Stream<<"build-point-cloud: primitive has no points"<<endl;
+		MZ_GC_UNREG();
+		return scheme_make_integer_value(0);
 	}
+
+	// missing colours and sizes are the particle defaults
+	const dVector *positions=Source->GetDataView<dVector>("p")->View();
+	vector<dColour> white;
+	const dColour *colours=NULL;
+	const TypedPData<dColour> *c=Source->GetDataView<dColour>("c");
+	if (c!=NULL) colours=c->View();
+	else 
+	{
+		white.resize(size,dColour(1,1,1));
+		colours=&white[0];
+	}
+	vector<dVector> defaultsizes;
+	const dVector *sizes=NULL;
+	const TypedPData<dVector> *s=Source->GetDataView<dVector>("s");
+	if (s!=NULL) sizes=s->View();
+	else 
+	{
+		defaultsizes.resize(size,dVector(0.1,0.1,0.1));
+		sizes=&defaultsizes[0];
+	}
+
+	PointOctree *octree=PointOctree::Build(positions,colours,sizes,size);
 	MZ_GC_UNREG();
-    return scheme_make_integer_value(Engine::Get()->Renderer()->AddPrimitive(Prim));
+	if (octree==NULL) return scheme_make_integer_value(0);
+	return scheme_make_integer_value(Engine::Get()->Renderer()->AddPrimitive(new PointCloudPrimitive(octree)));
+}
+
+// StartFunctionDoc-en
+// point-cloud-budget points-number
+// Returns: void
+// Description:
+// Sets the most points the grabbed point cloud draws each frame, 
+// defaults to a million.
+// Example:
+// (with-primitive cloud (point-cloud-budget 3000000))
+// EndFunctionDoc
+
+Scheme_Object *point_cloud_budget(int argc, Scheme_Object **argv)
+{
+	DECL_ARGV();
+	ArgCheck("point-cloud-budget", "i", argc, argv);
+	PointCloudPrimitive *Grabbed=dynamic_cast<PointCloudPrimitive*>(Engine::Get()->Renderer()->Grabbed());
+	int budget=IntFromScheme(argv[0]);
+	if (Grabbed && budget>0) Grabbed->SetBudget(budget);
+	else Trace::Stream<<"point-cloud-budget can only be called while a point cloud is grabbed"<<endl;
+	MZ_GC_UNREG();
+	return scheme_void;
+}
+
+// StartFunctionDoc-en
+// point-cloud-error pixels-number
+// Returns: void
+// Description:
+// Sets how far apart the points of the grabbed point cloud can be on screen
+// before more detail is drawn. Defaults to 1, bigger values draw fewer points.
+// Example:
+// (with-primitive cloud (point-cloud-error 4))
+// EndFunctionDoc
+
+Scheme_Object *point_cloud_error(int argc, Scheme_Object **argv)
+{
+	DECL_ARGV();
+	ArgCheck("point-cloud-error", "f", argc, argv);
+	PointCloudPrimitive *Grabbed=dynamic_cast<PointCloudPrimitive*>(Engine::Get()->Renderer()->Grabbed());
+	if (Grabbed) Grabbed->SetMaxError(FloatFromScheme(argv[0]));
+	else Trace::Stream<<"point-cloud-error can only be called while a point cloud is grabbed"<<endl;
+	MZ_GC_UNREG();
+	return scheme_void;
 }
 
 // StartFunctionDoc-en
@@ -1092,12 +1199,19 @@ Scheme_Object *build_image(int argc, Scheme_Object **argv)
 }
 
 // StartFunctionDoc-en
-// build-voxels width-number height-number depth-number 
+// build-voxels width-number height-number depth-number [sparse-boolean]
 // Returns: primitiveid-number
 // Description:
 // Builds voxels primitive, similar to pixel primitives, except include a 3rd dimension.
+// Sparse voxels only store the 8x8x8 bricks of voxels that have something in them, so
+// big grids with lots of empty space are cheap. They start out clear rather than black,
+// and their pdata arrays only hold the voxels that are stored. Bricks are freed again
+// when a voxel operation leaves them clear, unless the gradient or a pdata array you've
+// added has been written to in them - new voxels in added arrays start out at 0 (or
+// opaque black for colours, identity for matrices), and bricks holding only that are freed.
 // Example:
 // (define vox (build-voxels 10 10 10))
+// (define big (build-voxels 512 512 512 #t))
 // EndFunctionDoc
 
 // StartFunctionDoc-fr
@@ -1113,11 +1227,21 @@ Scheme_Object *build_image(int argc, Scheme_Object **argv)
 Scheme_Object *build_voxels(int argc, Scheme_Object **argv)
 {
 	DECL_ARGV();
-	ArgCheck("build-voxels", "iii", argc, argv);
+	bool sparse = false;
+	if (argc == 3)
+	{
+		ArgCheck("build-voxels", "iii", argc, argv);
+	}
+	else
+	{
+		ArgCheck("build-voxels", "iiib", argc, argv);
+		sparse = BoolFromScheme(argv[3]);
+	}
 
 	VoxelPrimitive *VoxPrim = new VoxelPrimitive(IntFromScheme(argv[0]),
 												IntFromScheme(argv[1]),
-												IntFromScheme(argv[2]));
+												IntFromScheme(argv[2]),
+												sparse);
 	MZ_GC_UNREG();
 
 	return scheme_make_integer_value(Engine::Get()->Renderer()->AddPrimitive(VoxPrim));
@@ -1170,7 +1294,10 @@ Scheme_Object *voxels2blobby(int argc, Scheme_Object **argv)
 // voxels->poly voxelsprimitiveid-number [isolevel-threshold-number]
 // Returns: polyprimid-number
 // Description:
-// Converts the voxels from a voxels primitive into a triangle list polygon primitive.
+// Converts the voxels from a voxels primitive into a triangle list polygon primitive,
+// with the surface where the magnitude of the voxel colours crosses the threshold.
+// The triangles are indexed, sharing their vertices, and the vertex colours come from
+// the voxels.
 // Example:
 // (clear)
 // (define vx (build-voxels 16 16 16))
@@ -1222,11 +1349,8 @@ Scheme_Object *voxels2poly(int argc, Scheme_Object **argv)
 		VoxelPrimitive *vp = dynamic_cast<VoxelPrimitive *>(Prim);
 		if (vp)
 		{
-			BlobbyPrimitive *bp = vp->ConvertToBlobby();
-
 			PolyPrimitive *np = new PolyPrimitive(PolyPrimitive::TRILIST);
-			bp->ConvertToPoly(*np, thres);
-			delete bp;
+			vp->ConvertToPoly(*np, thres);
 			MZ_GC_UNREG();
 			return scheme_make_integer_value(Engine::Get()->Renderer()->AddPrimitive(np));
 		}
@@ -1442,6 +1566,10 @@ Scheme_Object *voxels_calc_gradient(int argc, Scheme_Object **argv)
 // Returns: void
 // Description:
 // Adds a coloured sperical influence into the voxel values from the centre position.
+// The influence is colour*(1/distance)^strength, and it's left out of voxels where 
+// that's below 1/1024 in every channel, which makes it much quicker with big grids.
+// The small amounts left out can add up when there are many influences, so use
+// a brighter colour and scale the values afterwards if that matters.
 // Example:
 // (clear)
 // (blend-mode 'src-alpha 'one)
@@ -1467,7 +1595,9 @@ Scheme_Object *voxels_calc_gradient(int argc, Scheme_Object **argv)
 // Retour: vide
 // Description:
 // Ajoute une influence sphérique colorée aux valeurs des voxels
-// à partir de la position de centre.
+// à partir de la position de centre. L'influence est couleur*(1/distance)^force,
+// et n'est pas ajoutée aux voxels où elle est inférieure à 1/1024 pour chaque
+// canal. Ces petites valeurs peuvent s'additionner avec beaucoup d'influences.
 // Exemple:
 // (clear)
 // (blend-mode 'src-alpha 'one)
@@ -1513,6 +1643,85 @@ Scheme_Object *voxels_sphere_influence(int argc, Scheme_Object **argv)
     return scheme_void;
 }
 
+// StartFunctionDoc-en
+// voxels-sphere-influences positions-list colours-list strength
+// Returns: void
+// Description:
+// Adds lots of coloured spherical influences into the voxel values at once. This is the same as
+// calling voxels-sphere-influence for each position and colour in turn, but only goes over the
+// voxels once. The strength can be a number used for all of them, or a list of one for each.
+// As with voxels-sphere-influence, each one is left out where it adds less than 1/1024 to 
+// every channel, so with hundreds of faint influences the total can be noticeably lower
+// than the exact sum.
+// Example:
+// (clear)
+// (define p (build-voxels 64 64 64))
+// (with-primitive p
+//     (voxels-sphere-influences
+//         (build-list 100 (lambda (i) (vector (rndf) (rndf) (rndf))))
+//         (build-list 100 (lambda (i) (vector 0.01 0.005 0.002 0.01)))
+//         2))
+// EndFunctionDoc
+
+Scheme_Object *voxels_sphere_influences(int argc, Scheme_Object **argv)
+{
+	Scheme_Object *posvec = NULL;
+	Scheme_Object *colvec = NULL;
+	Scheme_Object *strengthvec = NULL;
+	MZ_GC_DECL_REG(4);
+	MZ_GC_VAR_IN_REG(0, argv);
+	MZ_GC_VAR_IN_REG(1, posvec);
+	MZ_GC_VAR_IN_REG(2, colvec);
+	MZ_GC_VAR_IN_REG(3, strengthvec);
+	MZ_GC_REG();
+
+	ArgCheck("voxels-sphere-influences", "ll?", argc, argv);
+	Primitive *Grabbed=Engine::Get()->Renderer()->Grabbed();
+	if (Grabbed)
+	{
+		VoxelPrimitive *pp = dynamic_cast<VoxelPrimitive *>(Grabbed);
+		if (pp)
+		{
+			posvec = scheme_list_to_vector(argv[0]);
+			colvec = scheme_list_to_vector(argv[1]);
+			if (!SCHEME_NUMBERP(argv[2])) strengthvec = scheme_list_to_vector(argv[2]);
+
+			unsigned int count=SCHEME_VEC_SIZE(posvec);
+			if ((unsigned int)SCHEME_VEC_SIZE(colvec)!=count || 
+				(strengthvec && (unsigned int)SCHEME_VEC_SIZE(strengthvec)!=count))
+			{
+				Trace::Stream<<"voxels-sphere-influences: the lists need to be the same length"<<endl;
+				MZ_GC_UNREG();
+				return scheme_void;
+			}
+
+			vector<VoxelPrimitive::Influence> influences(count);
+			for (unsigned int n=0; n<count; n++)
+			{
+				Scheme_Object *pos=SCHEME_VEC_ELS(posvec)[n];
+				Scheme_Object *col=SCHEME_VEC_ELS(colvec)[n];
+				if (!SCHEME_VECTORP(pos) || SCHEME_VEC_SIZE(pos)<3 || !SCHEME_VECTORP(col) || 
+					SCHEME_VEC_SIZE(col)<3 || (strengthvec && !SCHEME_NUMBERP(SCHEME_VEC_ELS(strengthvec)[n])))
+				{
+					Trace::Stream<<"voxels-sphere-influences: expects a list of positions, a list of colours and strengths"<<endl;
+					MZ_GC_UNREG();
+					return scheme_void;
+				}
+				FloatsFromScheme(SCHEME_VEC_ELS(posvec)[n],influences[n].Pos.arr(),3);
+				influences[n].Col=ColourFromScheme(SCHEME_VEC_ELS(colvec)[n], Engine::Get()->State()->ColourMode);
+				influences[n].Strength=FloatFromScheme(strengthvec?SCHEME_VEC_ELS(strengthvec)[n]:argv[2]);
+			}
+			pp->SphereInfluences(influences);
+			MZ_GC_UNREG();
+		    return scheme_void;
+		}
+	}
+	MZ_GC_UNREG();
+
+	Trace::Stream<<"voxels-sphere-influences can only be called while a voxels primitive is grabbed"<<endl;
+    return scheme_void;
+}
+
 // StartFunctionDoc-en
 // voxels-sphere-solid pos-vector colour-vector radius
 // Returns: void
@@ -1969,6 +2178,54 @@ Scheme_Object *clear_geometry_cache(int argc, Scheme_Object **argv)
 	return scheme_void;
 }
 
+// StartFunctionDoc-en
+// set-mesh-cache-path path-string
+// Returns: void
+// Description:
+// Sets the directory loaded meshes are cached in. The cache keeps the 
+// final pdata of each file loaded with load-primitive, so the next time 
+// it's loaded (even after restarting fluxus) it doesn't need parsing 
+// again. Entries are checked against the size and modification time of 
+// the file they came from. Defaults to ~/.cache/fluxus/meshes, an empty 
+// string turns the cache off.
+// Example:
+// (set-mesh-cache-path "/tmp/fluxus-meshes")
+// (define mynewshape (load-primitive "octopus.obj"))
+// EndFunctionDoc
+
+Scheme_Object *set_mesh_cache_path(int argc, Scheme_Object **argv)
+{
+	DECL_ARGV();
+	ArgCheck("set-mesh-cache-path", "s", argc, argv);
+	MeshCache::SetPath(StringFromScheme(argv[0]));
+	MZ_GC_UNREG();
+	return scheme_void;
+}
+
+// StartFunctionDoc-en
+// set-ply-decimation n-number
+// Returns: void
+// Description:
+// Sets load-primitive to only keep every nth point when loading ply files,
+// for looking at huge scans quickly. Ply files are loaded as particle 
+// primitives, with colours and normals if the file has them. 1 keeps all 
+// the points, which is the default.
+// Example:
+// (set-ply-decimation 10)
+// (define scan (load-primitive "bunny.ply"))
+// (with-primitive scan (hint-none) (hint-points))
+// EndFunctionDoc
+
+Scheme_Object *set_ply_decimation(int argc, Scheme_Object **argv)
+{
+	DECL_ARGV();
+	ArgCheck("set-ply-decimation", "i", argc, argv);
+	int n=IntFromScheme(argv[0]);
+	PLYPrimitiveIO::SetDecimation(n<1?1:n);
+	MZ_GC_UNREG();
+	return scheme_void;
+}
+
 // StartFunctionDoc-en
 // save-primitive
 // Returns: void
@@ -2837,9 +3094,10 @@ Scheme_Object *build_blobby(int argc, Scheme_Object **argv)
 // blobby->poly blobbyprimitiveid-number
 // Returns: polyprimid-number
 // Description:
-// Converts the mesh of a blobby primitive into a triangle list polygon primitive. This is useful as
-// the polygon primitive will be much much faster to render, but can't deform in the blobby way.
-// Doesn't convert vertex colours over yet unfortunately.
+// Converts the mesh of a blobby primitive into an indexed triangle list polygon primitive, with
+// the vertices shared between neighbouring triangles. This is useful as the polygon primitive can
+// be textured and deformed like any other, but can't deform in the blobby way. Vertex colours are 
+// converted over if the blobby has hint-vertcols set.
 // Example:
 // (clear)
 // (define b (build-blobby 5 (vector 30 30 30) (vector 1 1 1)))
@@ -2969,7 +3227,11 @@ Scheme_Object *blobby2poly(int argc, Scheme_Object **argv)
 // Returns: void
 // Description:
 // Copies a retained mode primitive and draws it in the current state as an immediate mode
-// primitive.
+// primitive. Consecutive calls drawing the same primitive with the same state apart from
+// transform and colour are batched together. If the primitive's shader has a mat4
+// "instance_transform" attribute (and optionally a vec4 "instance_colour") polygon
+// primitives are drawn with a single hardware instanced call, and the shader needs to
+// apply the instance transform itself.
 // Example:
 // (define mynewshape (build-cube))
 // (colour (vector 1 0 0))
@@ -3418,9 +3680,9 @@ Scheme_Object *poly_indices(int argc, Scheme_Object **argv)
 		{
 			l = scheme_null;
 
-			for (int n=(int)pp->GetIndex().size()-1; n>=0; n--)
+			for (int n=(int)pp->GetIndexConst().size()-1; n>=0; n--)
 			{
-				l=scheme_make_pair(scheme_make_integer(pp->GetIndex()[n]),l);
+				l=scheme_make_pair(scheme_make_integer(pp->GetIndexConst()[n]),l);
 			}
 			MZ_GC_UNREG();
 		    return l;
@@ -4295,10 +4557,10 @@ Scheme_Object *geo_line_intersect(int argc, Scheme_Object **argv)
 // recalc-bb
 // Returns: void
 // Description:
-// This call regenerates the primitives bounding box. 
-// As this call can be expensive, it's up to you when to call it - only if the pdata 
-// has changed and just before operations that use the bounding box 
-// (such as bb/bb-intersect) is the fastest policy.
+// This call regenerates the primitives bounding box. The bounding boxes are
+// now cached and recalculated automatically when the transform or pdata
+// changes, so this is only needed if the primitive has been changed some
+// other way.
 // Example:
 // (define myprim (build-cube))
 // (with-primitive myprim
@@ -4750,9 +5012,12 @@ void PrimitiveFunctions::AddGlobals(Scheme_Env *env)
 	scheme_add_global("build-nurbs-sphere", scheme_make_prim_w_arity(build_nurbs_sphere, "build-nurbs-sphere", 2, 2), env);
 	scheme_add_global("build-nurbs-plane", scheme_make_prim_w_arity(build_nurbs_plane, "build-nurbs-sphere", 2, 2), env);
 	scheme_add_global("build-particles", scheme_make_prim_w_arity(build_particles, "build-particles", 1, 1), env);
+	scheme_add_global("build-point-cloud", scheme_make_prim_w_arity(build_point_cloud, "build-point-cloud", 1, 1), env);
+	scheme_add_global("point-cloud-budget", scheme_make_prim_w_arity(point_cloud_budget, "point-cloud-budget", 1, 1), env);
+	scheme_add_global("point-cloud-error", scheme_make_prim_w_arity(point_cloud_error, "point-cloud-error", 1, 1), env);
 	scheme_add_global("build-image", scheme_make_prim_w_arity(build_image, "build-image", 3, 3), env);
 	scheme_add_global("build-locator", scheme_make_prim_w_arity(build_locator, "build-locator", 0, 0), env);
-	scheme_add_global("build-voxels", scheme_make_prim_w_arity(build_voxels, "build-voxels", 3, 3), env);
+	scheme_add_global("build-voxels", scheme_make_prim_w_arity(build_voxels, "build-voxels", 3, 4), env);
 	scheme_add_global("locator-bounding-radius", scheme_make_prim_w_arity(locator_bounding_radius, "locator-bounding-radius", 1, 1), env);
 	scheme_add_global("build-pixels", scheme_make_prim_w_arity(build_pixels, "build-pixels", 2, 4), env);
 	scheme_add_global("build-type", scheme_make_prim_w_arity(build_type, "build-type", 2, 2), env);
@@ -4760,6 +5025,8 @@ void PrimitiveFunctions::AddGlobals(Scheme_Env *env)
 	scheme_add_global("load-primitive", scheme_make_prim_w_arity(load_primitive, "load-primitive", 1, 1), env);
 	scheme_add_global("save-primitive", scheme_make_prim_w_arity(save_primitive, "save-primitive", 1, 1), env);
 	scheme_add_global("clear-geometry-cache", scheme_make_prim_w_arity(clear_geometry_cache, "clear-geometry-cache", 0, 0), env);
+	scheme_add_global("set-mesh-cache-path", scheme_make_prim_w_arity(set_mesh_cache_path, "set-mesh-cache-path", 1, 1), env);
+	scheme_add_global("set-ply-decimation", scheme_make_prim_w_arity(set_ply_decimation, "set-ply-decimation", 1, 1), env);
 	scheme_add_global("pixels-upload", scheme_make_prim_w_arity(pixels_upload, "pixels-upload", 0, 0), env);
 	scheme_add_global("pixels-download", scheme_make_prim_w_arity(pixels_download, "pixels-download", 0, 1), env);
 	scheme_add_global("pixels-load", scheme_make_prim_w_arity(pixels_load, "pixels-load", 1, 1), env);
@@ -4777,6 +5044,7 @@ void PrimitiveFunctions::AddGlobals(Scheme_Env *env)
 	scheme_add_global("voxels-depth", scheme_make_prim_w_arity(voxels_depth, "voxels-depth", 0, 0), env);
 	scheme_add_global("voxels-calc-gradient", scheme_make_prim_w_arity(voxels_calc_gradient, "voxels-calc-gradient", 0, 0), env);
 	scheme_add_global("voxels-sphere-influence", scheme_make_prim_w_arity(voxels_sphere_influence, "voxels-sphere-influence", 3, 3), env);
+	scheme_add_global("voxels-sphere-influences", scheme_make_prim_w_arity(voxels_sphere_influences, "voxels-sphere-influences", 3, 3), env);
 	scheme_add_global("voxels-sphere-solid", scheme_make_prim_w_arity(voxels_sphere_solid, "voxels-sphere-solid", 3, 3), env);
 	scheme_add_global("voxels-box-solid", scheme_make_prim_w_arity(voxels_box_solid, "voxels-box-solid", 3, 3), env);
 	scheme_add_global("voxels-threshold", scheme_make_prim_w_arity(voxels_threshold, "voxels-threshold", 1, 1), env);
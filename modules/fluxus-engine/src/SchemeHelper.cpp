@@ -334,6 +334,14 @@ void SchemeHelper::ArgCheck(const string &funcname, const string &format, int ar
 					}
 				break;
 
+				case 'h': // pdata name or handle
+					if (!SCHEME_CHAR_STRINGP(argv[n]) && !SCHEME_INTP(argv[n]))
+					{
+						MZ_GC_UNREG();
+						scheme_wrong_type(funcname.c_str(), "pdata name string or handle", n, argc, argv);
+					}
+				break;
+
 				case 'l':
 					if (!SCHEME_LISTP(argv[n]))
 					{